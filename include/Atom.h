@@ -3,6 +3,7 @@
 #include "AtomType.h"
 #include "EnumDefinition.h"
 #include "FunctionDefinition.h"
+#include "ScopeArena.h"
 #include "StructDefinition.h"
 #include "Variable.h"
 
@@ -11,6 +12,8 @@ typedef struct Atom
     AtomType type;
     TemLangString name;
     bool notCompiled;
+    // TemLangStringHash of the name. Set when the atom is added to a state
+    uint32_t hash;
     union
     {
         Variable variable;
@@ -88,9 +91,14 @@ AtomCopy(Atom* dest, const Atom* src, const Allocator* allocator)
     AtomFree(dest);
     dest->type = src->type;
     dest->notCompiled = src->notCompiled;
+    dest->hash = src->hash;
     if (!TemLangStringCopy(&dest->name, &src->name, allocator)) {
         return false;
     }
+    if (src->type != AtomType_Variable) {
+        // Values made from definitions share parts of them
+        allocator = ScopeArenaParentOr(allocator);
+    }
     switch (src->type) {
         case AtomType_Variable:
             return VariableCopy(&dest->variable, &src->variable, allocator);
@@ -112,6 +120,66 @@ AtomCopy(Atom* dest, const Atom* src, const Allocator* allocator)
     }
 }
 
+// Names shared by values of an enum or flag atom. Made when the atom is
+// defined so workers of a parallel iterate only read them
+static inline bool
+AtomCreateEnumNames(Atom* atom)
+{
+    EnumDefinition* d = &atom->enumDefinition;
+    if (d->names == NULL) {
+        d->names =
+          EnumNamesCreate(&atom->name, &d->members, d->members.allocator);
+    }
+    return d->names != NULL;
+}
+
+static inline bool
+AtomToEnumValue(const Atom* atom, const size_t ordinal, pValue value)
+{
+    EnumNames* names = atom->enumDefinition.names;
+    if (names == NULL) {
+        return false;
+    }
+    value->type = ValueType_Enum;
+    value->enumValue.names = EnumNamesShare(names);
+    value->enumValue.ordinal = (uint32_t)ordinal;
+    return true;
+}
+
+// Makes a value of a flag atom with no members set
+static inline bool
+AtomToFlagValue(const Atom* atom, pValue value, const Allocator* allocator)
+{
+    EnumNames* names = atom->enumDefinition.names;
+    if (names == NULL) {
+        return false;
+    }
+    value->type = ValueType_Flag;
+    memset(&value->flagValue, 0, sizeof(FlagValue));
+    return FlagValueCreate(&value->flagValue, names, allocator);
+}
+
+// Member names shared by values of a struct atom. Made when the atom is
+// defined like the names of an enum
+static inline bool
+AtomCreateStructShape(Atom* atom)
+{
+    StructDefinition* d = &atom->structDefinition;
+    if (d->shape == NULL) {
+        const Allocator* allocator = d->members.allocator;
+        TemLangStringList names = { .allocator = allocator };
+        for (size_t i = 0; i < d->members.used; ++i) {
+            if (!TemLangStringListAppend(&names, &d->members.buffer[i].name)) {
+                TemLangStringListFree(&names);
+                return false;
+            }
+        }
+        d->shape = StructShapeCreate(&names, allocator);
+        TemLangStringListFree(&names);
+    }
+    return d->shape != NULL;
+}
+
 static inline void
 AtomExistsError(const Atom* atom)
 {
@@ -142,4 +210,19 @@ static inline ComparisonOperator
 AtomCompare(const Atom* a, const Atom* b)
 {
     return AtomCompareName(a, &b->name);
-}
\ No newline at end of file
+}
+
+MAKE_LIST(Atom)
+DEFAULT_MAKE_LIST_FUNCTIONS(Atom)
+
+// Appends the atom without copying it. The atom is left empty
+static inline bool
+AtomListAppendMove(AtomList* list, pAtom atom)
+{
+    if (!AtomListRellocateIfNeeded(list)) {
+        return false;
+    }
+    list->buffer[list->used++] = *atom;
+    memset(atom, 0, sizeof(Atom));
+    return true;
+}
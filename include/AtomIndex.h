@@ -0,0 +1,139 @@
+#pragma once
+
+#include "Atom.h"
+
+// Open addressing table mapping atom name hashes to their position in an
+// AtomList. Small lists are scanned linearly instead, so short lived scopes
+// never allocate a table. The owner of the list bumps a generation on every
+// change to it and the table is only used while it was built for the current
+// one.
+
+#define ATOM_INDEX_THRESHOLD 8U
+
+typedef struct AtomIndexEntry
+{
+    uint32_t hash;
+    // Index into the atom list plus one. Zero means the slot is empty.
+    uint32_t atom;
+} AtomIndexEntry, *pAtomIndexEntry;
+
+typedef struct AtomIndex
+{
+    AtomIndexEntry* entries;
+    // Always a power of 2
+    uint32_t size;
+    uint32_t used;
+    // Generation of the atom list the entries were made for
+    uint32_t generation;
+    const Allocator* allocator;
+} AtomIndex, *pAtomIndex;
+
+static inline void
+AtomIndexFree(AtomIndex* index)
+{
+    if (index->entries != NULL) {
+        index->allocator->free(index->entries);
+    }
+    memset(index, 0, sizeof(AtomIndex));
+}
+
+static inline bool
+AtomIndexIsValid(const AtomIndex* index, const uint32_t generation)
+{
+    return index->entries != NULL && index->generation == generation;
+}
+
+static inline void
+AtomIndexPut(AtomIndex* index, const uint32_t hash, const uint32_t atom)
+{
+    const uint32_t mask = index->size - 1U;
+    uint32_t i = hash & mask;
+    while (index->entries[i].atom != 0) {
+        i = (i + 1U) & mask;
+    }
+    index->entries[i].hash = hash;
+    index->entries[i].atom = atom + 1U;
+    ++index->used;
+}
+
+static inline bool
+AtomIndexRebuild(AtomIndex* index,
+                 const AtomList* atoms,
+                 const uint32_t generation)
+{
+    uint32_t size = 16U;
+    while (size < atoms->used * 2U) {
+        size *= 2U;
+    }
+    if (index->entries == NULL || index->size != size) {
+        if (index->entries != NULL) {
+            index->allocator->free(index->entries);
+        }
+        index->allocator = atoms->allocator;
+        index->entries =
+          index->allocator->allocate(sizeof(AtomIndexEntry) * size);
+        if (index->entries == NULL) {
+            memset(index, 0, sizeof(AtomIndex));
+            return false;
+        }
+        index->size = size;
+    }
+    memset(index->entries, 0, sizeof(AtomIndexEntry) * index->size);
+    index->used = 0;
+    index->generation = generation;
+    for (uint32_t i = 0; i < atoms->used; ++i) {
+        AtomIndexPut(index, atoms->buffer[i].hash, i);
+    }
+    return true;
+}
+
+// Call after an atom was appended to the list. The generation is the one the
+// append made. Anything else that changed the list since the index was built
+// makes it start over
+static inline bool
+AtomIndexUpdate(AtomIndex* index,
+                const AtomList* atoms,
+                const uint32_t generation)
+{
+    if (atoms->used < ATOM_INDEX_THRESHOLD) {
+        return true;
+    }
+    if (!AtomIndexIsValid(index, generation - 1U) ||
+        (index->used + 1U) * 2U > index->size) {
+        return AtomIndexRebuild(index, atoms, generation);
+    }
+    const uint32_t last = atoms->used - 1U;
+    AtomIndexPut(index, atoms->buffer[last].hash, last);
+    index->generation = generation;
+    return true;
+}
+
+// The hash is TemLangStringHash of the name. Callers searching more than one
+// list compute it once
+static inline int64_t
+AtomIndexFind(const AtomIndex* index,
+              const AtomList* atoms,
+              const uint32_t generation,
+              const TemLangString* name,
+              const uint32_t hash)
+{
+    if (!AtomIndexIsValid(index, generation)) {
+        for (uint32_t i = 0; i < atoms->used; ++i) {
+            if (atoms->buffer[i].hash == hash &&
+                AtomNameEquals(&atoms->buffer[i], name)) {
+                return i;
+            }
+        }
+        return -1;
+    }
+    const uint32_t mask = index->size - 1U;
+    for (uint32_t i = hash & mask; index->entries[i].atom != 0;
+         i = (i + 1U) & mask) {
+        const AtomIndexEntry* entry = &index->entries[i];
+        if (entry->hash == hash &&
+            AtomNameEquals(&atoms->buffer[entry->atom - 1U], name)) {
+            return entry->atom - 1U;
+        }
+    }
+    return -1;
+}
@@ -26,6 +26,47 @@ static size_tList returnValueScopes = { 0 };
 static size_t noCleanupState = 0;
 #define MAX_RETURN_VALUE_SCOPES 512
 
+// Set while compiling for the JIT (see Jit.h). Numbers are then declared with
+// the widest type of their kind instead of the smallest one that fits the
+// value seen while compiling since the code runs on other values too.
+static bool compilerWideNumbers = false;
+
+static inline CType
+CompilerNumberCType(const Number* n)
+{
+    if (!compilerWideNumbers) {
+        return NumberToCType(n);
+    }
+    return n->type == NumberType_Float ? CType_f64 : CType_i64;
+}
+
+// Integer math compiled for the JIT calls the checked functions in the JIT
+// prelude (see Jit.h) so a result that doesn't fit in int64_t makes the call
+// fall back to the interpreter instead of wrapping
+static inline TemLangString
+CompilerNumberOperation(const NumberOperator op,
+                        const Value* left,
+                        const Value* right,
+                        const char* a,
+                        const char* b,
+                        const Allocator* allocator)
+{
+    static const char* checked[] = {
+        "jitAdd", "jitSubtract", "jitMultiply", "jitDivide", "jitModulo"
+    };
+    if (compilerWideNumbers && op >= NumberOperator_Add &&
+        op <= NumberOperator_Modulo &&
+        left->rangedNumber.number.type != NumberType_Float &&
+        right->rangedNumber.number.type != NumberType_Float) {
+        TemLangStringCreateFormat(
+          call, allocator, "%s(%s, %s)", checked[op], a, b);
+        return call;
+    }
+    TemLangStringCreateFormat(
+      s, allocator, "%s %c %s", a, NumberOperatorToChar(op), b);
+    return s;
+}
+
 static inline void
 prepareCompiler()
 {
@@ -105,22 +146,22 @@ ValueFreeName(const Value* value, const Allocator* allocator)
         } break;
         case ValueType_Variant: {
             TemLangStringAppendFormat(
-              s, "%sFree", value->variantValue.name.buffer);
+              s, "%sFree", value->variantValue->name.buffer);
         } break;
         case ValueType_Enum: {
             TemLangStringAppendFormat(
-              s, "%sFree", value->enumValue.name.buffer);
+              s, "%sFree", EnumValueName(&value->enumValue)->buffer);
         } break;
         case ValueType_Flag: {
             TemLangStringAppendFormat(
-              s, "%sFree", value->flagValue.name.buffer);
+              s, "%sFree", value->flagValue.names->name.buffer);
         } break;
         case ValueType_Number: {
             CType type = { 0 };
-            if (value->rangedNumber.hasRange) {
-                type = RangeToCType(&value->rangedNumber.range);
+            if (value->rangedNumber.range != NULL) {
+                type = RangeToCType(value->rangedNumber.range);
             } else {
-                type = NumberToCType(&value->rangedNumber.number);
+                type = CompilerNumberCType(&value->rangedNumber.number);
             }
             TemLangStringAppendFormat(s, "%sFree", CTypeToTypeString(type));
         } break;
@@ -129,7 +170,7 @@ ValueFreeName(const Value* value, const Allocator* allocator)
         } break;
         case ValueType_List: {
             TemLangString s1 =
-              ValueFreeName(value->list.exampleValue, allocator);
+              ValueFreeName(value->list->exampleValue, allocator);
             TemLangStringAppendFormat(s, "%sListFree", s1.buffer);
             TemLangStringFree(&s1);
         } break;
@@ -153,22 +194,22 @@ ValueCopyName(const Value* value, const Allocator* allocator)
         } break;
         case ValueType_Enum: {
             TemLangStringAppendFormat(
-              s, "%sCopy", value->enumValue.name.buffer);
+              s, "%sCopy", EnumValueName(&value->enumValue)->buffer);
         } break;
         case ValueType_Flag: {
             TemLangStringAppendFormat(
-              s, "%sCopy", value->flagValue.name.buffer);
+              s, "%sCopy", value->flagValue.names->name.buffer);
         } break;
         case ValueType_Variant: {
             TemLangStringAppendFormat(
-              s, "%sCopy", value->variantValue.name.buffer);
+              s, "%sCopy", value->variantValue->name.buffer);
         } break;
         case ValueType_Number: {
             CType type = { 0 };
-            if (value->rangedNumber.hasRange) {
-                type = RangeToCType(&value->rangedNumber.range);
+            if (value->rangedNumber.range != NULL) {
+                type = RangeToCType(value->rangedNumber.range);
             } else {
-                type = NumberToCType(&value->rangedNumber.number);
+                type = CompilerNumberCType(&value->rangedNumber.number);
             }
             TemLangStringAppendFormat(s, "%sCopy", CTypeToTypeString(type));
         } break;
@@ -177,7 +218,7 @@ ValueCopyName(const Value* value, const Allocator* allocator)
         } break;
         case ValueType_List: {
             TemLangString s1 =
-              ValueFreeName(value->list.exampleValue, allocator);
+              ValueFreeName(value->list->exampleValue, allocator);
             TemLangStringAppendFormat(s, "%sListCopy", s1.buffer);
             TemLangStringFree(&s1);
         } break;
@@ -196,16 +237,16 @@ CompileValueCleanup(const TemLangString* name,
     TemLangString s = TemLangStringCreate("", allocator);
     switch (value->type) {
         case ValueType_List: {
-            if (ValueNeedsCleanup(value->list.exampleValue->type)) {
+            if (ValueNeedsCleanup(value->list->exampleValue->type)) {
                 TemLangString looper = TemLangStringCreate("", allocator);
                 TemLangString c = TemLangStringCreate("", allocator);
-                if (value->list.isArray) {
+                if (value->listIsArray) {
                     {
                         TemLangStringAppendFormat(
                           looper,
                           "{for(size_t listCleanupIndex = 0; "
-                          "listCleanupIndex < %u; ++listCleanupIndex){",
-                          value->list.values.used);
+                          "listCleanupIndex < %zu; ++listCleanupIndex){",
+                          ValueListValueLength(value->list));
                     }
                     {
                         TemLangStringAppendFormat(
@@ -226,7 +267,7 @@ CompileValueCleanup(const TemLangString* name,
                     }
                 }
                 TemLangString k =
-                  CompileValueCleanup(&c, value->list.exampleValue, allocator);
+                  CompileValueCleanup(&c, value->list->exampleValue, allocator);
                 if (!TemLangStringIsEmpty(&k)) {
                     TemLangStringAppend(&s, &looper);
                     TemLangStringAppend(&s, &k);
@@ -236,7 +277,7 @@ CompileValueCleanup(const TemLangString* name,
                 TemLangStringFree(&k);
                 TemLangStringFree(&c);
             }
-            if (!value->list.isArray) {
+            if (!value->listIsArray) {
                 TemLangStringAppendFormat(
                   s,
                   "if(%s.buffer != NULL){ "
@@ -251,8 +292,10 @@ CompileValueCleanup(const TemLangString* name,
         case ValueType_Struct: {
             char buffer[256] = { 0 };
             TemLangString n = { .buffer = buffer, .allocator = NULL };
-            for (size_t i = 0; i < value->structValues->used; ++i) {
-                const NamedValue* nv = &value->structValues->buffer[i];
+            for (size_t i = 0; i < value->structValues->values.used; ++i) {
+                const NamedValue member =
+                  StructValuesGet(value->structValues, i);
+                const NamedValue* nv = &member;
                 n.used = n.size = snprintf(buffer,
                                            sizeof(buffer),
                                            "%s.%s",
@@ -326,7 +369,7 @@ CompileStateCleanup(const State* state, const Allocator* allocator)
 
 #define COMPILE_COPIED_STATE_CLEANUP(orig, copy, s)                            \
     for (size_t i = 0; i < orig.atoms.used; ++i) {                             \
-        AtomListRemove(&copy.atoms, 0, allocator);                             \
+        StateRemoveAtom(&copy, 0, allocator);                                   \
     }                                                                          \
     COMPILE_STATE_CLEANUP(copy, s);
 
@@ -418,8 +461,8 @@ CompilerValueIndexerName(const Value* v, const Allocator* allocator)
         case ValueType_Enum: {
             TemLangStringAppendFormat(s,
                                       "[%s_%s]",
-                                      v->enumValue.name.buffer,
-                                      v->enumValue.value.buffer);
+                                      EnumValueName(&v->enumValue)->buffer,
+                                      EnumValueMember(&v->enumValue)->buffer);
         } break;
         default: {
             TemLangError("Value type '%s' cannot be a indexer",
@@ -527,9 +570,10 @@ CompilerDeclareValueType(const TemLangString* name,
             }
             break;
         case ValueType_Number: {
-            const CType type = value->rangedNumber.hasRange
-                                 ? RangeToCType(&value->rangedNumber.range)
-                                 : NumberToCType(&value->rangedNumber.number);
+            const CType type =
+              value->rangedNumber.range != NULL
+                ? RangeToCType(value->rangedNumber.range)
+                : CompilerNumberCType(&value->rangedNumber.number);
             if (name == NULL) {
                 TemLangStringCreateFormat(
                   a, allocator, "%s", CTypeToTypeString(type));
@@ -549,16 +593,17 @@ CompilerDeclareValueType(const TemLangString* name,
         case ValueType_Enum:
             if (name == NULL) {
                 TemLangStringCreateFormat(
-                  a, allocator, "%s", value->enumValue.name.buffer);
+                  a, allocator, "%s", EnumValueName(&value->enumValue)->buffer);
                 TemLangStringCopy(&s, &a, allocator);
                 TemLangStringFree(&a);
             } else {
-                TemLangStringCreateFormat(a,
-                                          allocator,
-                                          "%s %s%s;",
-                                          value->enumValue.name.buffer,
-                                          name->buffer,
-                                          setDefault ? "=-1L" : "");
+                TemLangStringCreateFormat(
+                  a,
+                  allocator,
+                  "%s %s%s;",
+                  EnumValueName(&value->enumValue)->buffer,
+                  name->buffer,
+                  setDefault ? "=-1L" : "");
                 TemLangStringCopy(&s, &a, allocator);
                 TemLangStringFree(&a);
             }
@@ -566,14 +611,14 @@ CompilerDeclareValueType(const TemLangString* name,
         case ValueType_Flag:
             if (name == NULL) {
                 TemLangStringCreateFormat(
-                  a, allocator, "%s", value->flagValue.name.buffer);
+                  a, allocator, "%s", value->flagValue.names->name.buffer);
                 TemLangStringCopy(&s, &a, allocator);
                 TemLangStringFree(&a);
             } else {
                 TemLangStringCreateFormat(a,
                                           allocator,
                                           "%s %s%s;",
-                                          value->enumValue.name.buffer,
+                                          value->flagValue.names->name.buffer,
                                           name->buffer,
                                           setDefault ? "=0" : "");
                 TemLangStringCopy(&s, &a, allocator);
@@ -582,24 +627,24 @@ CompilerDeclareValueType(const TemLangString* name,
             break;
         case ValueType_List: {
             if (name == NULL) {
-                if (value->list.isArray) {
+                if (value->listIsArray) {
                     TemLangError("Cannot declare a array  without a name.");
                 } else {
                     TemLangString b = CompilerDeclareValueType(
-                      NULL, state, allocator, value->list.exampleValue, false);
+                      NULL, state, allocator, value->list->exampleValue, false);
                     TemLangStringCreateFormat(a, allocator, "%sList", b.buffer);
                     TemLangStringCopy(&s, &a, allocator);
                     TemLangStringFree(&a);
                     TemLangStringFree(&b);
                 }
             } else {
-                if (value->list.isArray) {
+                if (value->listIsArray) {
                     if (useCGLM &&
-                        value->list.exampleValue->type == ValueType_Number &&
+                        value->list->exampleValue->type == ValueType_Number &&
                         RangeToCType(
-                          &value->list.exampleValue->rangedNumber.range) ==
+                          value->list->exampleValue->rangedNumber.range) ==
                           CType_f32) {
-                        switch (value->list.values.used) {
+                        switch (ValueListValueLength(value->list)) {
                             case 2: {
                                 TemLangStringCreateFormat(a,
                                                           allocator,
@@ -659,13 +704,14 @@ CompilerDeclareValueType(const TemLangString* name,
                                 break;
                         }
                     }
-                    TemLangStringCreateFormat(b,
-                                              allocator,
-                                              "%s[%u]",
-                                              name->buffer,
-                                              value->list.values.used);
+                    TemLangStringCreateFormat(
+                      b,
+                      allocator,
+                      "%s[%zu]",
+                      name->buffer,
+                      ValueListValueLength(value->list));
                     TemLangString a = CompilerDeclareValueType(
-                      &b, state, allocator, value->list.exampleValue, false);
+                      &b, state, allocator, value->list->exampleValue, false);
                     TemLangStringCopy(&s, &a, allocator);
                     TemLangStringFree(&a);
                     TemLangStringFree(&b);
@@ -677,7 +723,7 @@ CompilerDeclareValueType(const TemLangString* name,
                     }
                 } else {
                     TemLangString b = CompilerDeclareValueType(
-                      NULL, state, allocator, value->list.exampleValue, false);
+                      NULL, state, allocator, value->list->exampleValue, false);
                     TemLangStringCreateFormat(a,
                                               allocator,
                                               "%sList %s%s;",
@@ -727,8 +773,10 @@ CompilerDeclareValueType(const TemLangString* name,
                 }
 
                 TemLangString b = TemLangStringCreate("", allocator);
-                for (size_t i = 0; i < value->structValues->used; ++i) {
-                    const NamedValue* nv = &value->structValues->buffer[i];
+                for (size_t i = 0; i < value->structValues->values.used; ++i) {
+                    const NamedValue member =
+                      StructValuesGet(value->structValues, i);
+                    const NamedValue* nv = &member;
                     TemLangString c = CompilerDeclareValueType(
                       &nv->name, state, allocator, &nv->value, false);
                     TemLangStringAppend(&b, &c);
@@ -750,14 +798,14 @@ CompilerDeclareValueType(const TemLangString* name,
         case ValueType_Variant: {
             if (name == NULL) {
                 TemLangStringCreateFormat(
-                  a, allocator, "%s", value->variantValue.name.buffer);
+                  a, allocator, "%s", value->variantValue->name.buffer);
                 TemLangStringCopy(&s, &a, allocator);
                 TemLangStringFree(&a);
             } else {
                 TemLangStringCreateFormat(a,
                                           allocator,
                                           "%s %s;",
-                                          value->variantValue.name.buffer,
+                                          value->variantValue->name.buffer,
                                           name->buffer);
                 TemLangStringCopy(&s, &a, allocator);
                 TemLangStringFree(&a);
@@ -765,7 +813,7 @@ CompilerDeclareValueType(const TemLangString* name,
                     TemLangStringAppendFormat(s,
                                               "memset(&%s,0,sizeof(%s));",
                                               name->buffer,
-                                              value->variantValue.name.buffer);
+                                              value->variantValue->name.buffer);
                 }
             }
         } break;
@@ -786,7 +834,15 @@ CompilerGetValue(const Value* value, const Allocator* allocator)
             s = TemLangStringCreate("NULL", allocator);
             break;
         case ValueType_Number:
-            s = NumberToString(&value->rangedNumber.number, allocator);
+            if (compilerWideNumbers &&
+                value->rangedNumber.number.type == NumberType_Float) {
+                // Exact so the result matches the interpreter
+                TemLangStringCreateFormat(
+                  a, allocator, "%a", value->rangedNumber.number.d);
+                s = a;
+            } else {
+                s = NumberToString(&value->rangedNumber.number, allocator);
+            }
             break;
         case ValueType_Boolean: {
             TemLangStringCreateFormat(
@@ -799,30 +855,34 @@ CompilerGetValue(const Value* value, const Allocator* allocator)
             s = a;
         } break;
         case ValueType_Enum: {
+            const EnumValue* e = &value->enumValue;
             TemLangStringCreateFormat(a,
                                       allocator,
                                       "%s_%s",
-                                      value->enumValue.name.buffer,
-                                      value->enumValue.value.buffer);
+                                      EnumValueName(e)->buffer,
+                                      EnumValueMember(e)->buffer);
             s = a;
         } break;
         case ValueType_Flag: {
-            if (value->flagValue.members.used == 0) {
+            TemLangStringList members =
+              FlagValueMembers(&value->flagValue, allocator);
+            if (members.used == 0) {
                 s = TemLangStringCreate("0", allocator);
             } else {
                 s = TemLangStringCreate("", allocator);
-                for (size_t i = 0; i < value->flagValue.members.used; ++i) {
+                for (size_t i = 0; i < members.used; ++i) {
                     TemLangStringAppendFormat(
                       s,
                       "%s_%s %c",
-                      value->flagValue.name.buffer,
-                      value->flagValue.members.buffer[i].buffer,
-                      i == value->flagValue.members.used - 1 ? ' ' : '|');
+                      value->flagValue.names->name.buffer,
+                      members.buffer[i].buffer,
+                      i == members.used - 1 ? ' ' : '|');
                 }
             }
+            TemLangStringListFree(&members);
         } break;
         case ValueType_Variant:
-            TemLangStringCopy(&s, &value->variantValue.memberName, allocator);
+            TemLangStringCopy(&s, &value->variantValue->memberName, allocator);
             break;
         default:
             TemLangError("Cannot compile value '%s'",
@@ -1121,7 +1181,7 @@ CompilerGetMatchBranch(State* state,
         TemLangStringAppendFormat(s,
                                   "if(%s == %s_%s) { %s goto scope%zu;}",
                                   targetName->buffer,
-                                  value->enumValue.name.buffer,
+                                  EnumValueName(&value->enumValue)->buffer,
                                   matcher.string.buffer,
                                   s2.buffer,
                                   returnScope);
@@ -1196,7 +1256,7 @@ end:
 
 #define CompilerGetMethod(left, right)                                         \
     Expression tempLeft = { .type = ExpressionType_UnaryValue,                 \
-                            .value = *left.variantValue.value };               \
+                            .value = *left.variantValue->value };              \
     Expression tempRight = { .type = ExpressionType_UnaryValue,                \
                              .value = right };                                 \
     Expression tempE = { 0 };                                                  \
@@ -1217,6 +1277,15 @@ CompilerGetNumberExpression(const State* state,
                             const Value* realValue,
                             const Expression* e);
 
+static inline TemLangString
+CompilerGetListQueryExpression(const State* state,
+                               const Allocator* allocator,
+                               const VariableTarget target,
+                               const ListQueryType type,
+                               const Value* left,
+                               const Value* right,
+                               const Expression* e);
+
 static inline TemLangString
 CompilerGetOperatorExpression(const State* state,
                               const Allocator* allocator,
@@ -1252,7 +1321,7 @@ CompilerGetOperatorExpression(const State* state,
                         TemLangStringAppendFormat(
                           lengthS,
                           "%s_Length",
-                          targetValue->enumValue.name.buffer);
+                          EnumValueName(&targetValue->enumValue)->buffer);
                         break;
                     default:
                         break;
@@ -1268,7 +1337,7 @@ CompilerGetOperatorExpression(const State* state,
                         TemLangStringAppendFormat(
                           lengthS,
                           "%s_Length",
-                          targetValue->enumValue.name.buffer);
+                          EnumValueName(&targetValue->enumValue)->buffer);
                         break;
                     default:
                         break;
@@ -1349,8 +1418,8 @@ CompilerGetOperatorExpression(const State* state,
                                   s,
                                   "return %s[%s_%s];",
                                   containerName.buffer,
-                                  right->enumValue.name.buffer,
-                                  right->enumValue.value.buffer);
+                                  EnumValueName(&right->enumValue)->buffer,
+                                  EnumValueMember(&right->enumValue)->buffer);
                             } break;
                             case VariableTarget_Variable: {
                                 TemLangStringCreateFormat(
@@ -1358,8 +1427,8 @@ CompilerGetOperatorExpression(const State* state,
                                   allocator,
                                   "%s[%s_%s]",
                                   containerName.buffer,
-                                  right->enumValue.name.buffer,
-                                  right->enumValue.value.buffer);
+                                  EnumValueName(&right->enumValue)->buffer,
+                                  EnumValueMember(&right->enumValue)->buffer);
                                 State temp = { 0 };
                                 temp.parent = state;
                                 temp.atoms.allocator = allocator;
@@ -1391,8 +1460,8 @@ CompilerGetOperatorExpression(const State* state,
                                   s,
                                   "%s[%s_%s];",
                                   containerName.buffer,
-                                  right->enumValue.name.buffer,
-                                  right->enumValue.value.buffer);
+                                  EnumValueName(&right->enumValue)->buffer,
+                                  EnumValueMember(&right->enumValue)->buffer);
                                 break;
                         }
                     }
@@ -1618,22 +1687,23 @@ CompilerGetExpression(const State* state,
                     const VariableTarget t = { .type = VariableTarget_Variable,
                                                .name = &tempName };
                     const float isCGLM =
-                      useCGLM && value->list.isArray &&
-                      value->list.exampleValue->type == ValueType_Number &&
+                      useCGLM && value->listIsArray &&
+                      value->list->exampleValue->type == ValueType_Number &&
                       RangeToCType(
-                        &value->list.exampleValue->rangedNumber.range) ==
+                        value->list->exampleValue->rangedNumber.range) ==
                         CType_f32;
-                    if (isCGLM && e->value.list.values.used == 9) {
+                    if (isCGLM && ValueListValueLength(e->value.list) == 9) {
                         for (size_t i = 0; i < 3; ++i) {
                             for (size_t j = 0; j < 3; ++j) {
-                                const Value* value =
-                                  &e->value.list.values.buffer[i * 3 + j];
+                                Value scratch = { 0 };
+                                const Value* value = ValueListValueAt(
+                                  e->value.list, i * 3 + j, &scratch);
                                 tempName.used = snprintf(
                                   buffer,
                                   sizeof(buffer),
                                   "%s%s[%zu][%zu]",
                                   target.name->buffer,
-                                  e->value.list.isArray ? "" : ".buffer",
+                                  e->value.listIsArray ? "" : ".buffer",
                                   i,
                                   j);
                                 Expression temp = { 0 };
@@ -1645,17 +1715,19 @@ CompilerGetExpression(const State* state,
                                 TemLangStringFree(&a);
                             }
                         }
-                    } else if (isCGLM && e->value.list.values.used == 16) {
+                    } else if (isCGLM &&
+                               ValueListValueLength(e->value.list) == 16) {
                         for (size_t i = 0; i < 4; ++i) {
                             for (size_t j = 0; j < 4; ++j) {
-                                const Value* value =
-                                  &e->value.list.values.buffer[i * 4 + j];
+                                Value scratch = { 0 };
+                                const Value* value = ValueListValueAt(
+                                  e->value.list, i * 4 + j, &scratch);
                                 tempName.used = snprintf(
                                   buffer,
                                   sizeof(buffer),
                                   "%s%s[%zu][%zu]",
                                   target.name->buffer,
-                                  e->value.list.isArray ? "" : ".buffer",
+                                  e->value.listIsArray ? "" : ".buffer",
                                   i,
                                   j);
                                 Expression temp = { 0 };
@@ -1668,15 +1740,18 @@ CompilerGetExpression(const State* state,
                             }
                         }
                     } else {
-                        for (size_t i = 0; i < e->value.list.values.used; ++i) {
+                        for (size_t i = 0;
+                             i < ValueListValueLength(e->value.list);
+                             ++i) {
+                            Value scratch = { 0 };
                             const Value* value =
-                              &e->value.list.values.buffer[i];
+                              ValueListValueAt(e->value.list, i, &scratch);
                             tempName.used =
                               snprintf(buffer,
                                        sizeof(buffer),
                                        "%s%s[%zu]",
                                        target.name->buffer,
-                                       e->value.list.isArray ? "" : ".buffer",
+                                       e->value.listIsArray ? "" : ".buffer",
                                        i);
                             Expression temp = { 0 };
                             temp.type = ExpressionType_UnaryValue;
@@ -1689,8 +1764,11 @@ CompilerGetExpression(const State* state,
                     }
                 } break;
                 case ValueType_Struct: {
-                    for (size_t i = 0; i < value->structValues->used; ++i) {
-                        const NamedValue* nv = &value->structValues->buffer[i];
+                    for (size_t i = 0; i < value->structValues->values.used;
+                         ++i) {
+                        const NamedValue member =
+                          StructValuesGet(value->structValues, i);
+                        const NamedValue* nv = &member;
                         switch (target.type) {
                             case VariableTarget_Variable: {
                                 Expression t1 = { 0 };
@@ -1734,7 +1812,7 @@ CompilerGetExpression(const State* state,
                             TemLangStringAppendFormat(
                               s,
                               "%sCopy(&%s, %s, currentAllocator);",
-                              value->variantValue.name.buffer,
+                              value->variantValue->name.buffer,
                               target.name->buffer,
                               a.buffer);
                         } break;
@@ -1795,13 +1873,13 @@ CompilerGetExpression(const State* state,
                     temp.parent = state;
                     const bool isCGLM =
                       useCGLM &&
-                      value->list.exampleValue->type == ValueType_Number &&
+                      value->list->exampleValue->type == ValueType_Number &&
                       RangeToCType(
-                        &value->list.exampleValue->rangedNumber.range) ==
+                        value->list->exampleValue->rangedNumber.range) ==
                         CType_f32;
-                    if (value->list.isArray) {
+                    if (value->listIsArray) {
                         if (isCGLM) {
-                            switch (value->list.values.used) {
+                            switch (ValueListValueLength(value->list)) {
                                 case 2:
                                     TemLangStringAppendFormat(
                                       s,
@@ -1849,10 +1927,10 @@ CompilerGetExpression(const State* state,
                         ++variableId;
                         TemLangStringAppendFormat(
                           s,
-                          "for(size_t %s = 0; %s < %u; ++%s){ ",
+                          "for(size_t %s = 0; %s < %zu; ++%s){ ",
                           indexName.buffer,
                           indexName.buffer,
-                          value->list.values.used,
+                          ValueListValueLength(value->list),
                           indexName.buffer);
                         TemLangStringAppendFormat(name,
                                                   "%s[%s]",
@@ -1863,7 +1941,7 @@ CompilerGetExpression(const State* state,
                                                   e->identifier.buffer,
                                                   indexName.buffer);
                         if (!StateAddValue(
-                              &temp, &name, value->list.exampleValue)) {
+                              &temp, &name, value->list->exampleValue)) {
                             TemLangError("Compiler error! Check (%s:%zu)",
                                          __FILE__,
                                          __LINE__);
@@ -1875,7 +1953,7 @@ CompilerGetExpression(const State* state,
                           CompilerAssignValue(&temp,
                                               &name,
                                               allocator,
-                                              value->list.exampleValue,
+                                              value->list->exampleValue,
                                               &tempE,
                                               false);
                         TemLangStringAppend(&s, &b);
@@ -1890,7 +1968,7 @@ CompilerGetExpression(const State* state,
                           CompilerDeclareValueType(NULL,
                                                    state,
                                                    allocator,
-                                                   value->list.exampleValue,
+                                                   value->list->exampleValue,
                                                    false);
                         TemLangStringAppendFormat(
                           s,
@@ -1904,8 +1982,11 @@ CompilerGetExpression(const State* state,
                     }
                 } break;
                 case ValueType_Struct:
-                    for (size_t i = 0; i < value->structValues->used; ++i) {
-                        const NamedValue* nv = &value->structValues->buffer[i];
+                    for (size_t i = 0; i < value->structValues->values.used;
+                         ++i) {
+                        const NamedValue member =
+                          StructValuesGet(value->structValues, i);
+                        const NamedValue* nv = &member;
                         switch (target.type) {
                             case VariableTarget_Variable: {
                                 Expression t1 = { 0 };
@@ -1993,8 +2074,10 @@ CompilerGetExpression(const State* state,
             temp.atoms.allocator = allocator;
             if (CompileInstructions(
                   &e->instructions, allocator, target, &temp, &s)) {
-                for (size_t i = 0; i < value->structValues->used; ++i) {
-                    const NamedValue* nv = &value->structValues->buffer[i];
+                for (size_t i = 0; i < value->structValues->values.used; ++i) {
+                    const NamedValue member =
+                      StructValuesGet(value->structValues, i);
+                    const NamedValue* nv = &member;
                     Expression t1 = { 0 };
                     t1.type = ExpressionType_UnaryVariable;
                     TemLangStringCreateFormat(
@@ -2026,12 +2109,12 @@ CompilerGetExpression(const State* state,
                 break;
             }
             const bool isCGLM =
-              useCGLM && value->list.isArray &&
-              value->list.exampleValue->type == ValueType_Number &&
-              RangeToCType(&value->list.exampleValue->rangedNumber.range) ==
+              useCGLM && value->listIsArray &&
+              value->list->exampleValue->type == ValueType_Number &&
+              RangeToCType(value->list->exampleValue->rangedNumber.range) ==
                 CType_f32;
             if (isCGLM) {
-                switch (value->list.values.used) {
+                switch (ValueListValueLength(value->list)) {
                     case 9:
                         for (size_t i = 0; i < 3; ++i) {
                             for (size_t j = 0; j < 3; ++j) {
@@ -2045,11 +2128,13 @@ CompilerGetExpression(const State* state,
                                     .type = VariableTarget_Variable,
                                     .name = &name
                                 };
+                                Value scratch = { 0 };
                                 TemLangString s1 = CompilerGetExpression(
                                   state,
                                   allocator,
                                   newTarget,
-                                  &value->list.values.buffer[i * 3 + j],
+                                  ValueListValueAt(
+                                    value->list, i * 3 + j, &scratch),
                                   &e->expressions.buffer[i * 3 + j]);
                                 TemLangStringAppend(&s, &s1);
                                 TemLangStringFree(&name);
@@ -2070,11 +2155,13 @@ CompilerGetExpression(const State* state,
                                     .type = VariableTarget_Variable,
                                     .name = &name
                                 };
+                                Value scratch = { 0 };
                                 TemLangString s1 = CompilerGetExpression(
                                   state,
                                   allocator,
                                   newTarget,
-                                  &value->list.values.buffer[i * 4 + j],
+                                  ValueListValueAt(
+                                    value->list, i * 4 + j, &scratch),
                                   &e->expressions.buffer[i * 4 + j]);
                                 TemLangStringAppend(&s, &s1);
                                 TemLangStringFree(&name);
@@ -2086,8 +2173,10 @@ CompilerGetExpression(const State* state,
                         break;
                 }
             }
-            for (size_t i = 0; i < value->list.values.used; ++i) {
-                if (value->list.isArray) {
+            for (size_t i = 0; i < ValueListValueLength(value->list); ++i) {
+                Value scratch = { 0 };
+                const Value* item = ValueListValueAt(value->list, i, &scratch);
+                if (value->listIsArray) {
                     TemLangStringCreateFormat(
                       name, allocator, "%s[%zu]", target.name->buffer, i);
                     VariableTarget newTarget = { .type =
@@ -2097,7 +2186,7 @@ CompilerGetExpression(const State* state,
                       CompilerGetExpression(state,
                                             allocator,
                                             newTarget,
-                                            &value->list.values.buffer[i],
+                                            item,
                                             &e->expressions.buffer[i]);
                     TemLangStringAppend(&s, &s1);
                     TemLangStringFree(&name);
@@ -2110,11 +2199,11 @@ CompilerGetExpression(const State* state,
                       CompilerAssignValue(state,
                                           &s1,
                                           allocator,
-                                          &value->list.values.buffer[i],
+                                          item,
                                           &e->expressions.buffer[i],
                                           true);
                     TemLangString s3 = CompilerDeclareValueType(
-                      NULL, state, allocator, value->list.exampleValue, false);
+                      NULL, state, allocator, value->list->exampleValue, false);
                     TemLangStringAppendFormat(
                       s,
                       "{\n %s %sListAppend(&%s, &%s); \n}",
@@ -2166,11 +2255,14 @@ CompilerGetExpression(const State* state,
                 case ValueType_Variant: {
                     const StateFindArgs args = { .log = true,
                                                  .searchParent = true };
-                    const Atom* atom = StateFindAtomConst(
-                      &temp, &matcher.variantValue.name, AtomType_Struct, args);
+                    const Atom* atom =
+                      StateFindAtomConst(&temp,
+                                         &matcher.variantValue->name,
+                                         AtomType_Struct,
+                                         args);
                     if (atom == NULL) {
                         TemLangError("Variant '%s' doesn't exist",
-                                     matcher.variantValue.name.buffer);
+                                     matcher.variantValue->name.buffer);
                         break;
                     }
 
@@ -2195,7 +2287,7 @@ CompilerGetExpression(const State* state,
                             TemLangError("Failed to find variant member '%s' "
                                          "in variant '%s'",
                                          branch->matcher.identifier.buffer,
-                                         matcher.variantValue.name.buffer);
+                                         matcher.variantValue->name.buffer);
                             break;
                         }
                         StructMemberToFakeValue(m, &temp, allocator, &nv);
@@ -2223,14 +2315,14 @@ CompilerGetExpression(const State* state,
                             TemLangStringAppendFormat(
                               s,
                               "case %sTag_%s:{ %s}break;",
-                              matcher.variantValue.name.buffer,
+                              matcher.variantValue->name.buffer,
                               branch->matcher.identifier.buffer,
                               s4.buffer);
                         } else {
                             TemLangStringAppendFormat(
                               s,
                               "case %sTag_%s:{%s %s = %s.%s; %s}break;",
-                              matcher.variantValue.name.buffer,
+                              matcher.variantValue->name.buffer,
                               branch->matcher.identifier.buffer,
                               typeName.buffer,
                               nv.name.buffer,
@@ -2350,11 +2442,36 @@ CompilerGetExpression(const State* state,
                     State temp = { 0 };
                     temp.parent = state;
                     temp.atoms.allocator = allocator;
-                    const StateFindArgs args = { .log = true,
+                    const StateFindArgs args = { .log = false,
                                                  .searchParent = true };
-                    const Atom* atom =
-                      StateFindAnyAtomConst(state, &e->op.functionCall, args);
+                    const Atom* atom = StateFindAtomConst(
+                      state, &e->op.functionCall, AtomType_Function, args);
                     if (atom == NULL) {
+                        const ListQueryType query =
+                          ListQueryTypeFromCaseInsensitiveString(
+                            e->op.functionCall.buffer,
+                            e->op.functionCall.used);
+                        if (query != ListQueryType_Invalid) {
+                            TemLangString a =
+                              CompilerGetListQueryExpression(state,
+                                                             allocator,
+                                                             target,
+                                                             query,
+                                                             &left,
+                                                             &right,
+                                                             e);
+                            TemLangStringAppend(&s, &a);
+                            TemLangStringFree(&a);
+                        } else {
+                            const StateFindArgs logArgs = {
+                                .log = true, .searchParent = true
+                            };
+                            StateFindAtomConst(state,
+                                               &e->op.functionCall,
+                                               AtomType_Function,
+                                               logArgs);
+                        }
+                        size_tListPop(&returnValueScopes);
                         break;
                     }
                     switch (atom->functionDefinition.type) {
@@ -2482,17 +2599,17 @@ CompilerAssignValue(const State* state,
             TemLangStringAppendFormat(s,
                                       "%s.tag = %sTag_%s;",
                                       name->buffer,
-                                      value->variantValue.name.buffer,
-                                      value->variantValue.memberName.buffer);
+                                      value->variantValue->name.buffer,
+                                      value->variantValue->memberName.buffer);
         }
     } else if (value->type == ValueType_Variant) {
         TemLangStringAppendFormat(s,
                                   "%sFree(&%s);%s.tag = %sTag_%s;",
-                                  value->variantValue.name.buffer,
+                                  value->variantValue->name.buffer,
                                   name->buffer,
                                   name->buffer,
-                                  value->variantValue.name.buffer,
-                                  value->variantValue.memberName.buffer);
+                                  value->variantValue->name.buffer,
+                                  value->variantValue->memberName.buffer);
     }
     {
         const VariableTarget target = { .name = name,
@@ -2538,6 +2655,229 @@ CompileWhileLoop(const State* state,
     return s;
 }
 
+// Buffer, length and element type of a list for the ListKernel functions.
+// False if the elements aren't numbers or booleans
+static inline bool
+CompilerListKernelArgs(const Value* list,
+                       const TemLangString* name,
+                       pTemLangString buffer,
+                       pTemLangString length,
+                       CType* type)
+{
+    const Value* example = list->list->exampleValue;
+    switch (example->type) {
+        case ValueType_Boolean:
+            *type = CType_bool;
+            break;
+        case ValueType_Number:
+            *type = example->rangedNumber.range != NULL
+                      ? RangeToCType(example->rangedNumber.range)
+                      : CompilerNumberCType(&example->rangedNumber.number);
+            break;
+        default:
+            return false;
+    }
+    if (list->listIsArray) {
+        TemLangStringAppendFormat((*buffer),
+                                  "%s%s",
+                                  *type == CType_bool ? "(uint8_t*)" : "",
+                                  name->buffer);
+        TemLangStringAppendFormat(
+          (*length), "%zu", ValueListValueLength(list->list));
+    } else {
+        TemLangStringAppendFormat((*buffer),
+                                  "%s%s.buffer",
+                                  *type == CType_bool ? "(uint8_t*)" : "",
+                                  name->buffer);
+        TemLangStringAppendFormat((*length), "%s.used", name->buffer);
+    }
+    return true;
+}
+
+static inline const char*
+CompilerListKernelSuffix(const CType type)
+{
+    return CTypeToString(type == CType_bool ? CType_u8 : type);
+}
+
+// Built-in list functions are compiled to the kernels in ListKernel.h. The
+// list has to be a variable holding numbers or booleans
+static inline TemLangString
+CompilerGetListQueryExpression(const State* state,
+                               const Allocator* allocator,
+                               const VariableTarget target,
+                               const ListQueryType type,
+                               const Value* left,
+                               const Value* right,
+                               const Expression* e)
+{
+    TemLangString s = TemLangStringCreate("", allocator);
+    const bool binary =
+      type == ListQueryType_Contains || type == ListQueryType_IndexOf ||
+      type == ListQueryType_CountEqual || type == ListQueryType_Fill;
+    const Value* list = binary ? left : getUnaryValue(left, right);
+    const Expression* listE = list == left ? e->left : e->right;
+    TemLangString name = { .allocator = allocator };
+    TemLangString buffer = { .allocator = allocator };
+    TemLangString length = { .allocator = allocator };
+    TemLangString result = { .allocator = allocator };
+    TemLangString tempVar = { .allocator = allocator };
+    CType ctype = CType_Invalid;
+    if (list == NULL || list->type != ValueType_List ||
+        !TryCompilerGetFullVariableName(listE, state, allocator, &name)) {
+        TemLangError("'%s' can only be compiled for variables holding lists "
+                     "of numbers or booleans",
+                     ListQueryTypeToString(type));
+        goto cleanup;
+    }
+    if (binary) {
+        TemLangStringAppendFormat(tempVar, "temp%zu", variableId);
+        ++variableId;
+        TemLangString o = CompilerAssignValue(
+          state, &tempVar, allocator, right, e->right, true);
+        TemLangStringAppendFormat(s, "{ %s", o.buffer);
+        TemLangStringFree(&o);
+    }
+    if (type == ListQueryType_Reverse || type == ListQueryType_Fill) {
+        // The copy is changed in place so it needs a name
+        if (target.type != VariableTarget_Variable) {
+            TemLangError("'%s' can only be compiled when its result is "
+                         "assigned to a variable",
+                         ListQueryTypeToString(type));
+            goto cleanup;
+        }
+        TemLangString o = CompilerAssignValue(
+          state, target.name, allocator, list, listE, false);
+        TemLangStringAppend(&s, &o);
+        TemLangStringFree(&o);
+        if (!CompilerListKernelArgs(
+              list, target.name, &buffer, &length, &ctype)) {
+            TemLangError("'%s' can only be compiled for lists of numbers or "
+                         "booleans",
+                         ListQueryTypeToString(type));
+            goto cleanup;
+        }
+        if (type == ListQueryType_Reverse) {
+            TemLangStringAppendFormat(s,
+                                      "ListKernelReverse_%s(%s, %s);",
+                                      CompilerListKernelSuffix(ctype),
+                                      buffer.buffer,
+                                      length.buffer);
+        } else {
+            TemLangStringAppendFormat(
+              s,
+              "ListKernelFill_%s(%s, %s, (%s)%s); }",
+              CompilerListKernelSuffix(ctype),
+              buffer.buffer,
+              length.buffer,
+              ctype == CType_bool ? "uint8_t" : CTypeToTypeString(ctype),
+              tempVar.buffer);
+        }
+        goto cleanup;
+    }
+    if (!CompilerListKernelArgs(list, &name, &buffer, &length, &ctype)) {
+        TemLangError("'%s' can only be compiled for lists of numbers or "
+                     "booleans",
+                     ListQueryTypeToString(type));
+        goto cleanup;
+    }
+    const char* suffix = CompilerListKernelSuffix(ctype);
+    switch (type) {
+        case ListQueryType_Sum:
+            TemLangStringAppendFormat(result,
+                                      "ListKernelSum_%s(%s, %s)",
+                                      suffix,
+                                      buffer.buffer,
+                                      length.buffer);
+            break;
+        case ListQueryType_Min:
+        case ListQueryType_Max:
+            TemLangStringAppendFormat(result,
+                                      "%s[ListKernel%s_%s(%s, %s)]",
+                                      buffer.buffer,
+                                      type == ListQueryType_Min ? "Min"
+                                                                : "Max",
+                                      suffix,
+                                      buffer.buffer,
+                                      length.buffer);
+            break;
+        default: {
+            // A value that doesn't fit in the element type can't be equal
+            // to any element
+            const char* element =
+              ctype == CType_bool ? "uint8_t" : CTypeToTypeString(ctype);
+            TemLangString fits = { .allocator = allocator };
+            if (ctype == CType_bool || ctype == CType_f32 ||
+                ctype == CType_f64) {
+                TemLangStringAppendChars(&fits, "true");
+            } else {
+                TemLangStringAppendFormat(fits,
+                                          "(%s)%s == %s",
+                                          element,
+                                          tempVar.buffer,
+                                          tempVar.buffer);
+            }
+            const char* kernel = type == ListQueryType_CountEqual
+                                   ? "CountEqual"
+                                   : "IndexOf";
+            TemLangStringAppendFormat(
+              s,
+              "size_t index%zu = %s ? ListKernel%s_%s(%s, %s, (%s)%s) : %s;",
+              variableId,
+              fits.buffer,
+              kernel,
+              suffix,
+              buffer.buffer,
+              length.buffer,
+              element,
+              tempVar.buffer,
+              type == ListQueryType_CountEqual ? "0" : length.buffer);
+            switch (type) {
+                case ListQueryType_Contains:
+                    TemLangStringAppendFormat(
+                      result, "index%zu < %s", variableId, length.buffer);
+                    break;
+                case ListQueryType_IndexOf:
+                    TemLangStringAppendFormat(
+                      result,
+                      "(index%zu < %s ? (int64_t)index%zu : -1)",
+                      variableId,
+                      length.buffer,
+                      variableId);
+                    break;
+                default:
+                    TemLangStringAppendFormat(
+                      result, "index%zu", variableId);
+                    break;
+            }
+            ++variableId;
+            TemLangStringFree(&fits);
+        } break;
+    }
+    switch (target.type) {
+        case VariableTarget_ReturnValue:
+            TemLangStringAppendFormat(s, "return %s;", result.buffer);
+            break;
+        case VariableTarget_Variable:
+            TemLangStringAppendFormat(
+              s, "%s = %s;", target.name->buffer, result.buffer);
+            break;
+        default:
+            TemLangStringAppendFormat(s, "%s;", result.buffer);
+            break;
+    }
+    if (binary) {
+        TemLangStringAppendChars(&s, " }");
+    }
+cleanup:
+    TemLangStringFree(&name);
+    TemLangStringFree(&buffer);
+    TemLangStringFree(&length);
+    TemLangStringFree(&result);
+    TemLangStringFree(&tempVar);
+    return s;
+}
+
 static inline TemLangString
 CompileListModify(const State* state,
                   const Allocator* allocator,
@@ -2570,13 +2910,13 @@ CompileListModify(const State* state,
                           tempVar.buffer);
                     } break;
                     case ValueType_List: {
-                        if (newValue.list.isArray) {
+                        if (newValue.listIsArray) {
                             TemLangStringAppendFormat(
                               s,
-                              "{ %s for(size_t i = 0; i < %u; ++i){ "
+                              "{ %s for(size_t i = 0; i < %zu; ++i){ "
                               "TemLangStringAppendChar(&%s, (char)%s[i]); } }",
                               o.buffer,
-                              newValue.list.values.used,
+                              ValueListValueLength(newValue.list),
                               name.buffer,
                               tempVar.buffer);
                         } else {
@@ -2673,7 +3013,7 @@ CompileListModify(const State* state,
                                           index);
             } else {
                 TemLangString c = CompilerDeclareValueType(
-                  NULL, state, allocator, listRef->list.exampleValue, false);
+                  NULL, state, allocator, listRef->list->exampleValue, false);
                 TemLangStringAppendFormat(s,
                                           "%sListRemove(&%s, %" PRIu64
                                           ", currentAllocator);",
@@ -2688,7 +3028,7 @@ CompileListModify(const State* state,
             EvaluateExpression(&i->newValue[0], state, &newValue, allocator);
             ValueToIndex(&newValue, &index);
             TemLangString c = CompilerDeclareValueType(
-              NULL, state, allocator, listRef->list.exampleValue, false);
+              NULL, state, allocator, listRef->list->exampleValue, false);
             TemLangStringAppendFormat(s,
                                       "%sListSwapRemove(&%s, %" PRIu64 ");",
                                       c.buffer,
@@ -2702,7 +3042,7 @@ CompileListModify(const State* state,
                   s, "TemLangStringPop(&%s);", name.buffer);
             } else {
                 TemLangString c = CompilerDeclareValueType(
-                  NULL, state, allocator, listRef->list.exampleValue, false);
+                  NULL, state, allocator, listRef->list->exampleValue, false);
                 TemLangStringAppendFormat(
                   s, "%sListPop(&%s);", c.buffer, name.buffer);
                 TemLangStringFree(&c);
@@ -2720,7 +3060,7 @@ CompileListModify(const State* state,
                 }
             } else {
                 TemLangString freeName = CompilerDeclareValueType(
-                  NULL, state, allocator, listRef->list.exampleValue, false);
+                  NULL, state, allocator, listRef->list->exampleValue, false);
                 TemLangStringAppendFormat(
                   s, "%sListFree(&%s);", freeName.buffer, name.buffer);
                 TemLangStringFree(&freeName);
@@ -2830,7 +3170,7 @@ CompileCFunctionReturnValue(const State* state,
         }
         for (size_t i = 0; i < nvList.used; ++i) {
             const NamedValue* nv = &nvList.buffer[i];
-            if (nv->value.type == ValueType_List && nv->value.list.isArray) {
+            if (nv->value.type == ValueType_List && nv->value.listIsArray) {
                 TemLangStringCreateFormat(
                   ts,
                   allocator,
@@ -2902,6 +3242,8 @@ CompileInstruction(State* state,
                    pTemLangString output)
 {
     static size_t inVariant = 0;
+    const bool slotsUsable = stateSlotsUsable;
+    stateSlotsUsable = false;
     Value value = { 0 };
     bool result = true;
     switch (instruction->type) {
@@ -3376,7 +3718,7 @@ CompileInstruction(State* state,
                       (*output),
                       "%s |= %s_%s;",
                       s1.buffer,
-                      atom->variable.value.flagValue.name.buffer,
+                      atom->variable.value.flagValue.names->name.buffer,
                       cf->member.buffer);
                 } break;
                 case ChangeFlagType_Toggle: {
@@ -3384,7 +3726,7 @@ CompileInstruction(State* state,
                       (*output),
                       "%s ^= %s_%s;",
                       s1.buffer,
-                      atom->variable.value.flagValue.name.buffer,
+                      atom->variable.value.flagValue.names->name.buffer,
                       cf->member.buffer);
                 } break;
                 case ChangeFlagType_Remove: {
@@ -3392,7 +3734,7 @@ CompileInstruction(State* state,
                       (*output),
                       "%s &= ~(%s_%s);",
                       s1.buffer,
-                      atom->variable.value.flagValue.name.buffer,
+                      atom->variable.value.flagValue.names->name.buffer,
                       cf->member.buffer);
                 } break;
                 default:
@@ -3414,16 +3756,14 @@ CompileInstruction(State* state,
             if (instruction->setAllFlag.clear) {
                 TemLangStringAppendFormat((*output), "%s = 0;", s1.buffer);
             } else {
+                const EnumNames* names = atom->variable.value.flagValue.names;
                 TemLangStringAppendFormat((*output), "%s = ", s1.buffer);
-                for (size_t i = 0;
-                     i < atom->variable.value.flagValue.members.used;
-                     ++i) {
-                    TemLangStringAppendFormat(
-                      (*output),
-                      "%s_%s",
-                      atom->variable.value.flagValue.name.buffer,
-                      atom->variable.value.flagValue.members.buffer[i].buffer);
-                    if (i != atom->variable.value.flagValue.members.used - 1) {
+                for (size_t i = 0; i < names->members.used; ++i) {
+                    TemLangStringAppendFormat((*output),
+                                              "%s_%s",
+                                              names->name.buffer,
+                                              names->members.buffer[i].buffer);
+                    if (i != names->members.used - 1) {
                         TemLangStringAppendChar(output, '|');
                     }
                 }
@@ -3468,6 +3808,7 @@ CompileInstruction(State* state,
               allocator, value.string.buffer, value.string.used, 1, buffer);
             InstructionList instructions =
               TokensToInstructions(&list, allocator);
+            FoldInstructions(&instructions, allocator);
             TemLangString s1 = TemLangStringCreate("", allocator);
 
             result =
@@ -3501,6 +3842,7 @@ CompileInstruction(State* state,
                   performLex(allocator, ptr, size, 0UL, value.string.buffer);
                 InstructionList instructions =
                   TokensToInstructions(&tokens, allocator);
+                FoldInstructions(&instructions, allocator);
                 const VariableTarget target = { .type = VariableTarget_None };
                 State temp = { 0 };
                 temp.atoms.allocator = allocator;
@@ -3721,7 +4063,7 @@ CompileInstruction(State* state,
             if (!result) {
                 break;
             }
-            if (instruction->toArray == value.list.isArray) {
+            if (instruction->toArray == value.listIsArray) {
                 TemLangString s =
                   CompilerAssignValue(state,
                                       &instruction->toContainer,
@@ -3734,13 +4076,13 @@ CompileInstruction(State* state,
             } else {
                 TemLangString name = CompilerGetFullVariableName(
                   &instruction->fromContainer, state, allocator);
-                value.list.isArray = !value.list.isArray;
+                value.listIsArray = !value.listIsArray;
                 TemLangString s = CompilerDeclareValueType(
                   &instruction->toContainer, state, allocator, &value, true);
                 TemLangStringAppend(output, &s);
                 TemLangStringFree(&s);
 
-                if (value.list.isArray) {
+                if (value.listIsArray) {
                     TemLangStringAppendFormat(
                       (*output),
                       "for(size_t i%zu = 0; i%zu < %s.used; ++i%zu){",
@@ -3763,7 +4105,7 @@ CompileInstruction(State* state,
                     s = CompilerAssignValue(state,
                                             &left,
                                             allocator,
-                                            value.list.exampleValue,
+                                            value.list->exampleValue,
                                             &e,
                                             false);
 
@@ -3773,14 +4115,14 @@ CompileInstruction(State* state,
                     TemLangStringAppendFormat((*output), "%s }", s.buffer);
                 } else {
                     s = CompilerDeclareValueType(
-                      NULL, state, allocator, value.list.exampleValue, false);
+                      NULL, state, allocator, value.list->exampleValue, false);
                     TemLangStringAppendFormat(
                       (*output),
-                      "for(size_t i%zu = 0; i%zu < %u; ++i%zu){"
+                      "for(size_t i%zu = 0; i%zu < %zu; ++i%zu){"
                       "%sListAppend(&%s, &%s[i%zu]);}",
                       variableId,
                       variableId,
-                      value.list.values.used,
+                      ValueListValueLength(value.list),
                       variableId,
                       s.buffer,
                       instruction->toContainer.buffer,
@@ -3862,8 +4204,8 @@ CompileInstruction(State* state,
                           "bool continueLoop = true;\nfor(int64_t item = "
                           "%" PRId64 "; continueLoop && item < %" PRId64
                           "; ++item){\n %s %s \n}",
-                          NumberToInt(&newValue.rangedNumber.range.min),
-                          NumberToInt(&newValue.rangedNumber.range.max),
+                          NumberToInt(&newValue.rangedNumber.range->min),
+                          NumberToInt(&newValue.rangedNumber.range->max),
                           s.buffer,
                           cleanupString.buffer);
                     } else {
@@ -3879,7 +4221,6 @@ CompileInstruction(State* state,
                     {
                         Value item = { .type = ValueType_Number,
                                        .rangedNumber = {
-                                         .hasRange = false,
                                          .number = NumberFromUInt(0UL) } };
 
                         TemLangString name =
@@ -3892,16 +4233,16 @@ CompileInstruction(State* state,
                         TemLangString name =
                           TemLangStringCreate("item", allocator);
                         result &= StateAddValue(
-                          &temp, &name, newValue.list.exampleValue);
+                          &temp, &name, newValue.list->exampleValue);
                         declareString =
                           CompilerDeclareValueType(&name,
                                                    state,
                                                    allocator,
-                                                   newValue.list.exampleValue,
+                                                   newValue.list->exampleValue,
                                                    false);
                         TemLangStringCreateFormat(getValue,
                                                   allocator,
-                                                  newValue.list.isArray
+                                                  newValue.listIsArray
                                                     ? "%s[index]"
                                                     : "%s.buffer[index]",
                                                   listName.buffer);
@@ -3914,7 +4255,7 @@ CompileInstruction(State* state,
                           CompilerGetExpression(state,
                                                 allocator,
                                                 target,
-                                                newValue.list.exampleValue,
+                                                newValue.list->exampleValue,
                                                 &e);
                         TemLangStringFree(&name);
                         TemLangStringFree(&getValue);
@@ -3932,14 +4273,14 @@ CompileInstruction(State* state,
                     COMPILE_COPIED_STATE_CLEANUP((*state), temp, cleanupString);
 
                     if (result) {
-                        if (newValue.list.isArray) {
+                        if (newValue.listIsArray) {
                             TemLangStringAppendFormat(
                               (*output),
                               "%s bool continueLoop = true;\nfor(size_t "
-                              "index = 0UL; continueLoop && index < %u; "
+                              "index = 0UL; continueLoop && index < %zu; "
                               "++index){\n %s %s %s \n}",
                               declareString.buffer,
-                              newValue.list.values.used,
+                              ValueListValueLength(newValue.list),
                               expString.buffer,
                               s.buffer,
                               cleanupString.buffer);
@@ -3987,8 +4328,11 @@ CompileInstruction(State* state,
                     COMPILE_COPIED_STATE_CLEANUP((*state), temp, cleanupString);
                     const StateFindArgs args = { .log = true,
                                                  .searchParent = true };
-                    const Atom* atom = StateFindAtomConst(
-                      state, &newValue.enumValue.name, AtomType_Enum, args);
+                    const Atom* atom =
+                      StateFindAtomConst(state,
+                                         EnumValueName(&newValue.enumValue),
+                                         AtomType_Enum,
+                                         args);
                     result = atom != NULL;
 
                     const Range range = {
@@ -4003,8 +4347,8 @@ CompileInstruction(State* state,
                           "bool continueLoop = true;\nfor(%s item = %s_%s; "
                           "continueLoop && item < %u; ++item){\n %s %s \n}",
                           c,
-                          newValue.enumValue.name.buffer,
-                          newValue.enumValue.value.buffer,
+                          EnumValueName(&newValue.enumValue)->buffer,
+                          EnumValueMember(&newValue.enumValue)->buffer,
                           atom->enumDefinition.members.used,
                           s.buffer,
                           cleanupString.buffer);
@@ -4110,9 +4454,9 @@ CompileInstruction(State* state,
             bool isFloat;
             {
                 const CType cType =
-                  value.rangedNumber.hasRange
-                    ? RangeToCType(&value.rangedNumber.range)
-                    : NumberToCType(&value.rangedNumber.number);
+                  value.rangedNumber.range != NULL
+                    ? RangeToCType(value.rangedNumber.range)
+                    : CompilerNumberCType(&value.rangedNumber.number);
                 switch (cType) {
                     case CType_f32:
                         isFloat = true;
@@ -4167,6 +4511,7 @@ cleanup:
                      instruction->source.source.buffer,
                      instruction->source.lineNumber);
     }
+    stateSlotsUsable = slotsUsable;
     return result;
 }
 
@@ -4270,12 +4615,15 @@ GetSimpleExpressionName(const State* state,
                           (*s), "fmod(%s,%s);", s1.buffer, s2.buffer);
                         break;
                     }
-                    TemLangStringAppendFormat(
-                      (*s),
-                      "(%s %c %s)",
-                      s1.buffer,
-                      NumberOperatorToChar(e->op.numberOperator),
-                      s2.buffer);
+                    TemLangString op =
+                      CompilerNumberOperation(e->op.numberOperator,
+                                              &left,
+                                              &right,
+                                              s1.buffer,
+                                              s2.buffer,
+                                              allocator);
+                    TemLangStringAppendFormat((*s), "(%s)", op.buffer);
+                    TemLangStringFree(&op);
                 } break;
                 case OperatorType_Boolean: {
                     if (e->op.booleanOperator == BooleanOperator_Not) {
@@ -4332,28 +4680,22 @@ CompilerGetNumberExpression(const State* state,
 {
     TemLangString s = TemLangStringCreate("", allocator);
     if (left->type == ValueType_Flag && right->type == ValueType_Flag) {
-        const size_t total =
-          left->flagValue.members.used + right->flagValue.members.used;
-        if (total > 0) {
+        TemLangStringList members =
+          FlagValueMembers(&left->flagValue, allocator);
+        TemLangStringList rightMembers =
+          FlagValueMembers(&right->flagValue, allocator);
+        for (size_t i = 0; i < rightMembers.used; ++i) {
+            TemLangStringListAppend(&members, &rightMembers.buffer[i]);
+        }
+        TemLangStringListFree(&rightMembers);
+        if (members.used > 0) {
             TemLangString temp = { .allocator = allocator };
-            size_t j = 0;
-            for (size_t i = 0; i < left->flagValue.members.used; ++i, ++j) {
-                TemLangStringAppendFormat(
-                  temp,
-                  "%s_%s",
-                  left->flagValue.name.buffer,
-                  left->flagValue.members.buffer[i].buffer);
-                if (i + j != total - 1) {
-                    TemLangStringAppendChar(&temp, '|');
-                }
-            }
-            for (size_t i = 0; i < right->flagValue.members.used; ++i, ++j) {
-                TemLangStringAppendFormat(
-                  temp,
-                  "%s_%s",
-                  right->flagValue.name.buffer,
-                  right->flagValue.members.buffer[i].buffer);
-                if (i + j != total - 1) {
+            for (size_t i = 0; i < members.used; ++i) {
+                TemLangStringAppendFormat(temp,
+                                          "%s_%s",
+                                          left->flagValue.names->name.buffer,
+                                          members.buffer[i].buffer);
+                if (i != members.used - 1) {
                     TemLangStringAppendChar(&temp, '|');
                 }
             }
@@ -4371,6 +4713,7 @@ CompilerGetNumberExpression(const State* state,
             }
             TemLangStringFree(&temp);
         }
+        TemLangStringListFree(&members);
     } else if (left->type == ValueType_Number &&
                right->type == ValueType_Number) {
         TemLangString s1 = { .allocator = allocator };
@@ -4407,34 +4750,26 @@ CompilerGetNumberExpression(const State* state,
                 } break;
             }
         } else {
+            TemLangString op = CompilerNumberOperation(e->op.numberOperator,
+                                                       left,
+                                                       right,
+                                                       s1.buffer,
+                                                       s2.buffer,
+                                                       allocator);
             switch (target.type) {
-                case VariableTarget_ReturnValue: {
-                    TemLangStringAppendFormat(
-                      s,
-                      "return %s %c %s;",
-                      s1.buffer,
-                      NumberOperatorToChar(e->op.numberOperator),
-                      s2.buffer);
-                } break;
-                case VariableTarget_Variable: {
+                case VariableTarget_ReturnValue:
+                    TemLangStringAppendFormat(s, "return %s;", op.buffer);
+                    break;
+                case VariableTarget_Variable:
                     TemLangStringAppendFormat(
-                      s,
-                      "%s = %s %c %s;",
-                      target.name->buffer,
-                      s1.buffer,
-                      NumberOperatorToChar(e->op.numberOperator),
-                      s2.buffer);
-                } break;
+                      s, "%s = %s;", target.name->buffer, op.buffer);
+                    break;
                 case VariableTarget_None:
-                default: {
-                    TemLangStringAppendFormat(
-                      s,
-                      "%s %c %s",
-                      s1.buffer,
-                      NumberOperatorToChar(e->op.numberOperator),
-                      s2.buffer);
-                } break;
+                default:
+                    TemLangStringAppend(&s, &op);
+                    break;
             }
+            TemLangStringFree(&op);
         }
         TemLangStringFree(&s1);
         TemLangStringFree(&s2);
@@ -4533,8 +4868,11 @@ CompilerGetNumberExpression(const State* state,
                                    &numberValue)) {
                 const StateFindArgs args = { .log = true,
                                              .searchParent = true };
-                const Atom* atom = StateFindAtomConst(
-                  state, &enumValue->enumValue.name, AtomType_Enum, args);
+                const Atom* atom =
+                  StateFindAtomConst(state,
+                                     EnumValueName(&enumValue->enumValue),
+                                     AtomType_Enum,
+                                     args);
                 if (atom == NULL) {
                     goto expressionCompileError;
                 }
@@ -4598,15 +4936,15 @@ CompilerGetNumberExpression(const State* state,
                 switch (typeValue->fakeValue->type) {
                     case ValueType_Number: {
                         const char* c = CTypeToTypeString(RangeToCType(
-                          &typeValue->fakeValue->rangedNumber.range));
+                          typeValue->fakeValue->rangedNumber.range));
                         switch (target.type) {
                             case VariableTarget_ReturnValue:
                                 TemLangStringAppendFormat(
                                   s,
                                   " return (%s)%s_%s;",
                                   c,
-                                  value->enumValue.name.buffer,
-                                  value->enumValue.value.buffer);
+                                  EnumValueName(&value->enumValue)->buffer,
+                                  EnumValueMember(&value->enumValue)->buffer);
                                 break;
                             case VariableTarget_Variable:
                                 TemLangStringAppendFormat(
@@ -4614,16 +4952,16 @@ CompilerGetNumberExpression(const State* state,
                                   "%s = (%s)%s_%s;",
                                   target.name->buffer,
                                   c,
-                                  value->enumValue.name.buffer,
-                                  value->enumValue.value.buffer);
+                                  EnumValueName(&value->enumValue)->buffer,
+                                  EnumValueMember(&value->enumValue)->buffer);
                                 break;
                             default:
                                 TemLangStringAppendFormat(
                                   s,
                                   " (%s)%s_%s",
                                   c,
-                                  value->enumValue.name.buffer,
-                                  value->enumValue.value.buffer);
+                                  EnumValueName(&value->enumValue)->buffer,
+                                  EnumValueMember(&value->enumValue)->buffer);
                                 break;
                         }
                     } break;
@@ -4633,7 +4971,7 @@ CompilerGetNumberExpression(const State* state,
                                 TemLangStringAppendFormat(
                                   s,
                                   "return \"%s\";",
-                                  value->enumValue.value.buffer);
+                                  EnumValueMember(&value->enumValue)->buffer);
                                 break;
                             case VariableTarget_Variable:
                                 TemLangStringAppendFormat(
@@ -4642,11 +4980,13 @@ CompilerGetNumberExpression(const State* state,
                                   "\"%s\");",
                                   target.name->buffer,
                                   target.name->buffer,
-                                  value->enumValue.value.buffer);
+                                  EnumValueMember(&value->enumValue)->buffer);
                                 break;
                             default:
                                 TemLangStringAppendFormat(
-                                  s, "\"%s\"", value->enumValue.value.buffer);
+                                  s,
+                                  "\"%s\"",
+                                  EnumValueMember(&value->enumValue)->buffer);
                                 break;
                         }
                     } break;
@@ -4663,7 +5003,7 @@ CompilerGetNumberExpression(const State* state,
                 switch (typeValue->fakeValue->type) {
                     case ValueType_Number: {
                         const char* c = CTypeToTypeString(RangeToCType(
-                          &typeValue->fakeValue->rangedNumber.range));
+                          typeValue->fakeValue->rangedNumber.range));
                         switch (target.type) {
                             case VariableTarget_ReturnValue:
                                 TemLangStringAppendFormat(s,
@@ -4692,7 +5032,7 @@ CompilerGetNumberExpression(const State* state,
                                   "%s %s = %sToString(%s);",
                                   s1.buffer,
                                   target.name->buffer,
-                                  value->enumValue.name.buffer,
+                                  EnumValueName(&value->enumValue)->buffer,
                                   temp.buffer);
                                 break;
                             case VariableTarget_ReturnValue:
@@ -4700,7 +5040,7 @@ CompilerGetNumberExpression(const State* state,
                                   s,
                                   "%s return %sToString(%s);",
                                   s1.buffer,
-                                  value->enumValue.name.buffer,
+                                  EnumValueName(&value->enumValue)->buffer,
                                   temp.buffer);
                                 break;
                             default:
@@ -4708,7 +5048,7 @@ CompilerGetNumberExpression(const State* state,
                                   s,
                                   "%s %sToString(%s)",
                                   s1.buffer,
-                                  value->enumValue.name.buffer,
+                                  EnumValueName(&value->enumValue)->buffer,
                                   temp.buffer);
                                 break;
                         }
@@ -4736,7 +5076,7 @@ CompilerGetNumberExpression(const State* state,
                             TemLangStringAppendFormat(
                               s,
                               "return %sTagToString(%s.tag, currentAllocator);",
-                              value->variantValue.name.buffer,
+                              value->variantValue->name.buffer,
                               s1.buffer);
                             break;
                         case VariableTarget_Variable:
@@ -4746,14 +5086,14 @@ CompilerGetNumberExpression(const State* state,
                               "%sTagToCharString(%s.tag));",
                               target.name->buffer,
                               target.name->buffer,
-                              value->variantValue.name.buffer,
+                              value->variantValue->name.buffer,
                               s1.buffer);
                             break;
                         default:
                             TemLangStringAppendFormat(
                               s,
                               "%sTagToString(%s.tag, currentAllocator);",
-                              value->variantValue.name.buffer,
+                              value->variantValue->name.buffer,
                               s1.buffer);
                             break;
                     }
@@ -4832,8 +5172,7 @@ CompilerGetNumberExpression(const State* state,
                                 TemLangStringAppend(&s, &s1);
                                 TemLangStringFree(&s1);
                             }
-                            switch (
-                              typeValue->fakeValue->rangedNumber.number.type) {
+                            switch (value->rangedNumber.number.type) {
                                 case NumberType_Signed:
                                     TemLangStringAppendFormat(
                                       s,
@@ -4983,21 +5322,21 @@ CompilerGetNumberExpression(const State* state,
                                   s,
                                   "%s = %s_%s;",
                                   target.name->buffer,
-                                  fakeValue->enumValue.name.buffer,
+                                  EnumValueName(&fakeValue->enumValue)->buffer,
                                   value->string.buffer);
                                 break;
                             case VariableTarget_ReturnValue:
                                 TemLangStringAppendFormat(
                                   s,
                                   "return %s_%s;",
-                                  fakeValue->enumValue.name.buffer,
+                                  EnumValueName(&fakeValue->enumValue)->buffer,
                                   value->string.buffer);
                                 break;
                             default:
                                 TemLangStringAppendFormat(
                                   s,
                                   "%s_%s",
-                                  fakeValue->enumValue.name.buffer,
+                                  EnumValueName(&fakeValue->enumValue)->buffer,
                                   value->string.buffer);
                                 break;
                         }
@@ -5052,20 +5391,20 @@ CompilerGetNumberExpression(const State* state,
                                 TemLangStringAppendFormat(
                                   s,
                                   "%sFromString(&string)",
-                                  fakeValue->enumValue.name.buffer);
+                                  EnumValueName(&fakeValue->enumValue)->buffer);
                             } break;
                             case VariableTarget_Variable: {
                                 TemLangStringAppendFormat(
                                   s,
                                   "%s = %sFromString(&string);",
                                   target.name->buffer,
-                                  fakeValue->enumValue.name.buffer);
+                                  EnumValueName(&fakeValue->enumValue)->buffer);
                             } break;
                             case VariableTarget_ReturnValue: {
                                 TemLangStringAppendFormat(
                                   s,
                                   "return %sFromString(&string);",
-                                  fakeValue->enumValue.name.buffer);
+                                  EnumValueName(&fakeValue->enumValue)->buffer);
                             } break;
                             default:
                                 break;
@@ -5073,9 +5412,10 @@ CompilerGetNumberExpression(const State* state,
                     } break;
                     case ValueType_Number: {
                         const char* c = CTypeToTypeString(
-                          fakeValue->rangedNumber.hasRange
-                            ? RangeToCType(&fakeValue->rangedNumber.range)
-                            : NumberToCType(&fakeValue->rangedNumber.number));
+                          fakeValue->rangedNumber.range != NULL
+                            ? RangeToCType(fakeValue->rangedNumber.range)
+                            : CompilerNumberCType(
+                                &fakeValue->rangedNumber.number));
                         switch (target.type) {
                             case VariableTarget_None: {
                                 TemLangStringAppendFormat(
@@ -5148,3 +5488,5 @@ expressionCompileError : {
     return s;
 }
 }
+
+#include "Jit.h"
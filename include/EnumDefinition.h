@@ -1,11 +1,65 @@
 #pragma once
 
 #include "Allocator.h"
+#include "Parallel.h"
 #include "TemLangString.h"
 
+// Names of an enum shared by its definition and every value of the enum.
+// Values only store an ordinal and look up their member name here
+typedef struct EnumNames
+{
+    TemLangString name;
+    TemLangStringList members;
+    size_t refCount;
+    const Allocator* allocator;
+} EnumNames, *pEnumNames;
+
+static inline EnumNames*
+EnumNamesCreate(const TemLangString* name,
+                const TemLangStringList* members,
+                const Allocator* allocator)
+{
+    EnumNames* names = allocator->allocate(sizeof(EnumNames));
+    if (names == NULL) {
+        return NULL;
+    }
+    names->refCount = 1;
+    names->allocator = allocator;
+    if (TemLangStringCopy(&names->name, name, allocator) &&
+        TemLangStringListCopy(&names->members, members, allocator)) {
+        return names;
+    }
+    TemLangStringFree(&names->name);
+    TemLangStringListFree(&names->members);
+    allocator->free(names);
+    return NULL;
+}
+
+static inline EnumNames*
+EnumNamesShare(EnumNames* names)
+{
+    if (names != NULL) {
+        RefCountIncrement(&names->refCount);
+    }
+    return names;
+}
+
+static inline void
+EnumNamesRelease(EnumNames* names)
+{
+    if (names == NULL || RefCountDecrement(&names->refCount) != 0) {
+        return;
+    }
+    TemLangStringFree(&names->name);
+    TemLangStringListFree(&names->members);
+    names->allocator->free(names);
+}
+
 typedef struct EnumDefinition
 {
     TemLangStringList members;
+    // Created when the enum is defined
+    EnumNames* names;
     bool isFlag;
 } EnumDefinition, *pEnumDefinition;
 
@@ -26,6 +80,8 @@ static inline void
 EnumDefinitionFree(EnumDefinition* e)
 {
     TemLangStringListFree(&e->members);
+    EnumNamesRelease(e->names);
+    e->names = NULL;
 }
 
 static inline bool
@@ -35,5 +91,6 @@ EnumDefinitionCopy(EnumDefinition* dest,
 {
     EnumDefinitionFree(dest);
     dest->isFlag = src->isFlag;
+    dest->names = EnumNamesShare(src->names);
     return TemLangStringListCopy(&dest->members, &src->members, allocator);
 }
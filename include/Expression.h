@@ -55,14 +55,30 @@ TokensToMatchBranch(const Token* tokens,
                     const Allocator* allocator,
                     pMatchBranchList list);
 
+// Location of a variable computed by the resolver (see Resolver.h)
+typedef struct VariableAddress
+{
+    // Number of parent states to walk up
+    uint32_t depth;
+    // Index into the atoms of that state plus one. Zero means unresolved.
+    uint32_t slot;
+} VariableAddress, *pVariableAddress;
+
 typedef struct Expression
 {
     ExpressionType type;
+    VariableAddress address;
     union
     {
         Value value;
         TemLangString identifier;
-        InstructionList instructions;
+        struct
+        {
+            InstructionList instructions;
+            // Shape of the last struct made by a unary struct. Reused while
+            // the struct has the same members
+            StructShape* structShape;
+        };
         struct
         {
             pMatchExpression matchExpression;
@@ -79,6 +95,10 @@ typedef struct Expression
             pExpression right;
             Operator op;
             const Allocator* expressionAllocator;
+            // Slot of a constant member name in the last struct shape it was
+            // looked up in
+            StructShape* memberShape;
+            size_t memberSlot;
         };
     };
 } Expression, *pExpression;
@@ -118,6 +138,12 @@ EvaluateExpressionToReference(const Expression* e,
                               State* state,
                               const Allocator* allocator);
 
+static inline const Value*
+EvaluateExpressionToConstReference(const Expression* e,
+                                   const State* state,
+                                   pValue storage,
+                                   const Allocator* allocator);
+
 static inline bool
 ExpressionCopy(Expression*, const Expression*, const Allocator*);
 
@@ -191,8 +217,11 @@ ExpressionFree(Expression* e)
             TemLangStringFree(&e->identifier);
             break;
         case ExpressionType_UnaryScope:
+            InstructionListFree(&e->instructions);
+            break;
         case ExpressionType_UnaryStruct:
             InstructionListFree(&e->instructions);
+            StructShapeRelease(e->structShape);
             break;
         case ExpressionType_UnaryList:
             ExpressionListFree(&e->expressions);
@@ -203,6 +232,7 @@ ExpressionFree(Expression* e)
             break;
         case ExpressionType_Binary:
             OperatorFree(&e->op);
+            StructShapeRelease(e->memberShape);
             if (e->left != NULL) {
                 ExpressionFree(e->left);
                 e->expressionAllocator->free(e->left);
@@ -225,6 +255,7 @@ ExpressionCopy(Expression* dest,
 {
     ExpressionFree(dest);
     dest->type = src->type;
+    dest->address = src->address;
     switch (src->type) {
         case ExpressionType_Nullary:
             return true;
@@ -269,8 +300,7 @@ makeRangeValue(pExpression e, const Range range, const Allocator* allocator)
     e->value.type = ValueType_Type;
     e->value.fakeValue = allocator->allocate(sizeof(Value));
     e->value.fakeValue->type = ValueType_Number;
-    e->value.fakeValue->rangedNumber.hasRange = true;
-    e->value.fakeValue->rangedNumber.range = range;
+    e->value.fakeValue->rangedNumber.range = RangeIntern(&range);
     e->value.fakeValueAllocator = allocator;
 }
 
@@ -281,9 +311,9 @@ TokenToExpression(const Token* token, pExpression e, const Allocator* allocator)
         case TokenType_Character: {
             e->type = ExpressionType_UnaryValue;
             e->value.type = ValueType_Number;
-            e->value.rangedNumber.hasRange = true;
-            e->value.rangedNumber.range.min = NumberFromInt(INT8_MIN);
-            e->value.rangedNumber.range.max = NumberFromInt(INT8_MAX);
+            const Range range = { .min = NumberFromInt(INT8_MIN),
+                                  .max = NumberFromInt(INT8_MAX) };
+            e->value.rangedNumber.range = RangeIntern(&range);
             e->value.rangedNumber.number.i = (int64_t)token->c;
             e->value.rangedNumber.number.type = NumberType_Signed;
             return true;
@@ -352,7 +382,7 @@ TokenToExpression(const Token* token, pExpression e, const Allocator* allocator)
         case TokenType_Number:
             e->type = ExpressionType_UnaryValue;
             e->value.type = ValueType_Number;
-            e->value.rangedNumber.hasRange = false;
+            e->value.rangedNumber.range = NULL;
             e->value.rangedNumber.number = token->number;
             return true;
         case TokenType_String:
@@ -686,64 +716,44 @@ EvaluateNumberExpression(const Value* left,
                          pValue value)
 {
     if (ValueTypesMatch(left, ValueType_Number, right, ValueType_Number)) {
+        if (NumberOperationTraps(
+              &left->rangedNumber.number, &right->rangedNumber.number, op)) {
+            TemLangString a = NumberToString(&left->rangedNumber.number,
+                                             allocator);
+            TemLangString b = NumberToString(&right->rangedNumber.number,
+                                             allocator);
+            TemLangError("Cannot divide '%s' by '%s'", a.buffer, b.buffer);
+            TemLangStringFree(&a);
+            TemLangStringFree(&b);
+            return false;
+        }
         value->type = ValueType_Number;
         value->rangedNumber.number = ApplyNumberOperator(
           &left->rangedNumber.number, &right->rangedNumber.number, op);
-        value->rangedNumber.hasRange = false;
+        value->rangedNumber.range = NULL;
         return true;
     }
     if (ValueTypesMatch(left, ValueType_Flag, right, ValueType_Flag) &&
-        TemLangStringsAreEqual(&left->flagValue.name, &right->flagValue.name)) {
-        switch (op) {
-            case NumberOperator_Add:
-                value->type = ValueType_Flag;
-                if (!TemLangStringListCopy(&value->flagValue.members,
-                                           &left->flagValue.members,
-                                           allocator)) {
-                    return false;
-                }
-                for (size_t i = 0; i < right->flagValue.members.used; ++i) {
-                    const TemLangString* s =
-                      &right->flagValue.members.buffer[i];
-                    if (!TemLangStringListFindIf(
-                          &value->flagValue.members,
-                          (TemLangStringListFindFunc)TemLangStringsAreEqual,
-                          s,
-                          NULL,
-                          NULL)) {
-                        TemLangStringListAppend(&value->flagValue.members, s);
-                    }
-                }
-                break;
-            case NumberOperator_Subtract:
-                value->type = ValueType_Flag;
-                if (!TemLangStringListCopy(&value->flagValue.members,
-                                           &left->flagValue.members,
-                                           allocator)) {
-                    return false;
-                }
-                for (size_t i = 0; i < right->flagValue.members.used; ++i) {
-                    const TemLangString* s =
-                      &right->flagValue.members.buffer[i];
-                    size_t index = 0;
-                    while (TemLangStringListFindIf(
-                      &value->flagValue.members,
-                      (TemLangStringListFindFunc)TemLangStringsAreEqual,
-                      s,
-                      NULL,
-                      &index)) {
-                        TemLangStringListSwapRemove(&value->flagValue.members,
-                                                    index);
-                    }
-                }
-                break;
-            default:
-                TemLangError("Expected '+' or '-' operator on flags. Got '%c'",
-                             NumberOperatorToChar(op));
-                return false;
+        FlagValuesSameFlag(&left->flagValue, &right->flagValue)) {
+        if (op != NumberOperator_Add && op != NumberOperator_Subtract) {
+            TemLangError("Expected '+' or '-' operator on flags. Got '%c'",
+                         NumberOperatorToChar(op));
+            return false;
         }
-        return TemLangStringCopy(
-          &value->flagValue.name, &left->flagValue.name, allocator);
+        value->type = ValueType_Flag;
+        if (!FlagValueCopy(&value->flagValue, &left->flagValue, allocator)) {
+            return false;
+        }
+        uint64_t* words = FlagValueWords(&value->flagValue);
+        const uint64_t* other = FlagValueConstWords(&right->flagValue);
+        for (size_t i = 0; i < FlagValueWordCount(&value->flagValue); ++i) {
+            if (op == NumberOperator_Add) {
+                words[i] |= other[i];
+            } else {
+                words[i] &= ~other[i];
+            }
+        }
+        return true;
     }
     switch (op) {
         case NumberOperator_Add:
@@ -769,19 +779,19 @@ EvaluateNumberExpression(const Value* left,
                 return false;
             }
             value->type = ValueType_List;
-            value->list.allocator = allocator;
-            value->list.isArray = true;
-            value->list.exampleValue = allocator->allocate(sizeof(Value));
-            value->list.values.allocator = allocator;
-            if (!ValueCopy(value->list.exampleValue, target, allocator)) {
+            value->listIsArray = true;
+            value->list = ValueListValueCreate(allocator);
+            if (value->list == NULL ||
+                !ValueCopy(value->list->exampleValue, target, allocator)) {
                 return false;
             }
             for (uint64_t i = 0; i < count; ++i) {
-                if (!ValueListAppend(&value->list.values, target)) {
+                if (!ValueListAppend(&value->list->values, target)) {
                     return false;
                 }
             }
-            return value->list.values.used == count;
+            return value->list->values.used == count &&
+                   ValueListValuePack(value->list);
         } break;
         default:
             break;
@@ -795,7 +805,7 @@ EvaluateNumberExpression(const Value* left,
         value->type = ValueType_Number;
         value->rangedNumber.number = ApplyNumberOperator(
           &target->rangedNumber.number, &n, NumberOperator_Multiply);
-        value->rangedNumber.hasRange = false;
+        value->rangedNumber.range = NULL;
         return true;
     }
     return false;
@@ -839,8 +849,46 @@ EvaluateFunctionExpression(const Value*,
                            const Value*,
                            const State*,
                            const Allocator*,
+                           pValue,
+                           pValue,
                            pValue);
 
+static inline bool
+EvaluateOperator(const Value* left,
+                 const Operator* op,
+                 const Value* right,
+                 const State* state,
+                 const Allocator* allocator,
+                 pValue value)
+{
+    switch (op->type) {
+        case OperatorType_Boolean:
+            return EvaluateBooleanExpression(
+              left, right, op->booleanOperator, value);
+        case OperatorType_Number:
+            return EvaluateNumberExpression(
+              left, right, state, allocator, op->numberOperator, value);
+        case OperatorType_Comparison:
+            return EvaluateComparisonExpression(
+              left, right, op->comparisonOperator, value);
+        case OperatorType_Get:
+            return EvaluateGetExpression(
+              left, right, state, allocator, op->getOperator, value);
+        case OperatorType_Function:
+            return EvaluateFunctionExpression(left,
+                                              &op->functionCall,
+                                              right,
+                                              state,
+                                              allocator,
+                                              value,
+                                              NULL,
+                                              NULL);
+        default:
+            break;
+    }
+    return false;
+}
+
 static inline bool
 EvaluateBinaryExpression(const Expression* eLeft,
                          const Operator* op,
@@ -852,33 +900,23 @@ EvaluateBinaryExpression(const Expression* eLeft,
     bool result = false;
     Value left = { 0 };
     Value right = { 0 };
-    if (!EvaluateExpression(eLeft, state, &left, allocator) ||
-        !EvaluateExpression(eRight, state, &right, allocator)) {
+    const Value* l =
+      EvaluateExpressionToConstReference(eLeft, state, &left, allocator);
+    if (l == NULL) {
         goto cleanup;
     }
-    switch (op->type) {
-        case OperatorType_Boolean:
-            result = EvaluateBooleanExpression(
-              &left, &right, op->booleanOperator, value);
-            break;
-        case OperatorType_Number:
-            result = EvaluateNumberExpression(
-              &left, &right, state, allocator, op->numberOperator, value);
-            break;
-        case OperatorType_Comparison:
-            result = EvaluateComparisonExpression(
-              &left, &right, op->comparisonOperator, value);
-            break;
-        case OperatorType_Get:
-            result = EvaluateGetExpression(
-              &left, &right, state, allocator, op->getOperator, value);
-            break;
-        case OperatorType_Function:
-            result = EvaluateFunctionExpression(
-              &left, &op->functionCall, &right, state, allocator, value);
-            break;
-        default:
-            break;
+    const Value* r =
+      EvaluateExpressionToConstReference(eRight, state, &right, allocator);
+    if (r == NULL) {
+        goto cleanup;
+    }
+    if (op->type == OperatorType_Function) {
+        // Arguments that were evaluated into left or right are moved into the
+        // parameters of the call
+        result = EvaluateFunctionExpression(
+          l, &op->functionCall, r, state, allocator, value, &left, &right);
+    } else {
+        result = EvaluateOperator(l, op, r, state, allocator, value);
     }
 cleanup:
     ValueFree(&left);
@@ -886,9 +924,16 @@ cleanup:
     return result;
 }
 
+// Set while a call past the maximum call depth unwinds so the error is only
+// reported once
+static _Thread_local bool callDepthExceeded = false;
+
 static inline void
 EvaluateExpressionError(const Expression* e)
 {
+    if (callDepthExceeded) {
+        return;
+    }
     TemLangError("Failed to evaluate '%s' expression",
                  ExpressionTypeToString(e->type));
 }
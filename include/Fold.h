@@ -0,0 +1,438 @@
+#pragma once
+
+#include "Instruction.h"
+
+// Static pass that replaces binary expressions whose operands are literals
+// (or constants with a literal value) with the value they evaluate to. Only
+// operators that can't fail, change state or depend on it are folded. So the
+// folded tree behaves exactly like the original one.
+
+typedef struct FoldName
+{
+    const TemLangString* name;
+    // Value of the constant. NULL if the name isn't a constant with a literal
+    // value
+    const Value* value;
+} FoldName, *pFoldName;
+
+MAKE_COPY_AND_FREE(FoldName);
+MAKE_LIST(FoldName);
+DEFAULT_MAKE_LIST_FUNCTIONS(FoldName);
+
+typedef struct Folder
+{
+    FoldNameList names;
+    // Names before this index can't be seen from the current scope
+    uint32_t visible;
+    const Allocator* allocator;
+} Folder, *pFolder;
+
+static inline bool
+FolderAdd(Folder* f, const TemLangString* name, const Value* value)
+{
+    const FoldName n = { .name = name, .value = value };
+    return FoldNameListAppend(&f->names, &n);
+}
+
+static inline bool
+FolderAddNames(Folder* f, const TemLangStringList* names)
+{
+    for (size_t i = 0; i < names->used; ++i) {
+        if (!FolderAdd(f, &names->buffer[i], NULL)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static inline const Value*
+FolderFind(const Folder* f, const TemLangString* name)
+{
+    for (uint32_t i = f->names.used; i > f->visible; --i) {
+        const FoldName* n = &f->names.buffer[i - 1];
+        if (TemLangStringsAreEqual(n->name, name)) {
+            return n->value;
+        }
+    }
+    return NULL;
+}
+
+typedef struct FolderScope
+{
+    uint32_t names;
+    uint32_t visible;
+} FolderScope, *pFolderScope;
+
+static inline FolderScope
+FolderPushScope(Folder* f, const bool linked)
+{
+    const FolderScope scope = { .names = f->names.used,
+                                .visible = f->visible };
+    if (!linked) {
+        f->visible = f->names.used;
+    }
+    return scope;
+}
+
+static inline void
+FolderPopScope(Folder* f, const FolderScope* scope)
+{
+    while (f->names.used > scope->names) {
+        FoldNameListPop(&f->names);
+    }
+    f->visible = scope->visible;
+}
+
+static inline bool
+FoldInstructionList(Folder*, InstructionList*);
+
+static inline const Value*
+FoldOperand(const Folder* f, const Expression* e)
+{
+    static const Value null = { .type = ValueType_Null };
+    switch (e->type) {
+        case ExpressionType_Nullary:
+            return &null;
+        case ExpressionType_UnaryValue:
+            return &e->value;
+        case ExpressionType_UnaryVariable:
+            return FolderFind(f, &e->identifier);
+        default:
+            return NULL;
+    }
+}
+
+// True if evaluating the operator on these values can't fail or read the
+// state
+static inline bool
+CanFoldOperator(const Value* left, const Operator* op, const Value* right)
+{
+    const Value* target = getUnaryValue(left, right);
+    switch (op->type) {
+        case OperatorType_Boolean:
+            if (ValueTypesMatch(
+                  left, ValueType_Boolean, right, ValueType_Boolean)) {
+                return true;
+            }
+            return op->booleanOperator == BooleanOperator_Not &&
+                   target != NULL && target->type == ValueType_Boolean;
+        case OperatorType_Comparison:
+            if (op->comparisonOperator == ComparisonOperator_EqualTo) {
+                return left->type != ValueType_Type &&
+                       right->type != ValueType_Type;
+            }
+            return ValueTypesMatch(
+                     left, ValueType_Number, right, ValueType_Number) ||
+                   ValueTypesMatch(
+                     left, ValueType_String, right, ValueType_String);
+        case OperatorType_Number:
+            break;
+        default:
+            return false;
+    }
+    const NumberOperator numberOperator = op->numberOperator;
+    if (ValueTypesMatch(left, ValueType_Number, right, ValueType_Number)) {
+        // Division by zero has to be reported when the expression runs
+        return !NumberOperationTraps(&left->rangedNumber.number,
+                                     &right->rangedNumber.number,
+                                     numberOperator);
+    }
+    if (numberOperator == NumberOperator_Subtract) {
+        return target != NULL && target->type == ValueType_Number;
+    }
+    if (numberOperator != NumberOperator_Add) {
+        return false;
+    }
+    if (ValueTypesMatch(left, ValueType_String, right, ValueType_String)) {
+        return true;
+    }
+    if (left->type != ValueType_Number || right->type != ValueType_Type) {
+        return false;
+    }
+    const Value* fakeValue = right->fakeValue;
+    switch (fakeValue->type) {
+        case ValueType_Number:
+            return numberInRange(&left->rangedNumber.number,
+                                 fakeValue->rangedNumber.range);
+        case ValueType_String:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static inline bool
+FoldExpression(Folder*, Expression*);
+
+static inline bool
+FoldBinaryExpression(Folder* f, Expression* e)
+{
+    if (!FoldExpression(f, e->left) || !FoldExpression(f, e->right)) {
+        return false;
+    }
+    const Value* left = FoldOperand(f, e->left);
+    const Value* right = FoldOperand(f, e->right);
+    if (left == NULL || right == NULL ||
+        !CanFoldOperator(left, &e->op, right)) {
+        return true;
+    }
+    Expression folded = { .type = ExpressionType_UnaryValue };
+    if (!EvaluateOperator(
+          left, &e->op, right, NULL, f->allocator, &folded.value)) {
+        ExpressionFree(&folded);
+        return true;
+    }
+    ExpressionFree(e);
+    *e = folded;
+    return true;
+}
+
+static inline bool
+FoldBranch(Folder* f, Branch* branch)
+{
+    switch (branch->type) {
+        case MatchBranchType_Instructions:
+            return FoldInstructionList(f, &branch->instructions);
+        case MatchBranchType_Expression:
+            return FoldExpression(f, &branch->expression);
+        default:
+            return true;
+    }
+}
+
+static inline bool
+FoldMatchExpression(Folder* f, MatchExpression* m)
+{
+    if (!FoldExpression(f, &m->matcher)) {
+        return false;
+    }
+    for (size_t i = 0; i < m->branches.used; ++i) {
+        MatchBranch* branch = &m->branches.buffer[i];
+        if (!FoldExpression(f, &branch->matcher)) {
+            return false;
+        }
+        const FolderScope scope = FolderPushScope(f, true);
+        bool result = true;
+        if (branch->matcher.type == ExpressionType_UnaryVariable) {
+            // Variant matches add the member as a variable
+            result = FolderAdd(f, &branch->matcher.identifier, NULL);
+        }
+        result = result && FoldBranch(f, &branch->branch);
+        FolderPopScope(f, &scope);
+        if (!result) {
+            return false;
+        }
+    }
+    const FolderScope scope = FolderPushScope(f, true);
+    const bool result = FoldBranch(f, &m->defaultBranch);
+    FolderPopScope(f, &scope);
+    return result;
+}
+
+static inline bool
+FoldExpression(Folder* f, Expression* e)
+{
+    switch (e->type) {
+        case ExpressionType_UnaryScope:
+        case ExpressionType_UnaryStruct: {
+            const FolderScope scope = FolderPushScope(f, true);
+            const bool result = FoldInstructionList(f, &e->instructions);
+            FolderPopScope(f, &scope);
+            return result;
+        }
+        case ExpressionType_UnaryMatch: {
+            const FolderScope scope = FolderPushScope(f, true);
+            const bool result = FoldMatchExpression(f, e->matchExpression);
+            FolderPopScope(f, &scope);
+            return result;
+        }
+        case ExpressionType_UnaryList:
+            for (size_t i = 0; i < e->expressions.used; ++i) {
+                if (!FoldExpression(f, &e->expressions.buffer[i])) {
+                    return false;
+                }
+            }
+            return true;
+        case ExpressionType_Binary:
+            return FoldBinaryExpression(f, e);
+        default:
+            return true;
+    }
+}
+
+static inline bool
+FoldFunctionDefinition(Folder* f, FunctionDefinition* d)
+{
+    // Functions can see the variables of whoever calls them. So constants
+    // from the enclosing scopes can't be trusted
+    const FolderScope scope = FolderPushScope(f, false);
+    bool result = true;
+    switch (d->type) {
+        case FunctionType_Unary:
+            result = FolderAdd(f, &d->leftParameter, NULL);
+            break;
+        case FunctionType_Binary:
+            result = FolderAdd(f, &d->leftParameter, NULL) &&
+                     FolderAdd(f, &d->rightParameter, NULL);
+            break;
+        case FunctionType_Procedure:
+            result = FolderAddNames(f, &d->captures);
+            break;
+        default:
+            break;
+    }
+    result = result && FoldInstructionList(f, &d->instructions);
+    FolderPopScope(f, &scope);
+    return result;
+}
+
+static inline bool
+FoldCreateVariable(Folder* f, CreateVariableInstruction* c)
+{
+    if (!FoldExpression(f, &c->value)) {
+        return false;
+    }
+    const Value* value = NULL;
+    if (c->type == VariableType_Constant &&
+        c->value.type == ExpressionType_UnaryValue) {
+        switch (c->value.value.type) {
+            case ValueType_Number:
+            case ValueType_Boolean:
+            case ValueType_String:
+                value = &c->value.value;
+                break;
+            default:
+                break;
+        }
+    }
+    return FolderAdd(f, &c->name, value);
+}
+
+static inline bool
+FoldInstruction(Folder* f, Instruction* i)
+{
+    switch (i->type) {
+        case InstructionType_NoCompile:
+        case InstructionType_NoCleanup:
+            return FoldInstructionList(f, &i->instructions);
+        case InstructionType_Return:
+            return FoldExpression(f, &i->expression);
+        case InstructionType_Inline:
+        case InstructionType_InlineFile:
+            if (!FoldExpression(f, &i->expression)) {
+                return false;
+            }
+            // Inlined instructions can add any name to this scope
+            f->visible = f->names.used;
+            return true;
+        case InstructionType_IfReturn:
+            return FoldExpression(f, &i->ifCondition) &&
+                   FoldExpression(f, &i->ifResult);
+        case InstructionType_CreateVariable:
+            return FoldCreateVariable(f, &i->createVariable);
+        case InstructionType_UpdateVariable:
+            return FoldExpression(f, &i->updateVariable.target) &&
+                   FoldExpression(f, &i->updateVariable.value);
+        case InstructionType_DefineRange:
+            return FoldExpression(f, &i->defineRange.min) &&
+                   FoldExpression(f, &i->defineRange.max) &&
+                   FolderAdd(f, &i->defineRange.name, NULL);
+        case InstructionType_DefineEnum:
+            return FolderAdd(f, &i->defineEnum.name, NULL);
+        case InstructionType_DefineStruct:
+            return FolderAdd(f, &i->defineStruct.name, NULL);
+        case InstructionType_DefineFunction:
+            return FolderAdd(f, &i->functionName, NULL) &&
+                   FoldFunctionDefinition(f, &i->functionDefinition);
+        case InstructionType_ChangeFlag:
+            return FoldExpression(f, &i->changeFlag.target);
+        case InstructionType_SetAllFlag:
+            return FoldExpression(f, &i->setAllFlag.target);
+        case InstructionType_ListModify:
+            return FoldExpression(f, &i->listModify.list) &&
+                   FoldExpression(f, &i->listModify.newValue[0]) &&
+                   FoldExpression(f, &i->listModify.newValue[1]);
+        case InstructionType_While:
+        case InstructionType_Until:
+        case InstructionType_Iterate: {
+            CaptureInstruction* c = &i->captureInstruction;
+            if (!FoldExpression(f, &c->target)) {
+                return false;
+            }
+            const FolderScope scope = FolderPushScope(f, true);
+            bool result = FolderAddNames(f, &c->captures);
+            if (i->type == InstructionType_Iterate) {
+                static const TemLangString item = { .buffer = "item",
+                                                    .used = 4,
+                                                    .size = 5 };
+                static const TemLangString index = { .buffer = "index",
+                                                     .used = 5,
+                                                     .size = 6 };
+                result = result && FolderAdd(f, &item, NULL) &&
+                         FolderAdd(f, &index, NULL);
+            }
+            result = result && FoldInstructionList(f, &c->instructions);
+            FolderPopScope(f, &scope);
+            return result;
+        }
+        case InstructionType_Match: {
+            MatchInstruction* m = &i->matchInstruction;
+            const FolderScope scope = FolderPushScope(f, true);
+            const bool result = FolderAddNames(f, &m->captures) &&
+                                FoldMatchExpression(f, &m->expression);
+            FolderPopScope(f, &scope);
+            return result;
+        }
+        case InstructionType_Print:
+        case InstructionType_Error:
+            for (size_t j = 0; j < i->printExpressions.used; ++j) {
+                if (!FoldExpression(f, &i->printExpressions.buffer[j])) {
+                    return false;
+                }
+            }
+            return true;
+        case InstructionType_ConvertContainer:
+            return FoldExpression(f, &i->fromContainer) &&
+                   FolderAdd(f, &i->toContainer, NULL);
+        case InstructionType_InlineVariable:
+            return FolderAdd(f, &i->definitionName, NULL);
+        case InstructionType_InlineText:
+        case InstructionType_InlineData:
+            return FoldExpression(f, &i->dataFile) &&
+                   FolderAdd(f, &i->dataName, NULL);
+        case InstructionType_Format:
+            return FoldExpression(f, &i->formatArgs) &&
+                   FolderAdd(f, &i->formatName, NULL);
+        case InstructionType_NumberRound:
+            return FoldExpression(f, &i->numberRoundTarget) &&
+                   FolderAdd(f, &i->numberRoundName, NULL);
+        default:
+            return true;
+    }
+}
+
+static inline bool
+FoldInstructionList(Folder* f, InstructionList* list)
+{
+    for (size_t i = 0; i < list->used; ++i) {
+        if (!FoldInstruction(f, &list->buffer[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Fold the constant expressions of instructions right after they are parsed
+static inline bool
+FoldInstructions(InstructionList* list, const Allocator* allocator)
+{
+    Folder f = { .names = { .allocator = allocator },
+                 .visible = 0,
+                 .allocator = allocator };
+    const bool result = FoldInstructionList(&f, list);
+    FoldNameListFree(&f.names);
+    if (!result) {
+        TemLangError("Failed to fold constant expressions");
+    }
+    return result;
+}
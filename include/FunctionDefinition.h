@@ -17,6 +17,14 @@ typedef struct FunctionDefinition
         };
         TemLangStringList captures;
     };
+    // Results of previous calls. Created on the first call if memoized
+    struct MemoCache* memo;
+    // Native code for the function. Created once it has been called enough
+    struct JitFunction* jit;
+    uint32_t calls;
+    // Profile entry plus one. Zero until the function is profiled
+    uint32_t profileEntry;
+    bool memoize;
 } FunctionDefinition, *pFunctionDefinition;
 
 static inline void
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <List.h>
+#include <ListKernel.h>
 #include <TemLangString.h>
 #include <math.h>
 #include <memory.h>
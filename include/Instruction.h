@@ -207,6 +207,8 @@ typedef struct ChangeFlagInstruction
     Expression target;
     TemLangString member;
     ChangeFlagType flag;
+    // Where the member was found the last time the instruction ran
+    size_t ordinal;
 } ChangeFlagInstruction, *pChangeFlagInstruction;
 
 static inline void
@@ -222,6 +224,7 @@ ChangeFlagInstructionCopy(ChangeFlagInstruction* dest,
                           const Allocator* allocator)
 {
     dest->flag = src->flag;
+    dest->ordinal = src->ordinal;
     return ExpressionCopy(&dest->target, &src->target, allocator) &&
            TemLangStringCopy(&dest->member, &src->member, allocator);
 }
@@ -366,7 +369,12 @@ typedef struct CaptureInstruction
 {
     Expression target;
     TemLangStringList captures;
+    // Filled by the resolver. Same encoding as VariableAddress::slot
+    uint32_tList captureSlots;
     InstructionList instructions;
+    // Iterations run on worker threads. Only set on iterate instructions
+    // without captures
+    bool parallel;
 } CaptureInstruction, *pCaptureInstruction;
 
 static inline void
@@ -374,6 +382,7 @@ CaptureInstructionFree(CaptureInstruction* i)
 {
     ExpressionFree(&i->target);
     TemLangStringListFree(&i->captures);
+    uint32_tListFree(&i->captureSlots);
     InstructionListFree(&i->instructions);
     memset(i, 0, sizeof(CaptureInstruction));
 }
@@ -384,9 +393,12 @@ CaptureInstructionCopy(CaptureInstruction* dest,
                        const Allocator* allocator)
 {
     CaptureInstructionFree(dest);
+    dest->parallel = src->parallel;
     return InstructionListCopy(
              &dest->instructions, &src->instructions, allocator) &&
            TemLangStringListCopy(&dest->captures, &src->captures, allocator) &&
+           uint32_tListCopy(
+             &dest->captureSlots, &src->captureSlots, allocator) &&
            ExpressionCopy(&dest->target, &src->target, allocator);
 }
 
@@ -400,10 +412,12 @@ CaptureInstructionToString(const CaptureInstruction* i,
     TemLangStringCreateFormat(
       s,
       allocator,
-      "{ \"target\": %s, \"captures\": %s, \"instructions\": %s }",
+      "{ \"target\": %s, \"captures\": %s, \"instructions\": %s, "
+      "\"parallel\": %s }",
       a.buffer,
       b.buffer,
-      c.buffer);
+      c.buffer,
+      i->parallel ? "true" : "false");
     TemLangStringFree(&a);
     TemLangStringFree(&b);
     TemLangStringFree(&c);
@@ -414,6 +428,8 @@ typedef struct MatchInstruction
 {
     MatchExpression expression;
     TemLangStringList captures;
+    // Filled by the resolver. Same encoding as VariableAddress::slot
+    uint32_tList captureSlots;
 } MatchInstruction, *pMatchInstruction;
 
 static inline void
@@ -430,6 +446,8 @@ MatchInstructionToString(const MatchInstruction* m, const Allocator*);
 typedef struct Instruction
 {
     InstructionType type;
+    // Profile entry plus one. Zero until the instruction is profiled
+    uint32_t profileEntry;
     InstructionSource source;
     union
     {
@@ -922,6 +940,16 @@ InstructionToString(const Instruction* i, const Allocator* allocator)
     return s;
 }
 
+// Options on instructions are written as string literals so they don't take
+// names away from variables and functions
+static inline bool
+TokenIsOption(const Token* token, const char* option)
+{
+    return token->type == TokenType_String &&
+           token->length == strlen(option) &&
+           memcmp(token->string, option, token->length) == 0;
+}
+
 static inline bool
 TokensToTemLangStringList(const TokenList* tokens,
                           const InstructionSource source,
@@ -1023,6 +1051,19 @@ TokensToInstruction(const InstructionStarter starter,
                     const Allocator* allocator,
                     pInstruction instruction)
 {
+    // unary "memoize" (name) ... caches the results of the function by its
+    // arguments
+    if ((starter == InstructionStarter_Nullary ||
+         starter == InstructionStarter_Unary ||
+         starter == InstructionStarter_Binary) &&
+        size > 0 && TokenIsOption(&tokens[0], "memoize")) {
+        if (!TokensToInstruction(
+              starter, tokens + 1, size - 1, allocator, instruction)) {
+            return false;
+        }
+        instruction->functionDefinition.memoize = true;
+        return true;
+    }
     switch (starter) {
         case InstructionStarter_NoCompile:
         case InstructionStarter_NoCleanup: {
@@ -1439,9 +1480,42 @@ TokensToInstruction(const InstructionStarter starter,
                     break;
             }
 
+            // iterate (target) ("parallel") { ... } runs the iterations on
+            // worker threads. Captured variables are the only ones the body
+            // can change and iterations run at the same time, so a parallel
+            // iterate can't capture any
+            const TokenList* captures = &tokens[1].tokens;
+            if (captures->used > 0 &&
+                TokenIsOption(&captures->buffer[0], "parallel")) {
+                if (starter != InstructionStarter_Iterate) {
+                    TemLangError("Only iterate can run in parallel (%s:%zu)",
+                                 instruction->source.source.buffer,
+                                 instruction->source.lineNumber);
+                    return false;
+                }
+                if (captures->used != 1) {
+                    TemLangError(
+                      "Parallel iterate cannot capture variables (%s:%zu)",
+                      instruction->source.source.buffer,
+                      instruction->source.lineNumber);
+                    return false;
+                }
+                instruction->captureInstruction.parallel = true;
+                captures = NULL;
+            }
+
             instruction->captureInstruction.instructions =
               TokensToInstructions(&tokens[2].tokens, allocator);
             instruction->captureInstruction.captures.allocator = allocator;
+            if (captures == NULL) {
+                return CheckInstructionSize(
+                         &instruction->captureInstruction.instructions,
+                         InstructionStarterToString(starter)) &&
+                       TokenToExpression(
+                         &tokens[0],
+                         &instruction->captureInstruction.target,
+                         allocator);
+            }
             return CheckInstructionSize(
                      &instruction->captureInstruction.instructions,
                      InstructionStarterToString(starter)) &&
@@ -1449,7 +1523,7 @@ TokensToInstruction(const InstructionStarter starter,
                                      &instruction->captureInstruction.target,
                                      allocator) &&
                    TokensToTemLangStringList(
-                     &tokens[1].tokens,
+                     captures,
                      instruction->source,
                      allocator,
                      InstructionTypeToString(instruction->type),
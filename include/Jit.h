@@ -0,0 +1,882 @@
+#pragma once
+
+#include "Compiler.h"
+
+// Functions called more than the threshold are emitted with the C backend,
+// built into a shared object with the system C compiler and called natively
+// from then on. Only functions made of number and boolean math with no calls
+// are compiled. Each is compiled for the kinds of arguments it got when it
+// crossed the threshold and the first calls are also interpreted to check the
+// results. Shared objects are cached by the hash of their source so later runs
+// don't build them again. The cache is in $XDG_CACHE_HOME or a directory in
+// /tmp named for the user and must only be usable by the user.
+
+#if __EMSCRIPTEN__ || _WIN32
+#define JIT_SUPPORTED 0
+#else
+#define JIT_SUPPORTED 1
+#endif
+
+// Calls whose results are compared with the interpreter before the native
+// code is trusted
+#define JIT_VERIFY_CALLS 8U
+#define JIT_SYMBOL "TemJitFunction"
+
+// Integer math in compiled functions. A result that doesn't fit in int64_t
+// (or a division the interpreter would have to handle) sets jitOverflow and
+// the native function returns false so the call is interpreted instead
+#define JIT_PRELUDE                                                            \
+    "static bool jitOverflow = false;\n"                                       \
+    "static int64_t\njitAdd(int64_t a, int64_t b)\n{\n"                        \
+    "    int64_t r = 0;\n"                                                     \
+    "    jitOverflow |= __builtin_add_overflow(a, b, &r);\n"                   \
+    "    return r;\n}\n"                                                       \
+    "static int64_t\njitSubtract(int64_t a, int64_t b)\n{\n"                   \
+    "    int64_t r = 0;\n"                                                     \
+    "    jitOverflow |= __builtin_sub_overflow(a, b, &r);\n"                   \
+    "    return r;\n}\n"                                                       \
+    "static int64_t\njitMultiply(int64_t a, int64_t b)\n{\n"                   \
+    "    int64_t r = 0;\n"                                                     \
+    "    jitOverflow |= __builtin_mul_overflow(a, b, &r);\n"                   \
+    "    return r;\n}\n"                                                       \
+    "static int64_t\njitDivide(int64_t a, int64_t b)\n{\n"                     \
+    "    if (b == 0 || (a == INT64_MIN && b == -1)) {\n"                      \
+    "        jitOverflow = true;\n        return 0;\n    }\n"                  \
+    "    return a / b;\n}\n"                                                   \
+    "static int64_t\njitModulo(int64_t a, int64_t b)\n{\n"                     \
+    "    if (b == 0 || (a == INT64_MIN && b == -1)) {\n"                      \
+    "        jitOverflow = true;\n        return 0;\n    }\n"                  \
+    "    return a % b;\n}\n"
+
+// Zero turns the JIT off
+static size_t jitThreshold = 0;
+static size_t jitCompiled = 0;
+static size_t jitNotCompiled = 0;
+static size_t jitRejected = 0;
+static size_t jitNativeCalls = 0;
+static size_t jitOverflowed = 0;
+
+typedef enum JitClass
+{
+    JitClass_None,
+    JitClass_Integer,
+    JitClass_Float,
+    JitClass_Boolean
+} JitClass,
+  *pJitClass;
+
+typedef union JitArgument
+{
+    int64_t i;
+    double d;
+    bool b;
+} JitArgument, *pJitArgument;
+
+// Returns false if the result couldn't be computed natively
+typedef bool (*JitNative)(const void* const*, void*);
+
+typedef struct JitFunction
+{
+    void* handle;
+    // Null if the function couldn't be compiled or gave a wrong result
+    JitNative native;
+    JitClass parameters[2];
+    JitClass result;
+    // Kind of the result while compiling. Integers keep it when they can
+    NumberType resultType;
+    uint32_t verified;
+    const Allocator* allocator;
+} JitFunction, *pJitFunction;
+
+static inline JitClass
+JitValueClass(const Value* v)
+{
+    switch (v->type) {
+        case ValueType_Number: {
+            const Number* n = &v->rangedNumber.number;
+            if (v->rangedNumber.range != NULL ||
+                (n->type == NumberType_Unsigned && n->u > INT64_MAX)) {
+                return JitClass_None;
+            }
+            return n->type == NumberType_Float ? JitClass_Float
+                                               : JitClass_Integer;
+        }
+        case ValueType_Boolean:
+            return JitClass_Boolean;
+        default:
+            return JitClass_None;
+    }
+}
+
+static inline const char*
+JitClassTypeName(const JitClass c)
+{
+    switch (c) {
+        case JitClass_Integer:
+            return "int64_t";
+        case JitClass_Float:
+            return "double";
+        default:
+            return "boolean";
+    }
+}
+
+static inline bool
+JitInstructionsSupported(const InstructionList*);
+
+static inline bool
+JitExpressionSupported(const Expression*);
+
+static inline bool
+JitBranchSupported(const Branch* branch)
+{
+    switch (branch->type) {
+        case MatchBranchType_Expression:
+            return JitExpressionSupported(&branch->expression);
+        case MatchBranchType_Instructions:
+            return JitInstructionsSupported(&branch->instructions);
+        default:
+            return true;
+    }
+}
+
+static inline bool
+JitMatchSupported(const MatchExpression* m)
+{
+    if (!JitExpressionSupported(&m->matcher)) {
+        return false;
+    }
+    for (size_t i = 0; i < m->branches.used; ++i) {
+        const MatchBranch* branch = &m->branches.buffer[i];
+        if (!JitExpressionSupported(&branch->matcher) ||
+            !JitBranchSupported(&branch->branch)) {
+            return false;
+        }
+    }
+    return JitBranchSupported(&m->defaultBranch);
+}
+
+static inline bool
+JitExpressionSupported(const Expression* e)
+{
+    switch (e->type) {
+        case ExpressionType_Nullary:
+            return true;
+        case ExpressionType_UnaryVariable:
+            // The resolver only finds parameters and locals in functions.
+            // Anything else isn't declared in the generated code.
+            return e->address.slot != 0;
+        case ExpressionType_UnaryValue:
+            return JitValueClass(&e->value) != JitClass_None;
+        case ExpressionType_UnaryScope:
+            return JitInstructionsSupported(&e->instructions);
+        case ExpressionType_UnaryMatch:
+            return JitMatchSupported(e->matchExpression);
+        case ExpressionType_Binary:
+            switch (e->op.type) {
+                case OperatorType_Number:
+                case OperatorType_Comparison:
+                case OperatorType_Boolean:
+                    return JitExpressionSupported(e->left) &&
+                           JitExpressionSupported(e->right);
+                default:
+                    // Calls, member access and lists
+                    return false;
+            }
+        default:
+            return false;
+    }
+}
+
+static inline bool
+JitInstructionSupported(const Instruction* i)
+{
+    switch (i->type) {
+        case InstructionType_CreateVariable:
+            // Constants are evaluated while compiling
+            return i->createVariable.type != VariableType_Constant &&
+                   JitExpressionSupported(&i->createVariable.value);
+        case InstructionType_UpdateVariable:
+            return i->updateVariable.target.type ==
+                     ExpressionType_UnaryVariable &&
+                   JitExpressionSupported(&i->updateVariable.target) &&
+                   JitExpressionSupported(&i->updateVariable.value);
+        case InstructionType_While:
+        case InstructionType_Until:
+            return JitExpressionSupported(&i->captureInstruction.target) &&
+                   JitInstructionsSupported(
+                     &i->captureInstruction.instructions);
+        case InstructionType_Match:
+            return JitMatchSupported(&i->matchInstruction.expression);
+        case InstructionType_Return:
+            return JitExpressionSupported(&i->expression);
+        case InstructionType_IfReturn:
+            return JitExpressionSupported(&i->ifCondition) &&
+                   JitExpressionSupported(&i->ifResult);
+        default:
+            return false;
+    }
+}
+
+static inline bool
+JitInstructionsSupported(const InstructionList* list)
+{
+    for (size_t i = 0; i < list->used; ++i) {
+        if (!JitInstructionSupported(&list->buffer[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Returns the number of arguments or -1 if the call can't be native
+static inline int
+JitArguments(const FunctionDefinition* f,
+             const Value* left,
+             const Value* right,
+             const Value** arguments)
+{
+    switch (f->type) {
+        case FunctionType_Unary:
+            arguments[0] = getUnaryValue(left, right);
+            return arguments[0] == NULL ? -1 : 1;
+        case FunctionType_Binary:
+            arguments[0] = left;
+            arguments[1] = right;
+            return 2;
+        case FunctionType_Nullary:
+            return left->type == ValueType_Null &&
+                       right->type == ValueType_Null
+                     ? 0
+                     : -1;
+        default:
+            return -1;
+    }
+}
+
+static inline bool
+JitValuesEqual(const Value* a, const Value* b)
+{
+    if (a->type != b->type) {
+        return false;
+    }
+    switch (a->type) {
+        case ValueType_Boolean:
+            return a->b == b->b;
+        case ValueType_Number: {
+            const Number* an = &a->rangedNumber.number;
+            const Number* bn = &b->rangedNumber.number;
+            return b->rangedNumber.range == NULL &&
+                   (an->type == NumberType_Float) ==
+                     (bn->type == NumberType_Float) &&
+                   NumberCompare(an, bn) == ComparisonOperator_EqualTo;
+        }
+        default:
+            return false;
+    }
+}
+
+#if JIT_SUPPORTED
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Keeps the JIT out of the frame of the recursive interpreter call. Those
+// functions aren't inline for the same reason
+#define JIT_NOINLINE __attribute__((noinline))
+
+static const char* jitCompiler = "cc";
+// Leaves room for the file names in paths
+static char jitCacheDirectory[PATH_MAX - 64] = { 0 };
+// Set while a function is compiled so the calls made to compile it are
+// interpreted
+static bool jitCompiling = false;
+// Set when the compiler couldn't be run
+static bool jitUnavailable = false;
+
+// Cached files are loaded into the process so only a cache only the user can
+// use and files in it that nobody else can write are trusted
+static inline bool
+JitOwned(const char* path, const mode_t type, const mode_t others)
+{
+    struct stat st = { 0 };
+    if (lstat(path, &st) != 0) {
+        TemLangError("Failed to check '%s': %s", path, strerror(errno));
+        return false;
+    }
+    if ((st.st_mode & S_IFMT) != type || st.st_uid != getuid() ||
+        (st.st_mode & others) != 0) {
+        TemLangError("'%s' must be a %s owned by the user with mode %o or "
+                     "less",
+                     path,
+                     type == S_IFDIR ? "directory" : "file",
+                     (unsigned int)(0777 & ~others));
+        return false;
+    }
+    return true;
+}
+
+static inline bool
+JitStart(const size_t threshold, const char* directory)
+{
+    if (threshold == 0) {
+        return true;
+    }
+    const char* compiler = getenv("CC");
+    if (compiler != NULL && compiler[0] != '\0') {
+        jitCompiler = compiler;
+    }
+    if (directory == NULL) {
+        const char* cache = getenv("XDG_CACHE_HOME");
+        if (cache != NULL && cache[0] != '\0') {
+            snprintf(jitCacheDirectory,
+                     sizeof(jitCacheDirectory),
+                     "%s/temlang-jit",
+                     cache);
+        } else {
+            snprintf(jitCacheDirectory,
+                     sizeof(jitCacheDirectory),
+                     "/tmp/temlang-jit-%ld",
+                     (long)getuid());
+        }
+    } else {
+        snprintf(
+          jitCacheDirectory, sizeof(jitCacheDirectory), "%s", directory);
+    }
+    if (mkdir(jitCacheDirectory, 0700) != 0 && errno != EEXIST) {
+        TemLangError("Failed to create JIT cache '%s': %s",
+                     jitCacheDirectory,
+                     strerror(errno));
+        return false;
+    }
+    if (!JitOwned(jitCacheDirectory, S_IFDIR, S_IRWXG | S_IRWXO)) {
+        return false;
+    }
+    jitThreshold = threshold;
+    return true;
+}
+
+static inline uint64_t
+JitHash(uint64_t hash, const char* data, const size_t size)
+{
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= (uint8_t)data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Runs the compiler with its output in the log. Returns false if it failed
+static inline bool
+JitRunCompiler(const char* source, const char* output, const char* log)
+{
+    char* const argv[] = { (char*)jitCompiler,
+                           "-O2",
+                           "-shared",
+                           "-fPIC",
+                           "-o",
+                           (char*)output,
+                           (char*)source,
+                           "-lm",
+                           NULL };
+    const pid_t pid = fork();
+    if (pid < 0) {
+        TemLangError("Failed to start C compiler: %s", strerror(errno));
+        return false;
+    }
+    if (pid == 0) {
+        const int fd =
+          open(log, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW, 0600);
+        if (fd >= 0) {
+            dup2(fd, STDOUT_FILENO);
+            dup2(fd, STDERR_FILENO);
+            close(fd);
+        }
+        execvp(jitCompiler, argv);
+        _exit(127);
+    }
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            TemLangError("Failed to wait for C compiler: %s", strerror(errno));
+            return false;
+        }
+    }
+    if (!WIFEXITED(status)) {
+        TemLangError("C compiler '%s' was stopped", jitCompiler);
+        return false;
+    }
+    switch (WEXITSTATUS(status)) {
+        case 0:
+            return true;
+        case 127:
+            // Nothing else will compile either
+            jitUnavailable = true;
+            TemLangError(
+              "Failed to run C compiler '%s'. Functions will be interpreted",
+              jitCompiler);
+            return false;
+        default:
+            TemLangError("Failed to compile '%s'. See '%s'", source, log);
+            return false;
+    }
+}
+
+// Files are created under a name only this process uses and moved into place
+// when they are complete. A file left by a process with the same id is stale
+static inline int
+JitCreate(const char* path)
+{
+    const int flags = O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW;
+    int fd = open(path, flags, 0600);
+    if (fd < 0 && errno == EEXIST && unlink(path) == 0) {
+        fd = open(path, flags, 0600);
+    }
+    if (fd < 0) {
+        TemLangError("Failed to create file %s: %s", path, strerror(errno));
+    }
+    return fd;
+}
+
+static inline bool
+JitBuild(const TemLangString* source, const uint64_t hash, const char* path)
+{
+    char sourcePath[PATH_MAX] = { 0 };
+    char tempSourcePath[PATH_MAX] = { 0 };
+    char tempPath[PATH_MAX] = { 0 };
+    char logPath[PATH_MAX] = { 0 };
+    snprintf(sourcePath,
+             sizeof(sourcePath),
+             "%s/%016" PRIx64 ".c",
+             jitCacheDirectory,
+             hash);
+    // Other processes may build the same function
+    snprintf(tempSourcePath,
+             sizeof(tempSourcePath),
+             "%s/%016" PRIx64 ".%ld.c",
+             jitCacheDirectory,
+             hash,
+             (long)getpid());
+    snprintf(tempPath,
+             sizeof(tempPath),
+             "%s/%016" PRIx64 ".%ld.so",
+             jitCacheDirectory,
+             hash,
+             (long)getpid());
+    snprintf(logPath,
+             sizeof(logPath),
+             "%s/%016" PRIx64 ".%ld.log",
+             jitCacheDirectory,
+             hash,
+             (long)getpid());
+    int fd = JitCreate(tempSourcePath);
+    if (fd < 0) {
+        return false;
+    }
+    FILE* file = fdopen(fd, "w");
+    if (file == NULL) {
+        TemLangError(
+          "Failed to open file %s: %s", tempSourcePath, strerror(errno));
+        close(fd);
+        unlink(tempSourcePath);
+        return false;
+    }
+    const bool written =
+      fwrite(source->buffer, 1, source->used, file) == source->used;
+    if (fclose(file) != 0 || !written) {
+        TemLangError("Failed to write file %s", tempSourcePath);
+        unlink(tempSourcePath);
+        return false;
+    }
+    // The compiler writes over the empty file
+    fd = JitCreate(tempPath);
+    if (fd < 0) {
+        unlink(tempSourcePath);
+        return false;
+    }
+    close(fd);
+    if (!JitRunCompiler(tempSourcePath, tempPath, logPath)) {
+        unlink(tempSourcePath);
+        unlink(tempPath);
+        return false;
+    }
+    unlink(logPath);
+    // The source is kept next to the shared object to see what was built
+    if (rename(tempSourcePath, sourcePath) != 0) {
+        unlink(tempSourcePath);
+    }
+    if (rename(tempPath, path) != 0) {
+        TemLangError("Failed to move '%s' to '%s': %s",
+                     tempPath,
+                     path,
+                     strerror(errno));
+        unlink(tempPath);
+        return false;
+    }
+    return true;
+}
+
+static inline bool
+JitLoad(JitFunction* jit, const TemLangString* source)
+{
+    uint64_t hash = JitHash(14695981039346656037ULL,
+                            jitCompiler,
+                            strlen(jitCompiler) + 1U);
+    hash = JitHash(hash, source->buffer, source->used);
+    char path[PATH_MAX] = { 0 };
+    snprintf(path,
+             sizeof(path),
+             "%s/%016" PRIx64 ".so",
+             jitCacheDirectory,
+             hash);
+    if (access(path, F_OK) != 0 && !JitBuild(source, hash, path)) {
+        return false;
+    }
+    if (!JitOwned(path, S_IFREG, S_IWGRP | S_IWOTH)) {
+        return false;
+    }
+    void* handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (handle == NULL) {
+        TemLangError("Failed to open JIT file %s; %s", path, dlerror());
+        return false;
+    }
+    JitNative native = (JitNative)dlsym(handle, JIT_SYMBOL);
+    if (native == NULL) {
+        TemLangError("Failed to find JIT function in %s; %s", path, dlerror());
+        dlclose(handle);
+        return false;
+    }
+    jit->handle = handle;
+    jit->native = native;
+    return true;
+}
+
+// Compiles a call to the function with the arguments as variables and wraps
+// it in a function that reads them from the argument pointers
+static inline bool
+JitFunctionSource(JitFunction* jit,
+                  const FunctionDefinition* f,
+                  const TemLangString* name,
+                  const Value** arguments,
+                  const int count,
+                  const State* state,
+                  const Allocator* allocator,
+                  pTemLangString source)
+{
+    static const char* names[] = { "jitArgument0", "jitArgument1" };
+    static const TemLangString resultName = { .buffer = "jitResult",
+                                              .used = 9,
+                                              .size = 10 };
+    bool result = false;
+    State compileState = { 0 };
+    compileState.atoms.allocator = allocator;
+    compileState.parent = state;
+    TemLangString call = { .allocator = allocator };
+    TemLangString body = { .allocator = allocator };
+    TokenList tokens = { .allocator = allocator };
+    InstructionList instructions = { .allocator = allocator };
+    for (int i = 0; i < count; ++i) {
+        TemLangString s = TemLangStringCreate(names[i], allocator);
+        const bool added = StateAddValue(&compileState, &s, arguments[i]);
+        TemLangStringFree(&s);
+        if (!added) {
+            goto cleanup;
+        }
+    }
+    switch (f->type) {
+        case FunctionType_Unary:
+            TemLangStringAppendFormat(
+              call, "let jitResult jitArgument0 :%s null", name->buffer);
+            break;
+        case FunctionType_Binary:
+            TemLangStringAppendFormat(call,
+                                      "let jitResult jitArgument0 :%s "
+                                      "jitArgument1",
+                                      name->buffer);
+            break;
+        default:
+            TemLangStringAppendFormat(
+              call, "let jitResult null :%s null", name->buffer);
+            break;
+    }
+    tokens = performLex(allocator, call.buffer, call.used, 1UL, "<JIT>");
+    instructions = TokensToInstructions(&tokens, allocator);
+    if (instructions.used != 1) {
+        goto cleanup;
+    }
+
+    compilerWideNumbers = true;
+    jitCompiling = true;
+    prepareCompiler();
+    const VariableTarget target = { .type = VariableTarget_None };
+    const bool compiled = CompileInstruction(
+      &compileState, &instructions.buffer[0], allocator, target, &body);
+    jitCompiling = false;
+    compilerWideNumbers = false;
+    if (!compiled) {
+        goto cleanup;
+    }
+
+    const StateFindArgs args = { .log = false, .searchParent = false };
+    const Atom* atom = StateFindAtomConst(
+      &compileState, &resultName, AtomType_Variable, args);
+    if (atom == NULL) {
+        goto cleanup;
+    }
+    jit->result = JitValueClass(&atom->variable.value);
+    if (jit->result == JitClass_None) {
+        goto cleanup;
+    }
+    if (jit->result != JitClass_Boolean) {
+        jit->resultType = atom->variable.value.rangedNumber.number.type;
+    }
+
+    TemLangStringAppendFormat((*source),
+                              "// %s\n#include <math.h>\n#include "
+                              "<stdbool.h>\n#include <stddef.h>\n#include "
+                              "<stdint.h>\ntypedef bool boolean;\n%s\nbool\n%s("
+                              "const void* const* jitArguments, void* "
+                              "jitOutput)\n{\njitOverflow = false;",
+                              name->buffer,
+                              JIT_PRELUDE,
+                              JIT_SYMBOL);
+    for (int i = 0; i < count; ++i) {
+        const char* type = JitClassTypeName(jit->parameters[i]);
+        TemLangStringAppendFormat((*source),
+                                  "\n%s %s = *(const %s*)jitArguments[%d];",
+                                  type,
+                                  names[i],
+                                  type,
+                                  i);
+    }
+    TemLangStringAppend(source, &body);
+    TemLangStringAppendFormat((*source),
+                              "\n*(%s*)jitOutput = jitResult;\nreturn "
+                              "!jitOverflow;\n}\n",
+                              JitClassTypeName(jit->result));
+    result = true;
+
+cleanup:
+    StateFree(&compileState);
+    InstructionListFree(&instructions);
+    TokenListFree(&tokens);
+    TemLangStringFree(&call);
+    TemLangStringFree(&body);
+    return result;
+}
+
+static inline JitFunction*
+JitFunctionCreate(const FunctionDefinition* f,
+                  const TemLangString* name,
+                  const Value** arguments,
+                  const int count,
+                  const State* state,
+                  const Allocator* allocator)
+{
+    const Allocator* a = f->instructions.allocator;
+    JitFunction* jit = (JitFunction*)a->allocate(sizeof(JitFunction));
+    if (jit == NULL) {
+        return NULL;
+    }
+    memset(jit, 0, sizeof(JitFunction));
+    jit->allocator = a;
+    bool supported =
+      !jitUnavailable && JitInstructionsSupported(&f->instructions);
+    for (int i = 0; supported && i < count; ++i) {
+        jit->parameters[i] = JitValueClass(arguments[i]);
+        supported = jit->parameters[i] != JitClass_None;
+    }
+    TemLangString source = { .allocator = allocator };
+    if (supported &&
+        JitFunctionSource(
+          jit, f, name, arguments, count, state, allocator, &source) &&
+        JitLoad(jit, &source)) {
+        ++jitCompiled;
+    } else {
+        ++jitNotCompiled;
+    }
+    TemLangStringFree(&source);
+    return jit;
+}
+
+static inline void
+JitFunctionUnload(JitFunction* jit)
+{
+    if (jit->handle != NULL) {
+        dlclose(jit->handle);
+    }
+    jit->handle = NULL;
+    jit->native = NULL;
+}
+
+static inline void
+JitFunctionDelete(JitFunction* jit)
+{
+    JitFunctionUnload(jit);
+    jit->allocator->free(jit);
+}
+
+static JIT_NOINLINE JitCall
+JitFunctionCall(const FunctionDefinition* f,
+                const TemLangString* name,
+                const Value* left,
+                const Value* right,
+                const State* state,
+                const Allocator* allocator,
+                pValue value)
+{
+    // Workers don't count calls since they would race on the counter
+    if (parallelWorker || jitThreshold == 0 || jitCompiling) {
+        return JitCall_Interpret;
+    }
+    const Value* arguments[2] = { NULL, NULL };
+    const int count = JitArguments(f, left, right, arguments);
+    if (count < 0) {
+        return JitCall_Interpret;
+    }
+    JitFunction* jit = f->jit;
+    if (jit == NULL) {
+        // Same as the memo cache, this is filled in on a const definition
+        FunctionDefinition* def = (FunctionDefinition*)f;
+        if (++def->calls < jitThreshold) {
+            return JitCall_Interpret;
+        }
+        jit = JitFunctionCreate(f, name, arguments, count, state, allocator);
+        if (jit == NULL) {
+            return JitCall_Interpret;
+        }
+        def->jit = jit;
+    }
+    if (jit->native == NULL) {
+        return JitCall_Interpret;
+    }
+    JitArgument storage[2] = { 0 };
+    const void* pointers[2] = { &storage[0], &storage[1] };
+    for (int i = 0; i < count; ++i) {
+        const Value* v = arguments[i];
+        switch (JitValueClass(v)) {
+            case JitClass_Integer:
+                if (jit->parameters[i] != JitClass_Integer) {
+                    return JitCall_Interpret;
+                }
+                storage[i].i = NumberToInt(&v->rangedNumber.number);
+                break;
+            case JitClass_Float:
+                if (jit->parameters[i] != JitClass_Float) {
+                    return JitCall_Interpret;
+                }
+                storage[i].d = v->rangedNumber.number.d;
+                break;
+            case JitClass_Boolean:
+                if (jit->parameters[i] != JitClass_Boolean) {
+                    return JitCall_Interpret;
+                }
+                storage[i].b = v->b;
+                break;
+            default:
+                return JitCall_Interpret;
+        }
+    }
+    JitArgument output = { 0 };
+    if (!jit->native(pointers, &output)) {
+        ++jitOverflowed;
+        return JitCall_Interpret;
+    }
+    ValueFree(value);
+    switch (jit->result) {
+        case JitClass_Integer:
+            value->type = ValueType_Number;
+            if (jit->resultType == NumberType_Unsigned && output.i >= 0) {
+                value->rangedNumber.number =
+                  NumberFromUInt((uint64_t)output.i);
+            } else {
+                value->rangedNumber.number = NumberFromInt(output.i);
+            }
+            break;
+        case JitClass_Float:
+            value->type = ValueType_Number;
+            value->rangedNumber.number = NumberFromDouble(output.d);
+            break;
+        default:
+            value->type = ValueType_Boolean;
+            value->b = output.b;
+            break;
+    }
+    if (jit->verified < JIT_VERIFY_CALLS) {
+        return JitCall_Verify;
+    }
+    ++jitNativeCalls;
+    return JitCall_Native;
+}
+
+static JIT_NOINLINE void
+JitFunctionVerify(const FunctionDefinition* f,
+                  const Value* native,
+                  const Value* value)
+{
+    JitFunction* jit = f->jit;
+    if (jit->native == NULL) {
+        return;
+    }
+    if (JitValuesEqual(native, value)) {
+        ++jit->verified;
+        return;
+    }
+    // The C backend picked types that don't hold what the interpreter does
+    JitFunctionUnload(jit);
+    ++jitRejected;
+}
+
+#else
+
+static inline bool
+JitStart(const size_t threshold, const char* directory)
+{
+    (void)directory;
+    if (threshold != 0) {
+        TemLangError("The JIT needs fork and dlopen");
+        return false;
+    }
+    return true;
+}
+
+static inline void
+JitFunctionDelete(JitFunction* jit)
+{
+    (void)jit;
+}
+
+static JitCall
+JitFunctionCall(const FunctionDefinition* f,
+                const TemLangString* name,
+                const Value* left,
+                const Value* right,
+                const State* state,
+                const Allocator* allocator,
+                pValue value)
+{
+    (void)f;
+    (void)name;
+    (void)left;
+    (void)right;
+    (void)state;
+    (void)allocator;
+    (void)value;
+    return JitCall_Interpret;
+}
+
+static void
+JitFunctionVerify(const FunctionDefinition* f,
+                  const Value* native,
+                  const Value* value)
+{
+    (void)f;
+    (void)native;
+    (void)value;
+}
+
+#endif
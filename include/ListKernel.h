@@ -0,0 +1,467 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Kernels over a packed list buffer. The interpreter calls them on packed
+// lists and compiled programs call them on list buffers and arrays. Integer
+// sums wrap like the add operator. Floats are equal when neither is less than
+// the other, the same as NumberCompare, so NaN is equal to everything. Float
+// sums are added in order so they round the same as a loop over the list.
+// Min and max return the index of the first smallest/largest element and
+// need at least one element.
+
+#define LIST_KERNEL_INT_ADD(S, a, b) (S)((uint64_t)(a) + (uint64_t)(b))
+#define LIST_KERNEL_FLOAT_ADD(S, a, b) ((a) + (b))
+#define LIST_KERNEL_INT_EQUAL(a, b) ((a) == (b))
+#define LIST_KERNEL_FLOAT_EQUAL(a, b) (!((a) < (b)) && !((a) > (b)))
+
+#define LIST_KERNEL_SCALAR(C, T, S, ADD, EQUAL)                                \
+    static inline S ListKernelSumFrom_##C(                                     \
+      const T* p, size_t i, const size_t n, S sum)                             \
+    {                                                                          \
+        for (; i < n; ++i) {                                                   \
+            sum = ADD(S, sum, p[i]);                                           \
+        }                                                                      \
+        return sum;                                                            \
+    }                                                                          \
+    static inline size_t ListKernelMinFrom_##C(                                \
+      const T* p, size_t i, const size_t n, size_t best)                       \
+    {                                                                          \
+        for (; i < n; ++i) {                                                   \
+            if (p[i] < p[best]) {                                              \
+                best = i;                                                      \
+            }                                                                  \
+        }                                                                      \
+        return best;                                                           \
+    }                                                                          \
+    static inline size_t ListKernelMaxFrom_##C(                                \
+      const T* p, size_t i, const size_t n, size_t best)                       \
+    {                                                                          \
+        for (; i < n; ++i) {                                                   \
+            if (p[i] > p[best]) {                                              \
+                best = i;                                                      \
+            }                                                                  \
+        }                                                                      \
+        return best;                                                           \
+    }                                                                          \
+    static inline size_t ListKernelIndexOfFrom_##C(                            \
+      const T* p, size_t i, const size_t n, const T value)                     \
+    {                                                                          \
+        for (; i < n; ++i) {                                                   \
+            if (EQUAL(p[i], value)) {                                          \
+                return i;                                                      \
+            }                                                                  \
+        }                                                                      \
+        return n;                                                              \
+    }                                                                          \
+    static inline size_t ListKernelCountEqualFrom_##C(                         \
+      const T* p, size_t i, const size_t n, const T value, size_t count)       \
+    {                                                                          \
+        for (; i < n; ++i) {                                                   \
+            count += EQUAL(p[i], value);                                       \
+        }                                                                      \
+        return count;                                                          \
+    }                                                                          \
+    static inline void ListKernelReverse_##C(T* p, const size_t n)             \
+    {                                                                          \
+        for (size_t i = 0, j = n; i + 1 < j; ++i) {                            \
+            --j;                                                               \
+            const T t = p[i];                                                  \
+            p[i] = p[j];                                                       \
+            p[j] = t;                                                          \
+        }                                                                      \
+    }                                                                          \
+    static inline void ListKernelFill_##C(T* p, const size_t n, const T value) \
+    {                                                                          \
+        for (size_t i = 0; i < n; ++i) {                                       \
+            p[i] = value;                                                      \
+        }                                                                      \
+    }
+
+#define LIST_KERNEL_INTEGER(C, T, S)                                           \
+    LIST_KERNEL_SCALAR(C, T, S, LIST_KERNEL_INT_ADD, LIST_KERNEL_INT_EQUAL)
+#define LIST_KERNEL_FLOAT(C, T)                                                \
+    LIST_KERNEL_SCALAR(                                                        \
+      C, T, double, LIST_KERNEL_FLOAT_ADD, LIST_KERNEL_FLOAT_EQUAL)
+
+// Entry points for types without a vectorized kernel
+#define LIST_KERNEL_PLAIN(C, T, S)                                             \
+    static inline S ListKernelSum_##C(const T* p, const size_t n)              \
+    {                                                                          \
+        return ListKernelSumFrom_##C(p, 0, n, 0);                              \
+    }                                                                          \
+    static inline size_t ListKernelMin_##C(const T* p, const size_t n)         \
+    {                                                                          \
+        return ListKernelMinFrom_##C(p, 1, n, 0);                              \
+    }                                                                          \
+    static inline size_t ListKernelMax_##C(const T* p, const size_t n)         \
+    {                                                                          \
+        return ListKernelMaxFrom_##C(p, 1, n, 0);                              \
+    }                                                                          \
+    static inline size_t ListKernelIndexOf_##C(                                \
+      const T* p, const size_t n, const T value)                               \
+    {                                                                          \
+        return ListKernelIndexOfFrom_##C(p, 0, n, value);                      \
+    }                                                                          \
+    static inline size_t ListKernelCountEqual_##C(                             \
+      const T* p, const size_t n, const T value)                               \
+    {                                                                          \
+        return ListKernelCountEqualFrom_##C(p, 0, n, value, 0);                \
+    }
+
+LIST_KERNEL_INTEGER(u8, uint8_t, uint64_t)
+LIST_KERNEL_INTEGER(u16, uint16_t, uint64_t)
+LIST_KERNEL_INTEGER(u32, uint32_t, uint64_t)
+LIST_KERNEL_INTEGER(u64, uint64_t, uint64_t)
+LIST_KERNEL_INTEGER(i8, int8_t, int64_t)
+LIST_KERNEL_INTEGER(i16, int16_t, int64_t)
+LIST_KERNEL_INTEGER(i32, int32_t, int64_t)
+LIST_KERNEL_INTEGER(i64, int64_t, int64_t)
+LIST_KERNEL_FLOAT(f32, float)
+LIST_KERNEL_FLOAT(f64, double)
+
+LIST_KERNEL_PLAIN(u16, uint16_t, uint64_t)
+LIST_KERNEL_PLAIN(u32, uint32_t, uint64_t)
+LIST_KERNEL_PLAIN(u64, uint64_t, uint64_t)
+LIST_KERNEL_PLAIN(i8, int8_t, int64_t)
+LIST_KERNEL_PLAIN(i16, int16_t, int64_t)
+LIST_KERNEL_PLAIN(i64, int64_t, int64_t)
+LIST_KERNEL_PLAIN(f32, float, double)
+
+static inline uint64_t
+ListKernelSum_u8(const uint8_t* p, const size_t n)
+{
+    size_t i = 0;
+    uint64_t sum = 0;
+#if defined(__SSE2__)
+    // Sum of absolute differences against zero adds 8 bytes into each lane
+    __m128i acc = _mm_setzero_si128();
+    for (const size_t end = n - n % 16; i < end; i += 16) {
+        const __m128i x = _mm_loadu_si128((const __m128i*)(p + i));
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(x, _mm_setzero_si128()));
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, acc);
+    sum = lanes[0] + lanes[1];
+#endif
+    return ListKernelSumFrom_u8(p, i, n, sum);
+}
+
+static inline size_t
+ListKernelMin_u8(const uint8_t* p, const size_t n)
+{
+    return ListKernelMinFrom_u8(p, 1, n, 0);
+}
+
+static inline size_t
+ListKernelMax_u8(const uint8_t* p, const size_t n)
+{
+    return ListKernelMaxFrom_u8(p, 1, n, 0);
+}
+
+static inline size_t
+ListKernelIndexOf_u8(const uint8_t* p, const size_t n, const uint8_t value)
+{
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256i v = _mm256_set1_epi8((char)value);
+    for (const size_t end = n - n % 32; i < end; i += 32) {
+        const __m256i x = _mm256_loadu_si256((const __m256i*)(p + i));
+        const uint32_t mask =
+          (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, v));
+        if (mask != 0) {
+            return i + (size_t)__builtin_ctz(mask);
+        }
+    }
+#elif defined(__SSE2__)
+    const __m128i v = _mm_set1_epi8((char)value);
+    for (const size_t end = n - n % 16; i < end; i += 16) {
+        const __m128i x = _mm_loadu_si128((const __m128i*)(p + i));
+        const uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(x, v));
+        if (mask != 0) {
+            return i + (size_t)__builtin_ctz(mask);
+        }
+    }
+#endif
+    return ListKernelIndexOfFrom_u8(p, i, n, value);
+}
+
+static inline size_t
+ListKernelCountEqual_u8(const uint8_t* p, const size_t n, const uint8_t value)
+{
+    size_t i = 0;
+    size_t count = 0;
+#if defined(__AVX2__)
+    const __m256i v = _mm256_set1_epi8((char)value);
+    for (const size_t end = n - n % 32; i < end; i += 32) {
+        const __m256i x = _mm256_loadu_si256((const __m256i*)(p + i));
+        count += (size_t)__builtin_popcount(
+          (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, v)));
+    }
+#elif defined(__SSE2__)
+    const __m128i v = _mm_set1_epi8((char)value);
+    for (const size_t end = n - n % 16; i < end; i += 16) {
+        const __m128i x = _mm_loadu_si128((const __m128i*)(p + i));
+        count += (size_t)__builtin_popcount(
+          (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(x, v)));
+    }
+#endif
+    return ListKernelCountEqualFrom_u8(p, i, n, value, count);
+}
+
+static inline int64_t
+ListKernelSum_i32(const int32_t* p, const size_t n)
+{
+    size_t i = 0;
+    int64_t sum = 0;
+#if defined(__AVX2__)
+    __m256i acc = _mm256_setzero_si256();
+    for (const size_t end = n - n % 8; i < end; i += 8) {
+        const __m256i x = _mm256_loadu_si256((const __m256i*)(p + i));
+        acc = _mm256_add_epi64(
+          acc, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(x)));
+        acc = _mm256_add_epi64(
+          acc, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(x, 1)));
+    }
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, acc);
+    sum = (int64_t)(lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+#elif defined(__SSE2__)
+    __m128i acc = _mm_setzero_si128();
+    for (const size_t end = n - n % 4; i < end; i += 4) {
+        const __m128i x = _mm_loadu_si128((const __m128i*)(p + i));
+        const __m128i sign = _mm_srai_epi32(x, 31);
+        acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(x, sign));
+        acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(x, sign));
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, acc);
+    sum = (int64_t)(lanes[0] + lanes[1]);
+#endif
+    return ListKernelSumFrom_i32(p, i, n, sum);
+}
+
+static inline size_t
+ListKernelIndexOf_i32(const int32_t* p, const size_t n, const int32_t value)
+{
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256i v = _mm256_set1_epi32(value);
+    for (const size_t end = n - n % 8; i < end; i += 8) {
+        const __m256i x = _mm256_loadu_si256((const __m256i*)(p + i));
+        const uint32_t mask = (uint32_t)_mm256_movemask_ps(
+          _mm256_castsi256_ps(_mm256_cmpeq_epi32(x, v)));
+        if (mask != 0) {
+            return i + (size_t)__builtin_ctz(mask);
+        }
+    }
+#elif defined(__SSE2__)
+    const __m128i v = _mm_set1_epi32(value);
+    for (const size_t end = n - n % 4; i < end; i += 4) {
+        const __m128i x = _mm_loadu_si128((const __m128i*)(p + i));
+        const uint32_t mask = (uint32_t)_mm_movemask_ps(
+          _mm_castsi128_ps(_mm_cmpeq_epi32(x, v)));
+        if (mask != 0) {
+            return i + (size_t)__builtin_ctz(mask);
+        }
+    }
+#endif
+    return ListKernelIndexOfFrom_i32(p, i, n, value);
+}
+
+static inline size_t
+ListKernelCountEqual_i32(const int32_t* p, const size_t n, const int32_t value)
+{
+    size_t i = 0;
+    size_t count = 0;
+#if defined(__AVX2__)
+    const __m256i v = _mm256_set1_epi32(value);
+    for (const size_t end = n - n % 8; i < end; i += 8) {
+        const __m256i x = _mm256_loadu_si256((const __m256i*)(p + i));
+        count += (size_t)__builtin_popcount((uint32_t)_mm256_movemask_ps(
+          _mm256_castsi256_ps(_mm256_cmpeq_epi32(x, v))));
+    }
+#elif defined(__SSE2__)
+    const __m128i v = _mm_set1_epi32(value);
+    for (const size_t end = n - n % 4; i < end; i += 4) {
+        const __m128i x = _mm_loadu_si128((const __m128i*)(p + i));
+        count += (size_t)__builtin_popcount((uint32_t)_mm_movemask_ps(
+          _mm_castsi128_ps(_mm_cmpeq_epi32(x, v))));
+    }
+#endif
+    return ListKernelCountEqualFrom_i32(p, i, n, value, count);
+}
+
+// The vector loop finds the smallest/largest value. The first element equal
+// to it is the one a scalar loop would pick.
+#define LIST_KERNEL_EXTREME_I32(Name, OP, AVX2_OP, SSE2_CMP)                   \
+    static inline size_t ListKernel##Name##_i32(const int32_t* p,              \
+                                                const size_t n)                \
+    {                                                                          \
+        size_t i = 0;                                                          \
+        int32_t best = p[0];                                                   \
+        LIST_KERNEL_EXTREME_I32_LOOP(OP, AVX2_OP, SSE2_CMP)                    \
+        for (; i < n; ++i) {                                                   \
+            if (p[i] OP best) {                                                \
+                best = p[i];                                                   \
+            }                                                                  \
+        }                                                                      \
+        return ListKernelIndexOf_i32(p, n, best);                              \
+    }
+
+#if defined(__AVX2__)
+#define LIST_KERNEL_EXTREME_I32_LOOP(OP, AVX2_OP, SSE2_CMP)                    \
+    __m256i m = _mm256_set1_epi32(best);                                       \
+    for (const size_t end = n - n % 8; i < end; i += 8) {                      \
+        m = AVX2_OP(m, _mm256_loadu_si256((const __m256i*)(p + i)));           \
+    }                                                                          \
+    int32_t lanes[8];                                                          \
+    _mm256_storeu_si256((__m256i*)lanes, m);                                   \
+    for (size_t j = 0; j < 8; ++j) {                                           \
+        if (lanes[j] OP best) {                                                \
+            best = lanes[j];                                                   \
+        }                                                                      \
+    }
+#elif defined(__SSE2__)
+// SSE2 has no 32 bit min/max so select with a compare mask
+#define LIST_KERNEL_EXTREME_I32_LOOP(OP, AVX2_OP, SSE2_CMP)                    \
+    __m128i m = _mm_set1_epi32(best);                                          \
+    for (const size_t end = n - n % 4; i < end; i += 4) {                      \
+        const __m128i x = _mm_loadu_si128((const __m128i*)(p + i));            \
+        const __m128i mask = SSE2_CMP(x, m);                                   \
+        m = _mm_or_si128(_mm_and_si128(mask, x), _mm_andnot_si128(mask, m));   \
+    }                                                                          \
+    int32_t lanes[4];                                                          \
+    _mm_storeu_si128((__m128i*)lanes, m);                                      \
+    for (size_t j = 0; j < 4; ++j) {                                           \
+        if (lanes[j] OP best) {                                                \
+            best = lanes[j];                                                   \
+        }                                                                      \
+    }
+#else
+#define LIST_KERNEL_EXTREME_I32_LOOP(OP, AVX2_OP, SSE2_CMP)
+#endif
+
+LIST_KERNEL_EXTREME_I32(Min, <, _mm256_min_epi32, _mm_cmplt_epi32)
+LIST_KERNEL_EXTREME_I32(Max, >, _mm256_max_epi32, _mm_cmpgt_epi32)
+
+static inline double
+ListKernelSum_f64(const double* p, const size_t n)
+{
+    return ListKernelSumFrom_f64(p, 0, n, 0);
+}
+
+static inline size_t
+ListKernelIndexOf_f64(const double* p, const size_t n, const double value)
+{
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256d v = _mm256_set1_pd(value);
+    for (const size_t end = n - n % 4; i < end; i += 4) {
+        const __m256d x = _mm256_loadu_pd(p + i);
+        const uint32_t mask =
+          (uint32_t)_mm256_movemask_pd(_mm256_cmp_pd(x, v, _CMP_EQ_UQ));
+        if (mask != 0) {
+            return i + (size_t)__builtin_ctz(mask);
+        }
+    }
+#elif defined(__SSE2__)
+    const __m128d v = _mm_set1_pd(value);
+    for (const size_t end = n - n % 2; i < end; i += 2) {
+        const __m128d x = _mm_loadu_pd(p + i);
+        const uint32_t mask = (uint32_t)_mm_movemask_pd(
+          _mm_or_pd(_mm_cmpeq_pd(x, v), _mm_cmpunord_pd(x, v)));
+        if (mask != 0) {
+            return i + (size_t)__builtin_ctz(mask);
+        }
+    }
+#endif
+    return ListKernelIndexOfFrom_f64(p, i, n, value);
+}
+
+static inline size_t
+ListKernelCountEqual_f64(const double* p, const size_t n, const double value)
+{
+    size_t i = 0;
+    size_t count = 0;
+#if defined(__AVX2__)
+    const __m256d v = _mm256_set1_pd(value);
+    for (const size_t end = n - n % 4; i < end; i += 4) {
+        const __m256d x = _mm256_loadu_pd(p + i);
+        count += (size_t)__builtin_popcount(
+          (uint32_t)_mm256_movemask_pd(_mm256_cmp_pd(x, v, _CMP_EQ_UQ)));
+    }
+#elif defined(__SSE2__)
+    const __m128d v = _mm_set1_pd(value);
+    for (const size_t end = n - n % 2; i < end; i += 2) {
+        const __m128d x = _mm_loadu_pd(p + i);
+        count += (size_t)__builtin_popcount((uint32_t)_mm_movemask_pd(
+          _mm_or_pd(_mm_cmpeq_pd(x, v), _mm_cmpunord_pd(x, v))));
+    }
+#endif
+    return ListKernelCountEqualFrom_f64(p, i, n, value, count);
+}
+
+// min_pd/max_pd return the second operand unless the first is strictly
+// smaller/larger, which is the scalar comparison. NaN elements are skipped
+// unless the first element is NaN, in which case the whole list is.
+#define LIST_KERNEL_EXTREME_F64(Name, OP, AVX2_OP, SSE2_OP)                    \
+    static inline size_t ListKernel##Name##_f64(const double* p,               \
+                                                const size_t n)                \
+    {                                                                          \
+        size_t i = 0;                                                          \
+        double best = p[0];                                                    \
+        LIST_KERNEL_EXTREME_F64_LOOP(OP, AVX2_OP, SSE2_OP)                     \
+        for (; i < n; ++i) {                                                   \
+            if (p[i] OP best) {                                                \
+                best = p[i];                                                   \
+            }                                                                  \
+        }                                                                      \
+        for (i = 0; i < n; ++i) {                                              \
+            if (p[i] == best) {                                                \
+                return i;                                                      \
+            }                                                                  \
+        }                                                                      \
+        return 0;                                                              \
+    }
+
+#if defined(__AVX2__)
+#define LIST_KERNEL_EXTREME_F64_LOOP(OP, AVX2_OP, SSE2_OP)                     \
+    __m256d m = _mm256_set1_pd(best);                                          \
+    for (const size_t end = n - n % 4; i < end; i += 4) {                      \
+        m = AVX2_OP(_mm256_loadu_pd(p + i), m);                                \
+    }                                                                          \
+    double lanes[4];                                                           \
+    _mm256_storeu_pd(lanes, m);                                                \
+    for (size_t j = 0; j < 4; ++j) {                                           \
+        if (lanes[j] OP best) {                                                \
+            best = lanes[j];                                                   \
+        }                                                                      \
+    }
+#elif defined(__SSE2__)
+#define LIST_KERNEL_EXTREME_F64_LOOP(OP, AVX2_OP, SSE2_OP)                     \
+    __m128d m = _mm_set1_pd(best);                                             \
+    for (const size_t end = n - n % 2; i < end; i += 2) {                      \
+        m = SSE2_OP(_mm_loadu_pd(p + i), m);                                   \
+    }                                                                          \
+    double lanes[2];                                                           \
+    _mm_storeu_pd(lanes, m);                                                   \
+    for (size_t j = 0; j < 2; ++j) {                                           \
+        if (lanes[j] OP best) {                                                \
+            best = lanes[j];                                                   \
+        }                                                                      \
+    }
+#else
+#define LIST_KERNEL_EXTREME_F64_LOOP(OP, AVX2_OP, SSE2_OP)
+#endif
+
+LIST_KERNEL_EXTREME_F64(Min, <, _mm256_min_pd, _mm_min_pd)
+LIST_KERNEL_EXTREME_F64(Max, >, _mm256_max_pd, _mm_max_pd)
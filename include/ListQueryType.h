@@ -0,0 +1,134 @@
+
+#pragma once
+#include <ctype.h>
+#include <memory.h>
+#include <stddef.h>
+
+typedef enum ListQueryType
+{
+    ListQueryType_Invalid = -1,
+    ListQueryType_Sum,
+    ListQueryType_Min,
+    ListQueryType_Max,
+    ListQueryType_Contains,
+    ListQueryType_IndexOf,
+    ListQueryType_CountEqual,
+    ListQueryType_Reverse,
+    ListQueryType_Fill
+} ListQueryType,
+  *pListQueryType;
+
+#define ListQueryTypeCount 8
+#define ListQueryTypeLongestString 10
+
+static const ListQueryType ListQueryTypeMembers[] = {
+    ListQueryType_Sum,      ListQueryType_Min,     ListQueryType_Max,
+    ListQueryType_Contains, ListQueryType_IndexOf, ListQueryType_CountEqual,
+    ListQueryType_Reverse,  ListQueryType_Fill
+};
+
+static inline ListQueryType
+ListQueryTypeFromIndex(size_t index)
+{
+    if (index >= ListQueryTypeCount) {
+        return ListQueryType_Invalid;
+    }
+    return ListQueryTypeMembers[index];
+}
+static inline ListQueryType
+ListQueryTypeFromString(const void* c, const size_t size)
+{
+    if (size > ListQueryTypeLongestString) {
+        return ListQueryType_Invalid;
+    }
+    if (size == 3 && memcmp("Sum", c, 3) == 0) {
+        return ListQueryType_Sum;
+    }
+    if (size == 3 && memcmp("Min", c, 3) == 0) {
+        return ListQueryType_Min;
+    }
+    if (size == 3 && memcmp("Max", c, 3) == 0) {
+        return ListQueryType_Max;
+    }
+    if (size == 8 && memcmp("Contains", c, 8) == 0) {
+        return ListQueryType_Contains;
+    }
+    if (size == 7 && memcmp("IndexOf", c, 7) == 0) {
+        return ListQueryType_IndexOf;
+    }
+    if (size == 10 && memcmp("CountEqual", c, 10) == 0) {
+        return ListQueryType_CountEqual;
+    }
+    if (size == 7 && memcmp("Reverse", c, 7) == 0) {
+        return ListQueryType_Reverse;
+    }
+    if (size == 4 && memcmp("Fill", c, 4) == 0) {
+        return ListQueryType_Fill;
+    }
+    return ListQueryType_Invalid;
+}
+static inline ListQueryType
+ListQueryTypeFromCaseInsensitiveString(const char* original, const size_t size)
+{
+    if (size > ListQueryTypeLongestString) {
+        return ListQueryType_Invalid;
+    }
+    char c[ListQueryTypeLongestString] = { 0 };
+    for (size_t i = 0; i < size; ++i) {
+        c[i] = tolower(original[i]);
+    }
+    if (size == 3 && memcmp("sum", c, 3) == 0) {
+        return ListQueryType_Sum;
+    }
+    if (size == 3 && memcmp("min", c, 3) == 0) {
+        return ListQueryType_Min;
+    }
+    if (size == 3 && memcmp("max", c, 3) == 0) {
+        return ListQueryType_Max;
+    }
+    if (size == 8 && memcmp("contains", c, 8) == 0) {
+        return ListQueryType_Contains;
+    }
+    if (size == 7 && memcmp("indexof", c, 7) == 0) {
+        return ListQueryType_IndexOf;
+    }
+    if (size == 10 && memcmp("countequal", c, 10) == 0) {
+        return ListQueryType_CountEqual;
+    }
+    if (size == 7 && memcmp("reverse", c, 7) == 0) {
+        return ListQueryType_Reverse;
+    }
+    if (size == 4 && memcmp("fill", c, 4) == 0) {
+        return ListQueryType_Fill;
+    }
+    return ListQueryType_Invalid;
+}
+static inline const char*
+ListQueryTypeToString(const ListQueryType e)
+{
+    if (e == ListQueryType_Sum) {
+        return "Sum";
+    }
+    if (e == ListQueryType_Min) {
+        return "Min";
+    }
+    if (e == ListQueryType_Max) {
+        return "Max";
+    }
+    if (e == ListQueryType_Contains) {
+        return "Contains";
+    }
+    if (e == ListQueryType_IndexOf) {
+        return "IndexOf";
+    }
+    if (e == ListQueryType_CountEqual) {
+        return "CountEqual";
+    }
+    if (e == ListQueryType_Reverse) {
+        return "Reverse";
+    }
+    if (e == ListQueryType_Fill) {
+        return "Fill";
+    }
+    return "Invalid";
+}
\ No newline at end of file
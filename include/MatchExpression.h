@@ -47,6 +47,8 @@ typedef struct MatchExpression
     TemLangStringList captures;
     MatchBranchList branches;
     Branch defaultBranch;
+    // Built the first time the expression is evaluated
+    struct MatchTable* table;
 } MatchExpression, *pMatchExpression;
 
 static inline void
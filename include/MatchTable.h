@@ -0,0 +1,351 @@
+#pragma once
+
+#include "MatchExpression.h"
+
+// Lookup tables for the branches of a match expression. Literal matchers are
+// indexed so a value finds its branch without testing every branch. Branches
+// with other matchers are still evaluated in order but only the ones before
+// the literal branch that matched.
+
+// Largest number of slots for a dense table of integer matchers
+#define MATCH_TABLE_DENSE_LIMIT 4096U
+
+typedef enum MatchLookup
+{
+    // The table found the branch. Matchers listed in dynamic still have to be
+    // tested if they come before it
+    MatchLookup_Branch,
+    // The table can't be used for the value. Test every branch in order
+    MatchLookup_Linear
+} MatchLookup,
+  *pMatchLookup;
+
+typedef struct MatchNumber
+{
+    Number number;
+    uint32_t branch;
+} MatchNumber, *pMatchNumber;
+
+typedef struct MatchTable
+{
+    // Open addressing tables of branch indices plus one. Zero means empty.
+    // Strings holds string literal matchers and names holds variable matchers
+    // (for variants).
+    uint32_t* strings;
+    uint32_t* names;
+    uint32_t slots;
+    // Number literal matchers. Either sorted by value or, when they are close
+    // together, a table indexed by value - denseMin
+    MatchNumber* numbers;
+    uint32_t numberCount;
+    uint32_t* dense;
+    int64_t denseMin;
+    uint32_t denseSize;
+    NumberType numberType;
+    // False if the number matchers have different types or are NaN
+    bool numbersUsable;
+    // True if every matcher is a variable
+    bool allNames;
+    // Indices of branches whose matchers must be evaluated. In branch order
+    uint32_t* dynamic;
+    uint32_t dynamicCount;
+    const Allocator* allocator;
+} MatchTable, *pMatchTable;
+
+static inline void
+MatchTableDelete(MatchTable* t)
+{
+    const Allocator* allocator = t->allocator;
+    if (t->strings != NULL) {
+        allocator->free(t->strings);
+    }
+    if (t->names != NULL) {
+        allocator->free(t->names);
+    }
+    if (t->numbers != NULL) {
+        allocator->free(t->numbers);
+    }
+    if (t->dense != NULL) {
+        allocator->free(t->dense);
+    }
+    if (t->dynamic != NULL) {
+        allocator->free(t->dynamic);
+    }
+    allocator->free(t);
+}
+
+static inline const TemLangString*
+MatchTableKey(const MatchExpression* m,
+              const uint32_t branch,
+              const bool isName)
+{
+    const Expression* e = &m->branches.buffer[branch].matcher;
+    return isName ? &e->identifier : &e->value.string;
+}
+
+static inline uint32_t
+MatchTableFindString(const MatchTable* t,
+                     const MatchExpression* m,
+                     const uint32_t* slots,
+                     const bool isName,
+                     const TemLangString* s)
+{
+    const uint32_t mask = t->slots - 1U;
+    for (uint32_t i = TemLangStringHash(s) & mask; slots[i] != 0;
+         i = (i + 1U) & mask) {
+        const TemLangString* key = MatchTableKey(m, slots[i] - 1U, isName);
+        if (TemLangStringCompare(key, s) == ComparisonOperator_EqualTo) {
+            return slots[i] - 1U;
+        }
+    }
+    return m->branches.used;
+}
+
+static inline void
+MatchTableAddString(MatchTable* t,
+                    const MatchExpression* m,
+                    uint32_t* slots,
+                    const bool isName,
+                    const uint32_t branch)
+{
+    const TemLangString* s = MatchTableKey(m, branch, isName);
+    const uint32_t mask = t->slots - 1U;
+    uint32_t i = TemLangStringHash(s) & mask;
+    for (; slots[i] != 0; i = (i + 1U) & mask) {
+        // Only the first branch with a matcher can ever run
+        const TemLangString* key = MatchTableKey(m, slots[i] - 1U, isName);
+        if (TemLangStringCompare(key, s) == ComparisonOperator_EqualTo) {
+            return;
+        }
+    }
+    slots[i] = branch + 1U;
+}
+
+static inline int
+MatchNumberCompare(const MatchNumber* a, const MatchNumber* b)
+{
+    switch (NumberCompare(&a->number, &b->number)) {
+        case ComparisonOperator_LessThan:
+            return -1;
+        case ComparisonOperator_GreaterThan:
+            return 1;
+        default:
+            return a->branch < b->branch ? -1 : (a->branch > b->branch);
+    }
+}
+
+static inline bool
+NumberIsNaN(const Number* n)
+{
+    return n->type == NumberType_Float && n->d != n->d;
+}
+
+static inline bool
+MatchTableBuildNumbers(MatchTable* t)
+{
+    if (t->numberCount == 0 || !t->numbersUsable) {
+        return true;
+    }
+    qsort(t->numbers,
+          t->numberCount,
+          sizeof(MatchNumber),
+          (int (*)(const void*, const void*))MatchNumberCompare);
+    // Keep the first branch of each value
+    uint32_t used = 1;
+    for (uint32_t i = 1; i < t->numberCount; ++i) {
+        if (NumberCompare(&t->numbers[i].number,
+                          &t->numbers[used - 1U].number) !=
+            ComparisonOperator_EqualTo) {
+            t->numbers[used++] = t->numbers[i];
+        }
+    }
+    t->numberCount = used;
+    if (t->numberType == NumberType_Float) {
+        return true;
+    }
+    const int64_t min = NumberToInt(&t->numbers[0].number);
+    const int64_t max = NumberToInt(&t->numbers[used - 1U].number);
+    if (t->numberType == NumberType_Unsigned &&
+        t->numbers[used - 1U].number.u > INT64_MAX) {
+        return true;
+    }
+    const uint64_t span = (uint64_t)max - (uint64_t)min + 1U;
+    if (span > MATCH_TABLE_DENSE_LIMIT || span > (uint64_t)used * 4U) {
+        return true;
+    }
+    t->denseMin = min;
+    t->denseSize = (uint32_t)span;
+    t->dense = t->allocator->allocate(sizeof(uint32_t) * span);
+    if (t->dense == NULL) {
+        return false;
+    }
+    memset(t->dense, 0, sizeof(uint32_t) * span);
+    for (uint32_t i = 0; i < used; ++i) {
+        const int64_t n = NumberToInt(&t->numbers[i].number);
+        t->dense[n - min] = t->numbers[i].branch + 1U;
+    }
+    return true;
+}
+
+static inline MatchTable*
+MatchTableCreate(const MatchExpression* m, const Allocator* allocator)
+{
+    const uint32_t count = m->branches.used;
+    MatchTable* t = allocator->allocate(sizeof(MatchTable));
+    if (t == NULL) {
+        return NULL;
+    }
+    memset(t, 0, sizeof(MatchTable));
+    t->allocator = allocator;
+    t->numbersUsable = true;
+    t->allNames = true;
+    t->slots = 16U;
+    while (t->slots < count * 2U) {
+        t->slots *= 2U;
+    }
+    t->strings = allocator->allocate(sizeof(uint32_t) * t->slots);
+    t->names = allocator->allocate(sizeof(uint32_t) * t->slots);
+    t->numbers = allocator->allocate(sizeof(MatchNumber) * (count + 1U));
+    t->dynamic = allocator->allocate(sizeof(uint32_t) * (count + 1U));
+    if (t->strings == NULL || t->names == NULL || t->numbers == NULL ||
+        t->dynamic == NULL) {
+        goto failed;
+    }
+    memset(t->strings, 0, sizeof(uint32_t) * t->slots);
+    memset(t->names, 0, sizeof(uint32_t) * t->slots);
+    for (uint32_t i = 0; i < count; ++i) {
+        const Expression* e = &m->branches.buffer[i].matcher;
+        if (e->type == ExpressionType_UnaryVariable) {
+            MatchTableAddString(t, m, t->names, true, i);
+        } else {
+            t->allNames = false;
+        }
+        switch (e->type) {
+            case ExpressionType_Nullary:
+                // Only matches null
+                continue;
+            case ExpressionType_UnaryValue:
+                break;
+            default:
+                t->dynamic[t->dynamicCount++] = i;
+                continue;
+        }
+        switch (e->value.type) {
+            case ValueType_String:
+                MatchTableAddString(t, m, t->strings, false, i);
+                break;
+            case ValueType_Number: {
+                const Number* n = &e->value.rangedNumber.number;
+                if (t->numberCount == 0) {
+                    t->numberType = n->type;
+                } else if (t->numberType != n->type) {
+                    t->numbersUsable = false;
+                }
+                if (NumberIsNaN(n)) {
+                    t->numbersUsable = false;
+                }
+                t->numbers[t->numberCount].number = *n;
+                t->numbers[t->numberCount].branch = i;
+                ++t->numberCount;
+            } break;
+            default:
+                // Enum literals can match strings so anything other than
+                // strings and numbers is evaluated
+                t->dynamic[t->dynamicCount++] = i;
+                break;
+        }
+    }
+    if (MatchTableBuildNumbers(t)) {
+        return t;
+    }
+failed:
+    MatchTableDelete(t);
+    return NULL;
+}
+
+static inline uint32_t
+MatchTableFindNumber(const MatchTable* t,
+                     const MatchExpression* m,
+                     const Number* n)
+{
+    if (t->dense != NULL) {
+        const uint64_t i =
+          (uint64_t)NumberToInt(n) - (uint64_t)t->denseMin;
+        if ((n->type == NumberType_Unsigned && n->u > INT64_MAX) ||
+            i >= t->denseSize) {
+            return m->branches.used;
+        }
+        const uint32_t branch = t->dense[i];
+        return branch == 0 ? m->branches.used : branch - 1U;
+    }
+    uint32_t low = 0;
+    uint32_t high = t->numberCount;
+    while (low < high) {
+        const uint32_t mid = low + (high - low) / 2U;
+        switch (NumberCompare(&t->numbers[mid].number, n)) {
+            case ComparisonOperator_LessThan:
+                low = mid + 1U;
+                break;
+            case ComparisonOperator_GreaterThan:
+                high = mid;
+                break;
+            default:
+                return t->numbers[mid].branch;
+        }
+    }
+    return m->branches.used;
+}
+
+// Finds the first literal branch that matches the value. Branch is set to the
+// number of branches if none of them match
+static inline MatchLookup
+MatchTableFind(const MatchTable* t,
+               const MatchExpression* m,
+               const Value* value,
+               uint32_t* branch)
+{
+    switch (value->type) {
+        case ValueType_Variant:
+            if (!t->allNames) {
+                return MatchLookup_Linear;
+            }
+            *branch = MatchTableFindString(
+              t, m, t->names, true, &value->variantValue->memberName);
+            return MatchLookup_Branch;
+        case ValueType_String:
+            *branch =
+              MatchTableFindString(t, m, t->strings, false, &value->string);
+            return MatchLookup_Branch;
+        case ValueType_Enum:
+            *branch = MatchTableFindString(
+              t, m, t->strings, false, EnumValueMember(&value->enumValue));
+            return MatchLookup_Branch;
+        case ValueType_Number: {
+            const Number* n = &value->rangedNumber.number;
+            if (t->numberCount == 0) {
+                *branch = m->branches.used;
+                return MatchLookup_Branch;
+            }
+            if (!t->numbersUsable || n->type != t->numberType ||
+                NumberIsNaN(n)) {
+                return MatchLookup_Linear;
+            }
+            *branch = MatchTableFindNumber(t, m, n);
+            return MatchLookup_Branch;
+        }
+        default:
+            return MatchLookup_Linear;
+    }
+}
+
+static inline const MatchTable*
+MatchExpressionTable(const MatchExpression* m)
+{
+    // Workers match linearly until the main thread builds the table
+    if (m->table == NULL && m->branches.used != 0 && !parallelWorker) {
+        // The table is filled in on a const expression. That way it sees the folded matchers
+        ((MatchExpression*)m)->table =
+          MatchTableCreate(m, m->branches.allocator);
+    }
+    return m->table;
+}
@@ -0,0 +1,402 @@
+#pragma once
+
+#include "Value.h"
+
+// Cache of function results keyed by the arguments of the call. Each function
+// definition owns one and evicts the least recently used entry when it is
+// full. Only arguments made of plain data can be used as keys.
+
+#define MEMO_CACHE_DEFAULT_CAPACITY 1024U
+
+// Memoize every function instead of only the ones marked "memoize"
+static bool memoizeAll = false;
+static size_t memoCapacity = MEMO_CACHE_DEFAULT_CAPACITY;
+static size_t memoHits = 0;
+static size_t memoMisses = 0;
+
+typedef struct MemoEntry
+{
+    Value left;
+    Value right;
+    Value result;
+    uint32_t hash;
+    // Indices into the entries plus one. Zero means none.
+    uint32_t newer;
+    uint32_t older;
+    uint32_t nextInBucket;
+} MemoEntry, *pMemoEntry;
+
+typedef struct MemoCache
+{
+    MemoEntry* entries;
+    // Index into the entries plus one for the first entry of each bucket
+    uint32_t* buckets;
+    // Always a power of 2
+    uint32_t bucketCount;
+    uint32_t used;
+    uint32_t capacity;
+    uint32_t newest;
+    uint32_t oldest;
+    const Allocator* allocator;
+} MemoCache, *pMemoCache;
+
+static inline uint32_t
+MemoHashBytes(uint32_t hash, const void* data, const size_t size)
+{
+    const uint8_t* bytes = (const uint8_t*)data;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+static inline uint32_t
+MemoHashString(const uint32_t hash, const TemLangString* s)
+{
+    return MemoHashBytes(MemoHashBytes(hash, &s->used, sizeof(s->used)),
+                         s->buffer,
+                         s->used);
+}
+
+static inline uint32_t
+MemoHashNumber(uint32_t hash, const Number* n)
+{
+    hash = MemoHashBytes(hash, &n->type, sizeof(n->type));
+    return MemoHashBytes(hash, &n->u, sizeof(n->u));
+}
+
+static inline bool
+MemoNumbersEqual(const Number* a, const Number* b)
+{
+    return a->type == b->type && a->u == b->u;
+}
+
+// Returns false if the value cannot be used as a key
+static inline bool
+MemoHashValue(const Value* v, uint32_t* hash)
+{
+    *hash = MemoHashBytes(*hash, &v->type, sizeof(v->type));
+    switch (v->type) {
+        case ValueType_Null:
+            return true;
+        case ValueType_Number: {
+            const RangedNumber* r = &v->rangedNumber;
+            *hash = MemoHashNumber(*hash, &r->number);
+            if (r->range != NULL) {
+                *hash = MemoHashNumber(*hash, &r->range->min);
+                *hash = MemoHashNumber(*hash, &r->range->max);
+            }
+            return true;
+        }
+        case ValueType_Boolean:
+            *hash = MemoHashBytes(*hash, &v->b, sizeof(v->b));
+            return true;
+        case ValueType_String:
+        case ValueType_Data:
+            *hash = MemoHashString(*hash, &v->string);
+            return true;
+        case ValueType_Enum:
+            *hash = MemoHashString(*hash, EnumValueName(&v->enumValue));
+            *hash = MemoHashBytes(*hash,
+                                  &v->enumValue.ordinal,
+                                  sizeof(v->enumValue.ordinal));
+            return true;
+        case ValueType_Flag:
+            *hash = MemoHashString(*hash, &v->flagValue.names->name);
+            *hash = MemoHashBytes(*hash,
+                                  FlagValueConstWords(&v->flagValue),
+                                  sizeof(uint64_t) *
+                                    FlagValueWordCount(&v->flagValue));
+            return true;
+        case ValueType_List: {
+            const ValueListValue* list = v->list;
+            *hash =
+              MemoHashBytes(*hash, &v->listIsArray, sizeof(v->listIsArray));
+            const size_t used = ValueListValueLength(list);
+            *hash = MemoHashBytes(*hash, &used, sizeof(used));
+            if (list->exampleValue != NULL &&
+                !MemoHashValue(list->exampleValue, hash)) {
+                return false;
+            }
+            for (size_t i = 0; i < used; ++i) {
+                Value scratch;
+                if (!MemoHashValue(ValueListValueAt(list, i, &scratch),
+                                   hash)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        case ValueType_Struct:
+            for (size_t i = 0; i < v->structValues->values.used; ++i) {
+                *hash = MemoHashString(
+                  *hash, &v->structValues->shape->names.buffer[i]);
+                if (!MemoHashValue(&v->structValues->values.buffer[i], hash)) {
+                    return false;
+                }
+            }
+            return true;
+        case ValueType_Variant: {
+            const VariantValue* variant = v->variantValue;
+            *hash = MemoHashString(*hash, &variant->name);
+            *hash = MemoHashString(*hash, &variant->memberName);
+            return variant->value == NULL ||
+                   MemoHashValue(variant->value, hash);
+        }
+        default:
+            return false;
+    }
+}
+
+// Only called on values that MemoHashValue accepted
+static inline bool
+MemoValuesEqual(const Value* a, const Value* b)
+{
+    if (a->type != b->type) {
+        return false;
+    }
+    switch (a->type) {
+        case ValueType_Null:
+            return true;
+        case ValueType_Number: {
+            const RangedNumber* x = &a->rangedNumber;
+            const RangedNumber* y = &b->rangedNumber;
+            if ((x->range == NULL) != (y->range == NULL) ||
+                !MemoNumbersEqual(&x->number, &y->number)) {
+                return false;
+            }
+            return x->range == y->range ||
+                   (MemoNumbersEqual(&x->range->min, &y->range->min) &&
+                    MemoNumbersEqual(&x->range->max, &y->range->max));
+        }
+        case ValueType_Boolean:
+            return a->b == b->b;
+        case ValueType_String:
+        case ValueType_Data:
+            return TemLangStringsAreEqual(&a->string, &b->string);
+        case ValueType_Enum:
+            return EnumValuesEqual(&a->enumValue, &b->enumValue);
+        case ValueType_Flag:
+            return FlagValuesEqual(&a->flagValue, &b->flagValue);
+        case ValueType_List: {
+            const ValueListValue* x = a->list;
+            const ValueListValue* y = b->list;
+            const size_t used = ValueListValueLength(x);
+            if (a->listIsArray != b->listIsArray ||
+                used != ValueListValueLength(y) ||
+                (x->exampleValue == NULL) != (y->exampleValue == NULL)) {
+                return false;
+            }
+            if (x == y) {
+                return true;
+            }
+            if (x->exampleValue != NULL &&
+                !MemoValuesEqual(x->exampleValue, y->exampleValue)) {
+                return false;
+            }
+            for (size_t i = 0; i < used; ++i) {
+                Value xScratch;
+                Value yScratch;
+                if (!MemoValuesEqual(ValueListValueAt(x, i, &xScratch),
+                                     ValueListValueAt(y, i, &yScratch))) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        case ValueType_Struct: {
+            const StructValues* x = a->structValues;
+            const StructValues* y = b->structValues;
+            if (x == y) {
+                return true;
+            }
+            if (!StructShapesEqual(x->shape, y->shape)) {
+                return false;
+            }
+            for (size_t i = 0; i < x->values.used; ++i) {
+                if (!MemoValuesEqual(&x->values.buffer[i],
+                                     &y->values.buffer[i])) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        case ValueType_Variant: {
+            const VariantValue* x = a->variantValue;
+            const VariantValue* y = b->variantValue;
+            if (!TemLangStringsAreEqual(&x->name, &y->name) ||
+                !TemLangStringsAreEqual(&x->memberName, &y->memberName) ||
+                (x->value == NULL) != (y->value == NULL)) {
+                return false;
+            }
+            return x->value == NULL || MemoValuesEqual(x->value, y->value);
+        }
+        default:
+            return false;
+    }
+}
+
+// Returns false if the arguments cannot be used as a key
+static inline bool
+MemoHashArguments(const Value* left, const Value* right, uint32_t* hash)
+{
+    *hash = 2166136261U;
+    return MemoHashValue(left, hash) && MemoHashValue(right, hash);
+}
+
+static inline MemoCache*
+MemoCacheCreate(const Allocator* allocator)
+{
+    const uint32_t capacity =
+      memoCapacity == 0 || memoCapacity > UINT32_MAX / 2U
+        ? MEMO_CACHE_DEFAULT_CAPACITY
+        : (uint32_t)memoCapacity;
+    uint32_t bucketCount = 16U;
+    while (bucketCount < capacity) {
+        bucketCount *= 2U;
+    }
+    MemoCache* cache = allocator->allocate(sizeof(MemoCache));
+    if (cache == NULL) {
+        return NULL;
+    }
+    memset(cache, 0, sizeof(MemoCache));
+    cache->allocator = allocator;
+    cache->capacity = capacity;
+    cache->bucketCount = bucketCount;
+    cache->entries = allocator->allocate(sizeof(MemoEntry) * capacity);
+    cache->buckets = allocator->allocate(sizeof(uint32_t) * bucketCount);
+    if (cache->entries == NULL || cache->buckets == NULL) {
+        if (cache->entries != NULL) {
+            allocator->free(cache->entries);
+        }
+        if (cache->buckets != NULL) {
+            allocator->free(cache->buckets);
+        }
+        allocator->free(cache);
+        return NULL;
+    }
+    memset(cache->entries, 0, sizeof(MemoEntry) * capacity);
+    memset(cache->buckets, 0, sizeof(uint32_t) * bucketCount);
+    return cache;
+}
+
+static inline void
+MemoCacheDelete(MemoCache* cache)
+{
+    for (uint32_t i = 0; i < cache->used; ++i) {
+        ValueFree(&cache->entries[i].left);
+        ValueFree(&cache->entries[i].right);
+        ValueFree(&cache->entries[i].result);
+    }
+    const Allocator* allocator = cache->allocator;
+    allocator->free(cache->entries);
+    allocator->free(cache->buckets);
+    allocator->free(cache);
+}
+
+static inline void
+MemoCacheUnlink(MemoCache* cache, const uint32_t index)
+{
+    MemoEntry* entry = &cache->entries[index];
+    if (entry->newer == 0) {
+        cache->newest = entry->older;
+    } else {
+        cache->entries[entry->newer - 1U].older = entry->older;
+    }
+    if (entry->older == 0) {
+        cache->oldest = entry->newer;
+    } else {
+        cache->entries[entry->older - 1U].newer = entry->newer;
+    }
+    entry->newer = 0;
+    entry->older = 0;
+}
+
+static inline void
+MemoCacheMakeNewest(MemoCache* cache, const uint32_t index)
+{
+    MemoEntry* entry = &cache->entries[index];
+    entry->older = cache->newest;
+    entry->newer = 0;
+    if (cache->newest != 0) {
+        cache->entries[cache->newest - 1U].newer = index + 1U;
+    }
+    cache->newest = index + 1U;
+    if (cache->oldest == 0) {
+        cache->oldest = index + 1U;
+    }
+}
+
+static inline const Value*
+MemoCacheFind(MemoCache* cache,
+              const uint32_t hash,
+              const Value* left,
+              const Value* right)
+{
+    uint32_t i = cache->buckets[hash & (cache->bucketCount - 1U)];
+    while (i != 0) {
+        MemoEntry* entry = &cache->entries[i - 1U];
+        if (entry->hash == hash && MemoValuesEqual(&entry->left, left) &&
+            MemoValuesEqual(&entry->right, right)) {
+            if (cache->newest != i) {
+                MemoCacheUnlink(cache, i - 1U);
+                MemoCacheMakeNewest(cache, i - 1U);
+            }
+            return &entry->result;
+        }
+        i = entry->nextInBucket;
+    }
+    return NULL;
+}
+
+static inline void
+MemoCacheRemoveFromBucket(MemoCache* cache, const uint32_t index)
+{
+    const MemoEntry* entry = &cache->entries[index];
+    uint32_t* next = &cache->buckets[entry->hash & (cache->bucketCount - 1U)];
+    while (*next != 0) {
+        if (*next == index + 1U) {
+            *next = entry->nextInBucket;
+            return;
+        }
+        next = &cache->entries[*next - 1U].nextInBucket;
+    }
+}
+
+static inline bool
+MemoCacheInsert(MemoCache* cache,
+                const uint32_t hash,
+                const Value* left,
+                const Value* right,
+                const Value* result)
+{
+    uint32_t index;
+    if (cache->used < cache->capacity) {
+        index = cache->used++;
+    } else {
+        index = cache->oldest - 1U;
+        MemoCacheUnlink(cache, index);
+        MemoCacheRemoveFromBucket(cache, index);
+    }
+    MemoEntry* entry = &cache->entries[index];
+    const Allocator* allocator = cache->allocator;
+    if (!ValueCopy(&entry->left, left, allocator) ||
+        !ValueCopy(&entry->right, right, allocator) ||
+        !ValueCopy(&entry->result, result, allocator)) {
+        ValueFree(&entry->left);
+        ValueFree(&entry->right);
+        ValueFree(&entry->result);
+        // Leave the slot out of the buckets so it is only reused by eviction
+        entry->hash = 0;
+        entry->nextInBucket = 0;
+        MemoCacheMakeNewest(cache, index);
+        return false;
+    }
+    uint32_t* bucket = &cache->buckets[hash & (cache->bucketCount - 1U)];
+    entry->hash = hash;
+    entry->nextInBucket = *bucket;
+    *bucket = index + 1U;
+    MemoCacheMakeNewest(cache, index);
+    return true;
+}
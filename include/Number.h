@@ -173,6 +173,25 @@ NumberCompare(const Number* a, const Number* b)
             break;                                                             \
     }
 
+// Integer division by zero and INT64_MIN / -1 trap instead of giving a
+// number. Two unsigned numbers are divided unsigned and everything else that
+// isn't a float is divided signed
+static inline bool
+NumberOperationTraps(const Number* a, const Number* b, NumberOperator op)
+{
+    if ((op != NumberOperator_Divide && op != NumberOperator_Modulo) ||
+        a->type == NumberType_Float || b->type == NumberType_Float) {
+        return false;
+    }
+    if (b->u == 0UL) {
+        return true;
+    }
+    if (a->type == NumberType_Unsigned && b->type == NumberType_Unsigned) {
+        return false;
+    }
+    return NumberToInt(a) == INT64_MIN && NumberToInt(b) == -1L;
+}
+
 static inline Number
 ApplyNumberOperator(const Number* a, const Number* b, NumberOperator op)
 {
@@ -0,0 +1,261 @@
+#pragma once
+
+#include "Allocator.h"
+
+#if __EMSCRIPTEN__
+#define PARALLEL_THREADS 0
+#else
+#define PARALLEL_THREADS 1
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+#define PARALLEL_MAX_THREADS 64U
+
+// Number of workers a parallel iterate is split across. 0 uses one per
+// processor
+static size_t parallelThreads = 0;
+
+// Set while workers are running. Payloads shared between values are only
+// touched by more than one thread then so counting is only atomic while set
+static bool parallelRunning = false;
+
+// Set on worker threads. Caches kept in definitions and expressions are only
+// filled in by the main thread
+static _Thread_local bool parallelWorker = false;
+
+// Each worker allocates from its own heap allocator
+static _Thread_local Allocator parallelAllocator = { 0 };
+
+// Members that outlive a call are allocated with the allocator of the value
+// they came from. Workers can't use it since it may not be thread safe
+static inline const Allocator*
+ParallelAllocatorOr(const Allocator* allocator)
+{
+    return parallelWorker ? &parallelAllocator : allocator;
+}
+
+static inline void
+RefCountIncrement(size_t* count)
+{
+    if (parallelRunning) {
+        __atomic_add_fetch(count, 1U, __ATOMIC_RELAXED);
+    } else {
+        ++*count;
+    }
+}
+
+static inline size_t
+RefCountDecrement(size_t* count)
+{
+    if (parallelRunning) {
+        return __atomic_sub_fetch(count, 1U, __ATOMIC_ACQ_REL);
+    }
+    return --*count;
+}
+
+static inline size_t
+RefCountLoad(const size_t* count)
+{
+    return parallelRunning ? __atomic_load_n(count, __ATOMIC_ACQUIRE) : *count;
+}
+
+typedef void (*ParallelTask)(void*);
+
+#if PARALLEL_THREADS
+
+// Worker threads are started by the first parallel iterate and wait for the
+// next one after that
+typedef struct ParallelPool
+{
+    pthread_t* threads;
+    size_t count;
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    ParallelTask task;
+    void* arg;
+    size_t generation;
+    size_t busy;
+    bool quit;
+} ParallelPool, *pParallelPool;
+
+static ParallelPool parallelPool = { .mutex = PTHREAD_MUTEX_INITIALIZER,
+                                     .wake = PTHREAD_COND_INITIALIZER,
+                                     .done = PTHREAD_COND_INITIALIZER };
+
+// Guards tables shared by every thread like the interned ranges
+static pthread_mutex_t parallelMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static inline void
+ParallelLock()
+{
+    if (parallelRunning) {
+        pthread_mutex_lock(&parallelMutex);
+    }
+}
+
+static inline void
+ParallelUnlock()
+{
+    if (parallelRunning) {
+        pthread_mutex_unlock(&parallelMutex);
+    }
+}
+
+static inline void*
+ParallelPoolThread(void* arg)
+{
+    ParallelPool* pool = (ParallelPool*)arg;
+    parallelWorker = true;
+    parallelAllocator = makeDefaultAllocator();
+    size_t generation = 0;
+    pthread_mutex_lock(&pool->mutex);
+    while (true) {
+        while (!pool->quit && pool->generation == generation) {
+            pthread_cond_wait(&pool->wake, &pool->mutex);
+        }
+        if (pool->quit) {
+            break;
+        }
+        generation = pool->generation;
+        const ParallelTask task = pool->task;
+        void* taskArg = pool->arg;
+        pthread_mutex_unlock(&pool->mutex);
+        task(taskArg);
+        pthread_mutex_lock(&pool->mutex);
+        if (--pool->busy == 0) {
+            pthread_cond_signal(&pool->done);
+        }
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return NULL;
+}
+
+static inline size_t
+ParallelThreadCount()
+{
+    size_t count = parallelThreads;
+    if (count == 0) {
+        const long processors = sysconf(_SC_NPROCESSORS_ONLN);
+        count = processors > 0 ? (size_t)processors : 1U;
+    }
+    return CLAMP(count, 1U, PARALLEL_MAX_THREADS);
+}
+
+static inline void
+ParallelPoolFree()
+{
+    ParallelPool* pool = &parallelPool;
+    if (pool->threads == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&pool->mutex);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->mutex);
+    for (size_t i = 0; i < pool->count; ++i) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    free(pool->threads);
+    pool->threads = NULL;
+    pool->count = 0;
+    pool->generation = 0;
+    pool->quit = false;
+}
+
+static inline bool
+ParallelPoolStart(ParallelPool* pool)
+{
+    const size_t count = ParallelThreadCount();
+    if (pool->threads != NULL && pool->count == count) {
+        return true;
+    }
+    ParallelPoolFree();
+    pool->threads = malloc(sizeof(pthread_t) * count);
+    if (pool->threads == NULL) {
+        return false;
+    }
+    // Workers inherit the mask so the sampling timer only interrupts the main
+    // thread
+    sigset_t signals;
+    sigset_t previous;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGPROF);
+    pthread_sigmask(SIG_BLOCK, &signals, &previous);
+    for (; pool->count < count; ++pool->count) {
+        if (pthread_create(&pool->threads[pool->count],
+                           NULL,
+                           ParallelPoolThread,
+                           pool) != 0) {
+            break;
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    if (pool->count == 0) {
+        free(pool->threads);
+        pool->threads = NULL;
+        return false;
+    }
+    return true;
+}
+
+// Runs the task once on every worker and returns after all of them finished.
+// Returns the number of workers that ran it. Workers don't start other
+// workers so 0 is returned on them
+static inline size_t
+ParallelRun(const ParallelTask task, void* arg)
+{
+    ParallelPool* pool = &parallelPool;
+    if (parallelWorker || ParallelThreadCount() < 2U ||
+        !ParallelPoolStart(pool)) {
+        return 0;
+    }
+    pthread_mutex_lock(&pool->mutex);
+    pool->task = task;
+    pool->arg = arg;
+    pool->busy = pool->count;
+    ++pool->generation;
+    parallelRunning = true;
+    pthread_cond_broadcast(&pool->wake);
+    while (pool->busy != 0) {
+        pthread_cond_wait(&pool->done, &pool->mutex);
+    }
+    parallelRunning = false;
+    pthread_mutex_unlock(&pool->mutex);
+    return pool->count;
+}
+
+#else
+
+static inline size_t
+ParallelThreadCount()
+{
+    return 1U;
+}
+
+static inline void
+ParallelLock()
+{
+}
+
+static inline void
+ParallelUnlock()
+{
+}
+
+static inline void
+ParallelPoolFree()
+{
+}
+
+static inline size_t
+ParallelRun(const ParallelTask task, void* arg)
+{
+    (void)task;
+    (void)arg;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,726 @@
+#pragma once
+
+#include "FunctionDefinition.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PROFILE_TSC 1
+#include <x86intrin.h>
+#else
+#define PROFILE_TSC 0
+#endif
+
+// Counts executions of every instruction and function call and times top
+// level instructions. Instructions inside them are only counted since reading
+// the clock around each one made programs up to twice as slow. Entries are
+// merged by source line so an instruction shows up once no matter how many
+// times its list was copied. Only the main thread is profiled.
+//
+// Calls aren't timed one by one. After about one in PROFILE_SAMPLE_PERIOD
+// calls or returns the time until the next one is measured and added, scaled
+// by the period, to the frame that was running. The total of an entry is the
+// time of everything under it in the call tree.
+//
+// Reading the thread's CPU clock is a system call so it is only read around
+// top level instructions. Each entry gets the share of that CPU time its total
+// wall time makes up.
+
+#define PROFILE_NONE UINT32_MAX
+// Deeper frames are added to the node of their parent so recursion can't grow
+// the call tree forever
+#define PROFILE_MAX_DEPTH 256U
+#define PROFILE_SAMPLE_PERIOD 16U
+
+static bool profileEnabled = false;
+static const char* profileOutput = "profile.folded";
+
+typedef struct ProfileEntry
+{
+    char* name;
+    uint64_t count;
+    // Time of everything under the entry. Added up when the profile is
+    // reported
+    uint64_t wall;
+    // Nanoseconds unlike the other times which are in ticks
+    uint64_t cpu;
+    // Last sample the entry was seen in. Only used by the sampler
+    uint64_t pending;
+    // Time not spent in a nested instruction or call
+    uint64_t self;
+    uint32_t active;
+    // Node of the outermost activation while the entry is active
+    uint32_t node;
+    // Set once the entry was timed instead of only counted
+    bool timed;
+} ProfileEntry, *pProfileEntry;
+
+// Node of the call tree written to the folded stack file
+typedef struct ProfileNode
+{
+    uint64_t self;
+    // CPU and wall time of top level instructions
+    uint64_t cpu;
+    uint64_t wall;
+    uint32_t entry;
+    uint32_t parent;
+    // Indices into the nodes plus one. Zero means none.
+    uint32_t child;
+    uint32_t sibling;
+} ProfileNode, *pProfileNode;
+
+typedef struct ProfileKey
+{
+    const void* key;
+    // Checked on a hit since a freed instruction's memory can be reused
+    const void* check;
+    size_t line;
+    uint32_t type;
+    uint32_t entry;
+} ProfileKey, *pProfileKey;
+
+// Start, CPU and children are only set for top level frames
+typedef struct ProfileFrame
+{
+    uint64_t start;
+    uint64_t cpu;
+    uint64_t children;
+    uint32_t node;
+    uint32_t entry;
+} ProfileFrame, *pProfileFrame;
+
+typedef struct Profile
+{
+    Allocator allocator;
+    ProfileEntry* entries;
+    ProfileNode* nodes;
+    ProfileKey* keys;
+    ProfileFrame* frames;
+    uint32_t entryCount;
+    uint32_t entryCapacity;
+    uint32_t nodeCount;
+    uint32_t nodeCapacity;
+    // Always a power of 2
+    uint32_t keyCapacity;
+    uint32_t keyCount;
+    uint32_t frameCount;
+    uint32_t frameCapacity;
+    // Calls and returns left until the next one is timed
+    uint32_t countdown;
+    uint32_t random;
+    // Set while the time after a call or return is measured
+    uint64_t sampleStart;
+    // Calls and returns the measured time stands for
+    uint64_t sampleWeight;
+    uint64_t startTicks;
+    uint64_t startNanoseconds;
+} Profile, *pProfile;
+
+static Profile profile = { 0 };
+
+static inline uint64_t
+ProfileClock(const clockid_t id)
+{
+    struct timespec t;
+    clock_gettime(id, &t);
+    return (uint64_t)t.tv_sec * 1000000000ULL + (uint64_t)t.tv_nsec;
+}
+
+static inline uint64_t
+ProfileTicks()
+{
+#if PROFILE_TSC
+    return __rdtsc();
+#else
+    return ProfileClock(CLOCK_MONOTONIC);
+#endif
+}
+
+static inline bool
+ProfileReserve(void** buffer,
+               uint32_t* capacity,
+               const uint32_t needed,
+               const size_t size)
+{
+    if (needed <= *capacity) {
+        return true;
+    }
+    uint32_t newCapacity = *capacity == 0 ? 64U : *capacity * 2U;
+    while (newCapacity < needed) {
+        newCapacity *= 2U;
+    }
+    void* newBuffer =
+      profile.allocator.reallocate(*buffer, (size_t)newCapacity * size);
+    if (newBuffer == NULL) {
+        return false;
+    }
+    *buffer = newBuffer;
+    *capacity = newCapacity;
+    return true;
+}
+
+static inline void
+ProfileInit(const char* output)
+{
+    profile.allocator = makeDefaultAllocator();
+    if (output != NULL) {
+        profileOutput = output;
+    }
+    profile.startTicks = ProfileTicks();
+    profile.startNanoseconds = ProfileClock(CLOCK_MONOTONIC);
+    profile.countdown = PROFILE_SAMPLE_PERIOD;
+    profile.random = (uint32_t)profile.startTicks | 1U;
+}
+
+static inline void
+ProfileStart(const char* output)
+{
+    ProfileInit(output);
+    profileEnabled = true;
+}
+
+static inline uint32_t
+ProfileKeySlot(const void* key)
+{
+    uint64_t hash = (uint64_t)(uintptr_t)key;
+    hash ^= hash >> 33U;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33U;
+    return (uint32_t)hash & (profile.keyCapacity - 1U);
+}
+
+static inline bool
+ProfileKeysGrow()
+{
+    const uint32_t oldCapacity = profile.keyCapacity;
+    ProfileKey* oldKeys = profile.keys;
+    const uint32_t capacity = oldCapacity == 0 ? 256U : oldCapacity * 2U;
+    ProfileKey* keys =
+      profile.allocator.allocate(sizeof(ProfileKey) * capacity);
+    if (keys == NULL) {
+        return false;
+    }
+    memset(keys, 0, sizeof(ProfileKey) * capacity);
+    profile.keys = keys;
+    profile.keyCapacity = capacity;
+    for (uint32_t i = 0; i < oldCapacity; ++i) {
+        if (oldKeys[i].key == NULL) {
+            continue;
+        }
+        uint32_t slot = ProfileKeySlot(oldKeys[i].key);
+        while (keys[slot].key != NULL) {
+            slot = (slot + 1U) & (capacity - 1U);
+        }
+        keys[slot] = oldKeys[i];
+    }
+    if (oldKeys != NULL) {
+        profile.allocator.free(oldKeys);
+    }
+    return true;
+}
+
+// Returns the entry with the name or adds one. Takes ownership of the name.
+static inline uint32_t
+ProfileEntryFindOrAdd(char* name)
+{
+    if (name == NULL) {
+        return PROFILE_NONE;
+    }
+    for (uint32_t i = 0; i < profile.entryCount; ++i) {
+        if (strcmp(profile.entries[i].name, name) == 0) {
+            profile.allocator.free(name);
+            return i;
+        }
+    }
+    if (!ProfileReserve((void**)&profile.entries,
+                        &profile.entryCapacity,
+                        profile.entryCount + 1U,
+                        sizeof(ProfileEntry))) {
+        profile.allocator.free(name);
+        return PROFILE_NONE;
+    }
+    ProfileEntry* entry = &profile.entries[profile.entryCount];
+    memset(entry, 0, sizeof(ProfileEntry));
+    entry->name = name;
+    return profile.entryCount++;
+}
+
+static inline char*
+ProfileMakeName(const char* prefix, const InstructionSource* source)
+{
+    const char* file = source == NULL || source->source.buffer == NULL
+                         ? ""
+                         : source->source.buffer;
+    const size_t line = source == NULL ? 0 : source->lineNumber;
+    const int size = snprintf(NULL, 0, "%s %s:%zu", prefix, file, line);
+    if (size < 0) {
+        return NULL;
+    }
+    char* name = profile.allocator.allocate((size_t)size + 1U);
+    if (name == NULL) {
+        return NULL;
+    }
+    snprintf(name, (size_t)size + 1U, "%s %s:%zu", prefix, file, line);
+    return name;
+}
+
+// Returns the slot of the key. Its entry is PROFILE_NONE until it is set.
+static inline ProfileKey*
+ProfileKeyFind(const void* key,
+               const void* check,
+               const size_t line,
+               const uint32_t type)
+{
+    if ((profile.keyCount + 1U) * 2U > profile.keyCapacity &&
+        !ProfileKeysGrow()) {
+        return NULL;
+    }
+    uint32_t slot = ProfileKeySlot(key);
+    ProfileKey* k = &profile.keys[slot];
+    while (k->key != NULL) {
+        if (k->key == key) {
+            if (k->check != check || k->line != line || k->type != type) {
+                // The memory belongs to a different instruction now
+                k->check = check;
+                k->line = line;
+                k->type = type;
+                k->entry = PROFILE_NONE;
+            }
+            return k;
+        }
+        slot = (slot + 1U) & (profile.keyCapacity - 1U);
+        k = &profile.keys[slot];
+    }
+    k->key = key;
+    k->check = check;
+    k->line = line;
+    k->type = type;
+    k->entry = PROFILE_NONE;
+    ++profile.keyCount;
+    return k;
+}
+
+// The entry is kept on the instruction. Copies find it again by their source
+static inline uint32_t
+ProfileInstructionEntry(const Instruction* instruction)
+{
+    if (instruction->profileEntry != 0) {
+        return instruction->profileEntry - 1U;
+    }
+    const InstructionSource* source = &instruction->source;
+    ProfileKey* k = ProfileKeyFind(instruction,
+                                   source->source.buffer,
+                                   source->lineNumber,
+                                   (uint32_t)instruction->type);
+    if (k == NULL) {
+        return PROFILE_NONE;
+    }
+    if (k->entry == PROFILE_NONE) {
+        k->entry = ProfileEntryFindOrAdd(ProfileMakeName(
+          InstructionTypeToString(instruction->type), source));
+    }
+    if (k->entry != PROFILE_NONE) {
+        ((Instruction*)instruction)->profileEntry = k->entry + 1U;
+    }
+    return k->entry;
+}
+
+static inline uint32_t
+ProfileFunctionEntry(const FunctionDefinition* f, const TemLangString* name)
+{
+    if (f->profileEntry != 0) {
+        return f->profileEntry - 1U;
+    }
+    ProfileKey* k = ProfileKeyFind(
+      f, f->instructions.buffer, f->instructions.used, (uint32_t)f->type);
+    if (k == NULL) {
+        return PROFILE_NONE;
+    }
+    if (k->entry == PROFILE_NONE) {
+        const InstructionSource* source =
+          f->instructions.used == 0 ? NULL : &f->instructions.buffer[0].source;
+        k->entry = ProfileEntryFindOrAdd(ProfileMakeName(name->buffer, source));
+    }
+    if (k->entry != PROFILE_NONE) {
+        ((FunctionDefinition*)f)->profileEntry = k->entry + 1U;
+    }
+    return k->entry;
+}
+
+// Adds the root of the call tree if there isn't one
+static inline bool
+ProfileRoot()
+{
+    if (profile.nodeCount != 0) {
+        return true;
+    }
+    if (!ProfileReserve((void**)&profile.nodes,
+                        &profile.nodeCapacity,
+                        1U,
+                        sizeof(ProfileNode))) {
+        return false;
+    }
+    memset(profile.nodes, 0, sizeof(ProfileNode));
+    profile.nodes[0].entry = PROFILE_NONE;
+    profile.nodeCount = 1;
+    return true;
+}
+
+static inline uint32_t
+ProfileNodeFindOrAdd(const uint32_t parent, const uint32_t entry)
+{
+    uint32_t i = profile.nodes[parent].child;
+    while (i != 0) {
+        if (profile.nodes[i - 1U].entry == entry) {
+            return i - 1U;
+        }
+        i = profile.nodes[i - 1U].sibling;
+    }
+    if (!ProfileReserve((void**)&profile.nodes,
+                        &profile.nodeCapacity,
+                        profile.nodeCount + 1U,
+                        sizeof(ProfileNode))) {
+        return PROFILE_NONE;
+    }
+    const uint32_t index = profile.nodeCount++;
+    ProfileNode* node = &profile.nodes[index];
+    node->self = 0;
+    node->entry = entry;
+    node->parent = parent;
+    node->child = 0;
+    node->sibling = profile.nodes[parent].child;
+    profile.nodes[parent].child = index + 1U;
+    return index;
+}
+
+// Counts an instruction that runs inside a timed frame
+static inline void
+ProfileCount(const uint32_t entry)
+{
+    if (entry != PROFILE_NONE) {
+        ++profile.entries[entry].count;
+    }
+}
+
+// Ends the time measured since the last call or return
+static inline void
+ProfileSampleEnd()
+{
+    if (profile.sampleStart == 0) {
+        return;
+    }
+    const uint64_t elapsed =
+      (ProfileTicks() - profile.sampleStart) * profile.sampleWeight;
+    profile.sampleStart = 0;
+    // Top level frames are timed when they exit
+    if (profile.frameCount > 1) {
+        const ProfileFrame* frame = &profile.frames[profile.frameCount - 1U];
+        profile.nodes[frame->node].self += elapsed;
+        profile.frames[0].children += elapsed;
+    }
+}
+
+// Starts measuring the time until the next call or return if it is due. The
+// gap between measurements is random so it can't line up with the calls of a
+// loop or recursion. The first calls of a function are always measured so a
+// function that is only called a few times isn't missed
+static inline void
+ProfileSampleNext()
+{
+    uint64_t weight = 0;
+    if (--profile.countdown == 0) {
+        uint32_t x = profile.random;
+        x ^= x << 13U;
+        x ^= x >> 17U;
+        x ^= x << 5U;
+        profile.random = x;
+        profile.countdown = 1U + x % (2U * PROFILE_SAMPLE_PERIOD - 1U);
+        weight = PROFILE_SAMPLE_PERIOD;
+    }
+    const ProfileFrame* frame = &profile.frames[profile.frameCount - 1U];
+    if (profile.entries[frame->entry].count <= PROFILE_SAMPLE_PERIOD) {
+        weight = 1;
+    }
+    if (weight != 0) {
+        profile.sampleWeight = weight;
+        profile.sampleStart = ProfileTicks();
+    }
+}
+
+// Returns false if the entry wasn't entered. ProfileExit must only be called
+// when this returns true.
+static inline bool
+ProfileEnter(const uint32_t entry)
+{
+    if (entry == PROFILE_NONE || !ProfileRoot()) {
+        return false;
+    }
+    if (!ProfileReserve((void**)&profile.frames,
+                        &profile.frameCapacity,
+                        profile.frameCount + 1U,
+                        sizeof(ProfileFrame))) {
+        return false;
+    }
+    ProfileSampleEnd();
+    const uint32_t parent = profile.frameCount == 0
+                              ? 0
+                              : profile.frames[profile.frameCount - 1U].node;
+    ProfileEntry* e = &profile.entries[entry];
+    uint32_t node = parent;
+    if (e->active != 0) {
+        // Recursive calls are added to the outermost call so the tree can't
+        // grow with every path through the recursion
+        node = e->node;
+    } else if (profile.frameCount < PROFILE_MAX_DEPTH) {
+        node = ProfileNodeFindOrAdd(parent, entry);
+        if (node == PROFILE_NONE) {
+            return false;
+        }
+    }
+    if (e->active++ == 0) {
+        e->node = node;
+    }
+    ++e->count;
+    e->timed = true;
+    ProfileFrame* frame = &profile.frames[profile.frameCount++];
+    frame->node = node;
+    frame->entry = entry;
+    if (profile.frameCount == 1) {
+        frame->children = 0;
+        frame->cpu = ProfileClock(CLOCK_THREAD_CPUTIME_ID);
+        frame->start = ProfileTicks();
+    } else {
+        ProfileSampleNext();
+    }
+    return true;
+}
+
+static inline void
+ProfileExit()
+{
+    ProfileSampleEnd();
+    const ProfileFrame* frame = &profile.frames[--profile.frameCount];
+    ProfileEntry* e = &profile.entries[frame->entry];
+    --e->active;
+    if (profile.frameCount > 1) {
+        ProfileSampleNext();
+    }
+    if (profile.frameCount != 0) {
+        return;
+    }
+    const uint64_t elapsed = ProfileTicks() - frame->start;
+    const uint64_t self =
+      elapsed > frame->children ? elapsed - frame->children : 0;
+    ProfileNode* node = &profile.nodes[frame->node];
+    node->self += self;
+    node->wall += elapsed;
+    node->cpu += ProfileClock(CLOCK_THREAD_CPUTIME_ID) - frame->cpu;
+}
+
+static inline uint64_t
+ProfileNodeTotal(const uint32_t index)
+{
+    const ProfileNode* node = &profile.nodes[index];
+    uint64_t total = node->self;
+    for (uint32_t i = node->child; i != 0; i = profile.nodes[i - 1U].sibling) {
+        total += ProfileNodeTotal(i - 1U);
+    }
+    return total;
+}
+
+// Scales the measured times under the node and adds them to the entries.
+// Returns the time under the node
+static inline uint64_t
+ProfileAddTotals(const uint32_t index,
+                 const double scale,
+                 const double cpuPerTick)
+{
+    ProfileNode* node = &profile.nodes[index];
+    node->self = (uint64_t)((double)node->self * scale);
+    uint64_t total = node->self;
+    for (uint32_t i = node->child; i != 0; i = profile.nodes[i - 1U].sibling) {
+        total += ProfileAddTotals(i - 1U, scale, cpuPerTick);
+    }
+    // An entry is never under another node of the same entry
+    ProfileEntry* e = &profile.entries[node->entry];
+    e->self += node->self;
+    e->wall += total;
+    e->cpu += (uint64_t)((double)total * cpuPerTick);
+    return total;
+}
+
+// Calls measured under a top level instruction can add up to a little more
+// than the instruction took since reading the clock slows down the calls it is
+// read around. They are scaled to the time the instruction spent in calls
+static inline void
+ProfileTotals()
+{
+    if (profile.nodeCount == 0) {
+        return;
+    }
+    const ProfileNode* root = &profile.nodes[0];
+    for (uint32_t i = root->child; i != 0; i = profile.nodes[i - 1U].sibling) {
+        const ProfileNode* node = &profile.nodes[i - 1U];
+        const uint64_t measured = ProfileNodeTotal(i - 1U) - node->self;
+        const double scale =
+          measured == 0
+            ? 1.0
+            : (double)(node->wall - node->self) / (double)measured;
+        const double cpuPerTick =
+          node->wall == 0 ? 0.0 : (double)node->cpu / (double)node->wall;
+        for (uint32_t j = node->child; j != 0;
+             j = profile.nodes[j - 1U].sibling) {
+            ProfileAddTotals(j - 1U, scale, cpuPerTick);
+        }
+        ProfileEntry* e = &profile.entries[node->entry];
+        e->self += node->self;
+        e->wall += node->wall;
+        e->cpu += node->cpu;
+    }
+}
+
+// Timed entries by self time and then counted ones by count
+static inline int
+ProfileCompareSelf(const void* a, const void* b)
+{
+    const ProfileEntry* x = &profile.entries[*(const uint32_t*)a];
+    const ProfileEntry* y = &profile.entries[*(const uint32_t*)b];
+    if (x->timed != y->timed) {
+        return x->timed ? -1 : 1;
+    }
+    if (x->self != y->self) {
+        return x->self < y->self ? 1 : -1;
+    }
+    return x->count < y->count ? 1 : x->count > y->count ? -1 : 0;
+}
+
+static inline void
+ProfileWriteNode(FILE* file,
+                 const uint32_t index,
+                 uint32_t* path,
+                 const double scale)
+{
+    const ProfileNode* node = &profile.nodes[index];
+    if (node->self != 0) {
+        uint32_t depth = 0;
+        for (uint32_t i = index; i != 0; i = profile.nodes[i].parent) {
+            path[depth++] = profile.nodes[i].entry;
+        }
+        while (depth != 0) {
+            fputs(profile.entries[path[--depth]].name, file);
+            fputc(depth == 0 ? ' ' : ';', file);
+        }
+        fprintf(file, "%.0f\n", (double)node->self * scale);
+    }
+    for (uint32_t i = node->child; i != 0; i = profile.nodes[i - 1U].sibling) {
+        ProfileWriteNode(file, i - 1U, path, scale);
+    }
+}
+
+// Returns the indices of the entries sorted by self time
+static inline uint32_t*
+ProfileSortEntries()
+{
+    uint32_t* order =
+      profile.allocator.allocate(sizeof(uint32_t) * profile.entryCount);
+    if (order == NULL) {
+        return NULL;
+    }
+    for (uint32_t i = 0; i < profile.entryCount; ++i) {
+        order[i] = i;
+    }
+    qsort(order, profile.entryCount, sizeof(uint32_t), ProfileCompareSelf);
+    return order;
+}
+
+// Writes every stack to the output file in the folded format that flame graph
+// tools read
+static inline bool
+ProfileWriteFolded(const double scale)
+{
+    FILE* file = fopen(profileOutput, "w");
+    if (file == NULL) {
+        TemLangError("Failed to open profile output '%s': %s",
+                     profileOutput,
+                     strerror(errno));
+        return false;
+    }
+    if (profile.nodeCount != 0) {
+        uint32_t path[PROFILE_MAX_DEPTH];
+        ProfileWriteNode(file, 0, path, scale);
+    }
+    fclose(file);
+    return true;
+}
+
+// Prints the entries with the most self time and writes the folded stacks
+static inline bool
+ProfileReport(const size_t top)
+{
+    if (!profileEnabled || profile.entryCount == 0) {
+        return true;
+    }
+    const uint64_t ticks = ProfileTicks() - profile.startTicks;
+    const uint64_t nanoseconds =
+      ProfileClock(CLOCK_MONOTONIC) - profile.startNanoseconds;
+    const double nanosecondsPerTick =
+      ticks == 0 ? 1.0 : (double)nanoseconds / (double)ticks;
+
+    ProfileTotals();
+    uint32_t* order = ProfileSortEntries();
+    if (order == NULL) {
+        return false;
+    }
+    fprintf(stderr,
+            "%13s %13s %13s %10s  %s\n",
+            "wall self ms",
+            "wall total ms",
+            "cpu total ms",
+            "count",
+            "location");
+    for (uint32_t i = 0; i < profile.entryCount && i < top; ++i) {
+        const ProfileEntry* e = &profile.entries[order[i]];
+        if (!e->timed) {
+            fprintf(stderr,
+                    "%13s %13s %13s %10" PRIu64 "  %s\n",
+                    "-",
+                    "-",
+                    "-",
+                    e->count,
+                    e->name);
+            continue;
+        }
+        fprintf(stderr,
+                "%13.3f %13.3f %13.3f %10" PRIu64 "  %s\n",
+                (double)e->self * nanosecondsPerTick / 1e6,
+                (double)e->wall * nanosecondsPerTick / 1e6,
+                (double)e->cpu / 1e6,
+                e->count,
+                e->name);
+    }
+    profile.allocator.free(order);
+    return ProfileWriteFolded(nanosecondsPerTick);
+}
+
+static inline void
+ProfileFree()
+{
+    if (profile.allocator.free == NULL) {
+        return;
+    }
+    for (uint32_t i = 0; i < profile.entryCount; ++i) {
+        profile.allocator.free(profile.entries[i].name);
+    }
+    void* buffers[] = {
+        profile.entries, profile.nodes, profile.keys, profile.frames
+    };
+    for (size_t i = 0; i < sizeof(buffers) / sizeof(void*); ++i) {
+        if (buffers[i] != NULL) {
+            profile.allocator.free(buffers[i]);
+        }
+    }
+    memset(&profile, 0, sizeof(Profile));
+    profileEnabled = false;
+}
@@ -4,6 +4,7 @@
 #include "ComparisonOperator.h"
 #include "Number.h"
 #include "NumberOperator.h"
+#include "Parallel.h"
 
 #include <float.h>
 
@@ -59,18 +60,106 @@ numberNotInRangeError(const Number* n,
     TemLangStringFree(&b);
 }
 
+// Ranges are interned so a ranged number only holds a pointer. There is one
+// per range definition, number type and iterated length so they are kept
+// until the program exits
+typedef struct RangeTable
+{
+    Range** slots;
+    size_t used;
+    size_t size;
+} RangeTable, *pRangeTable;
+
+static RangeTable rangeTable = { 0 };
+
+static inline bool
+NumbersIdentical(const Number* a, const Number* b)
+{
+    return a->type == b->type && a->u == b->u;
+}
+
+static inline size_t
+RangeHash(const Range* r)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    const uint64_t parts[] = { r->min.type, r->min.u, r->max.type, r->max.u };
+    for (size_t i = 0; i < sizeof(parts) / sizeof(uint64_t); ++i) {
+        hash = (hash ^ parts[i]) * 1099511628211ULL;
+    }
+    return (size_t)(hash ^ (hash >> 32));
+}
+
+static inline bool
+RangeTableGrow(RangeTable* t)
+{
+    const size_t size = t->size == 0 ? 64U : t->size * 2U;
+    Range** slots = zmalloc(sizeof(Range*) * size);
+    if (slots == NULL) {
+        return false;
+    }
+    for (size_t i = 0; i < t->size; ++i) {
+        if (t->slots[i] == NULL) {
+            continue;
+        }
+        size_t j = RangeHash(t->slots[i]) & (size - 1U);
+        while (slots[j] != NULL) {
+            j = (j + 1U) & (size - 1U);
+        }
+        slots[j] = t->slots[i];
+    }
+    free(t->slots);
+    t->slots = slots;
+    t->size = size;
+    return true;
+}
+
+static inline const Range*
+RangeTableIntern(const Range* r)
+{
+    RangeTable* t = &rangeTable;
+    if ((t->used + 1U) * 2U > t->size && !RangeTableGrow(t)) {
+        return NULL;
+    }
+    size_t i = RangeHash(r) & (t->size - 1U);
+    for (; t->slots[i] != NULL; i = (i + 1U) & (t->size - 1U)) {
+        const Range* found = t->slots[i];
+        if (NumbersIdentical(&found->min, &r->min) &&
+            NumbersIdentical(&found->max, &r->max)) {
+            return found;
+        }
+    }
+    Range* range = zmalloc(sizeof(Range));
+    if (range == NULL) {
+        return NULL;
+    }
+    *range = *r;
+    t->slots[i] = range;
+    ++t->used;
+    return range;
+}
+
+// Workers of a parallel iterate intern ranges too
+static inline const Range*
+RangeIntern(const Range* r)
+{
+    ParallelLock();
+    const Range* range = RangeTableIntern(r);
+    ParallelUnlock();
+    return range;
+}
+
 typedef struct RangedNumber
 {
-    Range range;
     Number number;
-    bool hasRange;
+    // Interned range the number must stay in. NULL if the number has no range
+    const Range* range;
 } RangedNumber, *pRangedNumber;
 
 static inline TemLangString
 RangedNumberToString(const RangedNumber* r, const Allocator* allocator)
 {
-    if (r->hasRange) {
-        TemLangString rStr = RangeToString(&r->range, allocator);
+    if (r->range != NULL) {
+        TemLangString rStr = RangeToString(r->range, allocator);
         TemLangString value = NumberToString(&r->number, allocator);
         TemLangStringCreateFormat(s,
                                   allocator,
@@ -88,7 +177,7 @@ RangedNumberToString(const RangedNumber* r, const Allocator* allocator)
 static inline bool
 RangedNumberValid(const RangedNumber* r)
 {
-    return r->hasRange ? numberInRange(&r->number, &r->range) : true;
+    return r->range == NULL || numberInRange(&r->number, r->range);
 }
 
 static inline Number
@@ -172,6 +261,31 @@ CTypeToTypeString(const CType t)
     }
 }
 
+static inline size_t
+CTypeSize(const CType t)
+{
+    switch (t) {
+        case CType_bool:
+            return sizeof(bool);
+        case CType_i8:
+        case CType_u8:
+            return sizeof(uint8_t);
+        case CType_i16:
+        case CType_u16:
+            return sizeof(uint16_t);
+        case CType_i32:
+        case CType_u32:
+        case CType_f32:
+            return sizeof(uint32_t);
+        case CType_i64:
+        case CType_u64:
+        case CType_f64:
+            return sizeof(uint64_t);
+        default:
+            return 0;
+    }
+}
+
 static inline Keyword
 CTypeToKeyword(const CType t)
 {
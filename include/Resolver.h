@@ -0,0 +1,467 @@
+#pragma once
+
+#include "Instruction.h"
+
+// Static pass that gives variable expressions and capture lists the
+// (depth, slot) address of the atom they will find at runtime. Addresses are
+// only filled in when the scope layout is known. Everything else is left
+// unresolved and looked up by name (i.e. the top level of the REPL, inlined
+// instructions and the parent scopes of functions and procedures).
+
+typedef struct ResolverName
+{
+    TemLangString name;
+    // Same encoding as VariableAddress::slot
+    uint32_t slot;
+    bool owned;
+} ResolverName, *pResolverName;
+
+static inline void
+ResolverNameFree(ResolverName* n)
+{
+    if (n->owned) {
+        TemLangStringFree(&n->name);
+    }
+    memset(n, 0, sizeof(ResolverName));
+}
+
+static inline bool
+ResolverNameCopy(ResolverName* dest,
+                 const ResolverName* src,
+                 const Allocator* allocator)
+{
+    ResolverNameFree(dest);
+    dest->slot = src->slot;
+    dest->owned = src->owned;
+    if (src->owned) {
+        return TemLangStringCopy(&dest->name, &src->name, allocator);
+    }
+    dest->name = src->name;
+    return true;
+}
+
+MAKE_LIST(ResolverName);
+DEFAULT_MAKE_LIST_FUNCTIONS(ResolverName);
+
+typedef struct ResolverScope
+{
+    // First name of this scope in Resolver::names
+    uint32_t names;
+    // Number of atoms that will be in the state at this point
+    uint32_t atoms;
+    // False once the number of atoms can't be known before running
+    bool slotsKnown;
+    // True if the state may contain atoms that the resolver doesn't know about
+    bool dynamic;
+    // True if the parent of the state is the enclosing scope
+    bool linked;
+} ResolverScope, *pResolverScope;
+
+MAKE_COPY_AND_FREE(ResolverScope);
+MAKE_LIST(ResolverScope);
+DEFAULT_MAKE_LIST_FUNCTIONS(ResolverScope);
+
+typedef struct Resolver
+{
+    ResolverNameList names;
+    ResolverScopeList scopes;
+} Resolver, *pResolver;
+
+static inline void
+ResolverFree(Resolver* r)
+{
+    ResolverNameListFree(&r->names);
+    ResolverScopeListFree(&r->scopes);
+}
+
+static inline ResolverScope*
+ResolverCurrentScope(Resolver* r)
+{
+    return &r->scopes.buffer[r->scopes.used - 1];
+}
+
+static inline bool
+ResolverPushScope(Resolver* r, const bool linked, const bool dynamic)
+{
+    const ResolverScope scope = { .names = r->names.used,
+                                  .atoms = 0,
+                                  .slotsKnown = !dynamic,
+                                  .dynamic = dynamic,
+                                  .linked = linked };
+    return ResolverScopeListAppend(&r->scopes, &scope);
+}
+
+static inline void
+ResolverRestoreScope(Resolver* r, const ResolverScope* saved)
+{
+    while (r->names.used > saved->names) {
+        ResolverNameListPop(&r->names);
+    }
+}
+
+static inline void
+ResolverPopScope(Resolver* r)
+{
+    ResolverRestoreScope(r, ResolverCurrentScope(r));
+    ResolverScopeListPop(&r->scopes);
+}
+
+static inline bool
+ResolverAddAtom(Resolver* r,
+                const TemLangString* name,
+                const bool owned,
+                const bool slotKnown)
+{
+    ResolverScope* scope = ResolverCurrentScope(r);
+    ResolverName n = { .name = *name,
+                       .slot = scope->slotsKnown && slotKnown
+                                 ? scope->atoms + 1U
+                                 : 0U,
+                       .owned = owned };
+    ++scope->atoms;
+    // List append copies the name. So only the original has to be freed
+    const bool result = ResolverNameListAppend(&r->names, &n);
+    if (owned) {
+        TemLangStringFree(&n.name);
+    }
+    return result;
+}
+
+static inline bool
+ResolverAdd(Resolver* r, const TemLangString* name)
+{
+    return ResolverAddAtom(r, name, false, true);
+}
+
+static inline VariableAddress
+ResolverFind(const Resolver* r, const TemLangString* name)
+{
+    const VariableAddress unresolved = { 0 };
+    VariableAddress address = { 0 };
+    uint32_t end = r->names.used;
+    for (uint32_t i = r->scopes.used; i > 0; --i) {
+        const ResolverScope* scope = &r->scopes.buffer[i - 1];
+        for (uint32_t j = end; j > scope->names; --j) {
+            const ResolverName* n = &r->names.buffer[j - 1];
+            if (TemLangStringsAreEqual(&n->name, name)) {
+                if (n->slot == 0) {
+                    return unresolved;
+                }
+                address.slot = n->slot;
+                return address;
+            }
+        }
+        if (scope->dynamic || !scope->linked) {
+            break;
+        }
+        end = scope->names;
+        ++address.depth;
+    }
+    return unresolved;
+}
+
+static inline bool
+ResolveInstructionList(Resolver*, InstructionList*);
+
+static inline bool
+ResolveExpression(Resolver*, Expression*);
+
+static inline bool
+ResolveScopedInstructions(Resolver* r, InstructionList* list)
+{
+    if (!ResolverPushScope(r, true, false)) {
+        return false;
+    }
+    const bool result = ResolveInstructionList(r, list);
+    ResolverPopScope(r);
+    return result;
+}
+
+static inline bool
+ResolveCaptures(Resolver* r,
+                const TemLangStringList* captures,
+                uint32_tList* slots,
+                const Allocator* allocator)
+{
+    // Captures are looked up in the enclosing scope and then added to the
+    // new one
+    uint32_tListFree(slots);
+    slots->allocator = allocator;
+    for (size_t i = 0; i < captures->used; ++i) {
+        const VariableAddress address =
+          ResolverFind(r, &captures->buffer[i]);
+        const uint32_t slot = address.depth == 0 ? address.slot : 0U;
+        if (!uint32_tListAppend(slots, &slot)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static inline bool
+ResolverAddCaptures(Resolver* r, const TemLangStringList* captures)
+{
+    for (size_t i = 0; i < captures->used; ++i) {
+        if (!ResolverAdd(r, &captures->buffer[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static inline bool
+ResolveBranch(Resolver* r, Branch* branch)
+{
+    switch (branch->type) {
+        case MatchBranchType_Instructions:
+            return ResolveInstructionList(r, &branch->instructions);
+        case MatchBranchType_Expression:
+            return ResolveExpression(r, &branch->expression);
+        default:
+            return true;
+    }
+}
+
+static inline bool
+ResolveMatchExpression(Resolver* r, MatchExpression* m)
+{
+    if (!ResolveExpression(r, &m->matcher)) {
+        return false;
+    }
+    for (size_t i = 0; i < m->branches.used; ++i) {
+        MatchBranch* branch = &m->branches.buffer[i];
+        if (!ResolveExpression(r, &branch->matcher)) {
+            return false;
+        }
+        // Only one branch runs. So every branch starts from the same scope
+        const ResolverScope saved = *ResolverCurrentScope(r);
+        if (branch->matcher.type == ExpressionType_UnaryVariable) {
+            // Variant matches add the member as a variable. Other values don't
+            if (!ResolverAddAtom(
+                  r, &branch->matcher.identifier, false, false)) {
+                return false;
+            }
+            ResolverCurrentScope(r)->slotsKnown = false;
+        }
+        const bool result = ResolveBranch(r, &branch->branch);
+        ResolverRestoreScope(r, &saved);
+        *ResolverCurrentScope(r) = saved;
+        if (!result) {
+            return false;
+        }
+    }
+    const ResolverScope saved = *ResolverCurrentScope(r);
+    const bool result = ResolveBranch(r, &m->defaultBranch);
+    ResolverRestoreScope(r, &saved);
+    *ResolverCurrentScope(r) = saved;
+    return result;
+}
+
+static inline bool
+ResolveExpression(Resolver* r, Expression* e)
+{
+    switch (e->type) {
+        case ExpressionType_UnaryVariable:
+            e->address = ResolverFind(r, &e->identifier);
+            return true;
+        case ExpressionType_UnaryScope:
+        case ExpressionType_UnaryStruct:
+            return ResolveScopedInstructions(r, &e->instructions);
+        case ExpressionType_UnaryMatch: {
+            if (!ResolverPushScope(r, true, false)) {
+                return false;
+            }
+            const bool result = ResolveMatchExpression(r, e->matchExpression);
+            ResolverPopScope(r);
+            return result;
+        }
+        case ExpressionType_UnaryList:
+            for (size_t i = 0; i < e->expressions.used; ++i) {
+                if (!ResolveExpression(r, &e->expressions.buffer[i])) {
+                    return false;
+                }
+            }
+            return true;
+        case ExpressionType_Binary:
+            return ResolveExpression(r, e->left) &&
+                   ResolveExpression(r, e->right);
+        default:
+            return true;
+    }
+}
+
+static inline bool
+ResolveFunctionDefinition(Resolver* r, FunctionDefinition* f)
+{
+    // Functions run in a state whose parent is the caller. So only the
+    // parameters and local variables can be resolved
+    if (!ResolverPushScope(r, false, false)) {
+        return false;
+    }
+    bool result = true;
+    switch (f->type) {
+        case FunctionType_Unary:
+            result = ResolverAdd(r, &f->leftParameter);
+            break;
+        case FunctionType_Binary:
+            result = ResolverAdd(r, &f->leftParameter) &&
+                     ResolverAdd(r, &f->rightParameter);
+            break;
+        case FunctionType_Procedure:
+            result = ResolverAddCaptures(r, &f->captures);
+            break;
+        default:
+            break;
+    }
+    result = result && ResolveInstructionList(r, &f->instructions);
+    ResolverPopScope(r);
+    return result;
+}
+
+static inline bool
+ResolveInstruction(Resolver* r, Instruction* i, const Allocator* allocator)
+{
+    if (!InstructionTypeCanBeExecuted(i->type)) {
+        return true;
+    }
+    switch (i->type) {
+        case InstructionType_NoCompile:
+            return ResolveInstructionList(r, &i->instructions);
+        case InstructionType_Return:
+        case InstructionType_Inline:
+        case InstructionType_InlineFile:
+            if (!ResolveExpression(r, &i->expression)) {
+                return false;
+            }
+            if (i->type != InstructionType_Return) {
+                ResolverCurrentScope(r)->dynamic = true;
+                ResolverCurrentScope(r)->slotsKnown = false;
+            }
+            return true;
+        case InstructionType_IfReturn:
+            return ResolveExpression(r, &i->ifCondition) &&
+                   ResolveExpression(r, &i->ifResult);
+        case InstructionType_CreateVariable:
+            return ResolveExpression(r, &i->createVariable.value) &&
+                   ResolverAdd(r, &i->createVariable.name);
+        case InstructionType_UpdateVariable:
+            return ResolveExpression(r, &i->updateVariable.target) &&
+                   ResolveExpression(r, &i->updateVariable.value);
+        case InstructionType_DefineRange:
+            return ResolveExpression(r, &i->defineRange.min) &&
+                   ResolveExpression(r, &i->defineRange.max) &&
+                   ResolverAdd(r, &i->defineRange.name);
+        case InstructionType_DefineEnum: {
+            if (!ResolverAdd(r, &i->defineEnum.name)) {
+                return false;
+            }
+            TemLangString length = { .allocator = allocator };
+            TemLangStringAppendFormat(
+              length, "%s_Length", i->defineEnum.name.buffer);
+            return ResolverAddAtom(r, &length, true, true);
+        }
+        case InstructionType_DefineStruct:
+            return ResolverAdd(r, &i->defineStruct.name);
+        case InstructionType_DefineFunction:
+            return ResolverAdd(r, &i->functionName) &&
+                   ResolveFunctionDefinition(r, &i->functionDefinition);
+        case InstructionType_ChangeFlag:
+            return ResolveExpression(r, &i->changeFlag.target);
+        case InstructionType_SetAllFlag:
+            return ResolveExpression(r, &i->setAllFlag.target);
+        case InstructionType_ListModify:
+            return ResolveExpression(r, &i->listModify.list) &&
+                   ResolveExpression(r, &i->listModify.newValue[0]) &&
+                   ResolveExpression(r, &i->listModify.newValue[1]);
+        case InstructionType_While:
+        case InstructionType_Until:
+        case InstructionType_Iterate: {
+            CaptureInstruction* c = &i->captureInstruction;
+            if (!ResolveExpression(r, &c->target) ||
+                !ResolveCaptures(
+                  r, &c->captures, &c->captureSlots, allocator) ||
+                !ResolverPushScope(r, true, false) ||
+                !ResolverAddCaptures(r, &c->captures)) {
+                return false;
+            }
+            bool result = true;
+            if (i->type == InstructionType_Iterate) {
+                // The order of these depends on what is being iterated
+                static const TemLangString item = { .buffer = "item",
+                                                    .used = 4,
+                                                    .size = 5 };
+                static const TemLangString index = { .buffer = "index",
+                                                     .used = 5,
+                                                     .size = 6 };
+                result = ResolverAddAtom(r, &item, false, false) &&
+                         ResolverAddAtom(r, &index, false, false);
+            }
+            result = result && ResolveInstructionList(r, &c->instructions);
+            ResolverPopScope(r);
+            return result;
+        }
+        case InstructionType_Match: {
+            MatchInstruction* m = &i->matchInstruction;
+            if (!ResolveCaptures(
+                  r, &m->captures, &m->captureSlots, allocator) ||
+                !ResolverPushScope(r, true, false) ||
+                !ResolverAddCaptures(r, &m->captures)) {
+                return false;
+            }
+            const bool result = ResolveMatchExpression(r, &m->expression);
+            ResolverPopScope(r);
+            return result;
+        }
+        case InstructionType_Print:
+        case InstructionType_Error:
+            for (size_t j = 0; j < i->printExpressions.used; ++j) {
+                if (!ResolveExpression(r, &i->printExpressions.buffer[j])) {
+                    return false;
+                }
+            }
+            return true;
+        case InstructionType_ConvertContainer:
+            return ResolveExpression(r, &i->fromContainer) &&
+                   ResolverAdd(r, &i->toContainer);
+        case InstructionType_InlineVariable:
+            return ResolverAdd(r, &i->definitionName);
+        case InstructionType_InlineText:
+        case InstructionType_InlineData:
+            return ResolveExpression(r, &i->dataFile) &&
+                   ResolverAdd(r, &i->dataName);
+        case InstructionType_Format:
+            return ResolveExpression(r, &i->formatArgs) &&
+                   ResolverAdd(r, &i->formatName);
+        case InstructionType_NumberRound:
+            return ResolveExpression(r, &i->numberRoundTarget) &&
+                   ResolverAdd(r, &i->numberRoundName);
+        default:
+            return true;
+    }
+}
+
+static inline bool
+ResolveInstructionList(Resolver* r, InstructionList* list)
+{
+    for (size_t i = 0; i < list->used; ++i) {
+        if (!ResolveInstruction(r, &list->buffer[i], list->allocator)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Resolve instructions that will run in a state with unknown contents
+static inline bool
+ResolveInstructions(InstructionList* list, const Allocator* allocator)
+{
+    Resolver r = { .names = { .allocator = allocator },
+                   .scopes = { .allocator = allocator } };
+    const bool result =
+      ResolverPushScope(&r, false, true) && ResolveInstructionList(&r, list);
+    ResolverFree(&r);
+    if (!result) {
+        TemLangError("Failed to resolve variables");
+    }
+    return result;
+}
@@ -0,0 +1,248 @@
+#pragma once
+
+#include "Parallel.h"
+#include "Profile.h"
+
+#if __EMSCRIPTEN__
+#define SAMPLER_SIGNALS 0
+#else
+#define SAMPLER_SIGNALS 1
+#include <signal.h>
+#include <sys/time.h>
+#endif
+
+// Samples what the main thread is running on a CPU time timer. The
+// interpreter keeps a shadow stack of the instructions and functions it is in
+// and the signal handler only records how deep that stack was. Frames below
+// that depth can't change until they are popped so the samples are added up
+// before every pop. Samples are kept in the tables of the profiler so it can't
+// be used at the same time.
+
+#define SAMPLER_DEFAULT_INTERVAL 1000U
+// Always a power of 2
+#define SAMPLER_RING_SIZE 1024U
+
+typedef struct SamplerFrame
+{
+    const void* key;
+    // Name of the function or NULL for an instruction
+    const TemLangString* name;
+} SamplerFrame, *pSamplerFrame;
+
+static bool samplerEnabled = false;
+// Microseconds of CPU time between samples
+static size_t samplerInterval = SAMPLER_DEFAULT_INTERVAL;
+
+static SamplerFrame samplerStack[PROFILE_MAX_DEPTH];
+static volatile uint32_t samplerDepth = 0;
+// Depth of the stack for each sample. Only the signal handler writes the head
+// and only the main thread writes the tail.
+static uint32_t samplerRing[SAMPLER_RING_SIZE];
+static uint32_t samplerHead = 0;
+static uint32_t samplerTail = 0;
+static volatile uint64_t samplerDropped = 0;
+static uint64_t samplerCount = 0;
+static uint32_t samplerOther = PROFILE_NONE;
+
+static inline void
+SamplerSignal(int signal)
+{
+    (void)signal;
+    const uint32_t head = __atomic_load_n(&samplerHead, __ATOMIC_RELAXED);
+    const uint32_t tail = __atomic_load_n(&samplerTail, __ATOMIC_ACQUIRE);
+    if (head - tail >= SAMPLER_RING_SIZE) {
+        samplerDropped = samplerDropped + 1U;
+        return;
+    }
+    samplerRing[head & (SAMPLER_RING_SIZE - 1U)] = samplerDepth;
+    __atomic_store_n(&samplerHead, head + 1U, __ATOMIC_RELEASE);
+}
+
+static inline void
+SamplerAdd(const uint32_t sampleDepth)
+{
+    if (!ProfileRoot()) {
+        return;
+    }
+    ++samplerCount;
+    uint32_t node = 0;
+    uint32_t entry = samplerOther;
+    const uint32_t depth = MIN(sampleDepth, PROFILE_MAX_DEPTH);
+    for (uint32_t i = 0; i < depth; ++i) {
+        const SamplerFrame* frame = &samplerStack[i];
+        entry = frame->name == NULL
+                  ? ProfileInstructionEntry((const Instruction*)frame->key)
+                  : ProfileFunctionEntry((const FunctionDefinition*)frame->key,
+                                         frame->name);
+        if (entry == PROFILE_NONE) {
+            return;
+        }
+        // Recursive entries are only counted once per sample
+        ProfileEntry* e = &profile.entries[entry];
+        if (e->pending != samplerCount) {
+            e->pending = samplerCount;
+            ++e->wall;
+        }
+        node = ProfileNodeFindOrAdd(node, entry);
+        if (node == PROFILE_NONE) {
+            return;
+        }
+    }
+    if (depth == 0) {
+        // Lexing, parsing and anything else not under an instruction
+        if (samplerOther == PROFILE_NONE) {
+            char* name = profile.allocator.allocate(sizeof("[interpreter]"));
+            if (name == NULL) {
+                return;
+            }
+            memcpy(name, "[interpreter]", sizeof("[interpreter]"));
+            samplerOther = ProfileEntryFindOrAdd(name);
+        }
+        entry = samplerOther;
+        if (entry == PROFILE_NONE) {
+            return;
+        }
+        ++profile.entries[entry].wall;
+        node = ProfileNodeFindOrAdd(0, entry);
+        if (node == PROFILE_NONE) {
+            return;
+        }
+    }
+    ++profile.entries[entry].self;
+    ++profile.nodes[node].self;
+}
+
+static inline void
+SamplerDrain()
+{
+    const uint32_t head = __atomic_load_n(&samplerHead, __ATOMIC_ACQUIRE);
+    uint32_t tail = samplerTail;
+    for (; tail != head; ++tail) {
+        SamplerAdd(samplerRing[tail & (SAMPLER_RING_SIZE - 1U)]);
+    }
+    __atomic_store_n(&samplerTail, tail, __ATOMIC_RELEASE);
+}
+
+static inline void
+SamplerPush(const void* key, const TemLangString* name)
+{
+    if (!samplerEnabled || parallelWorker) {
+        return;
+    }
+    const uint32_t depth = samplerDepth;
+    if (depth < PROFILE_MAX_DEPTH) {
+        samplerStack[depth].key = key;
+        samplerStack[depth].name = name;
+    }
+    __atomic_signal_fence(__ATOMIC_RELEASE);
+    samplerDepth = depth + 1U;
+}
+
+static inline void
+SamplerPop()
+{
+    if (!samplerEnabled || parallelWorker) {
+        return;
+    }
+    // The popped frame is still there for samples taken before this
+    samplerDepth = samplerDepth - 1U;
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&samplerHead, __ATOMIC_RELAXED) != samplerTail) {
+        SamplerDrain();
+    }
+}
+
+#if SAMPLER_SIGNALS
+
+static inline bool
+SamplerStart(const char* output)
+{
+    ProfileInit(output);
+    struct sigaction action = { 0 };
+    action.sa_handler = SamplerSignal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, NULL) != 0) {
+        TemLangError("Failed to set sampling signal handler: %s",
+                     strerror(errno));
+        return false;
+    }
+    const size_t interval = samplerInterval == 0 ? 1U : samplerInterval;
+    struct itimerval timer = { 0 };
+    timer.it_interval.tv_sec = interval / 1000000U;
+    timer.it_interval.tv_usec = interval % 1000000U;
+    timer.it_value = timer.it_interval;
+    samplerEnabled = true;
+    if (setitimer(ITIMER_PROF, &timer, NULL) != 0) {
+        TemLangError("Failed to start sampling timer: %s", strerror(errno));
+        samplerEnabled = false;
+        return false;
+    }
+    return true;
+}
+
+static inline void
+SamplerStop()
+{
+    const struct itimerval timer = { 0 };
+    setitimer(ITIMER_PROF, &timer, NULL);
+    signal(SIGPROF, SIG_IGN);
+}
+
+#else
+
+static inline bool
+SamplerStart(const char* output)
+{
+    (void)output;
+    TemLangError("Sampling is not supported on this platform");
+    return false;
+}
+
+static inline void
+SamplerStop()
+{
+}
+
+#endif
+
+// Prints the lines with the most samples and writes the folded stacks
+static inline bool
+SamplerReport(const size_t top)
+{
+    if (!samplerEnabled) {
+        return true;
+    }
+    SamplerStop();
+    SamplerDrain();
+    samplerEnabled = false;
+    fprintf(stderr,
+            "Samples: %" PRIu64 " every %zu us, %" PRIu64 " dropped\n",
+            samplerCount,
+            samplerInterval,
+            (uint64_t)samplerDropped);
+    if (samplerCount == 0) {
+        return true;
+    }
+    uint32_t* order = ProfileSortEntries();
+    if (order == NULL) {
+        return false;
+    }
+    fprintf(stderr,
+            "%10s %10s %10s  %s\n",
+            "self %",
+            "total %",
+            "samples",
+            "location");
+    for (uint32_t i = 0; i < profile.entryCount && i < top; ++i) {
+        const ProfileEntry* e = &profile.entries[order[i]];
+        fprintf(stderr,
+                "%10.2f %10.2f %10" PRIu64 "  %s\n",
+                (double)e->self * 100.0 / (double)samplerCount,
+                (double)e->wall * 100.0 / (double)samplerCount,
+                e->self,
+                e->name);
+    }
+    profile.allocator.free(order);
+    return ProfileWriteFolded(1.0);
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+#include "Allocator.h"
+#include "Parallel.h"
+
+// The states made for scopes, loops, matches and runs allocate their atoms
+// from a bump region that is reset when the state is freed instead of freeing
+// every name and value one at a time. Only memory that is copied whenever a
+// value leaves a state is put there (atom lists, names, strings, flags and
+// types). Payloads that values share are allocated with the allocator the
+// region came from so nothing outside of a scope can point into it.
+
+#define SCOPE_ARENA_DEFAULT_SIZE MB(1)
+
+static ArenaAllocator scopeArena = { .name = "scope" };
+// Allocations that don't fit in the region are passed on to this
+static const Allocator* scopeArenaParent = NULL;
+static Allocator scopeArenaAllocator = { 0 };
+
+static inline bool
+ScopeArenaOwns(const void* data)
+{
+    const uint8_t* p = (const uint8_t*)data;
+    return p >= scopeArena.buffer &&
+           p < scopeArena.buffer + scopeArena.totalSize;
+}
+
+// Each allocation is preceded by its size so it can be copied when it has to
+// be moved to grow
+static inline void*
+ScopeArenaAllocate(const size_t size)
+{
+    const uintptr_t current = (uintptr_t)scopeArena.buffer + scopeArena.used;
+    const size_t start = alignForward(current, ALLOCATOR_ALIGNMENT) -
+                         (uintptr_t)scopeArena.buffer;
+    if (start + ALLOCATOR_ALIGNMENT + size > scopeArena.totalSize) {
+        return scopeArenaParent->allocate(size);
+    }
+    uint8_t* block =
+      ArenaAllocatorAllocate(&scopeArena, ALLOCATOR_ALIGNMENT + size);
+    *(size_t*)block = size;
+    return block + ALLOCATOR_ALIGNMENT;
+}
+
+static inline void*
+ScopeArenaReallocate(void* data, const size_t size)
+{
+    if (data == NULL) {
+        return ScopeArenaAllocate(size);
+    }
+    if (!ScopeArenaOwns(data)) {
+        return scopeArenaParent->reallocate(data, size);
+    }
+    uint8_t* block = (uint8_t*)data - ALLOCATOR_ALIGNMENT;
+    const size_t oldSize = *(size_t*)block;
+    const size_t end =
+      (size_t)(block - scopeArena.buffer) + ALLOCATOR_ALIGNMENT;
+    if (block == scopeArena.previousAllocation &&
+        end + size <= scopeArena.totalSize) {
+        scopeArena.used = end + size;
+        scopeArena.previousAllocationSize = ALLOCATOR_ALIGNMENT + size;
+        *(size_t*)block = size;
+        return data;
+    }
+    void* newData = ScopeArenaAllocate(size);
+    if (newData != NULL) {
+        memcpy(newData, data, MIN(oldSize, size));
+    }
+    return newData;
+}
+
+static inline void
+ScopeArenaFree(void* data)
+{
+    if (data == NULL) {
+        return;
+    }
+    if (!ScopeArenaOwns(data)) {
+        scopeArenaParent->free(data);
+        return;
+    }
+    // The last allocation can be taken back right away
+    uint8_t* block = (uint8_t*)data - ALLOCATOR_ALIGNMENT;
+    if (block == scopeArena.previousAllocation) {
+        scopeArena.used = (size_t)(block - scopeArena.buffer);
+        scopeArena.previousAllocation = NULL;
+        scopeArena.previousAllocationSize = 0;
+    }
+}
+
+static inline size_t
+ScopeArenaUsed()
+{
+    return scopeArena.used;
+}
+
+static inline size_t
+ScopeArenaTotalSize()
+{
+    return scopeArena.totalSize;
+}
+
+static inline bool
+ScopeArenaStart(const Allocator* allocator, const size_t size)
+{
+    if (size == 0) {
+        return true;
+    }
+    scopeArena.buffer = allocator->allocate(size);
+    if (scopeArena.buffer == NULL) {
+        return false;
+    }
+    scopeArena.totalSize = size;
+    arenaAllocatorReset(&scopeArena);
+    scopeArenaParent = allocator;
+    scopeArenaAllocator.allocate = ScopeArenaAllocate;
+    scopeArenaAllocator.reallocate = ScopeArenaReallocate;
+    scopeArenaAllocator.free = ScopeArenaFree;
+    scopeArenaAllocator.used = ScopeArenaUsed;
+    scopeArenaAllocator.totalSize = ScopeArenaTotalSize;
+    return true;
+}
+
+static inline void
+ScopeArenaStop()
+{
+    if (scopeArena.buffer == NULL) {
+        return;
+    }
+    scopeArenaParent->free(scopeArena.buffer);
+    scopeArena.buffer = NULL;
+    scopeArena.totalSize = 0;
+    arenaAllocatorReset(&scopeArena);
+}
+
+// Allocator for the atoms of a state made with the given allocator. Workers
+// keep using their own since the region isn't thread safe
+static inline const Allocator*
+ScopeArenaOr(const Allocator* allocator)
+{
+    return scopeArena.buffer != NULL && !parallelWorker &&
+               allocator == scopeArenaParent
+             ? &scopeArenaAllocator
+             : allocator;
+}
+
+// Allocator for payloads that may be shared past the end of a scope
+static inline const Allocator*
+ScopeArenaParentOr(const Allocator* allocator)
+{
+    return allocator == &scopeArenaAllocator ? scopeArenaParent : allocator;
+}
+
+static inline size_t
+ScopeArenaSave()
+{
+    return parallelWorker ? 0 : arenaAllocatorSaveState(&scopeArena);
+}
+
+static inline void
+ScopeArenaRestore(const size_t s)
+{
+    if (!parallelWorker) {
+        arenaAllocatorRestore(&scopeArena, s);
+    }
+}
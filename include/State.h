@@ -1,18 +1,24 @@
 #pragma once
 
 #include "Atom.h"
+#include "AtomIndex.h"
 #include "Error.h"
 #include "Expression.h"
+#include "Fold.h"
 #include "Instruction.h"
 #include "Lexer.h"
+#include "ListQueryType.h"
+#include "MatchTable.h"
+#include "Memoize.h"
 #include "ProcessTokensArgs.h"
+#include "Profile.h"
+#include "Resolver.h"
+#include "Sampler.h"
+#include "Trace.h"
 #include "Variable.h"
 
 #include <errno.h>
 
-MAKE_LIST(Atom)
-DEFAULT_MAKE_LIST_FUNCTIONS(Atom)
-
 typedef struct State State, *pState;
 
 extern int
@@ -21,22 +27,108 @@ REPL_print(const char*, ...);
 static inline NamedValueList
 StateToVariableList(const State* state, const Allocator* allocator);
 
+static inline bool
+StateToStructValues(State*, const Expression*, pStructValues, const Allocator*);
+
+static inline const Value*
+EvaluateMemberReference(const Expression*,
+                        const State*,
+                        pValue,
+                        const Allocator*);
+
+static inline bool
+StateUpdateReference(const Expression*, State*, const Value*, const Allocator*);
+
 static inline bool
 StructMemberToFakeValue(const StructMember* m,
                         const State* state,
                         const Allocator* allocator,
                         pNamedValue nv);
 
+// How a call to a function is run. See Jit.h
+typedef enum JitCall
+{
+    JitCall_Interpret,
+    JitCall_Native,
+    // Native result is compared with the interpreter's
+    JitCall_Verify
+} JitCall,
+  *pJitCall;
+
+static inline void
+JitFunctionDelete(struct JitFunction*);
+
+static JitCall
+JitFunctionCall(const FunctionDefinition*,
+                const TemLangString*,
+                const Value*,
+                const Value*,
+                const State*,
+                const Allocator*,
+                pValue);
+
+static void
+JitFunctionVerify(const FunctionDefinition*, const Value*, const Value*);
+
 typedef struct State
 {
     AtomList atoms;
+    AtomIndex index;
+    // Bumped by every change to atoms. The index is used only while it was
+    // built for the current generation
+    uint32_t generation;
     const State* parent;
+    // Number of leading atoms borrowed from the parent by CaptureVariables
+    uint32_t borrowed;
+    // Set when a return ends the state so returned variables can be moved
+    // out of it
+    bool movesReturns;
 } State, *pState;
 
+static inline int64_t
+StateFindAtomIndex(const State* state,
+                   const TemLangString* name,
+                   const uint32_t hash)
+{
+    return AtomIndexFind(
+      &state->index, &state->atoms, state->generation, name, hash);
+}
+
 static inline void
 StateFree(State* state)
 {
+    // Give borrowed variables back to the parent. It cannot change while this
+    // state is alive so its atoms are still where they were captured from
+    State* parent = (State*)state->parent;
+    for (uint32_t i = 0; i < state->borrowed; ++i) {
+        Atom* atom = &state->atoms.buffer[i];
+        const int64_t j = StateFindAtomIndex(parent, &atom->name, atom->hash);
+        if (j >= 0) {
+            parent->atoms.buffer[j].variable = atom->variable;
+        }
+        memset(atom, 0, sizeof(Atom));
+    }
+    state->borrowed = 0;
     AtomListFree(&state->atoms);
+    AtomIndexFree(&state->index);
+    ++state->generation;
+}
+
+// States made for a scope allocate their atoms from the scope arena. Returns
+// how much of it was used so StateFreeScope can reset it to that
+static inline size_t
+StateInitScope(State* state, const State* parent, const Allocator* allocator)
+{
+    state->parent = parent;
+    state->atoms.allocator = ScopeArenaOr(allocator);
+    return ScopeArenaSave();
+}
+
+static inline void
+StateFreeScope(State* state, const size_t arenaState)
+{
+    StateFree(state);
+    ScopeArenaRestore(arenaState);
 }
 
 static inline bool
@@ -48,7 +140,247 @@ StateCopy(State* dest, const State* src, const Allocator* allocator)
         dest->atoms.allocator = allocator;
         return true;
     }
-    return AtomListCopy(&dest->atoms, &src->atoms, allocator);
+    if (!AtomListCopy(&dest->atoms, &src->atoms, allocator)) {
+        return false;
+    }
+    ++dest->generation;
+    if (dest->atoms.used >= ATOM_INDEX_THRESHOLD) {
+        return AtomIndexRebuild(&dest->index, &dest->atoms, dest->generation);
+    }
+    return true;
+}
+
+// Call after the atoms were changed other than by appending to them
+static inline bool
+StateAtomsChanged(State* state)
+{
+    ++state->generation;
+    if (state->atoms.used >= ATOM_INDEX_THRESHOLD) {
+        return AtomIndexRebuild(
+          &state->index, &state->atoms, state->generation);
+    }
+    AtomIndexFree(&state->index);
+    return true;
+}
+
+// Call after an atom was appended
+static inline bool
+StateAtomAppended(State* state)
+{
+    pAtom atom = &state->atoms.buffer[state->atoms.used - 1U];
+    atom->hash = TemLangStringHash(&atom->name);
+    ++state->generation;
+    return AtomIndexUpdate(&state->index, &state->atoms, state->generation);
+}
+
+static inline bool
+StateAddAtom(State* state, const Atom* atom)
+{
+    return AtomListAppend(&state->atoms, atom) && StateAtomAppended(state);
+}
+
+// Appends the atom without copying it. The atom is left empty
+static inline bool
+StateAddAtomMove(State* state, pAtom atom)
+{
+    return AtomListAppendMove(&state->atoms, atom) && StateAtomAppended(state);
+}
+
+static inline bool
+StateRemoveAtom(State* state, const size_t i, const Allocator* allocator)
+{
+    return AtomListRemove(&state->atoms, i, allocator) &&
+           StateAtomsChanged(state);
+}
+
+// Appends the atom without copying it
+static inline bool
+StateTakeAtom(State* state, const Atom* atom)
+{
+    if (!AtomListRellocateIfNeeded(&state->atoms)) {
+        return false;
+    }
+    state->atoms.buffer[state->atoms.used++] = *atom;
+    return StateAtomAppended(state);
+}
+
+// Frees every atom after the first count atoms
+static inline bool
+StateTruncate(State* state, const size_t count)
+{
+    if (state->atoms.used <= count) {
+        return true;
+    }
+    while (state->atoms.used > count) {
+        AtomFree(&state->atoms.buffer[--state->atoms.used]);
+    }
+    return StateAtomsChanged(state);
+}
+
+// Loop variables are added on the first iteration and overwritten in place
+// after that
+static inline bool
+StateBindLoopVariable(State* state,
+                      const size_t slot,
+                      const char* name,
+                      const Value* value,
+                      const Allocator* allocator)
+{
+    if (slot < state->atoms.used) {
+        return ValueCopy(
+          &state->atoms.buffer[slot].variable.value, value, allocator);
+    }
+    Atom atom = { .type = AtomType_Variable,
+                  .variable = { .type = VariableType_Immutable } };
+    atom.name = TemLangStringCreate(name, allocator);
+    if (!ValueCopy(&atom.variable.value, value, allocator)) {
+        AtomFree(&atom);
+        return false;
+    }
+    return StateTakeAtom(state, &atom);
+}
+
+// Parameters keep their atom between calls. An argument that was evaluated
+// into storage is moved instead of copied
+static inline bool
+StateBindParameter(State* state,
+                   const size_t slot,
+                   const TemLangString* name,
+                   const Value* value,
+                   pValue storage,
+                   const Allocator* allocator)
+{
+    if (slot >= state->atoms.used) {
+        Atom atom = { .type = AtomType_Variable,
+                      .variable = { .type = VariableType_Immutable } };
+        if (!TemLangStringCopy(&atom.name, name, allocator) ||
+            !StateTakeAtom(state, &atom)) {
+            AtomFree(&atom);
+            return false;
+        }
+    } else if (!AtomNameEquals(&state->atoms.buffer[slot], name)) {
+        pAtom atom = &state->atoms.buffer[slot];
+        if (!TemLangStringCopy(&atom->name, name, allocator)) {
+            return false;
+        }
+        atom->hash = TemLangStringHash(name);
+        if (!StateAtomsChanged(state)) {
+            return false;
+        }
+    }
+    Value* dest = &state->atoms.buffer[slot].variable.value;
+    if (value != storage) {
+        return ValueCopy(dest, value, allocator);
+    }
+    ValueMove(dest, storage);
+    return true;
+}
+
+// Function calls run in frames that are kept between calls so each depth
+// only allocates its atoms and parameter names once
+#define CALL_STACK_DEFAULT_DEPTH 1000U
+// Frames are allocated this many at a time as calls get deeper. They are never
+// moved since the states of a call point to its frame
+#define CALL_STACK_CHUNK_FRAMES 64U
+
+typedef struct CallStack
+{
+    // Each chunk has CALL_STACK_CHUNK_FRAMES frames
+    State** chunks;
+    size_t chunkCount;
+    size_t used;
+    const Allocator* allocator;
+} CallStack, *pCallStack;
+
+static _Thread_local CallStack callStack = { 0 };
+static size_t maxCallDepth = CALL_STACK_DEFAULT_DEPTH;
+
+static inline bool
+CallStackGrow(const Allocator* allocator)
+{
+    const size_t count = callStack.chunkCount + 1U;
+    State** chunks = allocator->allocate(sizeof(State*) * count);
+    State* chunk = allocator->allocate(sizeof(State) * CALL_STACK_CHUNK_FRAMES);
+    if (chunks == NULL || chunk == NULL) {
+        TemLangError("Failed to allocate call stack of %zu frames",
+                     count * CALL_STACK_CHUNK_FRAMES);
+        if (chunks != NULL) {
+            allocator->free(chunks);
+        }
+        if (chunk != NULL) {
+            allocator->free(chunk);
+        }
+        return false;
+    }
+    memset(chunk, 0, sizeof(State) * CALL_STACK_CHUNK_FRAMES);
+    if (callStack.chunks != NULL) {
+        memcpy(chunks, callStack.chunks, sizeof(State*) * (count - 1U));
+        allocator->free(callStack.chunks);
+    }
+    chunks[count - 1U] = chunk;
+    callStack.chunks = chunks;
+    callStack.chunkCount = count;
+    return true;
+}
+
+static inline State*
+CallStackPush(const State* parent,
+              const TemLangString* name,
+              const Allocator* allocator)
+{
+    if (callStack.used >= maxCallDepth) {
+        TemLangError("Maximum call depth of %zu reached when calling '%s'",
+                     maxCallDepth,
+                     name->buffer);
+        callDepthExceeded = true;
+        return NULL;
+    }
+    if (callStack.allocator == NULL) {
+        callStack.allocator = allocator;
+    }
+    if (callStack.used == callStack.chunkCount * CALL_STACK_CHUNK_FRAMES &&
+        !CallStackGrow(callStack.allocator)) {
+        return NULL;
+    }
+    State* frame = &callStack.chunks[callStack.used / CALL_STACK_CHUNK_FRAMES]
+                                    [callStack.used % CALL_STACK_CHUNK_FRAMES];
+    ++callStack.used;
+    frame->parent = parent;
+    frame->movesReturns = true;
+    if (frame->atoms.allocator == NULL) {
+        frame->atoms.allocator = allocator;
+    }
+    TraceEmit(TraceEventType_ScopeCreate, TRACE_NO_NAME, callStack.used);
+    return frame;
+}
+
+// Frees everything the call created except the parameter atoms
+static inline void
+CallStackPop(State* frame, const size_t parameters)
+{
+    StateTruncate(frame, parameters);
+    for (size_t i = 0; i < frame->atoms.used; ++i) {
+        ValueFree(&frame->atoms.buffer[i].variable.value);
+    }
+    TraceEmit(TraceEventType_ScopeFree, TRACE_NO_NAME, callStack.used);
+    if (--callStack.used == 0) {
+        callDepthExceeded = false;
+    }
+}
+
+static inline void
+CallStackFree()
+{
+    for (size_t i = 0; i < callStack.chunkCount; ++i) {
+        for (size_t j = 0; j < CALL_STACK_CHUNK_FRAMES; ++j) {
+            StateFree(&callStack.chunks[i][j]);
+        }
+        callStack.allocator->free(callStack.chunks[i]);
+    }
+    if (callStack.chunks != NULL) {
+        callStack.allocator->free(callStack.chunks);
+    }
+    memset(&callStack, 0, sizeof(CallStack));
 }
 
 static inline TemLangString
@@ -88,12 +420,9 @@ StateFindAnyAtom(State* state,
                  const TemLangString* name,
                  const StateFindArgs args)
 {
-    for (size_t i = 0; i < state->atoms.used; ++i) {
-        Atom* atom = &state->atoms.buffer[i];
-        if (TemLangStringCompare(&atom->name, name) ==
-            ComparisonOperator_EqualTo) {
-            return atom;
-        }
+    const int64_t i = StateFindAtomIndex(state, name, TemLangStringHash(name));
+    if (i >= 0) {
+        return &state->atoms.buffer[i];
     }
     if (args.log) {
         AtomNotFoundError(name);
@@ -106,16 +435,14 @@ StateFindAnyAtomConst(const State* state,
                       const TemLangString* name,
                       const StateFindArgs args)
 {
-    for (size_t i = 0; i < state->atoms.used; ++i) {
-        const Atom* atom = &state->atoms.buffer[i];
-        if (TemLangStringCompare(&atom->name, name) ==
-            ComparisonOperator_EqualTo) {
-            return atom;
+    const uint32_t hash = TemLangStringHash(name);
+    for (const State* s = state; s != NULL;
+         s = args.searchParent ? s->parent : NULL) {
+        const int64_t i = StateFindAtomIndex(s, name, hash);
+        if (i >= 0) {
+            return &s->atoms.buffer[i];
         }
     }
-    if (args.searchParent && state->parent != NULL) {
-        return StateFindAnyAtomConst(state->parent, name, args);
-    }
     if (args.log) {
         AtomNotFoundError(name);
     }
@@ -158,9 +485,101 @@ StateFindAtomConst(const State* state,
     return atom;
 }
 
+// Cleared while compiling to C. The compiler evaluates expressions in copies
+// of states whose atoms aren't where the resolver put them
+static _Thread_local bool stateSlotsUsable = true;
+
+// Atom at a slot given by the resolver. Unresolved names (slot 0) are looked
+// up by name by the caller. The resolver is trusted so the name is only
+// checked in debug builds where a wrong slot is reported
+static inline const Atom*
+StateAtomAtSlot(const State* state,
+                const uint32_t slot,
+                const TemLangString* name)
+{
+    if (slot == 0 || !stateSlotsUsable) {
+        return NULL;
+    }
+#if _DEBUG
+    if (slot > state->atoms.used ||
+        state->atoms.buffer[slot - 1U].type != AtomType_Variable ||
+        !AtomNameEquals(&state->atoms.buffer[slot - 1U], name)) {
+        TemLangError("Variable '%s' was resolved to the wrong slot (%u)",
+                     name->buffer,
+                     slot);
+        return NULL;
+    }
+#else
+    (void)name;
+#endif
+    return &state->atoms.buffer[slot - 1U];
+}
+
+static inline const Atom*
+StateFindVariableConst(const State* state, const Expression* e)
+{
+    const State* s = state;
+    for (uint32_t i = 0; s != NULL && i < e->address.depth; ++i) {
+        s = s->parent;
+    }
+    if (s != NULL) {
+        const Atom* atom =
+          StateAtomAtSlot(s, e->address.slot, &e->identifier);
+        if (atom != NULL) {
+            return atom;
+        }
+    }
+    const StateFindArgs args = { .log = true, .searchParent = true };
+    return StateFindAtomConst(state, &e->identifier, AtomType_Variable, args);
+}
+
+static inline Atom*
+StateFindVariable(State* state, const Expression* e)
+{
+    // Only variables in the current state can be changed
+    if (e->address.depth == 0) {
+        const Atom* atom =
+          StateAtomAtSlot(state, e->address.slot, &e->identifier);
+        if (atom != NULL) {
+            return (Atom*)atom;
+        }
+    }
+    const StateFindArgs args = { .log = true, .searchParent = false };
+    return StateFindAtom(state, &e->identifier, AtomType_Variable, args);
+}
+
+// Value of a variable that can be moved out by a return instead of copied.
+// Only variables the state made itself are given since borrowed ones go back
+// to the parent
+static inline pValue
+StateReturnedVariable(State* state, const Expression* e)
+{
+    if (!state->movesReturns || e->type != ExpressionType_UnaryVariable ||
+        e->address.depth != 0) {
+        return NULL;
+    }
+    const Atom* atom = StateAtomAtSlot(state, e->address.slot, &e->identifier);
+    if (atom == NULL) {
+        const int64_t i = StateFindAtomIndex(
+          state, &e->identifier, TemLangStringHash(&e->identifier));
+        if (i < 0) {
+            return NULL;
+        }
+        atom = &state->atoms.buffer[i];
+    }
+    if (atom->type != AtomType_Variable ||
+        atom < state->atoms.buffer + state->borrowed) {
+        return NULL;
+    }
+    return (pValue)&atom->variable.value;
+}
+
 static inline void
 InstructionError(const Instruction* i)
 {
+    if (callDepthExceeded) {
+        return;
+    }
     if (i->type == InstructionType_Error) {
         TemLangError("Manual error occured (%s:%zu)",
                      i->source.source.buffer,
@@ -174,28 +593,57 @@ InstructionError(const Instruction* i)
 }
 
 static inline bool
-StateAddVariable(State* state,
-                 const TemLangString* name,
-                 const Variable* variable)
+StateCanAddVariable(const State* state, const TemLangString* name)
 {
     if (TemLangStringIsEmpty(name)) {
         TemLangError("Emtpy strings cannot be used for variable names");
         return false;
     }
-    {
-        const StateFindArgs args = { .log = false, .searchParent = false };
-        const Atom* atom =
-          StateFindAtomConst(state, name, AtomType_Variable, args);
-        if (atom != NULL) {
-            AtomExistsError(atom);
-            return false;
-        }
+    const StateFindArgs args = { .log = false, .searchParent = false };
+    const Atom* atom = StateFindAtomConst(state, name, AtomType_Variable, args);
+    if (atom != NULL) {
+        AtomExistsError(atom);
+        return false;
     }
+    return true;
+}
 
+static inline bool
+StateAddVariable(State* state,
+                 const TemLangString* name,
+                 const Variable* variable)
+{
+    if (!StateCanAddVariable(state, name)) {
+        return false;
+    }
     const Atom atom = { .type = AtomType_Variable,
                         .name = *name,
                         .variable = *variable };
-    return AtomListAppend(&state->atoms, &atom);
+    return StateAddAtom(state, &atom);
+}
+
+// Same as StateAddVariable but the value is moved into the state instead of
+// copied. The variable is left empty
+static inline bool
+StateAddVariableMove(State* state,
+                     const TemLangString* name,
+                     pVariable variable)
+{
+    if (!StateCanAddVariable(state, name)) {
+        return false;
+    }
+    Atom atom = { .type = AtomType_Variable };
+    if (!TemLangStringCopy(&atom.name, name, state->atoms.allocator)) {
+        AtomFree(&atom);
+        return false;
+    }
+    atom.variable = *variable;
+    memset(variable, 0, sizeof(Variable));
+    if (!StateAddAtomMove(state, &atom)) {
+        AtomFree(&atom);
+        return false;
+    }
+    return true;
 }
 
 static inline bool
@@ -215,6 +663,17 @@ StateAddValue(State* state, const TemLangString* name, const Value* value)
       state, name, value, VariableType_Immutable);
 }
 
+// Adds an immutable variable that takes the value. The value is left null
+static inline bool
+StateAddValueMove(State* state, const TemLangString* name, pValue value)
+{
+    Variable v = { .type = VariableType_Immutable };
+    ValueMove(&v.value, value);
+    const bool result = StateAddVariableMove(state, name, &v);
+    VariableFree(&v);
+    return result;
+}
+
 #define CHECK_ATOM_EXISTS(name, doSearchParent)                                \
     {                                                                          \
         const StateFindArgs args = { .log = false,                             \
@@ -236,19 +695,95 @@ static inline bool
 CaptureVariables(State* dest,
                  const State* src,
                  const TemLangStringList* captures,
+                 const uint32_tList* slots,
                  const InstructionSource source);
 
+// Lines printed on a worker of a parallel iterate are kept until the main
+// thread prints them in iteration order
+static _Thread_local TemLangStringList* parallelOutput = NULL;
+
 static inline bool
-UpdateCapturedVariables(State* dest,
-                        const State* src,
-                        const TemLangStringList* captures,
-                        const Allocator* allocator);
+StatePrintLine(const TemLangString* s)
+{
+    if (parallelOutput != NULL) {
+        return TemLangStringListAppend(parallelOutput, s);
+    }
+    REPL_print("%s\n", s->buffer);
+    return true;
+}
+
+static inline bool
+StateBindIterateVariables(State* temp,
+                          const Value* target,
+                          const int64_t i,
+                          const int64_t start,
+                          pValue item,
+                          pValue index,
+                          pValue scratch,
+                          const Allocator* allocator);
+
+static inline bool
+StateParallelIterate(const State* state,
+                     const CaptureInstruction* c,
+                     const Value* target,
+                     const int64_t start,
+                     const int64_t end,
+                     const Value* item,
+                     const Value* index,
+                     const Allocator* allocator,
+                     bool* ran);
+
+static inline bool
+StateExecuteInstruction(State* state,
+                        const Instruction* instruction,
+                        const Allocator* allocator,
+                        pValue value);
 
 static inline bool
 StateProcessInstruction(State* state,
                         const Instruction* instruction,
                         const Allocator* allocator,
                         pValue value)
+{
+    if ((!profileEnabled && !samplerEnabled && !traceEnabled) ||
+        parallelWorker || !InstructionTypeCanBeExecuted(instruction->type)) {
+        return StateExecuteInstruction(state, instruction, allocator, value);
+    }
+    // Only top level instructions are timed. The rest are counted.
+    if (profileEnabled && !traceEnabled && profile.frameCount != 0) {
+        ProfileCount(ProfileInstructionEntry(instruction));
+        return StateExecuteInstruction(state, instruction, allocator, value);
+    }
+    const uint32_t entry = profileEnabled || traceEnabled
+                             ? ProfileInstructionEntry(instruction)
+                             : PROFILE_NONE;
+    TraceEmit(TraceEventType_InstructionBegin,
+              entry,
+              instruction->source.lineNumber);
+    SamplerPush(instruction, NULL);
+    bool profiled = false;
+    if (profileEnabled) {
+        if (profile.frameCount == 0) {
+            profiled = ProfileEnter(entry);
+        } else {
+            ProfileCount(entry);
+        }
+    }
+    const bool result =
+      StateExecuteInstruction(state, instruction, allocator, value);
+    if (profiled) {
+        ProfileExit();
+    }
+    SamplerPop();
+    TraceEmit(TraceEventType_InstructionEnd, entry, result);
+    return result;
+}
+
+static inline bool
+StateExecuteInstruction(State* state,
+                        const Instruction* instruction,
+                        const Allocator* allocator,
+                        pValue value)
 {
     if (!InstructionTypeCanBeExecuted(instruction->type)) {
         return true;
@@ -290,7 +825,7 @@ StateProcessInstruction(State* state,
             }
             ValueFree(value);
         } break;
-        case InstructionType_Return:
+        case InstructionType_Return: {
             if (instruction->expression.type == ExpressionType_UnaryVariable &&
                 !TemLangStringStartsWith(&instruction->expression.identifier,
                                          "r_")) {
@@ -298,9 +833,16 @@ StateProcessInstruction(State* state,
                 result = false;
                 break;
             }
+            pValue returned =
+              StateReturnedVariable(state, &instruction->expression);
+            if (returned != NULL) {
+                ValueMove(value, returned);
+                result = ValueLeaveScopeArena(value, allocator);
+                break;
+            }
             result = EvaluateExpression(
               &instruction->expression, state, value, allocator);
-            break;
+        } break;
         case InstructionType_IfReturn: {
             result = EvaluateExpression(
               &instruction->ifCondition, state, value, allocator);
@@ -313,8 +855,15 @@ StateProcessInstruction(State* state,
                 break;
             }
             if (value->b) {
-                result = EvaluateExpression(
-                  &instruction->ifResult, state, value, allocator);
+                pValue returned =
+                  StateReturnedVariable(state, &instruction->ifResult);
+                if (returned != NULL) {
+                    ValueMove(value, returned);
+                    result = ValueLeaveScopeArena(value, allocator);
+                } else {
+                    result = EvaluateExpression(
+                      &instruction->ifResult, state, value, allocator);
+                }
             } else {
                 value->type = ValueType_Null;
             }
@@ -344,35 +893,21 @@ StateProcessInstruction(State* state,
             if (!result) {
                 goto createVariableCleanup;
             }
-            result = StateAddVariable(
+            result = StateAddVariableMove(
               state, &instruction->createVariable.name, &variable);
         createVariableCleanup:
             VariableFree(&variable);
         } break;
         case InstructionType_UpdateVariable: {
-            Value* target = EvaluateExpressionToReference(
-              &instruction->updateVariable.target, state, allocator);
-            if (target == NULL) {
-                result = false;
-                break;
-            }
             Value newValue = { 0 };
-            result = EvaluateExpression(
-              &instruction->updateVariable.value, state, &newValue, allocator);
-            if (!result) {
-                goto updateVariableCleanup;
-            }
-            result = ValueTransition(target, &newValue, allocator);
-            if (!result) {
-                TemLangString from = ValueToString(target, allocator);
-                TemLangString to = ValueToString(&newValue, allocator);
-                TemLangError("Cannot transition value '%s' to '%s'",
-                             from.buffer,
-                             to.buffer);
-                TemLangStringFree(&from);
-                TemLangStringFree(&to);
-            }
-        updateVariableCleanup:
+            result = EvaluateExpression(&instruction->updateVariable.value,
+                                        state,
+                                        &newValue,
+                                        allocator) &&
+                     StateUpdateReference(&instruction->updateVariable.target,
+                                          state,
+                                          &newValue,
+                                          allocator);
             ValueFree(&newValue);
         } break;
         case InstructionType_DefineRange: {
@@ -413,7 +948,7 @@ StateProcessInstruction(State* state,
             }
             atom.range.max = value.rangedNumber.number;
 
-            result = AtomListAppend(&state->atoms, &atom);
+            result = StateAddAtomMove(state, &atom);
         defineRangeCleanup:
             ValueFree(&value);
             AtomFree(&atom);
@@ -430,7 +965,6 @@ StateProcessInstruction(State* state,
                                   .value = {
                                     .type = ValueType_Number,
                                     .rangedNumber = {
-                                      .hasRange = false,
                                       .number = NumberFromUInt(length) } } } };
             atom.enumDefinition.isFlag = false;
             lengthAtom.name.allocator = allocator;
@@ -443,8 +977,9 @@ StateProcessInstruction(State* state,
                      EnumDefinitionCopy(&atom.enumDefinition,
                                         &instruction->defineEnum.definition,
                                         allocator) &&
-                     AtomListAppend(&state->atoms, &atom) &&
-                     AtomListAppend(&state->atoms, &lengthAtom);
+                     AtomCreateEnumNames(&atom) &&
+                     StateAddAtomMove(state, &atom) &&
+                     StateAddAtomMove(state, &lengthAtom);
             AtomFree(&atom);
             AtomFree(&lengthAtom);
         } break;
@@ -468,111 +1003,60 @@ StateProcessInstruction(State* state,
                 break;
             }
 
-            const StateFindArgs args = { .log = true, .searchParent = true };
-            const Atom* atom = StateFindAtomConst(
-              state, &target->flagValue.name, AtomType_Enum, args);
-            if (atom == NULL) {
-                result = false;
-                break;
-            }
-
-            if (!atom->enumDefinition.isFlag) {
-                UnexpectedValueTypeError(
-                  &instruction->source, ValueType_Flag, ValueType_Enum);
-                result = false;
-                break;
-            }
-
-            if (!TemLangStringListFindIf(
-                  &atom->enumDefinition.members,
-                  (TemLangStringListFindFunc)TemLangStringsAreEqual,
-                  &instruction->changeFlag.member,
-                  NULL,
-                  NULL)) {
-                TemLangError("Member '%s' not found in flag",
-                             instruction->changeFlag.member.buffer);
-                result = false;
-                break;
+            const EnumNames* names = target->flagValue.names;
+            const TemLangString* member = &instruction->changeFlag.member;
+            // The ordinal found last time is checked first. The same
+            // instruction may see a different flag
+            size_t ordinal = instruction->changeFlag.ordinal;
+            if (ordinal >= names->members.used ||
+                !TemLangStringsAreEqual(&names->members.buffer[ordinal],
+                                        member)) {
+                if (!TemLangStringListFindIf(
+                      &names->members,
+                      (TemLangStringListFindFunc)TemLangStringsAreEqual,
+                      member,
+                      NULL,
+                      &ordinal)) {
+                    TemLangError("Member '%s' not found in flag",
+                                 member->buffer);
+                    result = false;
+                    break;
+                }
+                if (!parallelWorker) {
+                    ((Instruction*)instruction)->changeFlag.ordinal = ordinal;
+                }
             }
 
-            const bool hasMember = TemLangStringListFindIf(
-              &target->flagValue.members,
-              (TemLangStringListFindFunc)TemLangStringsAreEqual,
-              &instruction->changeFlag.member,
-              NULL,
-              NULL);
-            enum
-            {
-                DoInsert,
-                DoRemoval,
-                DoNothing
-            } action = DoNothing;
             switch (instruction->changeFlag.flag) {
                 case ChangeFlagType_Add:
-                    action = hasMember ? DoNothing : DoInsert;
+                    FlagValueSet(&target->flagValue, ordinal, true);
                     break;
                 case ChangeFlagType_Remove:
-                    action = hasMember ? DoRemoval : DoNothing;
+                    FlagValueSet(&target->flagValue, ordinal, false);
                     break;
                 default:
-                    action = hasMember ? DoRemoval : DoInsert;
-                    break;
-            }
-            switch (action) {
-                case DoInsert:
-                    result =
-                      TemLangStringListAppend(&target->flagValue.members,
-                                              &instruction->changeFlag.member);
-                    break;
-                case DoRemoval:
-                    TemLangStringListRemoveIf(
-                      &target->flagValue.members,
-                      (TemLangStringListFindFunc)TemLangStringsAreEqual,
-                      &instruction->changeFlag.member,
-                      allocator);
-                    break;
-                case DoNothing:
-                default:
-                    break;
-            }
-        } break;
-        case InstructionType_SetAllFlag: {
-            Value* target = EvaluateExpressionToReference(
-              &instruction->setAllFlag.target, state, allocator);
-            if (target == NULL) {
-                result = false;
-                break;
-            }
-
-            if (target->type != ValueType_Flag) {
-                UnexpectedValueTypeError(
-                  &instruction->source, ValueType_Flag, target->type);
-                result = false;
-                break;
-            }
-
-            const StateFindArgs args = { .log = true, .searchParent = true };
-            const Atom* atom = StateFindAtomConst(
-              state, &target->flagValue.name, AtomType_Enum, args);
-            if (atom == NULL) {
+                    FlagValueSet(&target->flagValue,
+                                 ordinal,
+                                 !FlagValueHas(&target->flagValue, ordinal));
+                    break;
+            }
+        } break;
+        case InstructionType_SetAllFlag: {
+            Value* target = EvaluateExpressionToReference(
+              &instruction->setAllFlag.target, state, allocator);
+            if (target == NULL) {
                 result = false;
                 break;
             }
 
-            if (!atom->enumDefinition.isFlag) {
+            if (target->type != ValueType_Flag) {
                 UnexpectedValueTypeError(
-                  &instruction->source, ValueType_Flag, ValueType_Enum);
+                  &instruction->source, ValueType_Flag, target->type);
                 result = false;
                 break;
             }
 
-            if (instruction->setAllFlag.clear) {
-                TemLangStringListFree(&target->flagValue.members);
-            } else {
-                result = TemLangStringListCopy(&target->flagValue.members,
-                                               &atom->enumDefinition.members,
-                                               allocator);
-            }
+            FlagValueSetAll(&target->flagValue, !instruction->setAllFlag.clear);
         } break;
         case InstructionType_DefineStruct: {
             CHECK_ATOM_EXISTS(instruction->defineStruct.name, true);
@@ -584,7 +1068,8 @@ StateProcessInstruction(State* state,
                      StructDefinitionCopy(&atom.structDefinition,
                                           &instruction->defineStruct.definition,
                                           allocator) &&
-                     AtomListAppend(&state->atoms, &atom);
+                     AtomCreateStructShape(&atom) &&
+                     StateAddAtomMove(state, &atom);
             AtomFree(&atom);
         } break;
         case InstructionType_DefineFunction: {
@@ -618,7 +1103,7 @@ StateProcessInstruction(State* state,
                      FunctionDefinitionCopy(&atom.functionDefinition,
                                             &instruction->functionDefinition,
                                             allocator) &&
-                     AtomListAppend(&state->atoms, &atom);
+                     StateAddAtomMove(state, &atom);
             AtomFree(&atom);
             break;
         parameterError:
@@ -641,17 +1126,25 @@ StateProcessInstruction(State* state,
                 break;
             }
             State temp = { 0 };
-            temp.parent = state;
-            temp.atoms.allocator = allocator;
+            const size_t arenaState = StateInitScope(&temp, state, allocator);
+            temp.movesReturns = true;
             result = CaptureVariables(&temp,
                                       state,
                                       &atom->functionDefinition.captures,
+                                      NULL,
                                       instruction->source);
             if (!result) {
                 goto runStateFree;
             }
             const InstructionList* instructions =
               &atom->functionDefinition.instructions;
+            const bool profiled =
+              profileEnabled && !parallelWorker &&
+              ProfileEnter(ProfileFunctionEntry(&atom->functionDefinition,
+                                                &instruction->procedureName));
+            SamplerPush(&atom->functionDefinition, &instruction->procedureName);
+            const uint32_t traced = TraceFunctionEnter(
+              &atom->functionDefinition, &instruction->procedureName);
             ValueFree(value);
             for (size_t i = 0; result && value->type == ValueType_Null &&
                                i < instructions->used;
@@ -662,13 +1155,13 @@ StateProcessInstruction(State* state,
                     InstructionError(&instructions->buffer[i]);
                 }
             }
-            if (!result) {
-                goto runStateFree;
+            TraceFunctionExit(traced, result);
+            SamplerPop();
+            if (profiled) {
+                ProfileExit();
             }
-            result = UpdateCapturedVariables(
-              state, &temp, &atom->functionDefinition.captures, allocator);
         runStateFree:
-            StateFree(&temp);
+            StateFreeScope(&temp, arenaState);
         } break;
         case InstructionType_ListModify: {
             result = HandleListModifyInstruction(
@@ -680,19 +1173,20 @@ StateProcessInstruction(State* state,
             const bool isWhile = instruction->type == InstructionType_While;
             do {
                 ValueFree(value);
-                result =
-                  EvaluateExpression(&w->target, state, value, allocator);
-                if (!result) {
+                const Value* condition = EvaluateExpressionToConstReference(
+                  &w->target, state, value, allocator);
+                if (condition == NULL) {
+                    result = false;
                     break;
                 }
-                switch (value->type) {
+                switch (condition->type) {
                     case ValueType_Null:
                         if (isWhile) {
                             goto endWhileLoop;
                         }
                         break;
                     case ValueType_Boolean:
-                        if (isWhile != value->b) {
+                        if (isWhile != condition->b) {
                             goto endWhileLoop;
                         }
                         break;
@@ -703,10 +1197,13 @@ StateProcessInstruction(State* state,
                         break;
                 }
                 State temp = { 0 };
-                temp.parent = state;
-                temp.atoms.allocator = allocator;
-                if (!CaptureVariables(
-                      &temp, state, &w->captures, instruction->source)) {
+                const size_t arenaState =
+                  StateInitScope(&temp, state, allocator);
+                if (!CaptureVariables(&temp,
+                                      state,
+                                      &w->captures,
+                                      &w->captureSlots,
+                                      instruction->source)) {
                     result = false;
                     goto stateFree;
                 }
@@ -717,14 +1214,12 @@ StateProcessInstruction(State* state,
                     result = StateProcessInstruction(
                       &temp, &w->instructions.buffer[i], allocator, value);
                     if (!result) {
-                        goto stateFree;
+                        break;
                     }
                 }
-                result = UpdateCapturedVariables(
-                  state, &temp, &w->captures, allocator);
             stateFree:
                 ValueFree(value);
-                StateFree(&temp);
+                StateFreeScope(&temp, arenaState);
             } while (result);
         endWhileLoop:
             ValueFree(value);
@@ -736,254 +1231,118 @@ StateProcessInstruction(State* state,
             if (!result) {
                 break;
             }
-            const Value falseValue = { .type = ValueType_Boolean, .b = false };
-            Value tempValue = { 0 };
+            Value index = { .type = ValueType_Number };
+            int64_t start = 0;
+            int64_t end = 0;
             switch (value->type) {
-                case ValueType_Number: {
-                    if (!value->rangedNumber.hasRange) {
+                case ValueType_Number:
+                    if (value->rangedNumber.range == NULL) {
                         TemLangError("Only ranged numbers can be iterated on");
                         result = false;
                         break;
                     }
-                    const Range range = value->rangedNumber.range;
-                    const int64_t start =
-                      NumberToInt(&value->rangedNumber.number);
-                    const int64_t end = NumberToInt(&range.max) + 1;
-                    bool continueLoop = true;
-                    for (int64_t i = start; continueLoop && result && i < end;
-                         ++i) {
-                        State temp = { 0 };
-                        temp.atoms.allocator = allocator;
-                        temp.parent = state;
-                        result = CaptureVariables(
-                          &temp, state, &c->captures, instruction->source);
-                        if (!result) {
-                            goto numberIterateStateFree;
-                        }
-                        {
-                            Atom atom = { 0 };
-                            atom.name = TemLangStringCreate("item", allocator);
-                            atom.type = AtomType_Variable;
-                            atom.variable.type = VariableType_Immutable;
-                            atom.variable.value.type = ValueType_Number;
-                            atom.variable.value.rangedNumber.hasRange = true;
-                            const Number n = { .type = NumberType_Signed,
-                                               .i = i };
-                            atom.variable.value.rangedNumber.number = n;
-                            atom.variable.value.rangedNumber.range = range;
-                            result = AtomListAppend(&temp.atoms, &atom);
-                            AtomFree(&atom);
-                        }
-                        if (!result) {
-                            goto numberIterateStateFree;
-                        }
-                        {
-                            Atom atom = { 0 };
-                            atom.name = TemLangStringCreate("index", allocator);
-                            atom.type = AtomType_Variable;
-                            atom.variable.type = VariableType_Immutable;
-                            atom.variable.value.type = ValueType_Number;
-                            atom.variable.value.rangedNumber.hasRange = true;
-                            const Number n = { .type = NumberType_Signed,
-                                               .i = i - start };
-                            atom.variable.value.rangedNumber.number = n;
-                            atom.variable.value.rangedNumber.range = range;
-                            result = AtomListAppend(&temp.atoms, &atom);
-                            AtomFree(&atom);
-                        }
-                        if (!result) {
-                            goto numberIterateStateFree;
-                        }
-                        for (size_t j = 0;
-                             continueLoop && result && j < c->instructions.used;
-                             ++j) {
-                            ValueFree(&tempValue);
-                            result = StateProcessInstruction(
-                              &temp,
-                              &c->instructions.buffer[j],
-                              allocator,
-                              &tempValue);
-                            continueLoop =
-                              !ValuesMatch(&tempValue, &falseValue);
-                        }
-                        if (result) {
-                            result = UpdateCapturedVariables(
-                              state, &temp, &c->captures, allocator);
-                        }
-                    numberIterateStateFree:
-                        StateFree(&temp);
-                    }
-                } break;
-                case ValueType_List: {
-                    const ValueList* values = &value->list.values;
-                    const Range range = { .min = { .type = NumberType_Unsigned,
-                                                   .u = 0UL },
-                                          .max = { .type = NumberType_Unsigned,
-                                                   .u = values->used - 1 } };
-                    bool continueLoop = true;
-                    for (size_t i = 0;
-                         continueLoop && result &&
-                         tempValue.type == ValueType_Null && i < values->used;
-                         ++i) {
-                        State temp = { 0 };
-                        temp.atoms.allocator = allocator;
-                        temp.parent = state;
-                        result = CaptureVariables(
-                          &temp, state, &c->captures, instruction->source);
-                        if (!result) {
-                            goto iterateStateFree;
-                        }
-                        {
-                            Atom atom = { 0 };
-                            atom.name = TemLangStringCreate("index", allocator);
-                            atom.type = AtomType_Variable;
-                            atom.variable.type = false;
-                            atom.variable.value.type = ValueType_Number;
-                            atom.variable.value.rangedNumber.hasRange = true;
-                            const Number n = { .type = NumberType_Unsigned,
-                                               .u = i };
-                            atom.variable.value.rangedNumber.number = n;
-                            atom.variable.value.rangedNumber.range = range;
-                            result = AtomListAppend(&temp.atoms, &atom);
-                            AtomFree(&atom);
-                        }
-                        if (!result) {
-                            goto iterateStateFree;
-                        }
-                        {
-                            Atom atom = { 0 };
-                            atom.name = TemLangStringCreate("item", allocator);
-                            atom.type = AtomType_Variable;
-                            atom.variable.type = VariableType_Immutable;
-                            result = ValueCopy(&atom.variable.value,
-                                               &values->buffer[i],
-                                               allocator) &&
-                                     AtomListAppend(&temp.atoms, &atom);
-                            AtomFree(&atom);
-                        }
-                        if (!result) {
-                            goto iterateStateFree;
-                        }
-                        for (size_t j = 0;
-                             continueLoop && result && j < c->instructions.used;
-                             ++j) {
-                            ValueFree(&tempValue);
-                            result = StateProcessInstruction(
-                              &temp,
-                              &c->instructions.buffer[j],
-                              allocator,
-                              &tempValue);
-                            continueLoop =
-                              !ValuesMatch(&tempValue, &falseValue);
-                        }
-                        if (result) {
-                            result = UpdateCapturedVariables(
-                              state, &temp, &c->captures, allocator);
-                        }
-                    iterateStateFree:
-                        StateFree(&temp);
-                    }
-                } break;
-                case ValueType_Enum: {
-                    const StateFindArgs args = { .log = true,
-                                                 .searchParent = true };
-                    const Atom* enumAtom = StateFindAtomConst(
-                      state, &value->enumValue.name, AtomType_Enum, args);
-                    if (enumAtom == NULL) {
-                        result = false;
-                        break;
-                    }
-                    const Range range = {
-                        .min = { .type = NumberType_Unsigned, .u = 0UL },
-                        .max = { .type = NumberType_Unsigned,
-                                 .u =
-                                   enumAtom->enumDefinition.members.used - 1 }
-                    };
-                    bool continueLoop = true;
-                    for (size_t i = 0;
-                         continueLoop && result &&
-                         i < enumAtom->enumDefinition.members.used;
-                         ++i) {
-                        State temp = { 0 };
-                        temp.atoms.allocator = allocator;
-                        temp.parent = state;
-                        result = CaptureVariables(
-                          &temp, state, &c->captures, instruction->source);
-                        if (!result) {
-                            goto iterateEnumStateFree;
-                        }
-                        {
-                            Atom atom = { 0 };
-                            atom.name = TemLangStringCreate("index", allocator);
-                            atom.type = AtomType_Variable;
-                            atom.variable.type = false;
-                            atom.variable.value.type = ValueType_Number;
-                            atom.variable.value.rangedNumber.hasRange = true;
-                            const Number n = { .type = NumberType_Unsigned,
-                                               .u = i };
-                            atom.variable.value.rangedNumber.number = n;
-                            atom.variable.value.rangedNumber.range = range;
-                            result = AtomListAppend(&temp.atoms, &atom);
-                            AtomFree(&atom);
-                        }
-                        {
-                            Atom atom = { 0 };
-                            atom.name = TemLangStringCreate("item", allocator);
-                            atom.type = AtomType_Variable;
-                            atom.variable.type = VariableType_Immutable;
-                            atom.variable.value.type = ValueType_Enum;
-                            result =
-                              TemLangStringCopy(
-                                &atom.variable.value.enumValue.name,
-                                &enumAtom->name,
-                                allocator) &&
-                              TemLangStringCopy(
-                                &atom.variable.value.enumValue.value,
-                                &enumAtom->enumDefinition.members.buffer[i],
-                                allocator) &&
-                              AtomListAppend(&temp.atoms, &atom);
-                            AtomFree(&atom);
-                        }
-                        if (!result) {
-                            goto iterateEnumStateFree;
-                        }
-                        for (size_t j = 0;
-                             continueLoop && result && j < c->instructions.used;
-                             ++j) {
-                            ValueFree(&tempValue);
-                            result = StateProcessInstruction(
-                              &temp,
-                              &c->instructions.buffer[j],
-                              allocator,
-                              &tempValue);
-                            continueLoop =
-                              !ValuesMatch(&tempValue, &falseValue);
-                        }
-                        if (result) {
-                            result = UpdateCapturedVariables(
-                              state, &temp, &c->captures, allocator);
-                        }
-                    iterateEnumStateFree:
-                        StateFree(&temp);
-                    }
-                } break;
+                    index.rangedNumber.range = value->rangedNumber.range;
+                    start = NumberToInt(&value->rangedNumber.number);
+                    end = NumberToInt(&index.rangedNumber.range->max) + 1;
+                    break;
+                case ValueType_List:
+                    end = ValueListValueLength(value->list);
+                    break;
+                case ValueType_Enum:
+                    end = value->enumValue.names->members.used;
+                    break;
                 default:
                     TemLangError("Cannot iterate on value of type '%s'",
                                  ValueTypeToString(value->type));
                     result = false;
                     break;
             }
+            const bool isNumber = value->type == ValueType_Number;
+            if (!isNumber) {
+                const Range range = { .min = { .type = NumberType_Unsigned,
+                                               .u = 0UL },
+                                      .max = { .type = NumberType_Unsigned,
+                                               .u = end - 1 } };
+                index.rangedNumber.range = RangeIntern(&range);
+            }
+            // Enum items borrow the names of the value being iterated
+            Value item = index;
+            if (value->type == ValueType_Enum) {
+                item.type = ValueType_Enum;
+                item.enumValue.names = value->enumValue.names;
+            }
+            if (c->parallel && result && end - start > 1) {
+                bool ran = false;
+                result = StateParallelIterate(state,
+                                              c,
+                                              value,
+                                              start,
+                                              end,
+                                              &item,
+                                              &index,
+                                              allocator,
+                                              &ran);
+                if (ran) {
+                    ValueFree(value);
+                    break;
+                }
+            }
+
+            // The loop scope is set up once. Variables made by the body are
+            // dropped after each iteration and item and index are overwritten
+            const Value falseValue = { .type = ValueType_Boolean, .b = false };
+            Value tempValue = { 0 };
+            Value scratch;
+            State temp = { 0 };
+            const size_t arenaState = StateInitScope(&temp, state, allocator);
+            bool continueLoop = true;
+            for (int64_t i = start;
+                 continueLoop && result && i < end &&
+                 (value->type != ValueType_List ||
+                  tempValue.type == ValueType_Null);
+                 ++i) {
+                if (i == start) {
+                    result = CaptureVariables(&temp,
+                                              state,
+                                              &c->captures,
+                                              &c->captureSlots,
+                                              instruction->source);
+                } else {
+                    result = StateTruncate(&temp, temp.borrowed + 2U);
+                }
+                result = result &&
+                         StateBindIterateVariables(&temp,
+                                                   value,
+                                                   i,
+                                                   start,
+                                                   &item,
+                                                   &index,
+                                                   &scratch,
+                                                   allocator);
+                for (size_t j = 0;
+                     continueLoop && result && j < c->instructions.used;
+                     ++j) {
+                    ValueFree(&tempValue);
+                    result = StateProcessInstruction(&temp,
+                                                     &c->instructions.buffer[j],
+                                                     allocator,
+                                                     &tempValue);
+                    continueLoop = !ValuesMatch(&tempValue, &falseValue);
+                }
+            }
+            StateFreeScope(&temp, arenaState);
             ValueFree(&tempValue);
             ValueFree(value);
         } break;
         case InstructionType_Match: {
             State temp = { 0 };
-            temp.parent = state;
-            temp.atoms.allocator = allocator;
-            result = CaptureVariables(&temp,
-                                      state,
-                                      &instruction->matchInstruction.captures,
-                                      instruction->source);
+            const size_t arenaState = StateInitScope(&temp, state, allocator);
+            result =
+              CaptureVariables(&temp,
+                               state,
+                               &instruction->matchInstruction.captures,
+                               &instruction->matchInstruction.captureSlots,
+                               instruction->source);
             if (!result) {
                 goto matchCleanup;
             }
@@ -992,28 +1351,24 @@ StateProcessInstruction(State* state,
                                       &temp,
                                       value,
                                       allocator);
-            if (!result) {
-                goto matchCleanup;
-            }
-            result = UpdateCapturedVariables(
-              state, &temp, &instruction->matchInstruction.captures, allocator);
         matchCleanup:
-            StateFree(&temp);
+            StateFreeScope(&temp, arenaState);
         } break;
         case InstructionType_Print:
         case InstructionType_Error: {
             for (size_t i = 0; result && i < instruction->printExpressions.used;
                  ++i) {
                 ValueFree(value);
-                result =
-                  EvaluateExpression(&instruction->printExpressions.buffer[i],
-                                     state,
-                                     value,
-                                     allocator);
+                const Value* v = EvaluateExpressionToConstReference(
+                  &instruction->printExpressions.buffer[i],
+                  state,
+                  value,
+                  allocator);
+                result = v != NULL;
                 if (result) {
-                    TemLangString s = ValueToString(value, allocator);
+                    TemLangString s = ValueToString(v, allocator);
                     if (instruction->type == InstructionType_Print) {
-                        REPL_print("%s\n", s.buffer);
+                        result = StatePrintLine(&s);
                     } else {
                         TemLangError("%s", s.buffer);
                         result = false;
@@ -1031,9 +1386,9 @@ StateProcessInstruction(State* state,
                 break;
             }
             if (value.type == ValueType_List) {
-                value.list.isArray = instruction->toArray;
+                value.listIsArray = instruction->toArray;
                 result =
-                  StateAddValue(state, &instruction->toContainer, &value);
+                  StateAddValueMove(state, &instruction->toContainer, &value);
             } else {
                 TemLangError("ConvertContainer instruction expects a list or "
                              "array to convert. Got '%s'",
@@ -1085,6 +1440,8 @@ StateProcessInstruction(State* state,
               allocator, value->string.buffer, value->string.used, 1, buffer);
             InstructionList instructions =
               TokensToInstructions(&list, allocator);
+            FoldInstructions(&instructions, allocator);
+            ResolveInstructions(&instructions, allocator);
             if (instructions.used == 0) {
                 TemLangError("Failed to parse any instructions from '%s'",
                              value->string.buffer);
@@ -1141,7 +1498,7 @@ StateProcessInstruction(State* state,
                     goto inlineDataCleanup;
                 }
                 result =
-                  StateAddValue(state, &instruction->dataName, &newValue);
+                  StateAddValueMove(state, &instruction->dataName, &newValue);
                 ValueFree(&newValue);
             } else {
                 TemLangError("Failed to open file '%s': %s",
@@ -1175,6 +1532,8 @@ StateProcessInstruction(State* state,
                   performLex(allocator, ptr, size, 0UL, value.string.buffer);
                 InstructionList instructions =
                   TokensToInstructions(&tokens, allocator);
+                FoldInstructions(&instructions, allocator);
+                ResolveInstructions(&instructions, allocator);
                 Value tempValue = { 0 };
                 for (size_t i = 0; i < instructions.used; ++i) {
                     ValueFree(&tempValue);
@@ -1241,16 +1600,14 @@ StateProcessInstruction(State* state,
                         const size_t length = end - i;
                         TemLangString t = TemLangStringCreateFromSize(
                           content->buffer + i, length + 1, allocator);
-                        const NamedValue* nv = NULL;
-                        result = NamedValueListFindIf(
-                          value->structValues,
-                          (NamedValueListFindFunc)NamedValueNameEqualsString,
-                          &t,
-                          &nv,
-                          NULL);
+                        size_t slot = 0;
+                        result = StructShapeFind(
+                          value->structValues->shape, &t, &slot);
                         if (result) {
                             TemLangStringFree(&t);
-                            t = ValueToSimpleString(&nv->value, allocator);
+                            t = ValueToSimpleString(
+                              &value->structValues->values.buffer[slot],
+                              allocator);
                             result = TemLangStringAppend(&output.string, &t);
                             i = end;
                         } else {
@@ -1269,7 +1626,7 @@ StateProcessInstruction(State* state,
             ValueFree(value);
             if (result) {
                 result =
-                  StateAddValue(state, &instruction->formatName, &output);
+                  StateAddValueMove(state, &instruction->formatName, &output);
             }
             ValueFree(&output);
         } break;
@@ -1292,9 +1649,9 @@ StateProcessInstruction(State* state,
                 result = false;
                 goto numberRoundEnd;
             }
-            if (!StructMemberToRange(&instruction->numberRoundMember,
-                                     state,
-                                     &value->rangedNumber.range)) {
+            Range range = { 0 };
+            if (!StructMemberToRange(
+                  &instruction->numberRoundMember, state, &range)) {
                 TemLangError(
                   "Struct member must be a number. Got '%s'",
                   instruction->numberRoundMember.isKeyword
@@ -1342,16 +1699,17 @@ StateProcessInstruction(State* state,
                     result = false;
                     goto numberRoundEnd;
             }
-            value->rangedNumber.hasRange = true;
+            value->rangedNumber.range = RangeIntern(&range);
             if (!numberInRange(&value->rangedNumber.number,
-                               &value->rangedNumber.range)) {
+                               value->rangedNumber.range)) {
                 numberNotInRangeError(&value->rangedNumber.number,
-                                      &value->rangedNumber.range,
+                                      value->rangedNumber.range,
                                       allocator);
                 result = false;
                 goto numberRoundEnd;
             }
-            result = StateAddValue(state, &instruction->numberRoundName, value);
+            result =
+              StateAddValueMove(state, &instruction->numberRoundName, value);
         numberRoundEnd:
             ValueFree(value);
         } break;
@@ -1368,7 +1726,7 @@ HandleListModifyInstruction(const ListModifyInstruction* i,
                             const Allocator* allocator)
 {
     Value* value = EvaluateExpressionToReference(&i->list, state, allocator);
-    if (value == NULL) {
+    if (value == NULL || !ValueMakeUnique(value)) {
         return false;
     }
     Value newValue = { 0 };
@@ -1392,11 +1750,14 @@ HandleListModifyInstruction(const ListModifyInstruction* i,
                                 break;
                             case ValueType_List:
                                 for (size_t i = 0;
-                                     result && i < newValue.list.values.used;
+                                     result &&
+                                     i < ValueListValueLength(newValue.list);
                                      ++i) {
+                                    Value scratch;
                                     result =
-                                      ValueToChar(
-                                        &newValue.list.values.buffer[i], &c) &&
+                                      ValueToChar(ValueListValueAt(
+                                                    newValue.list, i, &scratch),
+                                                  &c) &&
                                       TemLangStringAppendChar(&value->string,
                                                               c);
                                 }
@@ -1455,18 +1816,21 @@ HandleListModifyInstruction(const ListModifyInstruction* i,
                 case ListModifyType_Pop:
                     TemLangStringPop(&value->string);
                     break;
-                case ListModifyType_Empty: {
-                    const Allocator* a = value->string.allocator;
-                    TemLangStringFree(&value->string);
-                    value->string.allocator = a;
-                } break;
+                case ListModifyType_Empty:
+                    // Keeps the buffer so the string is still "" when it
+                    // is read in place
+                    if (value->string.buffer != NULL) {
+                        value->string.used = 0;
+                        TemLangStringNullTerminate(&value->string);
+                    }
+                    break;
                 default:
                     result = false;
                     break;
             }
         } break;
         case ValueType_List: {
-            if (value->list.isArray) {
+            if (value->listIsArray) {
                 TemLangError("Cannot add/remove values from arrays");
                 result = false;
                 break;
@@ -1475,22 +1839,23 @@ HandleListModifyInstruction(const ListModifyInstruction* i,
                 case ListModifyType_Append: {
                     if (EvaluateExpression(
                           &i->newValue[0], state, &newValue, allocator)) {
-                        if (ValueCanTransition(
-                              value->list.exampleValue, &newValue, allocator)) {
-                            if (value->list.exampleValue->type ==
+                        if (ValueCanTransition(value->list->exampleValue,
+                                               &newValue,
+                                               allocator)) {
+                            if (value->list->exampleValue->type ==
                                 ValueType_Number) {
-                                newValue.rangedNumber.hasRange = true;
                                 newValue.rangedNumber.range =
-                                  value->list.exampleValue->rangedNumber.range;
+                                  value->list->exampleValue->rangedNumber.range;
                             }
                             result =
-                              ValueListAppend(&value->list.values, &newValue);
+                              ValueListValueAppend(value->list, &newValue);
                         } else {
                             TemLangError(
                               "Cannot add value to list because of "
                               "a type mismatch. List has '%s' but "
                               "tried to add '%s'",
-                              ValueTypeToString(value->list.exampleValue->type),
+                              ValueTypeToString(
+                                value->list->exampleValue->type),
                               ValueTypeToString(newValue.type));
                             result = false;
                         }
@@ -1505,22 +1870,23 @@ HandleListModifyInstruction(const ListModifyInstruction* i,
                         ValueToIndex(&newValue, &index)) {
                         if (EvaluateExpression(
                               &i->newValue[1], state, &newValue, allocator) &&
-                            ValueCanTransition(
-                              value->list.exampleValue, &newValue, allocator)) {
-                            if (value->list.exampleValue->type ==
+                            ValueCanTransition(value->list->exampleValue,
+                                               &newValue,
+                                               allocator)) {
+                            if (value->list->exampleValue->type ==
                                 ValueType_Number) {
-                                newValue.rangedNumber.hasRange = true;
                                 newValue.rangedNumber.range =
-                                  value->list.exampleValue->rangedNumber.range;
+                                  value->list->exampleValue->rangedNumber.range;
                             }
-                            result = ValueListInsert(
-                              &value->list.values, index, &newValue);
+                            result = ValueListValueInsert(
+                              value->list, index, &newValue);
                         } else {
                             TemLangError(
                               "Cannot add value to list because of "
                               "a type mismatch. List has '%s' but "
                               "tried to add '%s'",
-                              ValueTypeToString(value->list.exampleValue->type),
+                              ValueTypeToString(
+                                value->list->exampleValue->type),
                               ValueTypeToString(newValue.type));
                             result = false;
                         }
@@ -1533,15 +1899,15 @@ HandleListModifyInstruction(const ListModifyInstruction* i,
                     if (EvaluateExpression(
                           &i->newValue[0], state, &newValue, allocator) &&
                         ValueToIndex(&newValue, &index)) {
-                        if (index >= value->list.values.used) {
+                        if (index >= ValueListValueLength(value->list)) {
                             TemLangError(
                               "Index out of range. Size: %zu; Index=%" PRIu64,
-                              value->list.values.used,
+                              ValueListValueLength(value->list),
                               index);
                             result = false;
                         }
-                        result = ValueListRemove(
-                          &value->list.values, index, allocator);
+                        result =
+                          ValueListValueRemove(value->list, index, allocator);
                     } else {
                         result = false;
                     }
@@ -1551,27 +1917,24 @@ HandleListModifyInstruction(const ListModifyInstruction* i,
                     if (EvaluateExpression(
                           &i->newValue[0], state, &newValue, allocator) &&
                         ValueToIndex(&newValue, &index)) {
-                        if (index >= value->list.values.used) {
+                        if (index >= ValueListValueLength(value->list)) {
                             TemLangError(
                               "Index out of range. Size: %zu; Index=%" PRIu64,
-                              value->list.values.used,
+                              ValueListValueLength(value->list),
                               index);
                             result = false;
                         }
-                        result =
-                          ValueListSwapRemove(&value->list.values, index);
+                        result = ValueListValueSwapRemove(value->list, index);
                     } else {
                         result = false;
                     }
                 } break;
                 case ListModifyType_Pop:
-                    ValueListPop(&value->list.values);
+                    ValueListValuePop(value->list);
+                    break;
+                case ListModifyType_Empty:
+                    ValueListValueEmpty(value->list);
                     break;
-                case ListModifyType_Empty: {
-                    const Allocator* a = value->list.values.allocator;
-                    ValueListFree(&value->list.values);
-                    value->list.values.allocator = a;
-                } break;
                 default:
                     result = false;
                     break;
@@ -1584,6 +1947,157 @@ HandleListModifyInstruction(const ListModifyInstruction* i,
     return result;
 }
 
+// Built-in functions on lists, called like user functions ('l :sum' or
+// 'l :indexof 3'). A function with the same name takes precedence so these
+// names aren't reserved
+static inline bool
+EvaluateListQuery(const ListQueryType type,
+                  const Value* left,
+                  const Value* right,
+                  const Allocator* allocator,
+                  pValue value,
+                  pValue leftStorage,
+                  pValue rightStorage)
+{
+    bool binary = false;
+    switch (type) {
+        case ListQueryType_Contains:
+        case ListQueryType_IndexOf:
+        case ListQueryType_CountEqual:
+        case ListQueryType_Fill:
+            binary = true;
+            break;
+        default:
+            break;
+    }
+    const Value* target = binary ? left : getUnaryValue(left, right);
+    if (target == NULL || (binary && right->type == ValueType_Null)) {
+        TemLangError("'%s' expects %s. Got '%s' and '%s'",
+                     ListQueryTypeToString(type),
+                     binary ? "a list on the left and a value on the right"
+                            : "one list and one null value",
+                     ValueTypeToString(left->type),
+                     ValueTypeToString(right->type));
+        return false;
+    }
+    if (type == ListQueryType_Reverse || type == ListQueryType_Fill) {
+        // These keep the length so they work on arrays and strings too
+        if (target->type != ValueType_List &&
+            target->type != ValueType_String) {
+            TemLangError("'%s' expects a list or a string. Got '%s'",
+                         ListQueryTypeToString(type),
+                         ValueTypeToString(target->type));
+            return false;
+        }
+        pValue storage = target == left ? leftStorage : rightStorage;
+        if (target != storage) {
+            if (!ValueCopy(value, target, allocator)) {
+                return false;
+            }
+        } else {
+            ValueMove(value, storage);
+        }
+        if (value->type == ValueType_String) {
+            char c;
+            if (type == ListQueryType_Reverse) {
+                ListKernelReverse_u8((uint8_t*)value->string.buffer,
+                                     value->string.used);
+            } else if (ValueToChar(right, &c)) {
+                ListKernelFill_u8((uint8_t*)value->string.buffer,
+                                  value->string.used,
+                                  (uint8_t)c);
+            } else {
+                TemLangError(
+                  "Cannot fill string because value is not a character.");
+                return false;
+            }
+            return true;
+        }
+        if (!ValueMakeUnique(value)) {
+            return false;
+        }
+        if (type == ListQueryType_Reverse) {
+            ValueListValueReverse(value->list);
+            return true;
+        }
+        const Value* example = value->list->exampleValue;
+        if (!ValueCanTransition(example, right, allocator)) {
+            TemLangError("Cannot fill list because of a type mismatch. List "
+                         "has '%s' but tried to fill with '%s'",
+                         ValueTypeToString(example->type),
+                         ValueTypeToString(right->type));
+            return false;
+        }
+        Value fill = { 0 };
+        bool result = ValueCopy(&fill, right, allocator);
+        if (result && example->type == ValueType_Number) {
+            fill.rangedNumber.range = example->rangedNumber.range;
+        }
+        result = result && ValueListValueFill(value->list, &fill, allocator);
+        ValueFree(&fill);
+        return result;
+    }
+    if (target->type != ValueType_List) {
+        TemLangError("'%s' expects a list. Got '%s'",
+                     ListQueryTypeToString(type),
+                     ValueTypeToString(target->type));
+        return false;
+    }
+    const ValueListValue* l = target->list;
+    const size_t n = ValueListValueLength(l);
+    switch (type) {
+        case ListQueryType_Sum:
+        case ListQueryType_Min:
+        case ListQueryType_Max: {
+            if (l->exampleValue->type != ValueType_Number) {
+                TemLangError("'%s' expects a list of numbers. Got a list of "
+                             "'%s'",
+                             ListQueryTypeToString(type),
+                             ValueTypeToString(l->exampleValue->type));
+                return false;
+            }
+            if (type == ListQueryType_Sum) {
+                value->type = ValueType_Number;
+                value->rangedNumber.range = NULL;
+                value->rangedNumber.number = ValueListValueSum(l);
+                return true;
+            }
+            if (n == 0) {
+                TemLangError("'%s' expects a list that isn't empty",
+                             ListQueryTypeToString(type));
+                return false;
+            }
+            const size_t index = ValueListValueFindExtreme(
+              l,
+              type == ListQueryType_Min ? ComparisonOperator_LessThan
+                                        : ComparisonOperator_GreaterThan);
+            Value scratch;
+            return ValueCopy(
+              value, ValueListValueAt(l, index, &scratch), allocator);
+        }
+        case ListQueryType_Contains:
+            value->type = ValueType_Boolean;
+            value->b = ValueListValueIndexOf(l, right) < n;
+            return true;
+        case ListQueryType_IndexOf: {
+            const size_t index = ValueListValueIndexOf(l, right);
+            value->type = ValueType_Number;
+            value->rangedNumber.range = NULL;
+            value->rangedNumber.number =
+              NumberFromInt(index < n ? (int64_t)index : -1);
+            return true;
+        }
+        case ListQueryType_CountEqual:
+            value->type = ValueType_Number;
+            value->rangedNumber.range = NULL;
+            value->rangedNumber.number =
+              NumberFromUInt(ValueListValueCountEqual(l, right));
+            return true;
+        default:
+            return false;
+    }
+}
+
 static inline Value
 StateProcessTokens(State* state,
                    const TokenList* list,
@@ -1600,6 +2114,8 @@ StateProcessTokens(State* state,
 
     Value v = { 0 };
     InstructionList instructions = TokensToInstructions(list, allocator);
+    FoldInstructions(&instructions, allocator);
+    ResolveInstructions(&instructions, allocator);
     for (size_t i = 0; v.type == ValueType_Null && i < instructions.used; ++i) {
         if (args.printInstructions) {
             TemLangString s =
@@ -1701,9 +2217,7 @@ EvaluateExpression(const Expression* e,
             result = ValueCopy(value, &e->value, allocator);
             break;
         case ExpressionType_UnaryVariable: {
-            const StateFindArgs args = { .log = true, .searchParent = true };
-            const Atom* atom = StateFindAtomConst(
-              state, &e->identifier, AtomType_Variable, args);
+            const Atom* atom = StateFindVariableConst(state, e);
             if (atom == NULL) {
                 result = false;
                 break;
@@ -1712,8 +2226,8 @@ EvaluateExpression(const Expression* e,
         } break;
         case ExpressionType_UnaryScope: {
             State temp = { 0 };
-            temp.parent = state;
-            temp.atoms.allocator = allocator;
+            const size_t arenaState = StateInitScope(&temp, state, allocator);
+            temp.movesReturns = true;
             result = true;
             for (size_t i = 0;
                  value->type == ValueType_Null && i < e->instructions.used;
@@ -1725,12 +2239,11 @@ EvaluateExpression(const Expression* e,
                     break;
                 }
             }
-            StateFree(&temp);
+            StateFreeScope(&temp, arenaState);
         } break;
         case ExpressionType_UnaryStruct: {
             State temp = { 0 };
-            temp.parent = state;
-            temp.atoms.allocator = allocator;
+            const size_t arenaState = StateInitScope(&temp, state, allocator);
             result = true;
             Value unused = { 0 };
             for (size_t i = 0; i < e->instructions.used; ++i) {
@@ -1750,20 +2263,21 @@ EvaluateExpression(const Expression* e,
             ValueFree(&unused);
             if (result) {
                 value->type = ValueType_Struct;
-                value->structValues =
-                  allocator->allocate(sizeof(NamedValueList));
-                *value->structValues = StateToVariableList(&temp, allocator);
+                value->structValues = StructValuesCreate(allocator);
                 value->structValuesAllocator = allocator;
+                value->structValuesRefCount = ValueRefCountCreate(allocator);
+                result = value->structValues != NULL &&
+                         StateToStructValues(
+                           &temp, e, value->structValues, allocator);
             }
-            StateFree(&temp);
+            StateFreeScope(&temp, arenaState);
         } break;
         case ExpressionType_UnaryMatch: {
             State temp = { 0 };
-            temp.parent = state;
-            temp.atoms.allocator = allocator;
+            const size_t arenaState = StateInitScope(&temp, state, allocator);
             result = EvaluateMatchExpression(
               e->matchExpression, &temp, value, allocator);
-            StateFree(&temp);
+            StateFreeScope(&temp, arenaState);
         } break;
         case ExpressionType_UnaryList:
             if (e->expressions.used == 0) {
@@ -1773,42 +2287,50 @@ EvaluateExpression(const Expression* e,
                 break;
             }
             value->type = ValueType_List;
-            value->list.isArray = e->isArray;
-            value->list.allocator = allocator;
-            value->list.values.allocator = allocator;
-            result = true;
+            value->listIsArray = e->isArray;
+            value->list = ValueListValueCreate(allocator);
+            result = value->list != NULL;
             for (size_t i = 0; result && i < e->expressions.used; ++i) {
                 Value temp = { 0 };
                 result =
                   EvaluateExpression(
                     &e->expressions.buffer[i], state, &temp, allocator) &&
-                  ValueListAppend(&value->list.values, &temp);
+                  ValueListAppendMove(&value->list->values, &temp);
+                ValueFree(&temp);
             }
             if (!result) {
                 break;
             }
 
-            result = ValueListValueIsValid(&value->list, allocator);
+            result = ValueListValueIsValid(value->list, allocator);
             if (!result) {
                 break;
             }
 
-            if (value->list.values.buffer[0].type == ValueType_Number) {
-                const Range range =
-                  value->list.values.buffer[0].rangedNumber.range;
-                for (size_t i = 1; i < value->list.values.used; ++i) {
-                    value->list.values.buffer[i].rangedNumber.range = range;
-                    value->list.values.buffer[i].rangedNumber.hasRange = true;
+            if (value->list->values.buffer[0].type == ValueType_Number) {
+                const Range* range =
+                  value->list->values.buffer[0].rangedNumber.range;
+                for (size_t i = 1; i < value->list->values.used; ++i) {
+                    value->list->values.buffer[i].rangedNumber.range = range;
                 }
             }
 
-            value->list.exampleValue = allocator->allocate(sizeof(Value));
-            result = ValueCopy(value->list.exampleValue,
-                               &value->list.values.buffer[0],
-                               allocator);
+            result = ValueCopy(value->list->exampleValue,
+                               &value->list->values.buffer[0],
+                               allocator) &&
+                     ValueListValuePack(value->list);
 
             break;
         case ExpressionType_Binary:
+            if (e->op.type == OperatorType_Get &&
+                e->op.getOperator == GetOperator_Member) {
+                const Value* member =
+                  EvaluateMemberReference(e, state, value, allocator);
+                result = member != NULL &&
+                         (member == value ||
+                          ValueCopy(value, member, allocator));
+                break;
+            }
             result = EvaluateBinaryExpression(
               e->left, &e->op, e->right, state, allocator, value);
             break;
@@ -1821,6 +2343,178 @@ EvaluateExpression(const Expression* e,
     return result;
 }
 
+// A struct member named by a constant string. The slot is kept on the
+// expression along with the shape it was found in so structs of that shape
+// skip the search
+static inline const Value*
+ExpressionStructMember(const Expression* e, const Value* container)
+{
+    if (container->type != ValueType_Struct ||
+        e->right->type != ExpressionType_UnaryValue ||
+        e->right->value.type != ValueType_String) {
+        return NULL;
+    }
+    const StructValues* s = container->structValues;
+    if (s->shape != e->memberShape) {
+        size_t slot = 0;
+        if (!StructShapeFind(s->shape, &e->right->value.string, &slot)) {
+            return NULL;
+        }
+        if (parallelWorker) {
+            return &s->values.buffer[slot];
+        }
+        Expression* cache = (Expression*)e;
+        StructShapeRelease(cache->memberShape);
+        cache->memberShape = StructShapeShare(s->shape);
+        cache->memberSlot = slot;
+    }
+    return &s->values.buffer[e->memberSlot];
+}
+
+// Enums index lists by their ordinal
+static inline const Value*
+ValueListIndexer(const Value* indexer, pValue number)
+{
+    if (indexer->type != ValueType_Enum) {
+        return indexer;
+    }
+    number->type = ValueType_Number;
+    number->rangedNumber.number = NumberFromUInt(indexer->enumValue.ordinal);
+    number->rangedNumber.range = NULL;
+    return number;
+}
+
+// Elements of packed lists aren't stored as values so they are read into
+// storage. Other members are returned without being copied
+static inline const Value*
+ValueIndexInto(const State* state,
+               const Value* container,
+               const Value* indexer,
+               pValue storage)
+{
+    if (container->type != ValueType_List ||
+        !ValueListValueIsPacked(container->list)) {
+        return ValueconstIndex(state, container, indexer);
+    }
+    Value number = { 0 };
+    indexer = ValueListIndexer(indexer, &number);
+    if (indexer->type != ValueType_Number) {
+        return ValueconstIndex(state, container, indexer);
+    }
+    uint64_t index = 0;
+    if (!ValueListIndex(container->list, indexer, &index)) {
+        return NULL;
+    }
+    ValueFree(storage);
+    return ValueListValueAt(container->list, index, storage);
+}
+
+// Member of the value of the left expression. Returned without being copied
+// unless the container was a temporary
+static inline const Value*
+EvaluateMemberReference(const Expression* e,
+                        const State* state,
+                        pValue storage,
+                        const Allocator* allocator)
+{
+    const Value* result = NULL;
+    Value left = { 0 };
+    Value right = { 0 };
+    const Value* container =
+      EvaluateExpressionToConstReference(e->left, state, &left, allocator);
+    if (container == NULL) {
+        goto cleanup;
+    }
+    result = ExpressionStructMember(e, container);
+    if (result == NULL) {
+        const Value* indexer = EvaluateExpressionToConstReference(
+          e->right, state, &right, allocator);
+        if (indexer == NULL) {
+            goto cleanup;
+        }
+        result = ValueIndexInto(state, container, indexer, storage);
+    }
+    // A temporary container is freed below so copy the member out
+    if (result != NULL && result != storage && container == &left) {
+        result = ValueCopy(storage, result, allocator) ? storage : NULL;
+    }
+cleanup:
+    ValueFree(&left);
+    ValueFree(&right);
+    return result;
+}
+
+// Variables, literals and members of them are returned without being copied.
+// Anything else is evaluated into storage
+const Value*
+EvaluateExpressionToConstReference(const Expression* e,
+                                   const State* state,
+                                   pValue storage,
+                                   const Allocator* allocator)
+{
+    switch (e->type) {
+        case ExpressionType_UnaryValue:
+            return &e->value;
+        case ExpressionType_UnaryVariable: {
+            const Atom* atom = StateFindVariableConst(state, e);
+            if (atom == NULL) {
+                EvaluateExpressionError(e);
+                return NULL;
+            }
+            return &atom->variable.value;
+        }
+        case ExpressionType_Binary: {
+            if (e->op.type != OperatorType_Get ||
+                e->op.getOperator != GetOperator_Member) {
+                break;
+            }
+            const Value* result =
+              EvaluateMemberReference(e, state, storage, allocator);
+            if (result == NULL) {
+                EvaluateExpressionError(e);
+            }
+            return result;
+        }
+        default:
+            break;
+    }
+    return EvaluateExpression(e, state, storage, allocator) ? storage : NULL;
+}
+
+// Member of left that a get expression refers to
+static inline Value*
+EvaluateMemberOfReference(const Expression* e,
+                          Value* left,
+                          State* state,
+                          const Allocator* allocator)
+{
+    Value* result = NULL;
+    Value right = { 0 };
+    if (!ValueHasMembers(left)) {
+        TemLangError("Can't use get operator on value type '%s'",
+                     ValueTypeToString(left->type));
+        goto cleanup;
+    }
+    if (left->type == ValueType_Struct) {
+        if (!ValueMakeUnique(left)) {
+            goto cleanup;
+        }
+        result = (Value*)ExpressionStructMember(e, left);
+        if (result != NULL) {
+            goto cleanup;
+        }
+    }
+    const Value* indexer =
+      EvaluateExpressionToConstReference(e->right, state, &right, allocator);
+    if (indexer == NULL) {
+        goto cleanup;
+    }
+    result = ValueIndex(state, left, indexer);
+cleanup:
+    ValueFree(&right);
+    return result;
+}
+
 Value*
 EvaluateExpressionToReference(const Expression* e,
                               State* state,
@@ -1828,9 +2522,7 @@ EvaluateExpressionToReference(const Expression* e,
 {
     switch (e->type) {
         case ExpressionType_UnaryVariable: {
-            const StateFindArgs args = { .log = true, .searchParent = false };
-            Atom* atom =
-              StateFindAtom(state, &e->identifier, AtomType_Variable, args);
+            Atom* atom = StateFindVariable(state, e);
             if (atom == NULL) {
                 return NULL;
             }
@@ -1845,27 +2537,12 @@ EvaluateExpressionToReference(const Expression* e,
         case ExpressionType_Binary: {
             switch (e->op.type) {
                 case OperatorType_Get: {
-                    Value* result = NULL;
-                    Value right = { 0 };
                     Value* left =
                       EvaluateExpressionToReference(e->left, state, allocator);
                     if (left == NULL) {
-                        goto cleanupValue;
+                        return NULL;
                     }
-                    if (!ValueHasMembers(left)) {
-                        TemLangError(
-                          "Can't use get operator on value type '%s'",
-                          ValueTypeToString(left->type));
-                        goto cleanupValue;
-                    }
-                    if (!EvaluateExpression(
-                          e->right, state, &right, allocator)) {
-                        goto cleanupValue;
-                    }
-                    result = ValueIndex(state, left, &right);
-                cleanupValue:
-                    ValueFree(&right);
-                    return result;
+                    return EvaluateMemberOfReference(e, left, state, allocator);
                 } break;
                 default:
                     break;
@@ -1881,6 +2558,78 @@ EvaluateExpressionToReference(const Expression* e,
     return NULL;
 }
 
+static inline bool
+ValueTransitionError(const Value* from,
+                     const Value* to,
+                     const Allocator* allocator)
+{
+    TemLangString fromString = ValueToString(from, allocator);
+    TemLangString toString = ValueToString(to, allocator);
+    TemLangError("Cannot transition value '%s' to '%s'",
+                 fromString.buffer,
+                 toString.buffer);
+    TemLangStringFree(&fromString);
+    TemLangStringFree(&toString);
+    return false;
+}
+
+// Changes the value that e refers to. Elements of packed lists are changed in
+// place so the list doesn't have to be unpacked
+static inline bool
+StateUpdateReference(const Expression* e,
+                     State* state,
+                     const Value* newValue,
+                     const Allocator* allocator)
+{
+    Value* target = NULL;
+    if (e->type != ExpressionType_Binary || e->op.type != OperatorType_Get) {
+        target = EvaluateExpressionToReference(e, state, allocator);
+        return target != NULL &&
+               (ValueTransition(target, newValue, allocator) ||
+                ValueTransitionError(target, newValue, allocator));
+    }
+    Value* left = EvaluateExpressionToReference(e->left, state, allocator);
+    if (left == NULL) {
+        return false;
+    }
+    if (left->type != ValueType_List || !ValueListValueIsPacked(left->list)) {
+        target = EvaluateMemberOfReference(e, left, state, allocator);
+        return target != NULL &&
+               (ValueTransition(target, newValue, allocator) ||
+                ValueTransitionError(target, newValue, allocator));
+    }
+
+    bool result = false;
+    Value right = { 0 };
+    Value number = { 0 };
+    Value element = { 0 };
+    uint64_t index = 0;
+    const Value* indexer =
+      EvaluateExpressionToConstReference(e->right, state, &right, allocator);
+    if (indexer == NULL) {
+        goto cleanup;
+    }
+    indexer = ValueListIndexer(indexer, &number);
+    if (indexer->type != ValueType_Number) {
+        target = ValueIndex(state, left, indexer);
+        result = target != NULL &&
+                 (ValueTransition(target, newValue, allocator) ||
+                  ValueTransitionError(target, newValue, allocator));
+        goto cleanup;
+    }
+    if (!ValueMakeUnique(left) ||
+        !ValueListIndex(left->list, indexer, &index)) {
+        goto cleanup;
+    }
+    result =
+      ValueListValueTransition(left->list, index, newValue, allocator) ||
+      ValueTransitionError(
+        ValueListValueAt(left->list, index, &element), newValue, allocator);
+cleanup:
+    ValueFree(&right);
+    return result;
+}
+
 static inline bool
 EvaluateGetExpression(const Value* left,
                       const Value* right,
@@ -1915,8 +2664,7 @@ EvaluateGetExpression(const Value* left,
                 case AtomType_Range: {
                     fakeValue->type = ValueType_Number;
                     fakeValue->rangedNumber.number = atom->range.min;
-                    fakeValue->rangedNumber.range = atom->range;
-                    fakeValue->rangedNumber.hasRange = true;
+                    fakeValue->rangedNumber.range = RangeIntern(&atom->range);
                     return true;
                 } break;
                 case AtomType_Variable:
@@ -1924,26 +2672,18 @@ EvaluateGetExpression(const Value* left,
                       fakeValue, &atom->variable.value, allocator);
                 case AtomType_Enum: {
                     if (atom->enumDefinition.isFlag) {
-                        fakeValue->type = ValueType_Flag;
-                        return TemLangStringCopy(
-                          &fakeValue->flagValue.name, &atom->name, allocator);
+                        return AtomToFlagValue(atom, fakeValue, allocator);
                     } else {
-                        fakeValue->type = ValueType_Enum;
-                        return TemLangStringCopy(
-                                 &fakeValue->enumValue.value,
-                                 &atom->enumDefinition.members.buffer[0],
-                                 allocator) &&
-                               TemLangStringCopy(&fakeValue->enumValue.name,
-                                                 &atom->name,
-                                                 allocator);
+                        return AtomToEnumValue(atom, 0, fakeValue);
                     }
                 } break;
                 case AtomType_Struct: {
                     if (atom->structDefinition.isVariant) {
                         fakeValue->type = ValueType_Variant;
-                        fakeValue->variantValue.allocator = allocator;
-                        fakeValue->variantValue.value =
-                          allocator->allocate(sizeof(Value));
+                        fakeValue->variantValue = VariantValueCreate(allocator);
+                        if (fakeValue->variantValue == NULL) {
+                            return false;
+                        }
                         {
                             NamedValue nv = { 0 };
                             if (!StructMemberToFakeValue(
@@ -1954,29 +2694,38 @@ EvaluateGetExpression(const Value* left,
                                 return false;
                             }
                             if (nv.value.type == ValueType_Type) {
-                                ValueCopy(fakeValue->variantValue.value,
+                                ValueCopy(fakeValue->variantValue->value,
                                           nv.value.fakeValue,
                                           allocator);
                             } else {
-                                ValueCopy(fakeValue->variantValue.value,
+                                ValueCopy(fakeValue->variantValue->value,
                                           &nv.value,
                                           allocator);
                             }
                             NamedValueFree(&nv);
                         }
-                        return TemLangStringCopy(&fakeValue->variantValue.name,
+                        return TemLangStringCopy(&fakeValue->variantValue->name,
                                                  &atom->name,
                                                  allocator) &&
                                TemLangStringCopy(
-                                 &fakeValue->variantValue.memberName,
+                                 &fakeValue->variantValue->memberName,
                                  &atom->structDefinition.members.buffer[0].name,
                                  allocator);
                     } else {
                         fakeValue->type = ValueType_Struct;
                         fakeValue->structValuesAllocator = allocator;
+                        fakeValue->structValuesRefCount =
+                          ValueRefCountCreate(allocator);
                         fakeValue->structValues =
-                          allocator->allocate(sizeof(NamedValueList));
-                        fakeValue->structValues->allocator = allocator;
+                          StructValuesCreate(allocator);
+                        if (fakeValue->structValues == NULL) {
+                            return false;
+                        }
+                        fakeValue->structValues->shape =
+                          StructShapeShare(atom->structDefinition.shape);
+                        if (fakeValue->structValues->shape == NULL) {
+                            return false;
+                        }
                         for (size_t i = 0;
                              i < atom->structDefinition.members.used;
                              ++i) {
@@ -1988,14 +2737,12 @@ EvaluateGetExpression(const Value* left,
                             if (result) {
                                 // Ensure structs of struct give an actual
                                 // struct and not a fake value
-                                NamedValue temp = { .name = nv.name };
-                                if (nv.value.type == ValueType_Type) {
-                                    temp.value = *nv.value.fakeValue;
-                                } else {
-                                    temp.value = nv.value;
-                                }
-                                result = NamedValueListAppend(
-                                  fakeValue->structValues, &temp);
+                                const Value* member =
+                                  nv.value.type == ValueType_Type
+                                    ? nv.value.fakeValue
+                                    : &nv.value;
+                                result = ValueListAppend(
+                                  &fakeValue->structValues->values, member);
                             }
                             NamedValueFree(&nv);
                             if (!result) {
@@ -2010,11 +2757,11 @@ EvaluateGetExpression(const Value* left,
             }
         } break;
         case GetOperator_Member: {
-            const Value* result = ValueconstIndex(state, left, right);
+            const Value* result = ValueIndexInto(state, left, right, value);
             if (result == NULL) {
                 break;
             }
-            return ValueCopy(value, result, allocator);
+            return result == value || ValueCopy(value, result, allocator);
         } break;
         case GetOperator_MakeList: {
             const Value* target = getUnaryValue(left, right);
@@ -2022,12 +2769,13 @@ EvaluateGetExpression(const Value* left,
                 break;
             }
             value->type = ValueType_List;
-            value->list.allocator = allocator;
-            value->list.isArray = false;
-            value->list.exampleValue = allocator->allocate(sizeof(Value));
-            ValueListFree(&value->list.values);
-            return ValueCopy(
-              value->list.exampleValue, target->fakeValue, allocator);
+            value->listIsArray = false;
+            value->list = ValueListValueCreate(allocator);
+            return value->list != NULL &&
+                   ValueCopy(value->list->exampleValue,
+                             target->fakeValue,
+                             allocator) &&
+                   ValueListValuePack(value->list);
         } break;
         case GetOperator_Length: {
             const Value* target = getUnaryValue(left, right);
@@ -2037,25 +2785,17 @@ EvaluateGetExpression(const Value* left,
             switch (target->type) {
                 case ValueType_List: {
                     value->type = ValueType_Number;
-                    value->rangedNumber.hasRange = false;
+                    value->rangedNumber.range = NULL;
                     value->rangedNumber.number =
-                      NumberFromUInt(target->list.values.used);
+                      NumberFromUInt(ValueListValueLength(target->list));
                     return true;
                 } break;
-                case ValueType_Enum: {
+                case ValueType_Enum:
                     value->type = ValueType_Number;
-                    value->rangedNumber.hasRange = false;
-                    const StateFindArgs args = { .log = true,
-                                                 .searchParent = true };
-                    const Atom* atom = StateFindAtomConst(
-                      state, &target->enumValue.name, AtomType_Enum, args);
-                    if (atom == NULL) {
-                        break;
-                    }
+                    value->rangedNumber.range = NULL;
                     value->rangedNumber.number =
-                      NumberFromUInt(atom->enumDefinition.members.used);
+                      NumberFromUInt(target->enumValue.names->members.used);
                     return true;
-                } break;
                 default:
                     TemLangError(
                       "Cannot used length operator on value type '%s'",
@@ -2077,20 +2817,76 @@ EvaluateFunctionExpression(const Value* left,
                            const Value* right,
                            const State* state,
                            const Allocator* allocator,
-                           pValue value)
+                           pValue value,
+                           pValue leftStorage,
+                           pValue rightStorage)
 {
-    const StateFindArgs args = { .log = true, .searchParent = true };
+    const StateFindArgs args = { .log = false, .searchParent = true };
     const Atom* atom = StateFindAtomConst(state, name, AtomType_Function, args);
     if (atom == NULL) {
+        const ListQueryType query =
+          ListQueryTypeFromCaseInsensitiveString(name->buffer, name->used);
+        if (query != ListQueryType_Invalid) {
+            return EvaluateListQuery(
+              query, left, right, allocator, value, leftStorage, rightStorage);
+        }
+        const StateFindArgs logArgs = { .log = true, .searchParent = true };
+        StateFindAtomConst(state, name, AtomType_Function, logArgs);
         return false;
     }
-    bool result = true;
-    State temp = { 0 };
-    temp.parent = state;
-    temp.atoms.allocator = allocator;
-    const InstructionList* instructions =
-      &atom->functionDefinition.instructions;
-    switch (atom->functionDefinition.type) {
+    const FunctionDefinition* f = &atom->functionDefinition;
+    size_t parameters = 0;
+    switch (f->type) {
+        case FunctionType_Unary:
+            parameters = 1;
+            break;
+        case FunctionType_Binary:
+            parameters = 2;
+            break;
+        default:
+            break;
+    }
+    MemoCache* memo = NULL;
+    uint32_t hash = 0;
+    // Caches are shared by every call so workers run the function instead
+    if ((memoizeAll || f->memoize) && f->type != FunctionType_Procedure &&
+        !parallelWorker && MemoHashArguments(left, right, &hash)) {
+        if (f->memo == NULL) {
+            // The cache is filled in on a const definition
+            ((FunctionDefinition*)f)->memo =
+              MemoCacheCreate(f->instructions.allocator);
+        }
+        memo = f->memo;
+    }
+    if (memo != NULL) {
+        const Value* cached = MemoCacheFind(memo, hash, left, right);
+        if (cached != NULL) {
+            ++memoHits;
+            return ValueCopy(value, cached, allocator);
+        }
+        ++memoMisses;
+        // The arguments become the key so they can't be moved into the frame
+        leftStorage = NULL;
+        rightStorage = NULL;
+    }
+    Value native = { 0 };
+    const JitCall jit =
+      JitFunctionCall(f, name, left, right, state, allocator, &native);
+    if (jit == JitCall_Native) {
+        ValueMove(value, &native);
+        return memo == NULL || MemoCacheInsert(memo, hash, left, right, value);
+    }
+    State* frame = CallStackPush(state, name, allocator);
+    if (frame == NULL) {
+        return false;
+    }
+    const bool profiled = profileEnabled && !parallelWorker &&
+                          ProfileEnter(ProfileFunctionEntry(f, name));
+    SamplerPush(f, name);
+    const uint32_t traced = TraceFunctionEnter(f, name);
+    bool result = StateTruncate(frame, parameters);
+    const InstructionList* instructions = &f->instructions;
+    switch (f->type) {
         case FunctionType_Unary: {
             const Value* target = getUnaryValue(left, right);
             if (target == NULL) {
@@ -2101,37 +2897,23 @@ EvaluateFunctionExpression(const Value* left,
                 result = false;
                 break;
             }
-            Atom newAtom = { 0 };
-            newAtom.type = AtomType_Variable;
-            newAtom.variable.type = VariableType_Immutable;
-            if (!TemLangStringCopy(&newAtom.name,
-                                   &atom->functionDefinition.leftParameter,
-                                   allocator) ||
-                !ValueCopy(&newAtom.variable.value, target, allocator)) {
-                result = false;
-            }
-            result = AtomListAppend(&temp.atoms, &newAtom);
-            AtomFree(&newAtom);
-        } break;
-        case FunctionType_Binary: {
-            Atom leftAtom = { 0 };
-            Atom rightAtom = { 0 };
-            rightAtom.type = leftAtom.type = AtomType_Variable;
-            rightAtom.variable.type = leftAtom.variable.type =
-              VariableType_Immutable;
-            result = TemLangStringCopy(&leftAtom.name,
-                                       &atom->functionDefinition.leftParameter,
-                                       allocator) &&
-                     ValueCopy(&leftAtom.variable.value, left, allocator) &&
-                     TemLangStringCopy(&rightAtom.name,
-                                       &atom->functionDefinition.rightParameter,
-                                       allocator) &&
-                     ValueCopy(&rightAtom.variable.value, right, allocator) &&
-                     AtomListAppend(&temp.atoms, &leftAtom) &&
-                     AtomListAppend(&temp.atoms, &rightAtom);
-            AtomFree(&leftAtom);
-            AtomFree(&rightAtom);
+            result = result &&
+                     StateBindParameter(frame,
+                                        0,
+                                        &f->leftParameter,
+                                        target,
+                                        target == left ? leftStorage
+                                                       : rightStorage,
+                                        allocator);
         } break;
+        case FunctionType_Binary:
+            result =
+              result &&
+              StateBindParameter(
+                frame, 0, &f->leftParameter, left, leftStorage, allocator) &&
+              StateBindParameter(
+                frame, 1, &f->rightParameter, right, rightStorage, allocator);
+            break;
         case FunctionType_Procedure:
             TemLangError("Cannot call procedures like functions");
             result = false;
@@ -2151,56 +2933,65 @@ EvaluateFunctionExpression(const Value* left,
          result && value->type == ValueType_Null && i < instructions->used;
          ++i) {
         result = StateProcessInstruction(
-          &temp, &instructions->buffer[i], allocator, value);
+          frame, &instructions->buffer[i], allocator, value);
         if (!result) {
             InstructionError(&instructions->buffer[i]);
             break;
         }
     }
-    StateFree(&temp);
+    TraceFunctionExit(traced, result);
+    SamplerPop();
+    if (profiled) {
+        ProfileExit();
+    }
+    CallStackPop(frame, parameters);
+    if (jit == JitCall_Verify) {
+        if (result) {
+            JitFunctionVerify(f, &native, value);
+        }
+        ValueFree(&native);
+    }
+    if (result && memo != NULL) {
+        result = MemoCacheInsert(memo, hash, left, right, value);
+    }
     return result;
 }
 
 static inline bool
-StructsMatch(const NamedValueList* list,
-             const NamedValueList* types,
+StructsMatch(const StructValues* list,
+             const StructValues* types,
              const Allocator* allocator)
 {
-    if (list->used != types->used) {
+    if (list->values.used != types->values.used) {
         TemLangError("Member count doesn't match when matching struct. "
-                     "Expected %zu. Got %zu.",
-                     types->used,
-                     list->used);
+                     "Expected %u. Got %u.",
+                     types->values.used,
+                     list->values.used);
         return false;
     }
-    const NamedValue* nv = NULL;
-    for (size_t i = 0; i < types->used; ++i) {
-        nv = NULL;
-        NamedValueListFindIf(list,
-                             (NamedValueListFindFunc)NamedValueNameEquals,
-                             &types->buffer[i],
-                             &nv,
-                             NULL);
-        if (nv == NULL) {
-            TemLangError("Missing member '%s' in struct",
-                         types->buffer[i].name.buffer);
+    for (size_t i = 0; i < types->values.used; ++i) {
+        const TemLangString* name = &types->shape->names.buffer[i];
+        size_t slot = 0;
+        if (!StructShapeFind(list->shape, name, &slot)) {
+            TemLangError("Missing member '%s' in struct", name->buffer);
             return false;
         }
+        const Value* value = &list->values.buffer[slot];
         const Value* targetValue = NULL;
-        if (nv->value.type == ValueType_Type) {
-            targetValue = types->buffer[i].value.fakeValue;
+        if (value->type == ValueType_Type) {
+            targetValue = types->values.buffer[i].fakeValue;
         } else {
-            targetValue = &nv->value;
+            targetValue = value;
         }
-        if (!ValueCanTransition(&nv->value, targetValue, allocator)) {
-            if (nv->value.type == targetValue->type) {
+        if (!ValueCanTransition(value, targetValue, allocator)) {
+            if (value->type == targetValue->type) {
                 TemLangError("Type mismatch for member '%s' in struct",
-                             types->buffer[i].name.buffer);
+                             name->buffer);
             } else {
                 TemLangError("Type mismatch for member '%s' in struct. Got "
                              "'%s'; Expected '%s'",
-                             types->buffer[i].name.buffer,
-                             ValueTypeToString(nv->value.type),
+                             name->buffer,
+                             ValueTypeToString(value->type),
                              ValueTypeToString(targetValue->type));
             }
             return false;
@@ -2209,6 +3000,38 @@ StructsMatch(const NamedValueList* list,
     return true;
 }
 
+// Puts the members of a struct that matched a struct type in the order of the
+// type's shape so it shares the type's member names
+static inline bool
+StructToShape(pValue value,
+              const Value* structValue,
+              const StructValues* types,
+              const Allocator* allocator)
+{
+    const StructValues* list = structValue->structValues;
+    if (list->shape == types->shape) {
+        return ValueCopy(value, structValue, allocator);
+    }
+    value->type = ValueType_Struct;
+    value->structValues = StructValuesCreate(allocator);
+    value->structValuesAllocator = allocator;
+    value->structValuesRefCount = ValueRefCountCreate(allocator);
+    if (value->structValues == NULL) {
+        return false;
+    }
+    value->structValues->shape = StructShapeShare(types->shape);
+    for (size_t i = 0; i < types->values.used; ++i) {
+        size_t slot = 0;
+        if (!StructShapeFind(
+              list->shape, &types->shape->names.buffer[i], &slot) ||
+            !ValueListAppend(&value->structValues->values,
+                             &list->values.buffer[slot])) {
+            return false;
+        }
+    }
+    return true;
+}
+
 static inline bool
 EvaluateAddExpression(const Value* left,
                       const Value* right,
@@ -2231,37 +3054,13 @@ EvaluateAddExpression(const Value* left,
                                ValueType_Enum,
                                &numberValue,
                                &enumValue)) {
-            StateFindArgs args = { .log = true, .searchParent = true };
-            const Atom* atom = StateFindAtomConst(
-              state, &enumValue->enumValue.name, AtomType_Enum, args);
-            if (atom == NULL) {
-                return false;
-            }
-            size_t index;
-            if (!TemLangStringListFindIf(
-                  &atom->enumDefinition.members,
-                  (TemLangStringListFindFunc)TemLangStringsAreEqual,
-                  &enumValue->enumValue.value,
-                  NULL,
-                  &index)) {
-                MemberNotFoundError(
-                  "Enum", &atom->name, &enumValue->enumValue.value);
-                TemLangString members = TemLangStringListToString(
-                  &atom->enumDefinition.members, allocator);
-                TemLangError("Members %s", members.buffer);
-                TemLangStringFree(&members);
-                return false;
-            }
-            const int64_t n = NumberToInt(&numberValue->rangedNumber.number);
-
+            const EnumValue* e = &enumValue->enumValue;
+            const uint64_t n = NumberToInt(&numberValue->rangedNumber.number);
             value->type = ValueType_Enum;
-            index = (n + index) % atom->enumDefinition.members.used;
-            return TemLangStringCopy(
-                     &value->enumValue.value,
-                     &atom->enumDefinition.members.buffer[index],
-                     allocator) &&
-                   TemLangStringCopy(
-                     &value->enumValue.name, &atom->name, allocator);
+            value->enumValue.names = EnumNamesShare(e->names);
+            value->enumValue.ordinal =
+              (uint32_t)((n + e->ordinal) % e->names->members.used);
+            return true;
         }
     }
     {
@@ -2278,9 +3077,9 @@ EvaluateAddExpression(const Value* left,
             switch (fakeValue->type) {
                 case ValueType_Number: {
                     if (!numberInRange(&numberValue->rangedNumber.number,
-                                       &fakeValue->rangedNumber.range)) {
+                                       fakeValue->rangedNumber.range)) {
                         numberNotInRangeError(&numberValue->rangedNumber.number,
-                                              &fakeValue->rangedNumber.range,
+                                              fakeValue->rangedNumber.range,
                                               allocator);
                         return false;
                     }
@@ -2288,7 +3087,6 @@ EvaluateAddExpression(const Value* left,
                     value->rangedNumber.number =
                       numberValue->rangedNumber.number;
                     value->rangedNumber.range = fakeValue->rangedNumber.range;
-                    value->rangedNumber.hasRange = true;
                     return true;
                 } break;
                 case ValueType_String: {
@@ -2298,31 +3096,22 @@ EvaluateAddExpression(const Value* left,
                     return true;
                 } break;
                 case ValueType_Enum: {
-                    const StateFindArgs args = { .log = true,
-                                                 .searchParent = true };
-                    const Atom* atom = StateFindAtomConst(
-                      state, &fakeValue->enumValue.name, AtomType_Enum, args);
-                    if (atom == NULL) {
-                        return false;
-                    }
+                    const EnumNames* names = fakeValue->enumValue.names;
                     const size_t index =
                       NumberToUInt(&numberValue->rangedNumber.number);
-                    if (index >= atom->enumDefinition.members.used) {
+                    if (index >= names->members.used) {
                         TemLangError("Enum '%s' only has %zu members but tried "
                                      "to get index %zu",
-                                     fakeValue->enumValue.name.buffer,
-                                     atom->enumDefinition.members.used,
+                                     names->name.buffer,
+                                     names->members.used,
                                      index);
                         return false;
                     }
                     value->type = ValueType_Enum;
-                    return TemLangStringCopy(&value->enumValue.name,
-                                             &fakeValue->enumValue.name,
-                                             allocator) &&
-                           TemLangStringCopy(
-                             &value->enumValue.value,
-                             &atom->enumDefinition.members.buffer[index],
-                             allocator);
+                    value->enumValue.names =
+                      EnumNamesShare(fakeValue->enumValue.names);
+                    value->enumValue.ordinal = (uint32_t)index;
+                    return true;
                 } break;
                 default:
                     break;
@@ -2341,54 +3130,48 @@ EvaluateAddExpression(const Value* left,
             const Value* fakeValue = typeValue->fakeValue;
             const Allocator* allocator = typeValue->fakeValueAllocator;
             switch (fakeValue->type) {
-                case ValueType_Enum:
-                case ValueType_Flag: {
-                    const StateFindArgs args = { .log = true,
-                                                 .searchParent = true };
-                    const Atom* atom = StateFindAtomConst(
-                      state, &fakeValue->enumValue.name, AtomType_Enum, args);
-                    if (atom == NULL) {
+                case ValueType_Enum: {
+                    const EnumNames* names = fakeValue->enumValue.names;
+                    size_t index = 0;
+                    if (!TemLangStringListFindIf(
+                          &names->members,
+                          (TemLangStringListFindFunc)TemLangStringsAreEqual,
+                          &stringValue->string,
+                          NULL,
+                          &index)) {
+                        MemberNotFoundError(
+                          "Enum", &names->name, &stringValue->string);
                         break;
                     }
-                    if (TemLangStringIsEmpty(&stringValue->string) &&
-                        fakeValue->type == ValueType_Flag) {
-                        value->type = ValueType_Flag;
-                        value->flagValue.members.allocator = allocator;
-                        value->flagValue.members.size = 0UL;
-                        value->flagValue.members.used = 0UL;
-                        value->flagValue.members.buffer = NULL;
-                        return true;
-                    }
-                    if (!TemLangStringListFindIf(
-                          &atom->enumDefinition.members,
+                    value->type = ValueType_Enum;
+                    value->enumValue.names =
+                      EnumNamesShare(fakeValue->enumValue.names);
+                    value->enumValue.ordinal = (uint32_t)index;
+                    return true;
+                } break;
+                case ValueType_Flag: {
+                    const FlagValue* flag = &fakeValue->flagValue;
+                    size_t ordinal = 0;
+                    if (!TemLangStringIsEmpty(&stringValue->string) &&
+                        !TemLangStringListFindIf(
+                          &flag->names->members,
                           (TemLangStringListFindFunc)TemLangStringsAreEqual,
                           &stringValue->string,
                           NULL,
-                          NULL)) {
+                          &ordinal)) {
                         MemberNotFoundError(
-                          fakeValue->type == ValueType_Enum ? "Enum" : "Flag",
-                          &fakeValue->enumValue.name,
-                          &stringValue->string);
+                          "Flag", &flag->names->name, &stringValue->string);
                         break;
                     }
-                    if (fakeValue->type == ValueType_Enum) {
-                        value->type = ValueType_Enum;
-                        return TemLangStringCopy(&value->enumValue.name,
-                                                 &fakeValue->enumValue.name,
-                                                 allocator) &&
-                               TemLangStringCopy(&value->enumValue.value,
-                                                 &stringValue->string,
-                                                 allocator);
-                    } else {
-                        value->type = ValueType_Flag;
-                        value->flagValue.members.allocator = allocator;
-                        return TemLangStringListAppend(
-                                 &value->flagValue.members,
-                                 &stringValue->string) &&
-                               TemLangStringCopy(&value->flagValue.name,
-                                                 &fakeValue->flagValue.name,
-                                                 allocator);
+                    value->type = ValueType_Flag;
+                    if (!FlagValueCreate(
+                          &value->flagValue, flag->names, allocator)) {
+                        return false;
+                    }
+                    if (!TemLangStringIsEmpty(&stringValue->string)) {
+                        FlagValueSet(&value->flagValue, ordinal, true);
                     }
+                    return true;
                 } break;
                 case ValueType_Number: {
                     if (isNumber(allocator,
@@ -2397,14 +3180,13 @@ EvaluateAddExpression(const Value* left,
                                  &value->rangedNumber.number)) {
                         value->type = ValueType_Number;
                         if (!numberInRange(&value->rangedNumber.number,
-                                           &fakeValue->rangedNumber.range)) {
+                                           fakeValue->rangedNumber.range)) {
                             numberNotInRangeError(
                               &value->rangedNumber.number,
-                              &fakeValue->rangedNumber.range,
+                              fakeValue->rangedNumber.range,
                               allocator);
                             break;
                         }
-                        value->rangedNumber.hasRange = true;
                         value->rangedNumber.range =
                           fakeValue->rangedNumber.range;
                         return true;
@@ -2433,23 +3215,27 @@ EvaluateAddExpression(const Value* left,
                     if (StructsMatch(structValue->structValues,
                                      fakeValue->structValues,
                                      allocator)) {
-                        return ValueCopy(value, structValue, allocator);
+                        return StructToShape(value,
+                                             structValue,
+                                             fakeValue->structValues,
+                                             allocator);
                     }
                     break;
                 case ValueType_Variant: {
-                    if (structValue->structValues->used != 1) {
+                    if (structValue->structValues->values.used != 1) {
                         TemLangError("Structs converted to variants should "
-                                     "only have 1 member. Got %zu",
-                                     structValue->structValues->used);
+                                     "only have 1 member. Got %u",
+                                     structValue->structValues->values.used);
                         break;
                     }
-                    const NamedValue* nv =
-                      &structValue->structValues->buffer[0];
+                    const NamedValue member =
+                      StructValuesGet(structValue->structValues, 0);
+                    const NamedValue* nv = &member;
                     const StateFindArgs args = { .log = true,
                                                  .searchParent = true };
                     const Atom* atom =
                       StateFindAtomConst(state,
-                                         &fakeValue->variantValue.name,
+                                         &fakeValue->variantValue->name,
                                          AtomType_Struct,
                                          args);
                     if (atom == NULL) {
@@ -2483,23 +3269,23 @@ EvaluateAddExpression(const Value* left,
                       ValueCanTransition(&nv->value, fakeValue, allocator);
                     if (result) {
                         value->type = ValueType_Variant;
-                        value->variantValue.allocator = allocator;
-                        pValue varValue = allocator->allocate(sizeof(Value));
-                        value->variantValue.value = varValue;
+                        value->variantValue = VariantValueCreate(allocator);
+                        pValue varValue = value->variantValue == NULL
+                                            ? NULL
+                                            : value->variantValue->value;
                         result =
-                          TemLangStringCopy(&value->variantValue.name,
+                          varValue != NULL &&
+                          TemLangStringCopy(&value->variantValue->name,
                                             &atom->name,
                                             allocator) &&
-                          TemLangStringCopy(&value->variantValue.memberName,
+                          TemLangStringCopy(&value->variantValue->memberName,
                                             &m->name,
                                             allocator) &&
                           ValueCopy(varValue, &nv->value, allocator);
                         if (result) {
                             if (varValue->type == ValueType_Number) {
-                                const Range range =
+                                varValue->rangedNumber.range =
                                   fakeValue->rangedNumber.range;
-                                varValue->rangedNumber.range = range;
-                                varValue->rangedNumber.hasRange = true;
                             }
                         }
                     } else {
@@ -2535,7 +3321,7 @@ EvaluateAddExpression(const Value* left,
                     value->type = ValueType_String;
                     return TemLangStringCopy(
                       &value->string,
-                      &variantValue->variantValue.memberName,
+                      &variantValue->variantValue->memberName,
                       allocator);
                 } break;
                 default:
@@ -2557,35 +3343,22 @@ EvaluateAddExpression(const Value* left,
                 case ValueType_String: {
                     value->type = ValueType_String;
                     return TemLangStringCopy(
-                      &value->string, &enumValue->enumValue.value, allocator);
+                      &value->string,
+                      EnumValueMember(&enumValue->enumValue),
+                      allocator);
                 } break;
                 case ValueType_Number: {
-                    const StateFindArgs args = { .log = true,
-                                                 .searchParent = true };
-                    const Atom* atom = StateFindAtomConst(
-                      state, &enumValue->enumValue.name, AtomType_Enum, args);
-                    if (atom == NULL) {
-                        return false;
-                    }
-                    size_t index = 0;
-                    TemLangStringListFindIf(
-                      &atom->enumDefinition.members,
-                      (TemLangStringListFindFunc)TemLangStringsAreEqual,
-                      &enumValue->enumValue.value,
-                      NULL,
-                      &index);
                     const Number number = { .type = NumberType_Unsigned,
-                                            .u = index };
+                                            .u = enumValue->enumValue.ordinal };
                     if (!numberInRange(&number,
-                                       &fakeValue->rangedNumber.range)) {
+                                       fakeValue->rangedNumber.range)) {
                         numberNotInRangeError(
-                          &number, &fakeValue->rangedNumber.range, allocator);
+                          &number, fakeValue->rangedNumber.range, allocator);
                         return false;
                     }
                     value->type = ValueType_Number;
                     value->rangedNumber.number = number;
                     value->rangedNumber.range = fakeValue->rangedNumber.range;
-                    value->rangedNumber.hasRange = true;
                     return true;
                 } break;
                 default:
@@ -2605,13 +3378,9 @@ EvaluateAddExpression(const Value* left,
             switch (typeValue->fakeValue->type) {
                 case ValueType_Flag:
                     value->type = ValueType_Flag;
-                    memset(&value->flagValue.members,
-                           0,
-                           sizeof(value->flagValue.members));
-                    value->flagValue.members.allocator = allocator;
-                    return TemLangStringCopy(
-                      &value->flagValue.name,
-                      &typeValue->fakeValue->flagValue.name,
+                    return FlagValueCreate(
+                      &value->flagValue,
+                      typeValue->fakeValue->flagValue.names,
                       allocator);
                 default:
                     break;
@@ -2644,6 +3413,73 @@ StateToVariableList(const State* state, const Allocator* allocator)
     return list;
 }
 
+// Moves the variables of a unary struct's scope into a struct value. The
+// expression keeps the shape so the structs it makes share member names
+static inline bool
+StateToStructValues(State* state,
+                    const Expression* e,
+                    pStructValues s,
+                    const Allocator* allocator)
+{
+    Expression* cache = (Expression*)e;
+    const StructShape* shape = cache->structShape;
+    size_t count = 0;
+    bool reuse = shape != NULL;
+    for (size_t i = 0; i < state->atoms.used; ++i) {
+        const Atom* atom = &state->atoms.buffer[i];
+        if (atom->type != AtomType_Variable) {
+            continue;
+        }
+        if (reuse && (count >= shape->names.used ||
+                      !TemLangStringsAreEqual(&shape->names.buffer[count],
+                                              &atom->name))) {
+            reuse = false;
+        }
+        ++count;
+    }
+    if (!reuse || count != shape->names.used) {
+        TemLangStringList names = { .allocator = allocator };
+        for (size_t i = 0; i < state->atoms.used; ++i) {
+            const Atom* atom = &state->atoms.buffer[i];
+            if (atom->type == AtomType_Variable &&
+                !TemLangStringListAppend(&names, &atom->name)) {
+                TemLangStringListFree(&names);
+                return false;
+            }
+        }
+        StructShape* newShape = StructShapeCreate(
+          &names, ParallelAllocatorOr(e->instructions.allocator));
+        TemLangStringListFree(&names);
+        if (newShape == NULL) {
+            return false;
+        }
+        if (parallelWorker) {
+            s->shape = newShape;
+            goto moveValues;
+        }
+        StructShapeRelease(cache->structShape);
+        cache->structShape = newShape;
+    }
+    s->shape = StructShapeShare(cache->structShape);
+moveValues:
+    for (size_t i = 0; i < state->atoms.used; ++i) {
+        pAtom atom = &state->atoms.buffer[i];
+        if (atom->type != AtomType_Variable) {
+            continue;
+        }
+        if (!ValueListRellocateIfNeeded(&s->values)) {
+            return false;
+        }
+        // The scope is freed after this so its values are moved
+        pValue v = &s->values.buffer[s->values.used++];
+        ValueMove(v, &atom->variable.value);
+        if (!ValueLeaveScopeArena(v, allocator)) {
+            return false;
+        }
+    }
+    return true;
+}
+
 static inline bool
 StructMemberToFakeValue(const StructMember* m,
                         const State* state,
@@ -2678,43 +3514,36 @@ StructMemberToFakeValue(const StructMember* m,
     switch (m->quantity) {
         case 0: {
             pValue fakeValue = tempValue.fakeValue;
-            ValueListValue list = { .allocator = allocator,
-                                    .isArray = false,
-                                    .values = { .buffer = NULL,
-                                                .allocator = allocator,
-                                                .size = 0,
-                                                .used = 0 } };
-            list.exampleValue = allocator->allocate(sizeof(Value));
-            if (!ValueCopy(list.exampleValue, fakeValue, allocator)) {
+            pValueListValue list = ValueListValueCreate(allocator);
+            if (list == NULL ||
+                !ValueCopy(list->exampleValue, fakeValue, allocator)) {
                 result = false;
             }
             fakeValue->type = ValueType_List;
             fakeValue->list = list;
+            fakeValue->listIsArray = false;
         } break;
         case 1:
             break;
         default: {
             pValue fakeValue = tempValue.fakeValue;
-            ValueListValue list = { .allocator = allocator,
-                                    .isArray = true,
-                                    .values = { .buffer = NULL,
-                                                .allocator = allocator,
-                                                .size = 0,
-                                                .used = 0 } };
-            list.exampleValue = allocator->allocate(sizeof(Value));
-            if (!ValueCopy(list.exampleValue, fakeValue, allocator)) {
+            pValueListValue list = ValueListValueCreate(allocator);
+            if (list == NULL ||
+                !ValueCopy(list->exampleValue, fakeValue, allocator)) {
                 result = false;
             }
             for (size_t i = 0; result && i < m->quantity; ++i) {
-                result = ValueListAppend(&list.values, fakeValue);
+                result = ValueListAppend(&list->values, fakeValue);
             }
+            result = result && ValueListValuePack(list);
             fakeValue->type = ValueType_List;
             fakeValue->list = list;
+            fakeValue->listIsArray = true;
         } break;
     }
     if (result) {
-        result = TemLangStringCopy(&nv->name, &m->name, allocator) &&
-                 ValueCopy(&nv->value, &tempValue, allocator);
+        result = TemLangStringCopy(&nv->name, &m->name, allocator);
+        ValueMove(&nv->value, &tempValue);
     }
     ValueFree(&tempValue);
     return result;
@@ -2755,26 +3584,28 @@ static inline bool
 CaptureVariables(State* dest,
                  const State* src,
                  const TemLangStringList* captures,
+                 const uint32_tList* slots,
                  const InstructionSource source)
 {
     bool result = true;
     for (size_t i = 0; result && i < captures->used; ++i) {
         const TemLangString* name = &captures->buffer[i];
         {
-            if (AtomListFindIf(&dest->atoms,
-                               (AtomListFindFunc)AtomNameEquals,
-                               name,
-                               NULL,
-                               NULL)) {
+            if (StateFindAtomIndex(dest, name, TemLangStringHash(name)) >=
+                0) {
                 TemLangError("Variable '%s' was captured multiple times",
                              name->buffer);
                 result = false;
                 break;
             }
         }
-        const Atom* atom = NULL;
-        AtomListFindIf(
-          &src->atoms, (AtomListFindFunc)AtomNameEquals, name, &atom, NULL);
+        const Atom* atom = slots != NULL && i < slots->used
+                             ? StateAtomAtSlot(src, slots->buffer[i], name)
+                             : NULL;
+        if (atom == NULL) {
+            const StateFindArgs args = { .log = false, .searchParent = false };
+            atom = StateFindAnyAtomConst(src, name, args);
+        }
         if (atom == NULL) {
             AtomNotFoundError(name);
             result = false;
@@ -2786,7 +3617,9 @@ CaptureVariables(State* dest,
             result = false;
             break;
         }
-        result = AtomListAppend(&dest->atoms, atom);
+        // Borrow the variable instead of copying it. StateFree hands it back
+        result = StateTakeAtom(dest, atom);
+        dest->borrowed = dest->atoms.used;
     }
     if (!result) {
         TemLangError("Failed to capture variables");
@@ -2794,37 +3627,225 @@ CaptureVariables(State* dest,
     return result;
 }
 
+// Item and index are only changed in their number or ordinal for each
+// iteration
 static inline bool
-UpdateCapturedVariables(State* dest,
-                        const State* src,
-                        const TemLangStringList* captures,
-                        const Allocator* allocator)
+StateBindIterateVariables(State* temp,
+                          const Value* target,
+                          const int64_t i,
+                          const int64_t start,
+                          pValue item,
+                          pValue index,
+                          pValue scratch,
+                          const Allocator* allocator)
 {
-    for (size_t i = 0; i < captures->used; ++i) {
-        const TemLangString* name = &captures->buffer[i];
-        const Atom* newAtom = NULL;
-        const Atom* oldAtom = NULL;
-        AtomListFindIf(
-          &src->atoms, (AtomListFindFunc)AtomNameEquals, name, &newAtom, NULL);
-        AtomListFindIf(
-          &dest->atoms, (AtomListFindFunc)AtomNameEquals, name, &oldAtom, NULL);
-        if (newAtom == NULL || oldAtom == NULL) {
-            TemLangError("Compiler error! Captured variable '%s' was removed.",
-                         name->buffer);
-            return false;
+    const Value* itemValue = item;
+    const uint32_t slot = temp->borrowed;
+    if (target->type == ValueType_Number) {
+        item->rangedNumber.number.type = NumberType_Signed;
+        item->rangedNumber.number.i = i;
+        index->rangedNumber.number.type = NumberType_Signed;
+        index->rangedNumber.number.i = i - start;
+        return StateBindLoopVariable(
+                 temp, slot, "item", itemValue, allocator) &&
+               StateBindLoopVariable(
+                 temp, slot + 1U, "index", index, allocator);
+    }
+    index->rangedNumber.number.type = NumberType_Unsigned;
+    index->rangedNumber.number.u = i;
+    if (target->type == ValueType_Enum) {
+        item->enumValue.ordinal = (uint32_t)i;
+    } else {
+        itemValue = ValueListValueAt(target->list, i, scratch);
+    }
+    return StateBindLoopVariable(temp, slot, "index", index, allocator) &&
+           StateBindLoopVariable(temp, slot + 1U, "item", itemValue, allocator);
+}
+
+// Iterations are split into chunks that workers take in order. Each chunk
+// keeps what it printed so the main thread can print it in iteration order
+typedef struct ParallelIterateChunk
+{
+    TemLangStringList output;
+    bool result;
+    // An instruction returned false or a list item was found
+    bool stopped;
+    bool ran;
+} ParallelIterateChunk, *pParallelIterateChunk;
+
+typedef struct ParallelIterate
+{
+    const State* state;
+    const CaptureInstruction* c;
+    const Value* target;
+    const Value* item;
+    const Value* index;
+    int64_t start;
+    int64_t end;
+    int64_t chunkSize;
+    size_t chunkCount;
+    pParallelIterateChunk chunks;
+    size_t next;
+    // Chunks after the first one that stopped the loop aren't started
+    size_t last;
+} ParallelIterate, *pParallelIterate;
+
+static inline void
+ParallelIterateChunkRun(const ParallelIterate* p,
+                        const size_t k,
+                        pParallelIterateChunk chunk)
+{
+    const Allocator* allocator = &parallelAllocator;
+    const Value falseValue = { .type = ValueType_Boolean, .b = false };
+    const int64_t from = p->start + (int64_t)k * p->chunkSize;
+    const int64_t to = MIN(from + p->chunkSize, p->end);
+    Value item = *p->item;
+    Value index = *p->index;
+    Value tempValue = { 0 };
+    Value scratch;
+    State temp = { 0 };
+    temp.atoms.allocator = allocator;
+    temp.parent = p->state;
+    chunk->output.allocator = allocator;
+    parallelOutput = &chunk->output;
+    bool result = true;
+    bool continueLoop = true;
+    for (int64_t i = from;
+         continueLoop && result && i < to &&
+         (p->target->type != ValueType_List ||
+          tempValue.type == ValueType_Null);
+         ++i) {
+        if (i != from) {
+            result = StateTruncate(&temp, 2U);
         }
-        Atom* a = (Atom*)oldAtom;
-        if (!AtomCopy(a, newAtom, allocator)) {
-            return false;
+        result = result && StateBindIterateVariables(&temp,
+                                                     p->target,
+                                                     i,
+                                                     p->start,
+                                                     &item,
+                                                     &index,
+                                                     &scratch,
+                                                     allocator);
+        for (size_t j = 0;
+             continueLoop && result && j < p->c->instructions.used;
+             ++j) {
+            ValueFree(&tempValue);
+            result = StateProcessInstruction(
+              &temp, &p->c->instructions.buffer[j], allocator, &tempValue);
+            continueLoop = !ValuesMatch(&tempValue, &falseValue);
         }
     }
-    return true;
+    parallelOutput = NULL;
+    chunk->result = result;
+    chunk->stopped = !continueLoop || (p->target->type == ValueType_List &&
+                                       tempValue.type != ValueType_Null);
+    chunk->ran = true;
+    StateFree(&temp);
+    ValueFree(&tempValue);
+}
+
+static inline void
+ParallelIterateWorker(void* arg)
+{
+    ParallelIterate* p = (ParallelIterate*)arg;
+    while (true) {
+        const size_t k = __atomic_fetch_add(&p->next, 1U, __ATOMIC_RELAXED);
+        if (k >= p->chunkCount ||
+            k > __atomic_load_n(&p->last, __ATOMIC_RELAXED)) {
+            break;
+        }
+        pParallelIterateChunk chunk = &p->chunks[k];
+        ParallelIterateChunkRun(p, k, chunk);
+        if (chunk->result && !chunk->stopped) {
+            continue;
+        }
+        size_t last = __atomic_load_n(&p->last, __ATOMIC_RELAXED);
+        while (k < last && !__atomic_compare_exchange_n(&p->last,
+                                                        &last,
+                                                        k,
+                                                        true,
+                                                        __ATOMIC_RELAXED,
+                                                        __ATOMIC_RELAXED)) {
+        }
+    }
+    // Call frames were allocated for this worker
+    CallStackFree();
+}
+
+// Returns false in ran if no workers could be started. The loop should run
+// on this thread then
+static inline bool
+StateParallelIterate(const State* state,
+                     const CaptureInstruction* c,
+                     const Value* target,
+                     const int64_t start,
+                     const int64_t end,
+                     const Value* item,
+                     const Value* index,
+                     const Allocator* allocator,
+                     bool* ran)
+{
+    *ran = false;
+    const size_t threads = ParallelThreadCount();
+    if (parallelWorker || threads < 2U) {
+        return true;
+    }
+    // More chunks than workers so a slow chunk doesn't hold up the others
+    const int64_t count = end - start;
+    const int64_t chunks = MIN(count, (int64_t)threads * 4);
+    ParallelIterate p = { .state = state,
+                          .c = c,
+                          .target = target,
+                          .item = item,
+                          .index = index,
+                          .start = start,
+                          .end = end,
+                          .chunkSize = (count + chunks - 1) / chunks,
+                          .chunkCount = 0,
+                          .chunks = NULL,
+                          .next = 0,
+                          .last = SIZE_MAX };
+    p.chunkCount = (size_t)((count + p.chunkSize - 1) / p.chunkSize);
+    p.chunks = allocator->allocate(sizeof(ParallelIterateChunk) * p.chunkCount);
+    if (p.chunks == NULL) {
+        return true;
+    }
+    memset(p.chunks, 0, sizeof(ParallelIterateChunk) * p.chunkCount);
+    *ran = ParallelRun(ParallelIterateWorker, &p) != 0;
+
+    bool result = true;
+    bool done = !*ran;
+    for (size_t k = 0; k < p.chunkCount; ++k) {
+        pParallelIterateChunk chunk = &p.chunks[k];
+        if (!done) {
+            for (size_t i = 0; i < chunk->output.used; ++i) {
+                REPL_print("%s\n", chunk->output.buffer[i].buffer);
+            }
+            result = chunk->ran && chunk->result;
+            done = !result || chunk->stopped;
+        }
+        if (chunk->ran) {
+            TemLangStringListFree(&chunk->output);
+        }
+    }
+    allocator->free(p.chunks);
+    return result;
 }
 
 static inline void
 FunctionDefinitionFree(FunctionDefinition* f)
 {
     InstructionListFree(&f->instructions);
+    if (f->memo != NULL) {
+        MemoCacheDelete(f->memo);
+        f->memo = NULL;
+    }
+    if (f->jit != NULL) {
+        JitFunctionDelete(f->jit);
+        f->jit = NULL;
+    }
+    f->calls = 0;
+    f->profileEntry = 0;
     if (f->type == FunctionType_Procedure) {
         TemLangStringListFree(&f->captures);
     } else {
@@ -2840,6 +3861,7 @@ FunctionDefinitionCopy(FunctionDefinition* dest,
 {
     FunctionDefinitionFree(dest);
     dest->type = src->type;
+    dest->memoize = src->memoize;
     if (!InstructionListCopy(
           &dest->instructions, &src->instructions, allocator)) {
         return false;
@@ -2882,6 +3904,9 @@ FunctionDefinitionToString(const FunctionDefinition* f,
             default:
                 break;
         }
+        if (f->memoize) {
+            TemLangStringAppendChars(&a, " \"memoize\": true,");
+        }
     }
     LIST_TO_STRING(f->instructions, b, InstructionToString, allocator);
     TemLangStringCreateFormat(s,
@@ -3010,6 +4035,10 @@ MatchExpressionFree(MatchExpression* m)
     TemLangStringListFree(&m->captures);
     MatchBranchListFree(&m->branches);
     BranchFree(&m->defaultBranch);
+    if (m->table != NULL) {
+        MatchTableDelete(m->table);
+        m->table = NULL;
+    }
 }
 
 static inline bool
@@ -3059,6 +4088,7 @@ MatchInstructionFree(MatchInstruction* m)
 {
     MatchExpressionFree(&m->expression);
     TemLangStringListFree(&m->captures);
+    uint32_tListFree(&m->captureSlots);
 }
 
 static inline bool
@@ -3069,7 +4099,8 @@ MatchInstructionCopy(MatchInstruction* dest,
     MatchInstructionFree(dest);
     return MatchExpressionCopy(
              &dest->expression, &src->expression, allocator) &&
-           TemLangStringListCopy(&dest->captures, &src->captures, allocator);
+           TemLangStringListCopy(&dest->captures, &src->captures, allocator) &&
+           uint32_tListCopy(&dest->captureSlots, &src->captureSlots, allocator);
 }
 
 static inline TemLangString
@@ -3118,86 +4149,142 @@ EvaluateBranchExpression(const Branch* branch,
 }
 
 static inline bool
-EvaluateMatchExpression(const MatchExpression* m,
-                        State* state,
-                        pValue value,
-                        const Allocator* allocator)
+EvaluateVariantBranch(const MatchBranch* branch,
+                      State* state,
+                      const Value* targetValue,
+                      pValue value,
+                      const Allocator* allocator)
 {
+    TemLangString varName = { 0 };
+    TemLangStringCopy(
+      &varName, &targetValue->variantValue->memberName, allocator);
     bool result = false;
-    bool done = false;
-    Value targetValue = { 0 };
-    if (!EvaluateExpression(&m->matcher, state, &targetValue, allocator)) {
+    if (!StateAddValue(state, &varName, targetValue->variantValue->value)) {
+        TemLangError("Cannot add variable '%s' because it already exists. "
+                     "Must execute this match expression in another scope",
+                     varName.buffer);
+        goto cleanup;
+    }
+    result =
+      EvaluateBranchExpression(&branch->branch, state, value, allocator);
+    const int64_t atomIndex =
+      StateFindAtomIndex(state, &varName, TemLangStringHash(&varName));
+    if (atomIndex < 0 || !StateRemoveAtom(state, atomIndex, allocator)) {
+        TemLangError("Failed to remove atom '%s' after calling "
+                     "variant match branch",
+                     varName.buffer);
+        result = false;
+    }
+cleanup:
+    TemLangStringFree(&varName);
+    return result;
+}
+
+// A matcher that fails to evaluate doesn't match
+static inline bool
+MatchBranchMatches(const MatchBranch* branch,
+                   State* state,
+                   const Value* targetValue,
+                   const Allocator* allocator)
+{
+    Value b = { 0 };
+    const Value* matcher = EvaluateExpressionToConstReference(
+      &branch->matcher, state, &b, allocator);
+    if (matcher == NULL) {
         return false;
     }
-    switch (targetValue.type) {
-        case ValueType_Variant: {
-            for (size_t i = 0; !done && i < m->branches.used; ++i) {
-                const MatchBranch* branch = &m->branches.buffer[i];
-                if (branch->matcher.type != ExpressionType_UnaryVariable) {
-                    TemLangError(
-                      "Expected variable for variant match. Got '%s'",
-                      ExpressionTypeToString(branch->matcher.type));
-                    result = false;
-                    done = true;
-                    break;
-                }
-                done =
-                  TemLangStringCompare(&targetValue.variantValue.memberName,
-                                       &branch->matcher.identifier) ==
-                  ComparisonOperator_EqualTo;
-                if (!done) {
-                    continue;
-                }
-                TemLangString varName = { 0 };
-                TemLangStringCopy(
-                  &varName, &targetValue.variantValue.memberName, allocator);
-                if (!StateAddValue(
-                      state, &varName, targetValue.variantValue.value)) {
-                    TemLangError(
-                      "Cannot add variable '%s' because it already exists. "
-                      "Must execute this match expression in another scope",
-                      varName.buffer);
-                    result = false;
-                    goto cleanupVariantMatch;
-                }
-                result = EvaluateBranchExpression(
-                  &branch->branch, state, value, allocator);
-                if (!AtomListRemoveIf(&state->atoms,
-                                      (AtomListRemoveIfFunc)AtomNameEquals,
-                                      &varName,
-                                      allocator)) {
-                    TemLangError("Failed to remove atom '%s' after calling "
-                                 "variant match branch",
-                                 varName.buffer);
-                    result = false;
-                }
-            cleanupVariantMatch:
-                TemLangStringFree(&varName);
+    const bool result = ValuesMatch(targetValue, matcher);
+    ValueFree(&b);
+    return result;
+}
+
+static inline bool
+EvaluateMatchBranchesLinear(const MatchExpression* m,
+                            State* state,
+                            const Value* targetValue,
+                            pValue value,
+                            const Allocator* allocator)
+{
+    const bool isVariant = targetValue->type == ValueType_Variant;
+    for (size_t i = 0; i < m->branches.used; ++i) {
+        const MatchBranch* branch = &m->branches.buffer[i];
+        if (isVariant) {
+            if (branch->matcher.type != ExpressionType_UnaryVariable) {
+                TemLangError("Expected variable for variant match. Got '%s'",
+                             ExpressionTypeToString(branch->matcher.type));
+                return false;
             }
-        } break;
-        default: {
-            for (size_t i = 0; !done && i < m->branches.used; ++i) {
-                const MatchBranch* branch = &m->branches.buffer[i];
-                Value b = { 0 };
-                result =
-                  EvaluateExpression(&branch->matcher, state, &b, allocator);
-                if (!result) {
-                    continue;
-                }
-                done = ValuesMatch(&targetValue, &b);
-                ValueFree(&b);
-                if (!done) {
-                    continue;
-                }
-                result = EvaluateBranchExpression(
-                  &branch->branch, state, value, allocator);
+            if (TemLangStringCompare(&targetValue->variantValue->memberName,
+                                     &branch->matcher.identifier) ==
+                ComparisonOperator_EqualTo) {
+                return EvaluateVariantBranch(
+                  branch, state, targetValue, value, allocator);
             }
-        } break;
+        } else if (MatchBranchMatches(branch, state, targetValue, allocator)) {
+            return EvaluateBranchExpression(
+              &branch->branch, state, value, allocator);
+        }
+    }
+    return EvaluateBranchExpression(&m->defaultBranch, state, value, allocator);
+}
+
+static inline bool
+EvaluateMatchBranches(const MatchExpression* m,
+                      State* state,
+                      const Value* targetValue,
+                      pValue value,
+                      const Allocator* allocator)
+{
+    const MatchTable* table = MatchExpressionTable(m);
+    uint32_t found = 0;
+    if (table == NULL || MatchTableFind(table, m, targetValue, &found) ==
+                           MatchLookup_Linear) {
+        return EvaluateMatchBranchesLinear(
+          m, state, targetValue, value, allocator);
+    }
+    if (targetValue->type == ValueType_Variant) {
+        if (found < m->branches.used) {
+            return EvaluateVariantBranch(
+              &m->branches.buffer[found], state, targetValue, value, allocator);
+        }
+        return EvaluateBranchExpression(
+          &m->defaultBranch, state, value, allocator);
+    }
+    // Matchers that aren't literals are still tested in order up to the
+    // literal branch that was found
+    for (uint32_t i = 0; i < table->dynamicCount && table->dynamic[i] < found;
+         ++i) {
+        if (MatchBranchMatches(&m->branches.buffer[table->dynamic[i]],
+                               state,
+                               targetValue,
+                               allocator)) {
+            found = table->dynamic[i];
+            break;
+        }
     }
-    if (!done) {
-        result =
-          EvaluateBranchExpression(&m->defaultBranch, state, value, allocator);
+    if (found < m->branches.used) {
+        return EvaluateBranchExpression(
+          &m->branches.buffer[found].branch, state, value, allocator);
+    }
+    return EvaluateBranchExpression(&m->defaultBranch, state, value, allocator);
+}
+
+static inline bool
+EvaluateMatchExpression(const MatchExpression* m,
+                        State* state,
+                        pValue value,
+                        const Allocator* allocator)
+{
+    // The matcher may point into the state. It is not read again once a
+    // branch has run so new atoms in the state cannot invalidate it
+    Value targetValue = { 0 };
+    const Value* matcher = EvaluateExpressionToConstReference(
+      &m->matcher, state, &targetValue, allocator);
+    if (matcher == NULL) {
+        return false;
     }
+    const bool result =
+      EvaluateMatchBranches(m, state, matcher, value, allocator);
     ValueFree(&targetValue);
     return result;
 }
@@ -3289,9 +4376,9 @@ NamedValueToStructMember(const NamedValue* nv,
         } break;
         case ValueType_Number: {
             m->isKeyword = true;
-            if (nv->value.rangedNumber.hasRange) {
+            if (nv->value.rangedNumber.range != NULL) {
                 m->keyword =
-                  CTypeToKeyword(RangeToCType(&nv->value.rangedNumber.range));
+                  CTypeToKeyword(RangeToCType(nv->value.rangedNumber.range));
             } else {
                 m->keyword =
                   CTypeToKeyword(NumberToCType(&nv->value.rangedNumber.number));
@@ -3316,26 +4403,28 @@ NamedValueToStructMember(const NamedValue* nv,
         case ValueType_Flag: {
             m->isKeyword = false;
             result = TemLangStringCopy(&m->name, &nv->name, allocator) &&
-                     TemLangStringCopy(
-                       &m->typeName, &nv->value.flagValue.name, allocator);
+                     TemLangStringCopy(&m->typeName,
+                                       &nv->value.flagValue.names->name,
+                                       allocator);
         } break;
         case ValueType_Enum: {
             m->isKeyword = false;
             result = TemLangStringCopy(&m->name, &nv->name, allocator) &&
-                     TemLangStringCopy(
-                       &m->typeName, &nv->value.enumValue.name, allocator);
+                     TemLangStringCopy(&m->typeName,
+                                       EnumValueName(&nv->value.enumValue),
+                                       allocator);
         } break;
         case ValueType_Variant: {
             m->isKeyword = false;
             result = TemLangStringCopy(&m->name, &nv->name, allocator) &&
                      TemLangStringCopy(
-                       &m->typeName, &nv->value.variantValue.name, allocator);
+                       &m->typeName, &nv->value.variantValue->name, allocator);
         } break;
         case ValueType_List: {
             StructMember m2 = { 0 };
             NamedValue new_nv = { 0 };
             if (!ValueCopy(
-                  &new_nv.value, nv->value.list.exampleValue, allocator) ||
+                  &new_nv.value, nv->value.list->exampleValue, allocator) ||
                 !TemLangStringCopy(&new_nv.name, &nv->name, allocator) ||
                 !NamedValueToStructMember(
                   &new_nv, state, &m2, allocator, log)) {
@@ -3346,17 +4435,17 @@ NamedValueToStructMember(const NamedValue* nv,
             if (m2.isKeyword) {
                 m->isKeyword = true;
                 m->keyword = m2.keyword;
-                if (nv->value.list.isArray) {
-                    m->quantity = nv->value.list.values.used;
+                if (nv->value.listIsArray) {
+                    m->quantity = ValueListValueLength(nv->value.list);
                 } else {
                     m->quantity = 0;
                 }
             } else {
                 TemLangString s = StructMemberToTypeName(&m2, allocator);
                 m->isKeyword = false;
-                if (nv->value.list.isArray) {
+                if (nv->value.listIsArray) {
                     TemLangStringCopy(&m->typeName, &s, allocator);
-                    m->quantity = nv->value.list.values.used;
+                    m->quantity = ValueListValueLength(nv->value.list);
                 } else {
                     TemLangStringCreateFormat(t, allocator, "%s", s.buffer);
                     m->typeName = t;
@@ -3382,17 +4471,15 @@ NamedValueToStructMember(const NamedValue* nv,
                 if (d->isVariant) {
                     continue;
                 }
-                if (d->members.used != nv->value.structValues->used) {
+                const StructValues* members = nv->value.structValues;
+                if (d->members.used != members->values.used) {
                     continue;
                 }
                 bool allMatch = true;
-                for (size_t j = 0; j < nv->value.structValues->used; ++j) {
+                for (size_t j = 0; j < members->values.used; ++j) {
+                    const NamedValue member = StructValuesGet(members, j);
                     if (!NamedValueInStructDefinition(
-                          &nv->value.structValues->buffer[j],
-                          state,
-                          allocator,
-                          d,
-                          log)) {
+                          &member, state, allocator, d, log)) {
                         allMatch = false;
                         break;
                     }
@@ -3451,8 +4538,8 @@ NamedValueToStructMember(const NamedValue* nv,
     return result;
 }
 
-CREATE_VALUE_INDEX(const)
-CREATE_VALUE_INDEX()
+CREATE_VALUE_INDEX(const, true)
+CREATE_VALUE_INDEX(, ValueMakeUnique(value) && ValueUnpack(value))
 
 static inline TemLangString
 VariableToTemLang(const TemLangString* name,
@@ -3476,31 +4563,34 @@ ValueToTemLang(const Value* value, const Allocator* allocator)
         case ValueType_Boolean:
             s = TemLangStringCreate(value->b ? "true" : "false", allocator);
             break;
-        case ValueType_Enum:
+        case ValueType_Enum: {
+            const EnumValue* e = &value->enumValue;
             TemLangStringAppendFormat(s,
                                       "#%s + \"%s\"",
-                                      value->enumValue.name.buffer,
-                                      value->enumValue.value.buffer);
-            break;
-        case ValueType_Flag:
+                                      EnumValueName(e)->buffer,
+                                      EnumValueMember(e)->buffer);
+        } break;
+        case ValueType_Flag: {
+            const FlagValue* f = &value->flagValue;
             TemLangStringAppendFormat(
-              s, "(null + #%s)", value->flagValue.name.buffer);
-            for (size_t i = 0; i < value->flagValue.members.used; ++i) {
-                TemLangStringAppendFormat(
-                  s,
-                  " +  (#%s + \"%s\")",
-                  value->flagValue.name.buffer,
-                  value->flagValue.members.buffer[i].buffer);
+              s, "(null + #%s)", f->names->name.buffer);
+            for (size_t i = 0; i < f->names->members.used; ++i) {
+                if (!FlagValueHas(f, i)) {
+                    continue;
+                }
+                TemLangStringAppendFormat(s,
+                                          " +  (#%s + \"%s\")",
+                                          f->names->name.buffer,
+                                          f->names->members.buffer[i].buffer);
             }
-            break;
+        } break;
         case ValueType_Struct:
             TemLangStringAppendChars(&s, "{{ ");
-            for (size_t i = 0; i < value->structValues->used; ++i) {
-                const NamedValue* nv = &value->structValues->buffer[i];
+            for (size_t i = 0; i < value->structValues->values.used; ++i) {
+                const NamedValue nv = StructValuesGet(value->structValues, i);
                 Variable v = { .type = VariableType_Immutable,
-                               .value = nv->value };
-                TemLangString temp =
-                  VariableToTemLang(&nv->name, &v, allocator);
+                               .value = nv.value };
+                TemLangString temp = VariableToTemLang(&nv.name, &v, allocator);
                 TemLangStringAppend(&s, &temp);
                 TemLangStringFree(&temp);
             }
@@ -3508,27 +4598,28 @@ ValueToTemLang(const Value* value, const Allocator* allocator)
             break;
         case ValueType_Variant: {
             TemLangString temp =
-              ValueToTemLang(value->variantValue.value, allocator);
+              ValueToTemLang(value->variantValue->value, allocator);
             TemLangStringAppendFormat(s,
                                       "{{ let %s %s }} + #%s",
-                                      value->variantValue.memberName.buffer,
+                                      value->variantValue->memberName.buffer,
                                       temp.buffer,
-                                      value->variantValue.name.buffer);
+                                      value->variantValue->name.buffer);
             TemLangStringFree(&temp);
         } break;
         case ValueType_List:
-            if (value->list.isArray) {
+            if (value->listIsArray) {
                 TemLangStringAppendChars(&s, "[| ");
             } else {
                 TemLangStringAppendChars(&s, "[ ");
             }
-            for (size_t i = 0; i < value->list.values.used; ++i) {
-                TemLangString temp =
-                  ValueToTemLang(&value->list.values.buffer[i], allocator);
+            for (size_t i = 0; i < ValueListValueLength(value->list); ++i) {
+                Value scratch = { 0 };
+                TemLangString temp = ValueToTemLang(
+                  ValueListValueAt(value->list, i, &scratch), allocator);
                 TemLangStringAppendFormat(s, "%s ", temp.buffer);
                 TemLangStringFree(&temp);
             }
-            if (value->list.isArray) {
+            if (value->listIsArray) {
                 TemLangStringAppendChars(&s, " |]");
             } else {
                 TemLangStringAppendChars(&s, " ]");
@@ -3581,4 +4672,7 @@ StateToTemLang(const State* state, const Allocator* allocator)
         TemLangStringFree(&s1);
     }
     return s;
-}
\ No newline at end of file
+}
+
+// Needed by the JIT
+#include "Compiler.h"
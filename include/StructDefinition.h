@@ -3,6 +3,7 @@
 #include "Allocator.h"
 #include "CType.h"
 #include "StructMember.h"
+#include "StructShape.h"
 #include "TemLangString.h"
 #include "Token.h"
 
@@ -71,6 +72,8 @@ typedef struct StructDefinition
     bool isVariant;
     TemLangString destructorTargetName;
     InstructionList deleteInstructions;
+    // Created when the struct is defined
+    StructShape* shape;
 } StructDefinition, *pStructDefinition;
 
 static inline void
@@ -79,6 +82,8 @@ StructDefinitionFree(StructDefinition* d)
     StructMemberListFree(&d->members);
     TemLangStringFree(&d->destructorTargetName);
     InstructionListFree(&d->deleteInstructions);
+    StructShapeRelease(d->shape);
+    d->shape = NULL;
 }
 
 static inline bool
@@ -88,6 +93,7 @@ StructDefinitionCopy(StructDefinition* dest,
 {
     StructDefinitionFree(dest);
     dest->isVariant = src->isVariant;
+    dest->shape = StructShapeShare(src->shape);
     return StructMemberListCopy(&dest->members, &src->members, allocator) &&
            TemLangStringCopy(&dest->destructorTargetName,
                              &src->destructorTargetName,
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "Allocator.h"
+#include "Parallel.h"
+#include "TemLangString.h"
+
+// Member names of a struct in slot order. Shared by every struct value with
+// the same members so a value only stores its member values
+typedef struct StructShape
+{
+    TemLangStringList names;
+    size_t refCount;
+    const Allocator* allocator;
+} StructShape, *pStructShape;
+
+static inline StructShape*
+StructShapeCreate(const TemLangStringList* names, const Allocator* allocator)
+{
+    StructShape* shape = allocator->allocate(sizeof(StructShape));
+    if (shape == NULL) {
+        return NULL;
+    }
+    memset(shape, 0, sizeof(StructShape));
+    shape->refCount = 1;
+    shape->allocator = allocator;
+    if (TemLangStringListCopy(&shape->names, names, allocator)) {
+        return shape;
+    }
+    TemLangStringListFree(&shape->names);
+    allocator->free(shape);
+    return NULL;
+}
+
+static inline StructShape*
+StructShapeShare(StructShape* shape)
+{
+    if (shape != NULL) {
+        RefCountIncrement(&shape->refCount);
+    }
+    return shape;
+}
+
+static inline void
+StructShapeRelease(StructShape* shape)
+{
+    if (shape == NULL || RefCountDecrement(&shape->refCount) != 0) {
+        return;
+    }
+    TemLangStringListFree(&shape->names);
+    shape->allocator->free(shape);
+}
+
+static inline bool
+StructShapeFind(const StructShape* shape,
+                const TemLangString* name,
+                size_t* slot)
+{
+    for (size_t i = 0; i < shape->names.used; ++i) {
+        if (TemLangStringsAreEqual(&shape->names.buffer[i], name)) {
+            *slot = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Structs made in different places can have equal shapes that aren't shared
+static inline bool
+StructShapesEqual(const StructShape* a, const StructShape* b)
+{
+    if (a == b) {
+        return true;
+    }
+    if (a->names.used != b->names.used) {
+        return false;
+    }
+    for (size_t i = 0; i < a->names.used; ++i) {
+        if (!TemLangStringsAreEqual(&a->names.buffer[i], &b->names.buffer[i])) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -442,6 +442,18 @@ TemLangStringsAreEqual(const TemLangString* a, const TemLangString* b)
     return TemLangStringCompare(a, b) == ComparisonOperator_EqualTo;
 }
 
+// FNV-1a
+static inline uint32_t
+TemLangStringHash(const TemLangString* s)
+{
+    uint32_t hash = 2166136261U;
+    for (size_t i = 0; i < s->used; ++i) {
+        hash ^= (uint8_t)s->buffer[i];
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
 static inline bool
 TemLangStringContainsSized(const TemLangString* a,
                            const char* c,
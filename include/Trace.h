@@ -0,0 +1,234 @@
+#pragma once
+
+#include "Parallel.h"
+#include "Profile.h"
+#include "TraceFormat.h"
+
+// Records instructions, calls, scopes and allocations of the main thread into
+// a memory mapped ring file. src/traceDecode.c turns the file into a Chrome
+// trace. Only built with TRACE_EVENTS set so other builds have no checks for
+// it.
+
+#ifndef TRACE_EVENTS
+#define TRACE_EVENTS 0
+#endif
+
+#if TRACE_EVENTS && __EMSCRIPTEN__
+#undef TRACE_EVENTS
+#define TRACE_EVENTS 0
+#endif
+
+#define TRACE_DEFAULT_EVENTS (1U << 20U)
+#define TRACE_NAMES_SIZE (1U << 20U)
+// Number of events between updates of the clock readings in the header
+#define TRACE_CLOCK_EVENTS 0xffffU
+
+#if TRACE_EVENTS
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+typedef struct Trace
+{
+    TraceHeader* header;
+    char* names;
+    TraceEvent* events;
+    size_t size;
+    uint64_t mask;
+    // Entries of the profiler whose names are in the file
+    uint32_t namesWritten;
+    Allocator allocator;
+} Trace, *pTrace;
+
+static bool traceEnabled = false;
+static Trace trace = { 0 };
+
+static inline void
+TraceWriteNames()
+{
+    TraceHeader* header = trace.header;
+    while (trace.namesWritten < profile.entryCount) {
+        const char* name = profile.entries[trace.namesWritten].name;
+        const size_t length = strlen(name) + 1U;
+        if (header->namesUsed + length > header->namesSize) {
+            // The decoder shows the index for names that didn't fit
+            trace.namesWritten = profile.entryCount;
+            return;
+        }
+        memcpy(trace.names + header->namesUsed, name, length);
+        header->namesUsed += length;
+        ++trace.namesWritten;
+    }
+}
+
+static inline void
+TraceEmit(const TraceEventType type, const uint32_t name, const uint64_t value)
+{
+    if (!traceEnabled || parallelWorker) {
+        return;
+    }
+    if (name != TRACE_NO_NAME && name >= trace.namesWritten) {
+        TraceWriteNames();
+    }
+    TraceHeader* header = trace.header;
+    const uint64_t written = header->written;
+    TraceEvent* event = &trace.events[written & trace.mask];
+    event->ticks = ProfileTicks();
+    event->value = value;
+    event->name = name;
+    event->type = (uint32_t)type;
+    header->written = written + 1U;
+    if ((written & TRACE_CLOCK_EVENTS) == 0) {
+        header->lastTicks = event->ticks;
+        header->lastNanoseconds = ProfileClock(CLOCK_MONOTONIC);
+    }
+}
+
+static inline void*
+TraceAllocate(const size_t size)
+{
+    void* data = trace.allocator.allocate(size);
+    TraceEmit(TraceEventType_Allocate, TRACE_NO_NAME, size);
+    return data;
+}
+
+static inline void*
+TraceReallocate(void* data, const size_t size)
+{
+    void* newData = trace.allocator.reallocate(data, size);
+    TraceEmit(TraceEventType_Reallocate, TRACE_NO_NAME, size);
+    return newData;
+}
+
+static inline void
+TraceFree(void* data)
+{
+    trace.allocator.free(data);
+    TraceEmit(TraceEventType_Free, TRACE_NO_NAME, 0);
+}
+
+// Returns an allocator that records every call before passing it to the given
+// one
+static inline Allocator
+TraceAllocator(const Allocator* allocator)
+{
+    trace.allocator = *allocator;
+    Allocator a = *allocator;
+    a.allocate = TraceAllocate;
+    a.reallocate = TraceReallocate;
+    a.free = TraceFree;
+    return a;
+}
+
+static inline bool
+TraceStart(const char* fileName, size_t capacity)
+{
+    uint64_t events = 1U;
+    while (events < capacity) {
+        events *= 2U;
+    }
+    const size_t size =
+      sizeof(TraceHeader) + TRACE_NAMES_SIZE + sizeof(TraceEvent) * events;
+    const int fd = open(fileName, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        TemLangError(
+          "Failed to open trace file '%s': %s", fileName, strerror(errno));
+        return false;
+    }
+    bool result = false;
+    if (ftruncate(fd, (off_t)size) != 0) {
+        TemLangError(
+          "Failed to resize trace file '%s': %s", fileName, strerror(errno));
+        goto cleanup;
+    }
+    void* data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        TemLangError(
+          "Failed to map trace file '%s': %s", fileName, strerror(errno));
+        goto cleanup;
+    }
+    ProfileInit(NULL);
+    trace.size = size;
+    trace.mask = events - 1U;
+    trace.header = (TraceHeader*)data;
+    trace.names = (char*)data + sizeof(TraceHeader);
+    trace.events = (TraceEvent*)(trace.names + TRACE_NAMES_SIZE);
+    TraceHeader* header = trace.header;
+    memcpy(header->magic, TRACE_MAGIC, sizeof(header->magic));
+    header->version = TRACE_VERSION;
+    header->eventSize = sizeof(TraceEvent);
+    header->capacity = events;
+    header->namesSize = TRACE_NAMES_SIZE;
+    header->startTicks = ProfileTicks();
+    header->startNanoseconds = ProfileClock(CLOCK_MONOTONIC);
+    header->lastTicks = header->startTicks;
+    header->lastNanoseconds = header->startNanoseconds;
+    traceEnabled = true;
+    result = true;
+
+cleanup:
+    // The mapping stays valid after the file is closed
+    close(fd);
+    return result;
+}
+
+static inline void
+TraceStop()
+{
+    if (trace.header == NULL) {
+        return;
+    }
+    TraceWriteNames();
+    traceEnabled = false;
+    trace.header->lastTicks = ProfileTicks();
+    trace.header->lastNanoseconds = ProfileClock(CLOCK_MONOTONIC);
+    munmap(trace.header, trace.size);
+    memset(&trace, 0, sizeof(Trace));
+}
+
+#else
+
+// Constant so the checks for it are removed
+static const bool traceEnabled = false;
+
+static inline void
+TraceEmit(const TraceEventType type, const uint32_t name, const uint64_t value)
+{
+    (void)type;
+    (void)name;
+    (void)value;
+}
+
+static inline bool
+TraceStart(const char* fileName, size_t capacity)
+{
+    (void)fileName;
+    (void)capacity;
+    TemLangError("Tracing needs a build with TRACE_EVENTS set to 1");
+    return false;
+}
+
+static inline void
+TraceStop()
+{
+}
+
+#endif
+
+static inline uint32_t
+TraceFunctionEnter(const FunctionDefinition* f, const TemLangString* name)
+{
+    if (!traceEnabled || parallelWorker) {
+        return TRACE_NO_NAME;
+    }
+    const uint32_t entry = ProfileFunctionEntry(f, name);
+    TraceEmit(TraceEventType_FunctionEnter, entry, 0);
+    return entry;
+}
+
+static inline void
+TraceFunctionExit(const uint32_t entry, const bool result)
+{
+    TraceEmit(TraceEventType_FunctionExit, entry, result);
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stdint.h>
+
+// Layout of a trace file. The header is followed by the names of the
+// instructions and functions, each ending with a zero, and then by the ring
+// of events. Events are written at the number written so far modulo the
+// capacity so the oldest ones are replaced once the ring is full.
+
+#define TRACE_MAGIC "TEMTRACE"
+#define TRACE_VERSION 1U
+#define TRACE_NO_NAME UINT32_MAX
+
+typedef enum TraceEventType
+{
+    TraceEventType_InstructionBegin,
+    TraceEventType_InstructionEnd,
+    TraceEventType_FunctionEnter,
+    TraceEventType_FunctionExit,
+    TraceEventType_Allocate,
+    TraceEventType_Reallocate,
+    TraceEventType_Free,
+    TraceEventType_ScopeCreate,
+    TraceEventType_ScopeFree,
+    TraceEventType_Invalid
+} TraceEventType,
+  *pTraceEventType;
+
+typedef struct TraceHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t eventSize;
+    // Always a power of 2
+    uint64_t capacity;
+    uint64_t namesSize;
+    uint64_t namesUsed;
+    uint64_t written;
+    // Pairs of clock readings to turn ticks into time. The last pair is
+    // updated while tracing so a trace can be read after a crash.
+    uint64_t startTicks;
+    uint64_t startNanoseconds;
+    uint64_t lastTicks;
+    uint64_t lastNanoseconds;
+} TraceHeader, *pTraceHeader;
+
+typedef struct TraceEvent
+{
+    uint64_t ticks;
+    // Line number for instructions, call depth for scopes and bytes for
+    // allocations
+    uint64_t value;
+    // Index of the name or TRACE_NO_NAME
+    uint32_t name;
+    uint32_t type;
+} TraceEvent, *pTraceEvent;
+
+static inline const char*
+TraceEventTypeToString(const TraceEventType e)
+{
+    switch (e) {
+        case TraceEventType_InstructionBegin:
+            return "InstructionBegin";
+        case TraceEventType_InstructionEnd:
+            return "InstructionEnd";
+        case TraceEventType_FunctionEnter:
+            return "FunctionEnter";
+        case TraceEventType_FunctionExit:
+            return "FunctionExit";
+        case TraceEventType_Allocate:
+            return "Allocate";
+        case TraceEventType_Reallocate:
+            return "Reallocate";
+        case TraceEventType_Free:
+            return "Free";
+        case TraceEventType_ScopeCreate:
+            return "ScopeCreate";
+        case TraceEventType_ScopeFree:
+            return "ScopeFree";
+        default:
+            return "Invalid";
+    }
+}
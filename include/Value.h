@@ -1,9 +1,13 @@
 #pragma once
 
 #include "Allocator.h"
+#include "EnumDefinition.h"
 #include "List.h"
+#include "ListKernel.h"
 #include "Number.h"
 #include "Range.h"
+#include "ScopeArena.h"
+#include "StructShape.h"
 #include "ValueType.h"
 
 typedef struct Value Value, *pValue;
@@ -24,25 +28,55 @@ NamedValueToString(const NamedValue* n, const Allocator* allocator);
 static inline TemLangString
 NamedValueListToString(const NamedValueList* list, const Allocator* allocator);
 
+typedef struct StructValues StructValues, *pStructValues;
+
+static inline TemLangString
+StructValuesToString(const StructValues*, const Allocator*);
+
 typedef struct EnumValue
 {
-    TemLangString name;
-    TemLangString value;
+    EnumNames* names;
+    uint32_t ordinal;
 } EnumValue, *pEnumValue;
 
+static inline const TemLangString*
+EnumValueName(const EnumValue* e)
+{
+    return &e->names->name;
+}
+
+static inline const TemLangString*
+EnumValueMember(const EnumValue* e)
+{
+    return &e->names->members.buffer[e->ordinal];
+}
+
 static inline void
 EnumValueFree(EnumValue* e)
 {
-    TemLangStringFree(&e->name);
-    TemLangStringFree(&e->value);
+    EnumNamesRelease(e->names);
+    e->names = NULL;
 }
 
 static inline bool
 EnumValueCopy(EnumValue* dest, const EnumValue* src, const Allocator* allocator)
 {
+    (void)allocator;
     EnumValueFree(dest);
-    return TemLangStringCopy(&dest->name, &src->name, allocator) &&
-           TemLangStringCopy(&dest->value, &src->value, allocator);
+    dest->names = EnumNamesShare(src->names);
+    dest->ordinal = src->ordinal;
+    return true;
+}
+
+static inline bool
+EnumValuesEqual(const EnumValue* a, const EnumValue* b)
+{
+    // The names are shared by copies of a definition so the pointers only
+    // differ for enums from separate definitions
+    return a->ordinal == b->ordinal &&
+           (a->names == b->names ||
+            TemLangStringCompare(EnumValueName(a), EnumValueName(b)) ==
+              ComparisonOperator_EqualTo);
 }
 
 static inline TemLangString
@@ -51,70 +85,185 @@ EnumValueToString(const EnumValue* e, const Allocator* allocator)
     TemLangStringCreateFormat(s,
                               allocator,
                               "{ \"name\": \"%s\", \"value\": \"%s\" }",
-                              e->name.buffer,
-                              e->value.buffer);
+                              EnumValueName(e)->buffer,
+                              EnumValueMember(e)->buffer);
     return s;
 }
 
+// Members of a flag are bits indexed by their ordinal in the definition.
+// Flags with up to 64 members keep their bits inline
 typedef struct FlagValue
 {
-    TemLangString name;
-    TemLangStringList members;
+    EnumNames* names;
+    union
+    {
+        uint64_t bits;
+        uint64_t* words;
+    };
+    const Allocator* allocator;
 } FlagValue, *pFlagValue;
 
+static inline size_t
+FlagValueWordCount(const FlagValue* f)
+{
+    return (f->names->members.used + 63U) / 64U;
+}
+
+static inline uint64_t*
+FlagValueWords(FlagValue* f)
+{
+    return FlagValueWordCount(f) > 1U ? f->words : &f->bits;
+}
+
+static inline const uint64_t*
+FlagValueConstWords(const FlagValue* f)
+{
+    return FlagValueWordCount(f) > 1U ? f->words : &f->bits;
+}
+
 static inline void
-FlagValueFree(FlagValue* e)
+FlagValueFree(FlagValue* f)
 {
-    TemLangStringFree(&e->name);
-    TemLangStringListFree(&e->members);
+    if (f->names == NULL) {
+        return;
+    }
+    if (FlagValueWordCount(f) > 1U) {
+        f->allocator->free(f->words);
+    }
+    EnumNamesRelease(f->names);
+    memset(f, 0, sizeof(FlagValue));
+}
+
+// Makes a flag with no members set
+static inline bool
+FlagValueCreate(FlagValue* f, EnumNames* names, const Allocator* allocator)
+{
+    FlagValueFree(f);
+    f->names = EnumNamesShare(names);
+    f->allocator = allocator;
+    const size_t count = FlagValueWordCount(f);
+    if (count > 1U) {
+        f->words = allocator->allocate(sizeof(uint64_t) * count);
+        if (f->words == NULL) {
+            EnumNamesRelease(f->names);
+            memset(f, 0, sizeof(FlagValue));
+            return false;
+        }
+        memset(f->words, 0, sizeof(uint64_t) * count);
+    } else {
+        f->bits = 0;
+    }
+    return true;
 }
 
 static inline bool
 FlagValueCopy(FlagValue* dest, const FlagValue* src, const Allocator* allocator)
 {
-    FlagValueFree(dest);
-    return TemLangStringListCopy(&dest->members, &src->members, allocator) &&
-           TemLangStringCopy(&dest->name, &src->name, allocator);
+    if (!FlagValueCreate(dest, src->names, allocator)) {
+        return false;
+    }
+    memcpy(FlagValueWords(dest),
+           FlagValueConstWords(src),
+           sizeof(uint64_t) * FlagValueWordCount(src));
+    return true;
+}
+
+static inline bool
+FlagValueHas(const FlagValue* f, const size_t ordinal)
+{
+    return (FlagValueConstWords(f)[ordinal / 64U] >> (ordinal % 64U)) & 1U;
+}
+
+static inline void
+FlagValueSet(FlagValue* f, const size_t ordinal, const bool set)
+{
+    uint64_t* word = &FlagValueWords(f)[ordinal / 64U];
+    const uint64_t bit = (uint64_t)1U << (ordinal % 64U);
+    *word = set ? (*word | bit) : (*word & ~bit);
+}
+
+static inline void
+FlagValueSetAll(FlagValue* f, const bool set)
+{
+    const size_t count = FlagValueWordCount(f);
+    uint64_t* words = FlagValueWords(f);
+    memset(words, set ? 0xff : 0, sizeof(uint64_t) * count);
+    const size_t rest = f->names->members.used % 64U;
+    if (set && rest != 0) {
+        words[count - 1U] = ((uint64_t)1U << rest) - 1U;
+    }
+}
+
+// Flags from separate definitions of the same flag have their own names
+static inline bool
+FlagValuesSameFlag(const FlagValue* a, const FlagValue* b)
+{
+    return a->names == b->names ||
+           (TemLangStringCompare(&a->names->name, &b->names->name) ==
+              ComparisonOperator_EqualTo &&
+            a->names->members.used == b->names->members.used);
+}
+
+static inline bool
+FlagValuesEqual(const FlagValue* a, const FlagValue* b)
+{
+    return FlagValuesSameFlag(a, b) &&
+           memcmp(FlagValueConstWords(a),
+                  FlagValueConstWords(b),
+                  sizeof(uint64_t) * FlagValueWordCount(a)) == 0;
+}
+
+// Members that are set in ordinal order
+static inline TemLangStringList
+FlagValueMembers(const FlagValue* f, const Allocator* allocator)
+{
+    TemLangStringList list = { .allocator = allocator };
+    for (size_t i = 0; i < f->names->members.used; ++i) {
+        if (FlagValueHas(f, i)) {
+            TemLangStringListAppend(&list, &f->names->members.buffer[i]);
+        }
+    }
+    return list;
 }
 
 static inline TemLangString
 FlagValueToString(const FlagValue* e, const Allocator* allocator)
 {
-    TemLangString n = TemLangStringListToString(&e->members, allocator);
+    TemLangStringList members = FlagValueMembers(e, allocator);
+    TemLangString n = TemLangStringListToString(&members, allocator);
     TemLangStringCreateFormat(s,
                               allocator,
                               "{ \"name\": \"%s\", \"value\": %s }",
-                              e->name.buffer,
+                              e->names->name.buffer,
                               n.buffer);
     TemLangStringFree(&n);
+    TemLangStringListFree(&members);
     return s;
 }
 
+// Variants are never changed after they are made so copies share one
 typedef struct VariantValue
 {
     TemLangString name;
     TemLangString memberName;
     pValue value;
     const Allocator* allocator;
+    size_t refCount;
 } VariantValue, *pVariantValue;
 
 static inline void
-VariantValueFree(VariantValue* v)
+VariantValueRelease(VariantValue* v)
 {
+    if (v == NULL || RefCountDecrement(&v->refCount) != 0) {
+        return;
+    }
     TemLangStringFree(&v->name);
     TemLangStringFree(&v->memberName);
-    if (v->value != NULL) {
-        ValueFree(v->value);
-        v->allocator->free(v->value);
-        v->value = NULL;
-    }
+    ValueFree(v->value);
+    v->allocator->free(v->value);
+    v->allocator->free(v);
 }
 
-static inline bool
-VariantValueCopy(VariantValue* dest,
-                 const VariantValue* src,
-                 const Allocator* allocator);
-
 static inline TemLangString
 VariantValueToString(const VariantValue* v, const Allocator* allocator)
 {
@@ -135,18 +284,28 @@ typedef struct ValueListValue
 {
     pValue exampleValue;
     const Allocator* allocator;
+    // Elements of a list that isn't packed
     ValueList values;
-    bool isArray;
+    // Numbers and booleans are packed as packedType when every element has
+    // the same number type and range. The list isn't packed when packedType
+    // is CType_Invalid
+    void* packed;
+    uint32_t packedUsed;
+    uint32_t packedSize;
+    CType packedType;
+    NumberType packedNumberType;
+    // Number of lists sharing the values and example value
+    size_t refCount;
 } ValueListValue, *pValueListValue;
 
 static inline void
-ValueListValueFree(ValueListValue*);
+ValueListValueRelease(ValueListValue*);
 
-static inline bool
-ValueListValueCopy(ValueListValue*, const ValueListValue*, const Allocator*);
+static inline pValueListValue
+ValueListValueClone(const ValueListValue*, const Allocator*);
 
 static inline TemLangString
-ValueListValueString(const ValueListValue*, const Allocator*);
+ValueListValueString(const ValueListValue*, bool, const Allocator*);
 
 typedef struct Value
 {
@@ -157,7 +316,11 @@ typedef struct Value
         bool b;
         void* ptr;
         TemLangString string;
-        ValueListValue list;
+        struct
+        {
+            pValueListValue list;
+            bool listIsArray;
+        };
         struct
         {
             pValue fakeValue;
@@ -165,15 +328,243 @@ typedef struct Value
         };
         EnumValue enumValue;
         FlagValue flagValue;
-        VariantValue variantValue;
+        pVariantValue variantValue;
         struct
         {
-            pNamedValueList structValues;
+            pStructValues structValues;
             const Allocator* structValuesAllocator;
+            size_t* structValuesRefCount;
         };
     };
 } Value, *pValue;
 
+// Strings, ranged numbers, flags and struct payloads are 24 bytes each. A
+// 16 byte Value would need all of them boxed and the number type moved into
+// the tag, which costs an allocation per string. examples/valueLayout.tem
+// shows what the size costs
+_Static_assert(sizeof(Value) == 32, "Value should be 32 bytes");
+
+// Members of a struct value. values.buffer[i] is the member named by
+// shape->names.buffer[i]
+typedef struct StructValues
+{
+    StructShape* shape;
+    ValueList values;
+} StructValues, *pStructValues;
+
+static inline void
+StructValuesFree(StructValues* s)
+{
+    ValueListFree(&s->values);
+    StructShapeRelease(s->shape);
+    s->shape = NULL;
+}
+
+static inline bool
+StructValuesCopy(StructValues* dest,
+                 const StructValues* src,
+                 const Allocator* allocator)
+{
+    StructValuesFree(dest);
+    dest->shape = StructShapeShare(src->shape);
+    return ValueListCopy(&dest->values, &src->values, allocator);
+}
+
+static inline pStructValues
+StructValuesCreate(const Allocator* allocator)
+{
+    pStructValues s = allocator->allocate(sizeof(StructValues));
+    if (s != NULL) {
+        memset(s, 0, sizeof(StructValues));
+        s->values.allocator = allocator;
+    }
+    return s;
+}
+
+static inline pVariantValue
+VariantValueCreate(const Allocator* allocator)
+{
+    pVariantValue v = allocator->allocate(sizeof(VariantValue));
+    if (v == NULL) {
+        return NULL;
+    }
+    memset(v, 0, sizeof(VariantValue));
+    v->allocator = allocator;
+    v->refCount = 1;
+    v->value = allocator->allocate(sizeof(Value));
+    if (v->value == NULL) {
+        allocator->free(v);
+        return NULL;
+    }
+    return v;
+}
+
+static inline pValueListValue
+ValueListValueCreate(const Allocator* allocator)
+{
+    pValueListValue list = allocator->allocate(sizeof(ValueListValue));
+    if (list == NULL) {
+        return NULL;
+    }
+    memset(list, 0, sizeof(ValueListValue));
+    list->allocator = allocator;
+    list->values.allocator = allocator;
+    list->packedType = CType_Invalid;
+    list->refCount = 1;
+    list->exampleValue = allocator->allocate(sizeof(Value));
+    if (list->exampleValue == NULL) {
+        allocator->free(list);
+        return NULL;
+    }
+    return list;
+}
+
+static inline bool
+ValueListValueIsPacked(const ValueListValue* list)
+{
+    return list->packedType != CType_Invalid;
+}
+
+static inline size_t
+ValueListValueLength(const ValueListValue* list)
+{
+    return ValueListValueIsPacked(list) ? list->packedUsed : list->values.used;
+}
+
+#define PACKED_INTEGER_TYPES(X)                                                \
+    X(u8, uint8_t)                                                             \
+    X(u16, uint16_t)                                                           \
+    X(u32, uint32_t)                                                           \
+    X(u64, uint64_t)                                                           \
+    X(i8, int8_t)                                                              \
+    X(i16, int16_t)                                                            \
+    X(i32, int32_t)                                                            \
+    X(i64, int64_t)
+
+#define PACKED_KERNEL_TYPES(X)                                                 \
+    PACKED_INTEGER_TYPES(X)                                                    \
+    X(f64, double)
+
+// One element of any packed type
+typedef union PackedElement
+{
+#define PACKED_MEMBER(C, T) T C;
+    PACKED_KERNEL_TYPES(PACKED_MEMBER)
+#undef PACKED_MEMBER
+    bool boolean;
+} PackedElement, *pPackedElement;
+
+// Element i of the list. Packed elements are read into scratch which never
+// needs to be freed
+static inline const Value*
+ValueListValueAt(const ValueListValue* list, const size_t i, pValue scratch)
+{
+    if (!ValueListValueIsPacked(list)) {
+        return &list->values.buffer[i];
+    }
+    const void* p =
+      (const char*)list->packed + i * CTypeSize(list->packedType);
+    memset(scratch, 0, sizeof(Value));
+    if (list->packedType == CType_bool) {
+        scratch->type = ValueType_Boolean;
+        scratch->b = *(const bool*)p;
+        return scratch;
+    }
+    scratch->type = ValueType_Number;
+    scratch->rangedNumber.range = list->exampleValue->rangedNumber.range;
+    Number* n = &scratch->rangedNumber.number;
+    n->type = list->packedNumberType;
+    switch (list->packedType) {
+#define PACKED_READ(C, T)                                                      \
+    case CType_##C:                                                            \
+        if (n->type == NumberType_Signed) {                                    \
+            n->i = (int64_t) * (const T*)p;                                    \
+        } else {                                                               \
+            n->u = (uint64_t) * (const T*)p;                                   \
+        }                                                                      \
+        break;
+        PACKED_INTEGER_TYPES(PACKED_READ)
+#undef PACKED_READ
+        case CType_f64:
+            n->d = *(const double*)p;
+            break;
+        default:
+            break;
+    }
+    return scratch;
+}
+
+// Writes value into the packed element at p. Fails without writing if the
+// value wouldn't read back the same
+static inline bool
+ValueListValueStore(const ValueListValue* list, void* p, const Value* value)
+{
+    if (list->packedType == CType_bool) {
+        if (value->type != ValueType_Boolean) {
+            return false;
+        }
+        *(bool*)p = value->b;
+        return true;
+    }
+    const Number* n = &value->rangedNumber.number;
+    if (value->type != ValueType_Number || n->type != list->packedNumberType ||
+        value->rangedNumber.range != list->exampleValue->rangedNumber.range) {
+        return false;
+    }
+    switch (list->packedType) {
+#define PACKED_WRITE(C, T)                                                     \
+    case CType_##C: {                                                          \
+        const T t = n->type == NumberType_Signed ? (T)n->i : (T)n->u;          \
+        if (n->type == NumberType_Signed ? (int64_t)t != n->i                  \
+                                         : (uint64_t)t != n->u) {              \
+            return false;                                                      \
+        }                                                                      \
+        *(T*)p = t;                                                            \
+        return true;                                                           \
+    }
+        PACKED_INTEGER_TYPES(PACKED_WRITE)
+#undef PACKED_WRITE
+        case CType_f64:
+            if (n->type != NumberType_Float) {
+                return false;
+            }
+            *(double*)p = n->d;
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Lists, structs and variants share their members between copies. Copying
+// only counts the new owner and ValueMakeUnique must be called before
+// changing the members in place. Struct members without a count are copied
+// every time
+
+static inline size_t*
+ValueRefCountCreate(const Allocator* allocator)
+{
+    size_t* refCount = allocator->allocate(sizeof(size_t));
+    if (refCount != NULL) {
+        *refCount = 1;
+    }
+    return refCount;
+}
+
+// Returns true if the caller was the last owner and must free the members
+static inline bool
+ValueUnshare(size_t** refCount, const Allocator* allocator)
+{
+    if (*refCount == NULL) {
+        return true;
+    }
+    const bool last = RefCountDecrement(*refCount) == 0;
+    if (last) {
+        allocator->free(*refCount);
+    }
+    *refCount = NULL;
+    return last;
+}
+
 static inline void
 ValueFree(Value* v)
 {
@@ -183,7 +574,7 @@ ValueFree(Value* v)
             TemLangStringFree(&v->string);
             break;
         case ValueType_List:
-            ValueListValueFree(&v->list);
+            ValueListValueRelease(v->list);
             break;
         case ValueType_Type:
             ValueFree(v->fakeValue);
@@ -196,11 +587,14 @@ ValueFree(Value* v)
             FlagValueFree(&v->flagValue);
             break;
         case ValueType_Struct:
-            NamedValueListFree(v->structValues);
-            v->structValuesAllocator->free(v->structValues);
+            if (ValueUnshare(&v->structValuesRefCount,
+                             v->structValuesAllocator)) {
+                StructValuesFree(v->structValues);
+                v->structValuesAllocator->free(v->structValues);
+            }
             break;
         case ValueType_Variant:
-            VariantValueFree(&v->variantValue);
+            VariantValueRelease(v->variantValue);
             break;
         default:
             break;
@@ -237,21 +631,119 @@ ValueCopy(Value* dest, const Value* src, const Allocator* allocator)
         case ValueType_Enum:
             return EnumValueCopy(&dest->enumValue, &src->enumValue, allocator);
         case ValueType_Struct:
+            if (src->structValuesRefCount != NULL) {
+                RefCountIncrement(src->structValuesRefCount);
+                dest->structValues = src->structValues;
+                dest->structValuesAllocator = src->structValuesAllocator;
+                dest->structValuesRefCount = src->structValuesRefCount;
+                return true;
+            }
+            // Copies of it will share it so it can't be in a scope's arena
+            allocator = ScopeArenaParentOr(allocator);
             dest->structValuesAllocator = allocator;
-            dest->structValues = allocator->allocate(sizeof(NamedValueList));
-            return NamedValueListCopy(
-              dest->structValues, src->structValues, allocator);
+            dest->structValuesRefCount = ValueRefCountCreate(allocator);
+            dest->structValues = StructValuesCreate(allocator);
+            return dest->structValues != NULL &&
+                   StructValuesCopy(
+                     dest->structValues, src->structValues, allocator);
         case ValueType_Variant:
-            return VariantValueCopy(
-              &dest->variantValue, &src->variantValue, allocator);
+            RefCountIncrement(&src->variantValue->refCount);
+            dest->variantValue = src->variantValue;
+            return true;
         case ValueType_List:
-            return ValueListValueCopy(&dest->list, &src->list, allocator);
+            RefCountIncrement(&src->list->refCount);
+            dest->list = src->list;
+            dest->listIsArray = src->listIsArray;
+            return true;
         default:
             copyFailure(ValueTypeToString(src->type));
             return false;
     }
 }
 
+// Gives dest the payload of src without copying it. src is left null
+static inline void
+ValueMove(Value* dest, Value* src)
+{
+    ValueFree(dest);
+    *dest = *src;
+    memset(src, 0, sizeof(Value));
+}
+
+static inline bool
+ValueMakeUnique(Value* v)
+{
+    switch (v->type) {
+        case ValueType_List: {
+            if (RefCountLoad(&v->list->refCount) == 1) {
+                return true;
+            }
+            pValueListValue list = ValueListValueClone(
+              v->list, ParallelAllocatorOr(v->list->allocator));
+            if (list == NULL) {
+                return false;
+            }
+            ValueListValueRelease(v->list);
+            v->list = list;
+        } break;
+        case ValueType_Struct: {
+            if (v->structValuesRefCount == NULL ||
+                RefCountLoad(v->structValuesRefCount) == 1) {
+                return true;
+            }
+            const Allocator* allocator =
+              ParallelAllocatorOr(v->structValuesAllocator);
+            pStructValues list = StructValuesCreate(allocator);
+            if (list == NULL) {
+                return false;
+            }
+            if (!StructValuesCopy(list, v->structValues, allocator)) {
+                StructValuesFree(list);
+                allocator->free(list);
+                return false;
+            }
+            ValueUnshare(&v->structValuesRefCount, v->structValuesAllocator);
+            v->structValues = list;
+            v->structValuesAllocator = allocator;
+            v->structValuesRefCount = ValueRefCountCreate(allocator);
+        } break;
+        default:
+            break;
+    }
+    return true;
+}
+
+// Copies a value out of a scope's arena so it can outlive the scope
+static inline bool
+ValueLeaveScopeArena(Value* v, const Allocator* allocator)
+{
+    const Allocator* from = NULL;
+    switch (v->type) {
+        case ValueType_String:
+        case ValueType_Data:
+            from = v->string.allocator;
+            break;
+        case ValueType_Flag:
+            from = v->flagValue.allocator;
+            break;
+        case ValueType_Type:
+            from = v->fakeValueAllocator;
+            break;
+        default:
+            break;
+    }
+    if (from != &scopeArenaAllocator) {
+        return true;
+    }
+    Value copy = { 0 };
+    if (!ValueCopy(&copy, v, allocator)) {
+        ValueFree(&copy);
+        return false;
+    }
+    ValueMove(v, &copy);
+    return true;
+}
+
 static inline TemLangString
 ValueToString(const Value* v, const Allocator* allocator)
 {
@@ -270,15 +762,19 @@ ValueToString(const Value* v, const Allocator* allocator)
         } break;
         case ValueType_String:
         case ValueType_Data: {
+            // Strings emptied or made without a buffer have none
             TemLangStringCreateFormat(
-              n2, allocator, "\"%s\"", v->string.buffer);
+              n2,
+              allocator,
+              "\"%s\"",
+              v->string.buffer == NULL ? "" : v->string.buffer);
             n = n2;
         } break;
         case ValueType_Type:
             n = ValueToString(v->fakeValue, allocator);
             break;
         case ValueType_List: {
-            n = ValueListValueString(&v->list, allocator);
+            n = ValueListValueString(v->list, v->listIsArray, allocator);
         } break;
         case ValueType_Enum:
             n = EnumValueToString(&v->enumValue, allocator);
@@ -287,10 +783,10 @@ ValueToString(const Value* v, const Allocator* allocator)
             n = FlagValueToString(&v->flagValue, allocator);
             break;
         case ValueType_Struct:
-            n = NamedValueListToString(v->structValues, allocator);
+            n = StructValuesToString(v->structValues, allocator);
             break;
         case ValueType_Variant:
-            n = VariantValueToString(&v->variantValue, allocator);
+            n = VariantValueToString(v->variantValue, allocator);
             break;
         default:
             n = TemLangStringCreate("null", allocator);
@@ -316,15 +812,22 @@ ValueToSimpleString(const Value* value, const Allocator* allocator)
         case ValueType_Boolean:
             return TemLangStringCreate(value->b ? "true" : "false", allocator);
         case ValueType_Enum:
-            return TemLangStringClone(&value->enumValue.value, allocator);
+            return TemLangStringClone(EnumValueMember(&value->enumValue),
+                                      allocator);
         case ValueType_Flag: {
+            const FlagValue* f = &value->flagValue;
             TemLangString s = { .allocator = allocator };
             TemLangStringAppendChar(&s, '[');
-            for (size_t i = 0; i < value->flagValue.members.used; ++i) {
-                TemLangStringAppend(&s, &value->flagValue.members.buffer[i]);
-                if (i != value->flagValue.members.used - 1) {
+            bool first = true;
+            for (size_t i = 0; i < f->names->members.used; ++i) {
+                if (!FlagValueHas(f, i)) {
+                    continue;
+                }
+                if (!first) {
                     TemLangStringAppendChar(&s, ',');
                 }
+                TemLangStringAppend(&s, &f->names->members.buffer[i]);
+                first = false;
             }
             TemLangStringAppendChar(&s, ']');
             return s;
@@ -389,14 +892,14 @@ ValueTransition(Value* from, const Value* to, const Allocator* allocator)
 
     switch (from->type) {
         case ValueType_Number:
-            if (from->rangedNumber.hasRange) {
+            if (from->rangedNumber.range != NULL) {
                 if (numberInRange(&to->rangedNumber.number,
-                                  &from->rangedNumber.range)) {
+                                  from->rangedNumber.range)) {
                     from->rangedNumber.number = to->rangedNumber.number;
                     return true;
                 } else {
                     numberNotInRangeError(&to->rangedNumber.number,
-                                          &from->rangedNumber.range,
+                                          from->rangedNumber.range,
                                           allocator);
                     return false;
                 }
@@ -404,22 +907,24 @@ ValueTransition(Value* from, const Value* to, const Allocator* allocator)
             from->rangedNumber.number = to->rangedNumber.number;
             return true;
         case ValueType_List:
-            if (from->list.isArray != to->list.isArray) {
+            if (from->listIsArray != to->listIsArray) {
                 TemLangError("Type mimatch. Got '%s'; Expected '%s'",
-                             from->list.isArray ? "Array" : "List",
-                             to->list.isArray ? "Array" : "List");
+                             from->listIsArray ? "Array" : "List",
+                             to->listIsArray ? "Array" : "List");
                 return false;
             }
-            if (!ValueCanTransition(
-                  from->list.exampleValue, to->list.exampleValue, allocator)) {
+            if (!ValueCanTransition(from->list->exampleValue,
+                                    to->list->exampleValue,
+                                    allocator)) {
                 return false;
             }
-            if (from->list.isArray &&
-                from->list.values.used != to->list.values.used) {
+            if (from->listIsArray &&
+                ValueListValueLength(from->list) !=
+                  ValueListValueLength(to->list)) {
                 TemLangError(
                   "Quantity mismatch in array. Got %zu; Expected %zu",
-                  from->list.values.used,
-                  to->list.values.used);
+                  ValueListValueLength(from->list),
+                  ValueListValueLength(to->list));
                 return false;
             }
             return ValueCopy(from, to, allocator);
@@ -445,8 +950,8 @@ ValueTryGetRange(const Value* value, pRange range)
 {
     switch (value->type) {
         case ValueType_Number:
-            if (value->rangedNumber.hasRange) {
-                *range = value->rangedNumber.range;
+            if (value->rangedNumber.range != NULL) {
+                *range = *value->rangedNumber.range;
                 return true;
             }
             break;
@@ -503,29 +1008,19 @@ ValueToIndex(const Value* value, uint64_t* index)
     return false;
 }
 
-static inline bool
-VariantValueCopy(VariantValue* dest,
-                 const VariantValue* src,
-                 const Allocator* allocator)
-{
-    VariantValueFree(dest);
-    dest->allocator = allocator;
-    dest->value = allocator->allocate(sizeof(Value));
-    return TemLangStringCopy(&dest->name, &src->name, allocator) &&
-           TemLangStringCopy(&dest->memberName, &src->memberName, allocator) &&
-           ValueCopy(dest->value, src->value, allocator);
-}
-
 static inline void
-ValueListValueFree(ValueListValue* v)
+ValueListValueRelease(ValueListValue* v)
 {
-    ValueListFree(&v->values);
-    if (v->exampleValue == NULL) {
+    if (v == NULL || RefCountDecrement(&v->refCount) != 0) {
         return;
     }
+    ValueListFree(&v->values);
+    if (v->packed != NULL) {
+        v->allocator->free(v->packed);
+    }
     ValueFree(v->exampleValue);
     v->allocator->free(v->exampleValue);
-    memset(v, 0, sizeof(ValueListValue));
+    v->allocator->free(v);
 }
 
 static inline bool
@@ -536,7 +1031,7 @@ ValuesMatch(const Value* a, const Value* b)
         const Value* right = NULL;
         if (ValueTypesTryMatch(
               a, ValueType_Enum, b, ValueType_String, &left, &right)) {
-            return TemLangStringCompare(&left->enumValue.value,
+            return TemLangStringCompare(EnumValueMember(&left->enumValue),
                                         &right->string) ==
                    ComparisonOperator_EqualTo;
         }
@@ -556,20 +1051,20 @@ ValuesMatch(const Value* a, const Value* b)
             return TemLangStringCompare(&a->string, &b->string) ==
                    ComparisonOperator_EqualTo;
         case ValueType_Enum:
-            return TemLangStringCompare(&a->enumValue.name,
-                                        &b->enumValue.name) ==
-                     ComparisonOperator_EqualTo &&
-                   TemLangStringCompare(&b->enumValue.value,
-                                        &b->enumValue.value) ==
-                     ComparisonOperator_EqualTo;
+            return EnumValuesEqual(&a->enumValue, &b->enumValue);
+        case ValueType_Flag:
+            return FlagValuesEqual(&a->flagValue, &b->flagValue);
         case ValueType_Variant:
-            return TemLangStringCompare(&a->variantValue.name,
-                                        &b->variantValue.name) ==
+            if (a->variantValue == b->variantValue) {
+                return true;
+            }
+            return TemLangStringCompare(&a->variantValue->name,
+                                        &b->variantValue->name) ==
                      ComparisonOperator_EqualTo &&
-                   TemLangStringCompare(&a->variantValue.memberName,
-                                        &b->variantValue.memberName) ==
+                   TemLangStringCompare(&a->variantValue->memberName,
+                                        &b->variantValue->memberName) ==
                      ComparisonOperator_EqualTo &&
-                   ValuesMatch(a->variantValue.value, b->variantValue.value);
+                   ValuesMatch(a->variantValue->value, b->variantValue->value);
         case ValueType_Type:
             return ValuesMatch(a->fakeValue, b->fakeValue);
         default:
@@ -578,30 +1073,58 @@ ValuesMatch(const Value* a, const Value* b)
     return false;
 }
 
-static inline bool
-ValueListValueCopy(ValueListValue* dest,
-                   const ValueListValue* src,
-                   const Allocator* allocator)
+static inline pValueListValue
+ValueListValueClone(const ValueListValue* src, const Allocator* allocator)
 {
-    ValueListValueFree(dest);
-    dest->isArray = src->isArray;
-    dest->allocator = allocator;
-    dest->exampleValue = allocator->allocate(sizeof(Value));
-    return ValueCopy(dest->exampleValue, src->exampleValue, allocator) &&
-           ValueListCopy(&dest->values, &src->values, allocator);
+    pValueListValue dest = ValueListValueCreate(allocator);
+    if (dest == NULL) {
+        return NULL;
+    }
+    if (!ValueCopy(dest->exampleValue, src->exampleValue, allocator) ||
+        !ValueListCopy(&dest->values, &src->values, allocator)) {
+        ValueListValueRelease(dest);
+        return NULL;
+    }
+    if (ValueListValueIsPacked(src) && src->packedSize != 0) {
+        const size_t size = src->packedSize * CTypeSize(src->packedType);
+        dest->packed = allocator->allocate(size);
+        if (dest->packed == NULL) {
+            ValueListValueRelease(dest);
+            return NULL;
+        }
+        memcpy(dest->packed, src->packed, size);
+    }
+    dest->packedUsed = src->packedUsed;
+    dest->packedSize = src->packedSize;
+    dest->packedType = src->packedType;
+    dest->packedNumberType = src->packedNumberType;
+    return dest;
 }
 
 static inline TemLangString
-ValueListValueString(const ValueListValue* v, const Allocator* allocator)
+ValueListValueString(const ValueListValue* v,
+                     const bool isArray,
+                     const Allocator* allocator)
 {
-    LIST_TO_STRING(v->values, n1, ValueToString, allocator);
+    // Packed elements are printed the same as values
+    ValueList unpacked = { .allocator = allocator };
+    const ValueList* values = &v->values;
+    if (ValueListValueIsPacked(v)) {
+        for (size_t i = 0; i < v->packedUsed; ++i) {
+            Value scratch;
+            ValueListAppend(&unpacked, ValueListValueAt(v, i, &scratch));
+        }
+        values = &unpacked;
+    }
+    LIST_TO_STRING((*values), n1, ValueToString, allocator);
+    ValueListFree(&unpacked);
     TemLangString n2 = ValueToString(v->exampleValue, allocator);
     TemLangStringCreateFormat(
       s,
       allocator,
       "{ \"values\": %s, \"isArray\": %s, \"example\": %s }",
       n1.buffer,
-      v->isArray ? "true" : "false",
+      isArray ? "true" : "false",
       n2.buffer);
     TemLangStringFree(&n1);
     TemLangStringFree(&n2);
@@ -612,7 +1135,7 @@ static inline bool
 ValueListValueIsValid(const ValueListValue* list, const Allocator* allocator)
 {
     const Value* first = &list->values.buffer[0];
-    if (first->type == ValueType_Number && !first->rangedNumber.hasRange) {
+    if (first->type == ValueType_Number && first->rangedNumber.range == NULL) {
         TemLangError("The first value of a number list/array must be ranged "
                      "so that the range can be applied to other unranged "
                      "numbers in the list");
@@ -690,4 +1213,508 @@ ValueToChar(const Value* value, char* c)
     return false;
 }
 
-DEFAULT_MAKE_LIST_FUNCTIONS(Value);
\ No newline at end of file
+DEFAULT_MAKE_LIST_FUNCTIONS(Value);
+
+// Appends the value without copying it. The value is left null
+static inline bool
+ValueListAppendMove(ValueList* list, pValue value)
+{
+    if (!ValueListRellocateIfNeeded(list)) {
+        return false;
+    }
+    list->buffer[list->used++] = *value;
+    memset(value, 0, sizeof(Value));
+    return true;
+}
+
+// Storage for list elements like example with the given number type.
+// CType_Invalid if they can't be packed
+static inline CType
+ValuePackedType(const Value* example, const NumberType numberType)
+{
+    switch (example->type) {
+        case ValueType_Boolean:
+            return CType_bool;
+        case ValueType_Number:
+            break;
+        default:
+            return CType_Invalid;
+    }
+    if (example->rangedNumber.range == NULL) {
+        return CType_Invalid;
+    }
+    switch (numberType) {
+        case NumberType_Float:
+            return CType_f64;
+        case NumberType_Signed:
+        case NumberType_Unsigned: {
+            const CType type = RangeToCType(example->rangedNumber.range);
+            if (type != CType_f32 && type != CType_f64) {
+                return type;
+            }
+            return numberType == NumberType_Signed ? CType_i64 : CType_u64;
+        }
+        default:
+            return CType_Invalid;
+    }
+}
+
+static inline bool
+ValueListValueReserve(ValueListValue* list, const size_t used)
+{
+    if (used <= list->packedSize) {
+        return true;
+    }
+    size_t size = list->packedSize == 0 ? 16U : list->packedSize;
+    while (size < used) {
+        size *= 2U;
+    }
+    void* packed = list->allocator->reallocate(
+      list->packed, size * CTypeSize(list->packedType));
+    if (packed == NULL) {
+        return false;
+    }
+    list->packed = packed;
+    list->packedSize = (uint32_t)size;
+    return true;
+}
+
+static inline void
+ValueListValueFreePacked(ValueListValue* list)
+{
+    if (list->packed != NULL) {
+        list->allocator->free(list->packed);
+    }
+    list->packed = NULL;
+    list->packedUsed = 0;
+    list->packedSize = 0;
+    list->packedType = CType_Invalid;
+}
+
+// Packs the elements of a list of numbers or booleans. The list keeps its
+// values if any of them can't be packed
+static inline bool
+ValueListValuePack(ValueListValue* list)
+{
+    if (ValueListValueIsPacked(list)) {
+        return true;
+    }
+    const Value* first = list->values.used == 0 ? list->exampleValue
+                                                : &list->values.buffer[0];
+    const NumberType numberType = first->type == ValueType_Number
+                                    ? first->rangedNumber.number.type
+                                    : NumberType_Invalid;
+    const CType type = ValuePackedType(list->exampleValue, numberType);
+    if (type == CType_Invalid) {
+        return true;
+    }
+    list->packedType = type;
+    list->packedNumberType = numberType;
+    if (!ValueListValueReserve(list, list->values.used)) {
+        ValueListValueFreePacked(list);
+        return false;
+    }
+    const size_t size = CTypeSize(type);
+    for (size_t i = 0; i < list->values.used; ++i) {
+        if (!ValueListValueStore(list,
+                                 (char*)list->packed + i * size,
+                                 &list->values.buffer[i])) {
+            ValueListValueFreePacked(list);
+            return true;
+        }
+    }
+    list->packedUsed = list->values.used;
+    const Allocator* a = list->values.allocator;
+    ValueListFree(&list->values);
+    list->values.allocator = a;
+    return true;
+}
+
+// Elements of a packed list can't be borrowed so the list is turned back
+// into values first
+static inline bool
+ValueListValueUnpack(ValueListValue* list)
+{
+    if (!ValueListValueIsPacked(list)) {
+        return true;
+    }
+    ValueList values = { .allocator = list->values.allocator };
+    for (size_t i = 0; i < list->packedUsed; ++i) {
+        Value scratch;
+        if (!ValueListAppend(&values, ValueListValueAt(list, i, &scratch))) {
+            ValueListFree(&values);
+            return false;
+        }
+    }
+    ValueListValueFreePacked(list);
+    ValueListFree(&list->values);
+    list->values = values;
+    return true;
+}
+
+static inline bool
+ValueUnpack(Value* v)
+{
+    return v->type != ValueType_List || ValueListValueUnpack(v->list);
+}
+
+// An empty packed list takes the number type of the first element added
+static inline void
+ValueListValueRetype(ValueListValue* list, const Value* value)
+{
+    if (list->packedUsed != 0 || value->type != ValueType_Number ||
+        value->rangedNumber.number.type == list->packedNumberType) {
+        return;
+    }
+    const NumberType numberType = value->rangedNumber.number.type;
+    const CType type = ValuePackedType(list->exampleValue, numberType);
+    if (type == CType_Invalid) {
+        return;
+    }
+    if (CTypeSize(type) != CTypeSize(list->packedType)) {
+        ValueListValueFreePacked(list);
+    }
+    list->packedType = type;
+    list->packedNumberType = numberType;
+}
+
+static inline bool
+ValueListValueAppend(ValueListValue* list, const Value* value)
+{
+    if (ValueListValueIsPacked(list)) {
+        ValueListValueRetype(list, value);
+        if (!ValueListValueReserve(list, list->packedUsed + 1U)) {
+            return false;
+        }
+        void* p = (char*)list->packed +
+                  list->packedUsed * CTypeSize(list->packedType);
+        if (ValueListValueStore(list, p, value)) {
+            ++list->packedUsed;
+            return true;
+        }
+        if (!ValueListValueUnpack(list)) {
+            return false;
+        }
+    }
+    return ValueListAppend(&list->values, value);
+}
+
+static inline void
+ValueListValueSwap(ValueListValue* list, const size_t a, const size_t b)
+{
+    if (!ValueListValueIsPacked(list)) {
+        const Value temp = list->values.buffer[a];
+        list->values.buffer[a] = list->values.buffer[b];
+        list->values.buffer[b] = temp;
+        return;
+    }
+    const size_t size = CTypeSize(list->packedType);
+    char* pa = (char*)list->packed + a * size;
+    char* pb = (char*)list->packed + b * size;
+    uint64_t temp;
+    memcpy(&temp, pa, size);
+    memcpy(pa, pb, size);
+    memcpy(pb, &temp, size);
+}
+
+// Same as ValueListInsert. The value is appended and then swapped with the
+// element at index
+static inline bool
+ValueListValueInsert(ValueListValue* list,
+                     const size_t index,
+                     const Value* value)
+{
+    if (!ValueListValueAppend(list, value)) {
+        return false;
+    }
+    const size_t used = ValueListValueLength(list);
+    if (index >= used) {
+        return false;
+    }
+    ValueListValueSwap(list, index, used - 1U);
+    return true;
+}
+
+static inline bool
+ValueListValueRemove(ValueListValue* list,
+                     const size_t index,
+                     const Allocator* allocator)
+{
+    if (!ValueListValueIsPacked(list)) {
+        return ValueListRemove(&list->values, index, allocator);
+    }
+    if (index >= list->packedUsed) {
+        return false;
+    }
+    const size_t size = CTypeSize(list->packedType);
+    char* p = (char*)list->packed + index * size;
+    memmove(p, p + size, (list->packedUsed - index - 1U) * size);
+    --list->packedUsed;
+    return true;
+}
+
+static inline bool
+ValueListValueSwapRemove(ValueListValue* list, const size_t index)
+{
+    if (!ValueListValueIsPacked(list)) {
+        return ValueListSwapRemove(&list->values, index);
+    }
+    if (index >= list->packedUsed) {
+        return false;
+    }
+    const size_t size = CTypeSize(list->packedType);
+    --list->packedUsed;
+    memcpy((char*)list->packed + index * size,
+           (char*)list->packed + list->packedUsed * size,
+           size);
+    return true;
+}
+
+static inline bool
+ValueListValuePop(ValueListValue* list)
+{
+    if (!ValueListValueIsPacked(list)) {
+        return ValueListPop(&list->values);
+    }
+    return list->packedUsed != 0 &&
+           ValueListValueSwapRemove(list, list->packedUsed - 1U);
+}
+
+static inline void
+ValueListValueEmpty(ValueListValue* list)
+{
+    list->packedUsed = 0;
+    const Allocator* a = list->values.allocator;
+    ValueListFree(&list->values);
+    list->values.allocator = a;
+}
+
+// Changes element i the same way ValueTransition changes a value. A packed
+// list stays packed if the new element can be packed
+static inline bool
+ValueListValueTransition(ValueListValue* list,
+                         const size_t i,
+                         const Value* to,
+                         const Allocator* allocator)
+{
+    if (!ValueListValueIsPacked(list)) {
+        return ValueTransition(&list->values.buffer[i], to, allocator);
+    }
+    Value element;
+    ValueListValueAt(list, i, &element);
+    if (!ValueTransition(&element, to, allocator)) {
+        return false;
+    }
+    const size_t size = CTypeSize(list->packedType);
+    const bool result =
+      ValueListValueStore(list, (char*)list->packed + i * size, &element) ||
+      (ValueListValueUnpack(list) &&
+       ValueCopy(&list->values.buffer[i], &element, allocator));
+    ValueFree(&element);
+    return result;
+}
+
+// Booleans are one byte so bool lists use the u8 kernels
+static inline void
+ValueListValueReverse(ValueListValue* list)
+{
+    if (!ValueListValueIsPacked(list)) {
+        for (size_t i = 0, j = list->values.used; i + 1 < j; ++i) {
+            --j;
+            const Value temp = list->values.buffer[i];
+            list->values.buffer[i] = list->values.buffer[j];
+            list->values.buffer[j] = temp;
+        }
+        return;
+    }
+    switch (list->packedType) {
+#define PACKED_REVERSE(C, T)                                                   \
+    case CType_##C:                                                            \
+        ListKernelReverse_##C((T*)list->packed, list->packedUsed);             \
+        break;
+        PACKED_KERNEL_TYPES(PACKED_REVERSE)
+#undef PACKED_REVERSE
+        case CType_bool:
+            ListKernelReverse_u8((uint8_t*)list->packed, list->packedUsed);
+            break;
+        default:
+            break;
+    }
+}
+
+// Sets every element to value. A packed list stays packed if value can be
+// packed, otherwise each element is transitioned to value
+static inline bool
+ValueListValueFill(ValueListValue* list,
+                   const Value* value,
+                   const Allocator* allocator)
+{
+    const size_t n = ValueListValueLength(list);
+    PackedElement e;
+    if (ValueListValueIsPacked(list) && ValueListValueStore(list, &e, value)) {
+        switch (list->packedType) {
+#define PACKED_FILL(C, T)                                                      \
+    case CType_##C:                                                            \
+        ListKernelFill_##C((T*)list->packed, n, e.C);                          \
+        return true;
+            PACKED_KERNEL_TYPES(PACKED_FILL)
+#undef PACKED_FILL
+            case CType_bool:
+                ListKernelFill_u8((uint8_t*)list->packed, n, e.boolean);
+                return true;
+            default:
+                break;
+        }
+    }
+    for (size_t i = 0; i < n; ++i) {
+        if (!ValueListValueTransition(list, i, value, allocator)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Sum of a list of numbers. Starts from zero of the element number type and
+// adds in order like the add operator
+static inline Number
+ValueListValueSum(const ValueListValue* list)
+{
+    Number sum = { 0 };
+    if (ValueListValueIsPacked(list)) {
+        const size_t n = list->packedUsed;
+        sum.type = list->packedNumberType;
+        uint64_t u = 0;
+        switch (list->packedType) {
+#define PACKED_SUM(C, T)                                                       \
+    case CType_##C:                                                            \
+        u = (uint64_t)ListKernelSum_##C((const T*)list->packed, n);            \
+        break;
+            PACKED_INTEGER_TYPES(PACKED_SUM)
+#undef PACKED_SUM
+            case CType_f64:
+                sum.d = ListKernelSum_f64((const double*)list->packed, n);
+                return sum;
+            default:
+                return sum;
+        }
+        if (sum.type == NumberType_Signed) {
+            sum.i = (int64_t)u;
+        } else {
+            sum.u = u;
+        }
+        return sum;
+    }
+    const Value* first = list->values.used == 0 ? list->exampleValue
+                                                : &list->values.buffer[0];
+    sum.type = first->rangedNumber.number.type;
+    for (size_t i = 0; i < list->values.used; ++i) {
+        sum = ApplyNumberOperator(&sum,
+                                  &list->values.buffer[i].rangedNumber.number,
+                                  NumberOperator_Add);
+    }
+    return sum;
+}
+
+// Index of the first smallest (LessThan) or largest (GreaterThan) number.
+// The list must not be empty
+static inline size_t
+ValueListValueFindExtreme(const ValueListValue* list,
+                          const ComparisonOperator op)
+{
+    const bool min = op == ComparisonOperator_LessThan;
+    if (ValueListValueIsPacked(list)) {
+        const size_t n = list->packedUsed;
+        switch (list->packedType) {
+#define PACKED_EXTREME(C, T)                                                   \
+    case CType_##C:                                                            \
+        return min ? ListKernelMin_##C((const T*)list->packed, n)              \
+                   : ListKernelMax_##C((const T*)list->packed, n);
+            PACKED_KERNEL_TYPES(PACKED_EXTREME)
+#undef PACKED_EXTREME
+            default:
+                break;
+        }
+    }
+    size_t best = 0;
+    for (size_t i = 1; i < list->values.used; ++i) {
+        if (NumberCompare(&list->values.buffer[i].rangedNumber.number,
+                          &list->values.buffer[best].rangedNumber.number) ==
+            op) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+// Packs value like an element of list so a kernel can look for it. Elements
+// are compared with ValuesMatch when it can't
+static inline bool
+ValueListValueStoreNeedle(const ValueListValue* list,
+                          const Value* value,
+                          PackedElement* e)
+{
+    if (!ValueListValueIsPacked(list)) {
+        return false;
+    }
+    Value needle = *value;
+    if (needle.type == ValueType_Number) {
+        needle.rangedNumber.range = list->exampleValue->rangedNumber.range;
+    }
+    return ValueListValueStore(list, e, &needle);
+}
+
+// Index of the first element matching value or the length of the list
+static inline size_t
+ValueListValueIndexOf(const ValueListValue* list, const Value* value)
+{
+    const size_t n = ValueListValueLength(list);
+    PackedElement e;
+    if (ValueListValueStoreNeedle(list, value, &e)) {
+        switch (list->packedType) {
+#define PACKED_INDEX_OF(C, T)                                                  \
+    case CType_##C:                                                            \
+        return ListKernelIndexOf_##C((const T*)list->packed, n, e.C);
+            PACKED_KERNEL_TYPES(PACKED_INDEX_OF)
+#undef PACKED_INDEX_OF
+            case CType_bool:
+                return ListKernelIndexOf_u8(
+                  (const uint8_t*)list->packed, n, e.boolean);
+            default:
+                break;
+        }
+    }
+    for (size_t i = 0; i < n; ++i) {
+        Value scratch;
+        if (ValuesMatch(ValueListValueAt(list, i, &scratch), value)) {
+            return i;
+        }
+    }
+    return n;
+}
+
+static inline size_t
+ValueListValueCountEqual(const ValueListValue* list, const Value* value)
+{
+    const size_t n = ValueListValueLength(list);
+    PackedElement e;
+    if (ValueListValueStoreNeedle(list, value, &e)) {
+        switch (list->packedType) {
+#define PACKED_COUNT_EQUAL(C, T)                                               \
+    case CType_##C:                                                            \
+        return ListKernelCountEqual_##C((const T*)list->packed, n, e.C);
+            PACKED_KERNEL_TYPES(PACKED_COUNT_EQUAL)
+#undef PACKED_COUNT_EQUAL
+            case CType_bool:
+                return ListKernelCountEqual_u8(
+                  (const uint8_t*)list->packed, n, e.boolean);
+            default:
+                break;
+        }
+    }
+    size_t count = 0;
+    for (size_t i = 0; i < n; ++i) {
+        Value scratch;
+        count += ValuesMatch(ValueListValueAt(list, i, &scratch), value);
+    }
+    return count;
+}
@@ -59,6 +59,32 @@ NamedValueToString(const NamedValue* n, const Allocator* allocator)
     return s;
 }
 
+// The member in a slot paired with its name. Borrows both so it must not be
+// freed
+static inline NamedValue
+StructValuesGet(const StructValues* s, const size_t slot)
+{
+    return (NamedValue){ .name = s->shape->names.buffer[slot],
+                         .value = s->values.buffer[slot] };
+}
+
+static inline TemLangString
+StructValuesToString(const StructValues* s, const Allocator* allocator)
+{
+    TemLangString result = TemLangStringCreate("[ ", allocator);
+    for (size_t i = 0; i < s->values.used; ++i) {
+        const NamedValue nv = StructValuesGet(s, i);
+        TemLangString temp = NamedValueToString(&nv, allocator);
+        TemLangStringAppend(&result, &temp);
+        TemLangStringFree(&temp);
+        if (i != s->values.used - 1) {
+            TemLangStringAppendChars(&result, ", ");
+        }
+    }
+    TemLangStringAppendChars(&result, " ]");
+    return result;
+}
+
 static inline ComparisonOperator
 NamedValueCompareNameToString(const NamedValue* a, const TemLangString* b)
 {
@@ -83,10 +109,50 @@ NamedValueNameEquals(const NamedValue* a, const NamedValue* b)
     return NamedValueCompareName(a, b) == ComparisonOperator_EqualTo;
 }
 
-#define CREATE_VALUE_INDEX(isConst)                                            \
+// Element of the list a number indexer refers to
+static inline bool
+ValueListIndex(const ValueListValue* list,
+               const Value* indexer,
+               uint64_t* index)
+{
+    const Number* n = &indexer->rangedNumber.number;
+    switch (n->type) {
+        case NumberType_Unsigned:
+            *index = n->u;
+            break;
+        case NumberType_Signed:
+            if (n->i < 0) {
+                TemLangError(
+                  "Cannot index with a negative number. Got %" PRId64, n->i);
+                return false;
+            }
+            *index = (uint64_t)n->i;
+            break;
+        default:
+            TemLangError("Cannot index with a floating point number. Got %f",
+                         n->d);
+            return false;
+    }
+    const size_t used = ValueListValueLength(list);
+    if (used <= *index) {
+        TemLangError("Index out of range. Length: %" PRIu64
+                     "; Index = %" PRIu64,
+                     (uint64_t)used,
+                     *index);
+        return false;
+    }
+    return true;
+}
+
+// prepare runs before the value is indexed. Mutable indexing uses it to stop
+// sharing the members of the value and to unpack packed lists
+#define CREATE_VALUE_INDEX(isConst, prepare)                                   \
     static inline isConst Value* Value##isConst##Index(                        \
       const State* state, isConst Value* value, const Value* indexer)          \
     {                                                                          \
+        if (!(prepare)) {                                                      \
+            return NULL;                                                       \
+        }                                                                      \
         switch (indexer->type) {                                               \
             case ValueType_Number: {                                           \
                 if (value->type != ValueType_List) {                           \
@@ -96,51 +162,23 @@ NamedValueNameEquals(const NamedValue* a, const NamedValue* b)
                     break;                                                     \
                 }                                                              \
                 uint64_t index = 0;                                            \
-                switch (indexer->rangedNumber.number.type) {                   \
-                    case NumberType_Unsigned:                                  \
-                        index = indexer->rangedNumber.number.u;                \
-                        break;                                                 \
-                    case NumberType_Signed:                                    \
-                        if (indexer->rangedNumber.number.i < 0) {              \
-                            TemLangError("Cannot index with a negative "       \
-                                         "number. Got %" PRId64,               \
-                                         indexer->rangedNumber.number.i);      \
-                            return NULL;                                       \
-                        }                                                      \
-                        index = (uint64_t)indexer->rangedNumber.number.i;      \
-                        break;                                                 \
-                    default:                                                   \
-                        TemLangError(                                          \
-                          "Cannot index with a floating point number. Got %f", \
-                          indexer->rangedNumber.number.d);                     \
-                        return NULL;                                           \
+                if (!ValueListIndex(value->list, indexer, &index)) {           \
+                    return NULL;                                               \
                 }                                                              \
-                if (value->list.values.used <= index) {                        \
-                    TemLangError("Index out of range. Length: %" PRIu64        \
-                                 "; Index = %" PRIu64,                         \
-                                 value->list.values.used,                      \
-                                 index);                                       \
-                    break;                                                     \
-                }                                                              \
-                return &value->list.values.buffer[index];                      \
+                return &value->list->values.buffer[index];                     \
             } break;                                                           \
             case ValueType_String:                                             \
                 switch (value->type) {                                         \
-                    case ValueType_Struct:                                     \
-                        for (size_t i = 0; i < value->structValues->used;      \
-                             ++i) {                                            \
-                            pNamedValue v = &value->structValues->buffer[i];   \
-                            switch (TemLangStringCompare(&v->name,             \
-                                                         &indexer->string)) {  \
-                                case ComparisonOperator_EqualTo:               \
-                                    return &v->value;                          \
-                                default:                                       \
-                                    break;                                     \
-                            }                                                  \
+                    case ValueType_Struct: {                                   \
+                        size_t slot = 0;                                       \
+                        if (StructShapeFind(value->structValues->shape,        \
+                                            &indexer->string,                  \
+                                            &slot)) {                          \
+                            return &value->structValues->values.buffer[slot];  \
                         }                                                      \
                         TemLangError("Failed to find member '%s' in struct",   \
                                      indexer->string.buffer);                  \
-                        break;                                                 \
+                    } break;                                                   \
                     default:                                                   \
                         TemLangError("Only structs can be indexed with a "     \
                                      "string. Got '%s'",                       \
@@ -149,28 +187,11 @@ NamedValueNameEquals(const NamedValue* a, const NamedValue* b)
                 }                                                              \
                 break;                                                         \
             case ValueType_Enum: {                                             \
-                const StateFindArgs args = { .log = true,                      \
-                                             .searchParent = true };           \
-                const Atom* atom = StateFindAtomConst(                         \
-                  state, &indexer->enumValue.name, AtomType_Enum, args);       \
-                if (atom == NULL) {                                            \
-                    break;                                                     \
-                }                                                              \
-                size_t index = 0;                                              \
-                if (!TemLangStringListFindIf(                                  \
-                      &atom->enumDefinition.members,                           \
-                      (TemLangStringListFindFunc)TemLangStringsAreEqual,       \
-                      &indexer->enumValue.value,                               \
-                      NULL,                                                    \
-                      &index)) {                                               \
-                    TemLangError("Failed to find enum member '%s'",            \
-                                 indexer->enumValue.value.buffer);             \
-                    break;                                                     \
-                }                                                              \
-                const Value newIndex = { .type = ValueType_Number,             \
-                                         .rangedNumber = {                     \
-                                           .hasRange = false,                  \
-                                           .number = NumberFromInt(index) } }; \
+                const Value newIndex = {                                       \
+                    .type = ValueType_Number,                                  \
+                    .rangedNumber = {                                          \
+                      .number = NumberFromUInt(indexer->enumValue.ordinal) }   \
+                };                                                             \
                 return Value##isConst##Index(state, value, &newIndex);         \
             } break;                                                           \
             default:                                                           \
@@ -77,6 +77,10 @@ with ThreadPoolExecutor(max_workers=8) as e:
     futures.append(e.submit(makeEnum, 'ListModifyType', [
                    'Append', 'Insert', 'Remove', 'SwapRemove', 'Pop', 'Empty']))
 
+    futures.append(e.submit(makeEnum, 'ListQueryType', [
+                   'Sum', 'Min', 'Max', 'Contains', 'IndexOf', 'CountEqual',
+                   'Reverse', 'Fill']))
+
     futures.append(e.submit(makeEnum, 'AtomType', [
         'Variable', 'Function', 'Enum', 'Range', 'Struct']))
 
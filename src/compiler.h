@@ -104,6 +104,7 @@ compileContents(const char* contents,
         }
     }
     InstructionList instructions = TokensToInstructions(&tokens, allocator);
+    FoldInstructions(&instructions, allocator);
 
     // Reorder instructions so that definitions are first and dependencies are
     // met
@@ -4,6 +4,7 @@
 #include <ProcessTokensArgs.h>
 
 #include <Includes.h>
+#include <ScopeArena.h>
 
 #define MAX_FILES 32
 
@@ -40,8 +41,21 @@ typedef struct CompilerArgs
     CString structName;
     CString outputFile;
     CString structOutput;
+    CString profileOutput;
+    CString traceFile;
+    CString jitCache;
     CString files[MAX_FILES];
     size_t fileCount;
+    size_t maxCallDepth;
+    size_t memoCapacity;
+    size_t threads;
+    size_t sampleInterval;
+    size_t traceEvents;
+    size_t scopeArenaSize;
+    size_t jitThreshold;
+    bool memoize;
+    bool profile;
+    bool sample;
     bool handleOutOfMemory;
     bool printCompilerArgs;
     bool useTempAllocator;
@@ -61,8 +75,21 @@ parseCompilerArgs(int argc, char** argv)
                           .structName = NULL,
                           .outputFile = "output.tem",
                           .structOutput = NULL,
+                          .profileOutput = NULL,
+                          .traceFile = NULL,
+                          .jitCache = NULL,
                           .files = { 0 },
                           .fileCount = 0,
+                          .maxCallDepth = 0,
+                          .memoCapacity = 0,
+                          .threads = 0,
+                          .sampleInterval = 0,
+                          .traceEvents = 0,
+                          .scopeArenaSize = SCOPE_ARENA_DEFAULT_SIZE,
+                          .jitThreshold = 0,
+                          .memoize = false,
+                          .profile = false,
+                          .sample = false,
                           .handleOutOfMemory = false,
                           .printCompilerArgs = false,
                           .useTempAllocator = false,
@@ -111,6 +138,36 @@ parseCompilerArgs(int argc, char** argv)
             i += 1;
             continue;
         });
+        STR_EQUALS(c, "--memoize", len, {
+            args.memoize = true;
+            i += 1;
+            continue;
+        });
+        STR_EQUALS(c, "-MZ", len, {
+            args.memoize = true;
+            i += 1;
+            continue;
+        });
+        STR_EQUALS(c, "--profile", len, {
+            args.profile = true;
+            i += 1;
+            continue;
+        });
+        STR_EQUALS(c, "-PR", len, {
+            args.profile = true;
+            i += 1;
+            continue;
+        });
+        STR_EQUALS(c, "--sample", len, {
+            args.sample = true;
+            i += 1;
+            continue;
+        });
+        STR_EQUALS(c, "-SP", len, {
+            args.sample = true;
+            i += 1;
+            continue;
+        });
         STR_EQUALS(c, "--handle-out-of-memory", len, {
             args.handleOutOfMemory = true;
             i += 1;
@@ -160,6 +217,120 @@ parseCompilerArgs(int argc, char** argv)
             i += 2;
             continue;
         });
+        STR_EQUALS(c, "--max-call-depth", len, {
+            char* end = NULL;
+            args.maxCallDepth = strtoull(argv[i + 1], &end, 10);
+            i += 2;
+            continue;
+        });
+        STR_EQUALS(c, "-D", len, {
+            char* end = NULL;
+            args.maxCallDepth = strtoull(argv[i + 1], &end, 10);
+            i += 2;
+            continue;
+        });
+        STR_EQUALS(c, "--memoize-capacity", len, {
+            char* end = NULL;
+            args.memoCapacity = strtoull(argv[i + 1], &end, 10);
+            i += 2;
+            continue;
+        });
+        STR_EQUALS(c, "-MC", len, {
+            char* end = NULL;
+            args.memoCapacity = strtoull(argv[i + 1], &end, 10);
+            i += 2;
+            continue;
+        });
+        STR_EQUALS(c, "--threads", len, {
+            char* end = NULL;
+            args.threads = strtoull(argv[i + 1], &end, 10);
+            i += 2;
+            continue;
+        });
+        STR_EQUALS(c, "-T", len, {
+            char* end = NULL;
+            args.threads = strtoull(argv[i + 1], &end, 10);
+            i += 2;
+            continue;
+        });
+        STR_EQUALS(c, "--sample-interval", len, {
+            char* end = NULL;
+            args.sampleInterval = strtoull(argv[i + 1], &end, 10);
+            i += 2;
+            continue;
+        });
+        STR_EQUALS(c, "-SI", len, {
+            char* end = NULL;
+            args.sampleInterval = strtoull(argv[i + 1], &end, 10);
+            i += 2;
+            continue;
+        });
+        STR_EQUALS(c, "--trace-events", len, {
+            char* end = NULL;
+            args.traceEvents = strtoull(argv[i + 1], &end, 10);
+            i += 2;
+            continue;
+        });
+        STR_EQUALS(c, "-TE", len, {
+            char* end = NULL;
+            args.traceEvents = strtoull(argv[i + 1], &end, 10);
+            i += 2;
+            continue;
+        });
+        STR_EQUALS(c, "--scope-arena", len, {
+            char* end = NULL;
+            args.scopeArenaSize = strtoull(argv[i + 1], &end, 10);
+            i += 2;
+            continue;
+        });
+        STR_EQUALS(c, "-SA", len, {
+            char* end = NULL;
+            args.scopeArenaSize = strtoull(argv[i + 1], &end, 10);
+            i += 2;
+            continue;
+        });
+        STR_EQUALS(c, "--jit", len, {
+            char* end = NULL;
+            args.jitThreshold = strtoull(argv[i + 1], &end, 10);
+            i += 2;
+            continue;
+        });
+        STR_EQUALS(c, "-J", len, {
+            char* end = NULL;
+            args.jitThreshold = strtoull(argv[i + 1], &end, 10);
+            i += 2;
+            continue;
+        });
+        STR_EQUALS(c, "--jit-cache", len, {
+            args.jitCache = argv[i + 1];
+            i += 2;
+            continue;
+        });
+        STR_EQUALS(c, "-JC", len, {
+            args.jitCache = argv[i + 1];
+            i += 2;
+            continue;
+        });
+        STR_EQUALS(c, "--trace", len, {
+            args.traceFile = argv[i + 1];
+            i += 2;
+            continue;
+        });
+        STR_EQUALS(c, "-TR", len, {
+            args.traceFile = argv[i + 1];
+            i += 2;
+            continue;
+        });
+        STR_EQUALS(c, "--profile-output", len, {
+            args.profileOutput = argv[i + 1];
+            i += 2;
+            continue;
+        });
+        STR_EQUALS(c, "-PO", len, {
+            args.profileOutput = argv[i + 1];
+            i += 2;
+            continue;
+        });
         STR_EQUALS(c, "--pre-init", len, {
             args.preInitFile = argv[i + 1];
             i += 2;
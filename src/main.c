@@ -22,14 +22,42 @@ main(int argc, char** argv)
 
     const CompilerArgs args = parseCompilerArgs(argc, argv);
     useCGLM = args.useCGLM;
+    if (args.maxCallDepth != 0) {
+        maxCallDepth = args.maxCallDepth;
+    }
+    memoizeAll = args.memoize;
+    if (args.memoCapacity != 0) {
+        memoCapacity = args.memoCapacity;
+    }
+    parallelThreads = args.threads;
+    if (args.profile && args.sample) {
+        TemLangError("Profiling and sampling can't be used together");
+        return EXIT_FAILURE;
+    }
+    if (args.profile) {
+        ProfileStart(args.profileOutput);
+    }
+    if (args.sampleInterval != 0) {
+        samplerInterval = args.sampleInterval;
+    }
+    if (args.sample && !SamplerStart(args.profileOutput)) {
+        return EXIT_FAILURE;
+    }
+    if (args.traceFile != NULL &&
+        !TraceStart(args.traceFile,
+                    args.traceEvents == 0 ? TRACE_DEFAULT_EVENTS
+                                          : args.traceEvents)) {
+        return EXIT_FAILURE;
+    }
     if (args.printCompilerArgs) {
         printf("/*Allocator size: %zu\nCompiler mode: %u\nPrint tokens: "
-               "%s\nPrint instructions: %s\nPre-init file: %s\nInit file: "
-               "%s\n",
+               "%s\nPrint instructions: %s\nMax call depth: %zu\nPre-init "
+               "file: %s\nInit file: %s\n",
                args.allocatorSize,
                (uint32_t)args.mode,
                args.processTokenArgs.printTokens ? "true" : "false",
                args.processTokenArgs.printInstructions ? "true" : "false",
+               maxCallDepth,
                args.preInitFile,
                args.initFile);
         for (size_t i = 0; i < args.fileCount; ++i) {
@@ -59,6 +87,16 @@ main(int argc, char** argv)
             allocator = makeDefaultAllocator();
             break;
     }
+#if TRACE_EVENTS
+    if (traceEnabled) {
+        allocator = TraceAllocator(&allocator);
+    }
+#endif
+    if (!ScopeArenaStart(&allocator, args.scopeArenaSize)) {
+        TemLangError("Failed to allocate %zu bytes for scopes. Scopes will "
+                     "use the global allocator",
+                     args.scopeArenaSize);
+    }
 
     int result = EXIT_FAILURE;
     switch (args.mode) {
@@ -72,12 +110,39 @@ main(int argc, char** argv)
             break;
         case CompilerMode_Repl:
             replPrintIsComment = false;
+            if (!JitStart(args.jitThreshold, args.jitCache)) {
+                TemLangError("Functions will be interpreted");
+            }
             result = runRepl(args, &allocator);
             break;
         default:
             TemLangError("Unknown compiler mode: %u\n", args.mode);
             break;
     }
+    CallStackFree();
+    ParallelPoolFree();
+    if (memoHits + memoMisses != 0) {
+        fprintf(stderr,
+                "Memoization: %zu hits, %zu misses\n",
+                memoHits,
+                memoMisses);
+    }
+    if (jitCompiled + jitNotCompiled != 0) {
+        fprintf(stderr,
+                "JIT: %zu compiled, %zu not compiled, %zu rejected, %zu "
+                "native calls, %zu overflowed\n",
+                jitCompiled,
+                jitNotCompiled,
+                jitRejected,
+                jitNativeCalls,
+                jitOverflowed);
+    }
+    if (!ProfileReport(20) || !SamplerReport(20)) {
+        result = EXIT_FAILURE;
+    }
+    ScopeArenaStop();
+    TraceStop();
+    ProfileFree();
     switch (args.allocatorType) {
         case AllocatorType_FreeListFirst:
         case AllocatorType_FreeListBest:
@@ -178,6 +243,7 @@ runDynamic(const CompilerArgs args, const Allocator* allocator)
         }
         TokenList tokens = performLex(allocator, ptr, size, 1UL, args.initFile);
         instructions = TokensToInstructions(&tokens, allocator);
+        FoldInstructions(&instructions, allocator);
         unmapFile(fd, ptr, size);
     }
 
@@ -107,6 +107,8 @@ replExecute(const char* content)
       performLex(allocator, content, strlen(content), 1, "<User Input>");
     printf("Got %u tokens\n", tokens.used);
     InstructionList instructions = TokensToInstructions(&tokens, allocator);
+    FoldInstructions(&instructions, allocator);
+    ResolveInstructions(&instructions, allocator);
     printf("Got %u instructions\n", instructions.used);
 
     currentColor = "darkcyan";
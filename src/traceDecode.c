@@ -0,0 +1,242 @@
+// Converts a file written with --trace into the trace event JSON that
+// chrome://tracing and Perfetto open.
+//
+// gcc -Iinclude src/traceDecode.c -o traceDecode
+// traceDecode trace.bin > trace.json
+
+#include "TraceFormat.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void
+printString(FILE* file, const char* s)
+{
+    fputc('"', file);
+    for (; *s != '\0'; ++s) {
+        const unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            fputc('\\', file);
+            fputc(c, file);
+        } else if (c < 0x20) {
+            fprintf(file, "\\u%04x", c);
+        } else {
+            fputc(c, file);
+        }
+    }
+    fputc('"', file);
+}
+
+static void
+printName(FILE* file,
+          const char** names,
+          const uint32_t nameCount,
+          const uint32_t name)
+{
+    if (name < nameCount) {
+        printString(file, names[name]);
+    } else if (name == TRACE_NO_NAME) {
+        fputs("\"unknown\"", file);
+    } else {
+        fprintf(file, "\"entry %" PRIu32 "\"", name);
+    }
+}
+
+static bool
+decode(const char* buffer, const size_t size, FILE* output)
+{
+    const TraceHeader* header = (const TraceHeader*)buffer;
+    if (size < sizeof(TraceHeader) ||
+        memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic)) != 0) {
+        fputs("Not a trace file\n", stderr);
+        return false;
+    }
+    if (header->version != TRACE_VERSION ||
+        header->eventSize != sizeof(TraceEvent)) {
+        fprintf(stderr,
+                "Unsupported trace version %" PRIu32 "\n",
+                header->version);
+        return false;
+    }
+    const uint64_t capacity = header->capacity;
+    if (capacity == 0 || (capacity & (capacity - 1U)) != 0 ||
+        header->namesUsed > header->namesSize ||
+        size < sizeof(TraceHeader) + header->namesSize +
+                 capacity * sizeof(TraceEvent)) {
+        fputs("Trace file is truncated\n", stderr);
+        return false;
+    }
+
+    const char* nameBuffer = buffer + sizeof(TraceHeader);
+    const TraceEvent* events =
+      (const TraceEvent*)(nameBuffer + header->namesSize);
+    uint32_t nameCount = 0;
+    for (uint64_t i = 0; i < header->namesUsed; ++i) {
+        if (nameBuffer[i] == '\0') {
+            ++nameCount;
+        }
+    }
+    const char** names = malloc(sizeof(const char*) * (nameCount + 1U));
+    if (names == NULL) {
+        fputs("Out of memory\n", stderr);
+        return false;
+    }
+    nameCount = 0;
+    for (uint64_t i = 0; i < header->namesUsed; ++i) {
+        if (i == 0 || nameBuffer[i - 1U] == '\0') {
+            names[nameCount++] = nameBuffer + i;
+        }
+    }
+    if (nameCount > 0 && nameBuffer[header->namesUsed - 1U] != '\0') {
+        --nameCount;
+    }
+
+    const uint64_t ticks = header->lastTicks - header->startTicks;
+    const uint64_t nanoseconds =
+      header->lastNanoseconds - header->startNanoseconds;
+    const double nanosecondsPerTick =
+      header->lastTicks <= header->startTicks || nanoseconds == 0
+        ? 1.0
+        : (double)nanoseconds / (double)ticks;
+
+    const uint64_t written = header->written;
+    const uint64_t first = written > capacity ? written - capacity : 0;
+    uint64_t requested = 0;
+    bool comma = false;
+    fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n", output);
+    for (uint64_t i = first; i < written; ++i) {
+        const TraceEvent* e = &events[i & (capacity - 1U)];
+        const double timestamp =
+          e->ticks < header->startTicks
+            ? 0.0
+            : (double)(e->ticks - header->startTicks) * nanosecondsPerTick /
+                1000.0;
+        if (comma) {
+            fputs(",\n", output);
+        }
+        comma = true;
+        fprintf(output, "{\"pid\":1,\"tid\":1,\"ts\":%.3f,", timestamp);
+        switch ((TraceEventType)e->type) {
+            case TraceEventType_InstructionBegin:
+            case TraceEventType_FunctionEnter:
+            case TraceEventType_InstructionEnd:
+            case TraceEventType_FunctionExit: {
+                const bool begin =
+                  e->type == TraceEventType_InstructionBegin ||
+                  e->type == TraceEventType_FunctionEnter;
+                const bool function =
+                  e->type == TraceEventType_FunctionEnter ||
+                  e->type == TraceEventType_FunctionExit;
+                fprintf(output,
+                        "\"ph\":\"%s\",\"cat\":\"%s\",\"name\":",
+                        begin ? "B" : "E",
+                        function ? "function" : "instruction");
+                printName(output, names, nameCount, e->name);
+                if (begin && !function) {
+                    fprintf(output,
+                            ",\"args\":{\"line\":%" PRIu64 "}",
+                            e->value);
+                } else if (!begin) {
+                    fprintf(output,
+                            ",\"args\":{\"result\":%s}",
+                            e->value ? "true" : "false");
+                }
+            } break;
+            case TraceEventType_ScopeCreate:
+            case TraceEventType_ScopeFree:
+                fprintf(output,
+                        "\"ph\":\"%s\",\"cat\":\"scope\",\"name\":\"scope\","
+                        "\"args\":{\"depth\":%" PRIu64 "}",
+                        e->type == TraceEventType_ScopeCreate ? "B" : "E",
+                        e->value);
+                break;
+            case TraceEventType_Allocate:
+            case TraceEventType_Reallocate:
+            case TraceEventType_Free:
+                fprintf(output,
+                        "\"ph\":\"i\",\"s\":\"t\",\"cat\":\"allocator\","
+                        "\"name\":\"%s\",\"args\":{\"bytes\":%" PRIu64 "}",
+                        TraceEventTypeToString((TraceEventType)e->type),
+                        e->value);
+                break;
+            default:
+                fprintf(output,
+                        "\"ph\":\"i\",\"s\":\"t\",\"name\":\"%s\"",
+                        TraceEventTypeToString(TraceEventType_Invalid));
+                break;
+        }
+        fputc('}', output);
+        if (e->type == TraceEventType_Allocate ||
+            e->type == TraceEventType_Reallocate) {
+            requested += e->value;
+            fprintf(output,
+                    ",\n{\"pid\":1,\"tid\":1,\"ts\":%.3f,\"ph\":\"C\","
+                    "\"name\":\"bytes requested\",\"args\":{\"bytes\":%" PRIu64
+                    "}}",
+                    timestamp,
+                    requested);
+        }
+    }
+    fputs("\n]}\n", output);
+    fprintf(stderr,
+            "%" PRIu64 " events, %" PRIu64 " overwritten\n",
+            written - first,
+            first);
+    free(names);
+    return true;
+}
+
+int
+main(int argc, char** argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <trace file> [output file]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    int result = EXIT_FAILURE;
+    char* buffer = NULL;
+    FILE* output = stdout;
+    FILE* file = fopen(argv[1], "rb");
+    if (file == NULL) {
+        perror(argv[1]);
+        goto cleanup;
+    }
+    if (fseek(file, 0, SEEK_END) != 0) {
+        perror(argv[1]);
+        goto cleanup;
+    }
+    const long size = ftell(file);
+    if (size < 0 || fseek(file, 0, SEEK_SET) != 0) {
+        perror(argv[1]);
+        goto cleanup;
+    }
+    buffer = malloc((size_t)size + 1U);
+    if (buffer == NULL ||
+        fread(buffer, 1, (size_t)size, file) != (size_t)size) {
+        fprintf(stderr, "Failed to read '%s'\n", argv[1]);
+        goto cleanup;
+    }
+    if (argc > 2) {
+        output = fopen(argv[2], "w");
+        if (output == NULL) {
+            perror(argv[2]);
+            goto cleanup;
+        }
+    }
+    if (decode(buffer, (size_t)size, output)) {
+        result = EXIT_SUCCESS;
+    }
+
+cleanup:
+    if (output != NULL && output != stdout) {
+        fclose(output);
+    }
+    if (file != NULL) {
+        fclose(file);
+    }
+    free(buffer);
+    return result;
+}
@@ -0,0 +1,45 @@
+#!/bin/sh
+# Runs every tests/*.tem file in the interpreter and compares what it prints
+# with tests/<name>.out. A test can give more arguments on its first line with
+# "// args: ...". --update rewrites the .out files instead.
+#
+# clang -Iinclude src/main.c -lm -lpthread -o temlang
+# tests/run_tem_tests.sh ./temlang
+
+if [ $# -lt 1 ]; then
+    echo "Usage: $0 <temlang> [--update]" >&2
+    exit 1
+fi
+bin=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+update=$2
+cd "$(dirname "$0")/.." || exit 1
+
+# Colors and the version line aren't part of the output
+run() {
+    echo q | "$bin" "$@" 2>/tmp/temlang-test-err.$$ |
+      sed -e 's/\x1b\[[0-9;]*m//g' -e '/^\/\/ TemLang /d'
+    echo "--- stderr"
+    sed -e 's/\x1b\[[0-9;]*m//g' /tmp/temlang-test-err.$$
+    rm -f /tmp/temlang-test-err.$$
+}
+
+failed=0
+for test in tests/*.tem; do
+    expected=${test%.tem}.out
+    args=$(sed -n '1s/^\/\/ args: //p' "$test")
+    if [ "$update" = "--update" ]; then
+        # shellcheck disable=SC2086
+        run -M 2 $args "$test" > "$expected"
+        continue
+    fi
+    # shellcheck disable=SC2086
+    if run -M 2 $args "$test" | diff -u "$expected" - > /dev/null; then
+        echo "PASS $test"
+    else
+        echo "FAIL $test"
+        # shellcheck disable=SC2086
+        run -M 2 $args "$test" | diff -u "$expected" -
+        failed=1
+    fi
+done
+exit $failed